@@ -447,7 +447,6 @@ static void
 sync_accounts(void)
 {
 	xmlnode *node;
-	char *data;
 
 	if (!accounts_loaded)
 	{
@@ -457,9 +456,7 @@ sync_accounts(void)
 	}
 
 	node = accounts_to_xmlnode();
-	data = xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_file("accounts.xml", data, -1);
-	g_free(data);
+	purple_util_write_xml_to_file("accounts.xml", node);
 	xmlnode_free(node);
 }
 
@@ -1717,6 +1714,9 @@ purple_account_set_connection(PurpleAccount *account, PurpleConnection *gc)
 	g_return_if_fail(account != NULL);
 
 	account->gc = gc;
+
+	/* Whether a buddy can get offline messages depends on this */
+	_purple_presence_invalidate_scores();
 }
 
 void
@@ -1988,6 +1988,10 @@ purple_account_set_int(PurpleAccount *account, const char *name, int value)
 
 	g_hash_table_insert(account->settings, g_strdup(name), setting);
 
+	/* This goes into the score of every presence on the account */
+	if (purple_strequal(name, "score"))
+		_purple_presence_invalidate_scores();
+
 	schedule_accounts_save();
 }
 
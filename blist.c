@@ -370,7 +370,6 @@ static void
 purple_blist_sync(void)
 {
 	xmlnode *node;
-	char *data;
 
 	if (!blist_loaded)
 	{
@@ -380,9 +379,7 @@ purple_blist_sync(void)
 	}
 
 	node = blist_to_xmlnode();
-	data = xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_file("blist.xml", data, -1);
-	g_free(data);
+	purple_util_write_xml_to_file("blist.xml", node);
 	xmlnode_free(node);
 }
 
@@ -721,6 +718,58 @@ purple_contact_compute_priority_buddy(PurpleContact *contact)
 	contact->priority_valid = TRUE;
 }
 
+void
+_purple_contact_update_priority_buddy(PurpleContact *contact, PurpleBuddy *buddy)
+{
+	PurpleBuddy *priority;
+	PurpleBlistNode *bnode;
+	int cmp;
+
+	g_return_if_fail(contact != NULL);
+	g_return_if_fail(buddy != NULL);
+
+	priority = contact->priority;
+
+	/*
+	 * If the priority buddy itself changed, it may have fallen behind any
+	 * of the others, so they all have to be looked at again.
+	 */
+	if (!contact->priority_valid || priority == NULL || priority == buddy) {
+		purple_contact_invalidate_priority_buddy(contact);
+		return;
+	}
+
+	/* Otherwise buddy either beats the priority buddy now or nothing changes */
+	if (!purple_account_is_connected(buddy->account))
+		return;
+
+	cmp = 1;
+	if (purple_account_is_connected(priority->account))
+		cmp = purple_presence_compare(purple_buddy_get_presence(priority),
+				purple_buddy_get_presence(buddy));
+
+	if (cmp < 0)
+		return;
+
+	if (cmp == 0) {
+		gboolean after = FALSE;
+
+		/* Ties go to the first buddy, or the last one with last_match */
+		for (bnode = ((PurpleBlistNode *)priority)->next; bnode != NULL;
+				bnode = bnode->next) {
+			if (bnode == (PurpleBlistNode *)buddy) {
+				after = TRUE;
+				break;
+			}
+		}
+
+		if (after != purple_prefs_get_bool("/purple/contact/last_match"))
+			return;
+	}
+
+	contact->priority = buddy;
+}
+
 
 /*****************************************************************************
  * Public API functions                                                      *
@@ -945,7 +994,7 @@ purple_blist_update_buddy_status(PurpleBuddy *buddy, PurpleStatus *old_status)
 	 * because something, somewhere changed.  Calling the stuff below
 	 * certainly won't hurt anything.  Unless you're on a K6-2 300.
 	 */
-	purple_contact_invalidate_priority_buddy(purple_buddy_get_contact(buddy));
+	_purple_contact_update_priority_buddy(purple_buddy_get_contact(buddy), buddy);
 	if (ops && ops->update)
 		ops->update(purplebuddylist, (PurpleBlistNode *)buddy);
 }
@@ -27,6 +27,10 @@
 
 #define DEFAULT_BUF_SIZE 256
 
+/* Once a drained buffer has grown past this many multiples of its
+ * growsize, its memory is given back instead of being kept around. */
+#define HIGH_WATER_FACTOR 16
+
 PurpleCircBuffer *
 purple_circ_buffer_new(gsize growsize) {
 	PurpleCircBuffer *buf = g_new0(PurpleCircBuffer, 1);
@@ -42,15 +46,20 @@ void purple_circ_buffer_destroy(PurpleCircBuffer *buf) {
 }
 
 static void grow_circ_buffer(PurpleCircBuffer *buf, gsize len) {
-	int in_offset = 0, out_offset = 0;
-	int start_buflen;
+	gsize in_offset = 0, out_offset = 0;
+	gsize start_buflen, needed;
 
 	g_return_if_fail(buf != NULL);
 
 	start_buflen = buf->buflen;
+	needed = buf->bufused + len;
 
-	while ((buf->buflen - buf->bufused) < len)
-		buf->buflen += buf->growsize;
+	/* Grow geometrically so that appending a large backlog in small
+	 * pieces doesn't turn into a quadratic number of reallocs. */
+	if (buf->buflen == 0)
+		buf->buflen = buf->growsize;
+	while (buf->buflen < needed)
+		buf->buflen *= 2;
 
 	if (buf->inptr != NULL) {
 		in_offset = buf->inptr - buf->buffer;
@@ -67,25 +76,23 @@ static void grow_circ_buffer(PurpleCircBuffer *buf, gsize len) {
 	}
 
 	/* If the fill pointer is wrapped to before the remove
-	 * pointer, we need to shift the data */
+	 * pointer, we need to shift the data.  Move whichever of the
+	 * two segments is smaller. */
 	if (in_offset < out_offset
 			|| (in_offset == out_offset && buf->bufused > 0)) {
-		int shift_n = MIN(buf->buflen - start_buflen,
-			in_offset);
-		memcpy(buf->buffer + start_buflen, buf->buffer,
-			shift_n);
-
-		/* If we couldn't fit the wrapped read buffer
-		 * at the end */
-		if (shift_n < in_offset) {
-			memmove(buf->buffer,
-				buf->buffer + shift_n,
-				in_offset - shift_n);
-			buf->inptr = buf->buffer +
-				(in_offset - shift_n);
+		gsize tail_len = start_buflen - out_offset;
+
+		if (in_offset <= tail_len
+				&& in_offset <= buf->buflen - start_buflen) {
+			/* Append the wrapped head after the old end */
+			memcpy(buf->buffer + start_buflen, buf->buffer,
+				in_offset);
+			buf->inptr = buf->buffer + start_buflen + in_offset;
 		} else {
-			buf->inptr = buf->buffer +
-				start_buflen + in_offset;
+			/* Slide the tail up against the new end */
+			memmove(buf->buffer + buf->buflen - tail_len,
+				buf->outptr, tail_len);
+			buf->outptr = buf->buffer + buf->buflen - tail_len;
 		}
 	}
 }
@@ -144,10 +151,77 @@ gboolean purple_circ_buffer_mark_read(PurpleCircBuffer *buf, gsize len) {
 
 	buf->outptr += len;
 	buf->bufused -= len;
-	/* wrap to the start if we're at the end */
-	if ((buf->outptr - buf->buffer) == buf->buflen)
+
+	if (buf->bufused == 0) {
+		/* Nothing left to read; start over so that the next writes
+		 * are contiguous, and shrink back after a large burst. */
+		if (buf->buflen > buf->growsize * HIGH_WATER_FACTOR) {
+			g_free(buf->buffer);
+			buf->buffer = buf->inptr = buf->outptr = NULL;
+			buf->buflen = 0;
+		} else
+			buf->inptr = buf->outptr = buf->buffer;
+	} else if ((buf->outptr - buf->buffer) == buf->buflen)
+		/* wrap to the start if we're at the end */
 		buf->outptr = buf->buffer;
 
 	return TRUE;
 }
 
+#ifndef _WIN32
+int purple_circ_buffer_get_read_iov(const PurpleCircBuffer *buf, struct iovec *iov) {
+	gsize first;
+
+	g_return_val_if_fail(buf != NULL, 0);
+	g_return_val_if_fail(iov != NULL, 0);
+
+	first = purple_circ_buffer_get_max_read(buf);
+	if (first == 0)
+		return 0;
+
+	iov[0].iov_base = buf->outptr;
+	iov[0].iov_len = first;
+
+	if (first == buf->bufused)
+		return 1;
+
+	iov[1].iov_base = buf->buffer;
+	iov[1].iov_len = buf->bufused - first;
+
+	return 2;
+}
+#endif
+
+gssize purple_circ_buffer_writev(PurpleCircBuffer *buf, int fd) {
+	gssize ret;
+	gsize first;
+
+	g_return_val_if_fail(buf != NULL, -1);
+
+	first = purple_circ_buffer_get_max_read(buf);
+	if (first == 0)
+		return 0;
+
+#ifndef _WIN32
+	{
+		struct iovec iov[2];
+		int iovcnt = purple_circ_buffer_get_read_iov(buf, iov);
+		ret = writev(fd, iov, iovcnt);
+	}
+#else
+	ret = write(fd, buf->outptr, first);
+#endif
+
+	if (ret <= 0)
+		return ret;
+
+	if ((gsize)ret <= first)
+		purple_circ_buffer_mark_read(buf, ret);
+	else {
+		purple_circ_buffer_mark_read(buf, first);
+		purple_circ_buffer_mark_read(buf, ret - first);
+	}
+
+	return ret;
+}
+
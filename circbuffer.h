@@ -26,6 +26,10 @@
 
 #include <glib.h>
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -35,8 +39,10 @@ typedef struct _PurpleCircBuffer {
 	/** A pointer to the starting address of our chunk of memory. */
 	gchar *buffer;
 
-	/** The incremental amount to increase this buffer by when
-	 *  the buffer is not big enough to hold incoming data, in bytes. */
+	/** The initial size of this buffer, in bytes.  When the buffer is
+	 *  not big enough to hold incoming data it is doubled until it is,
+	 *  and once it drains it is released if it grew beyond its
+	 *  high-water mark. */
 	gsize growsize;
 
 	/** The length of this buffer, in bytes. */
@@ -60,8 +66,9 @@ typedef struct _PurpleCircBuffer {
  * actual buffer until data is appended to it.
  *
  * @param growsize The amount that the buffer should grow the first time data
- *                 is appended and every time more space is needed.  Pass in
- *                 "0" to use the default of 256 bytes.
+ *                 is appended.  When more space is needed afterwards the
+ *                 buffer size is doubled.  Pass in "0" to use the default
+ *                 of 256 bytes.
  *
  * @return The new PurpleCircBuffer. This should be freed with
  *         purple_circ_buffer_destroy when you are done with it
@@ -111,6 +118,38 @@ gsize purple_circ_buffer_get_max_read(const PurpleCircBuffer *buf);
  */
 gboolean purple_circ_buffer_mark_read(PurpleCircBuffer *buf, gsize len);
 
+#ifndef _WIN32
+/**
+ * Describe all of the unread data in the PurpleCircBuffer as a vector
+ * suitable for writev() or sendmsg().  Because the buffer is circular the
+ * data may be split into two segments: one from the read position to the
+ * end of the buffer and one from the start of the buffer.
+ *
+ * @param buf The PurpleCircBuffer to describe
+ * @param iov An array of at least two iovecs to fill in
+ *
+ * @return The number of iovecs that were filled in (0, 1 or 2).
+ *
+ * @since 2.10.0
+ */
+int purple_circ_buffer_get_read_iov(const PurpleCircBuffer *buf, struct iovec *iov);
+#endif
+
+/**
+ * Write as much buffered data as possible to a file descriptor and mark
+ * the written bytes as read.  Both readable segments of the buffer are
+ * written with a single writev() call where it is available.
+ *
+ * @param buf The PurpleCircBuffer to drain
+ * @param fd  The file descriptor to write to
+ *
+ * @return The number of bytes written, 0 if the buffer was empty, or -1
+ *         on error, in which case errno is set by the underlying write.
+ *
+ * @since 2.10.0
+ */
+gssize purple_circ_buffer_writev(PurpleCircBuffer *buf, int fd);
+
 #ifdef __cplusplus
 }
 #endif
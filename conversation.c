@@ -1148,7 +1148,7 @@ purple_conv_im_start_typing_timeout(PurpleConvIm *im, int timeout)
 
 	conv = purple_conv_im_get_conversation(im);
 
-	im->typing_timeout = purple_timeout_add_seconds(timeout, reset_typing_cb, conv);
+	im->typing_timeout = purple_timeout_wheel_add_seconds(timeout, reset_typing_cb, conv);
 }
 
 void
@@ -1195,9 +1195,10 @@ purple_conv_im_start_send_typed_timeout(PurpleConvIm *im)
 {
 	g_return_if_fail(im != NULL);
 
-	im->send_typed_timeout = purple_timeout_add_seconds(SEND_TYPED_TIMEOUT_SECONDS,
-	                                                    send_typed_cb,
-	                                                    purple_conv_im_get_conversation(im));
+	/* Restarted with every keystroke, so it goes in the timer wheel */
+	im->send_typed_timeout = purple_timeout_wheel_add_seconds(SEND_TYPED_TIMEOUT_SECONDS,
+	                                                          send_typed_cb,
+	                                                          purple_conv_im_get_conversation(im));
 }
 
 void
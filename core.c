@@ -104,6 +104,21 @@ purple_core_init(const char *ui)
 
 	purple_util_init();
 
+	/*
+	 * Get the files the accounts, statuses, buddy list and pounces are
+	 * kept in off the disk while everything else starts up.  The objects
+	 * are still made from them here, as each subsystem is initialized.
+	 */
+	if (g_thread_supported())
+	{
+		static const char * const files[] = { "pounces.xml", NULL };
+		static const char * const xml_files[] = {
+			"accounts.xml", "status.xml", "blist.xml", NULL
+		};
+
+		_purple_util_prefetch_files(files, xml_files);
+	}
+
 	purple_signal_register(core, "uri-handler",
 		purple_marshal_BOOLEAN__POINTER_POINTER_POINTER,
 		purple_value_new(PURPLE_TYPE_BOOLEAN), 3,
@@ -44,6 +44,7 @@
 #include "dbus-bindings.h"
 #include "debug.h"
 #include "core.h"
+#include "plugin.h"
 #include "savedstatuses.h"
 #include "smiley.h"
 #include "util.h"
@@ -87,6 +88,10 @@ gboolean purple_dbus_is_owner(void)
 void
 purple_dbus_init_ids(void)
 {
+	/* Objects keep their ids if D-Bus is started again */
+	if (map_node_id != NULL)
+		return;
+
 	map_id_node = g_hash_table_new(g_direct_hash, g_direct_equal);
 	map_id_type = g_hash_table_new(g_direct_hash, g_direct_equal);
 	map_node_id = g_hash_table_new(g_direct_hash, g_direct_equal);
@@ -417,6 +422,27 @@ error:
 
 static DBusConnection *purple_dbus_connection;
 
+typedef struct
+{
+	void *handle;          /* Who registered the bindings */
+	GHashTable *methods;
+} PurpleDBusBindingTable;
+
+/*
+ * For each bindings array, its methods by name.  Looking a method up
+ * beats strcmp'ing through hundreds of bindings on every call.
+ */
+static GHashTable *binding_tables;
+/* Whether tables are dropped when the plugin that registered them is */
+static gboolean watching_plugins;
+
+static void
+purple_dbus_binding_table_free(PurpleDBusBindingTable *table)
+{
+	g_hash_table_destroy(table->methods);
+	g_free(table);
+}
+
 DBusConnection *
 purple_dbus_get_connection(void)
 {
@@ -431,8 +457,10 @@ purple_dbus_dispatch_cb(DBusConnection *connection,
 		DBusMessage *message, void *user_data)
 {
 	const char *name;
-	PurpleDBusBinding *bindings;
-	int i;
+	PurpleDBusBinding *bindings, *binding;
+	PurpleDBusBindingTable *table;
+	DBusMessage *reply;
+	DBusError error;
 
 	bindings = (PurpleDBusBinding*) user_data;
 
@@ -447,30 +475,31 @@ purple_dbus_dispatch_cb(DBusConnection *connection,
 	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
 		return FALSE;
 
-	for (i = 0; bindings[i].name; i++)
-		if (!strcmp(name, bindings[i].name))
-		{
-			DBusMessage *reply;
-			DBusError error;
+	table = g_hash_table_lookup(binding_tables, bindings);
+	if (table == NULL)
+		return FALSE;
 
-			dbus_error_init(&error);
+	binding = g_hash_table_lookup(table->methods, name);
+	if (binding == NULL)
+		return FALSE;
 
-			reply = bindings[i].handler(message, &error);
+	dbus_error_init(&error);
 
-			if (reply == NULL && dbus_error_is_set(&error))
-				reply = dbus_message_new_error (message,
-						error.name, error.message);
+	reply = binding->handler(message, &error);
 
-			if (reply != NULL)
-			{
-				dbus_connection_send(connection, reply, NULL);
-				dbus_message_unref(reply);
-			}
+	if (reply == NULL && dbus_error_is_set(&error))
+		reply = dbus_message_new_error (message,
+				error.name, error.message);
 
-			return TRUE; /* return reply! */
-		}
+	if (reply != NULL)
+	{
+		dbus_connection_send(connection, reply, NULL);
+		dbus_message_unref(reply);
+	}
 
-	return FALSE;
+	dbus_error_free(&error);
+
+	return TRUE; /* return reply! */
 }
 
 
@@ -538,6 +567,13 @@ static DBusMessage *purple_dbus_introspect(DBusMessage *message)
 		}
 	}
 
+	g_string_append(str, "    <method name='SubscribeSignal'>\n"
+			"      <arg name='signal' type='s' direction='in'/>\n"
+			"    </method>\n"
+			"    <method name='UnsubscribeSignal'>\n"
+			"      <arg name='signal' type='s' direction='in'/>\n"
+			"    </method>\n");
+
 	if (sizeof(int) == sizeof(dbus_int32_t))
 		pointer_type = "type='i'";
 	else
@@ -562,6 +598,136 @@ static DBusMessage *purple_dbus_introspect(DBusMessage *message)
 	return reply;
 }
 
+/*
+ * Which signals the clients want.  Every signal is sent, as before,
+ * unless filtering has been turned on; then, once a client subscribes
+ * to one, only the signals that somebody subscribed to are.
+ */
+
+/* Unique bus name of each client -> the set of signals it wants */
+static GHashTable *subscribers;
+/* D-Bus name of each signal somebody wants -> how many clients do */
+static GHashTable *subscriptions;
+/* Whether signals nobody subscribed to are left out */
+static gboolean signal_filtering;
+
+void
+purple_dbus_set_signal_filtering(gboolean enabled)
+{
+	signal_filtering = enabled;
+}
+
+gboolean
+purple_dbus_get_signal_filtering(void)
+{
+	return signal_filtering;
+}
+
+static char *
+purple_dbus_owner_match_rule(const char *client)
+{
+	return g_strdup_printf("type='signal',sender='" DBUS_SERVICE_DBUS "',"
+			"interface='" DBUS_INTERFACE_DBUS "',member='NameOwnerChanged',"
+			"arg0='%s'", client);
+}
+
+static void
+purple_dbus_unsubscribe_cb(gpointer key, gpointer value, gpointer user_data)
+{
+	int count = GPOINTER_TO_INT(g_hash_table_lookup(subscriptions, key));
+
+	if (count > 1)
+		g_hash_table_insert(subscriptions, g_strdup(key),
+				GINT_TO_POINTER(count - 1));
+	else
+		g_hash_table_remove(subscriptions, key);
+}
+
+/* Forgets all of a client's subscriptions */
+static void
+purple_dbus_remove_subscriber(const char *client)
+{
+	GHashTable *signals;
+	char *rule;
+
+	signals = g_hash_table_lookup(subscribers, client);
+	if (signals == NULL)
+		return;
+
+	g_hash_table_foreach(signals, purple_dbus_unsubscribe_cb, NULL);
+
+	rule = purple_dbus_owner_match_rule(client);
+	dbus_bus_remove_match(purple_dbus_connection, rule, NULL);
+	g_free(rule);
+
+	g_hash_table_remove(subscribers, client);
+}
+
+static DBusMessage *
+purple_dbus_subscribe(DBusMessage *message, gboolean subscribe)
+{
+	const char *client, *name;
+	GHashTable *signals;
+	DBusError error;
+	int count;
+
+	dbus_error_init(&error);
+	if (!dbus_message_get_args(message, &error, DBUS_TYPE_STRING, &name,
+			DBUS_TYPE_INVALID))
+	{
+		DBusMessage *reply = dbus_message_new_error(message, error.name,
+				error.message);
+		dbus_error_free(&error);
+		return reply;
+	}
+
+	client = null_to_empty(dbus_message_get_sender(message));
+	signals = g_hash_table_lookup(subscribers, client);
+
+	if (subscribe && signals == NULL) {
+		char *rule;
+
+		signals = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		g_hash_table_insert(subscribers, g_strdup(client), signals);
+
+		/* Find out when the client goes away */
+		rule = purple_dbus_owner_match_rule(client);
+		dbus_bus_add_match(purple_dbus_connection, rule, NULL);
+		g_free(rule);
+	}
+
+	if (subscribe && g_hash_table_lookup(signals, name) == NULL) {
+		g_hash_table_insert(signals, g_strdup(name), GINT_TO_POINTER(TRUE));
+		count = GPOINTER_TO_INT(g_hash_table_lookup(subscriptions, name));
+		g_hash_table_insert(subscriptions, g_strdup(name),
+				GINT_TO_POINTER(count + 1));
+	} else if (!subscribe && signals != NULL &&
+			g_hash_table_lookup(signals, name) != NULL) {
+		purple_dbus_unsubscribe_cb((gpointer)name, NULL, NULL);
+		g_hash_table_remove(signals, name);
+		if (g_hash_table_size(signals) == 0)
+			purple_dbus_remove_subscriber(client);
+	}
+
+	return dbus_message_new_method_return(message);
+}
+
+static DBusHandlerResult
+purple_dbus_filter(DBusConnection *connection,
+		DBusMessage *message, void *user_data)
+{
+	const char *name, *old_owner, *new_owner;
+
+	if (dbus_message_is_signal(message, DBUS_INTERFACE_DBUS, "NameOwnerChanged") &&
+			dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &name,
+				DBUS_TYPE_STRING, &old_owner, DBUS_TYPE_STRING, &new_owner,
+				DBUS_TYPE_INVALID) &&
+			*new_owner == '\0')
+		purple_dbus_remove_subscriber(name);
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
 static DBusHandlerResult
 purple_dbus_dispatch(DBusConnection *connection,
 		DBusMessage *message, void *user_data)
@@ -580,12 +746,65 @@ purple_dbus_dispatch(DBusConnection *connection,
 		return DBUS_HANDLER_RESULT_HANDLED;
 	}
 
+	if ((dbus_message_is_method_call(message, DBUS_INTERFACE_PURPLE, "SubscribeSignal") ||
+			dbus_message_is_method_call(message, DBUS_INTERFACE_PURPLE, "UnsubscribeSignal")) &&
+			dbus_message_has_path(message, DBUS_PATH_PURPLE))
+	{
+		DBusMessage *reply;
+		reply = purple_dbus_subscribe(message,
+				dbus_message_has_member(message, "SubscribeSignal"));
+		dbus_connection_send(connection, reply, NULL);
+		dbus_message_unref(reply);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
 	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
+static gboolean
+purple_dbus_binding_table_is_owned_by(gpointer key, gpointer value,
+		gpointer handle)
+{
+	return ((PurpleDBusBindingTable *)value)->handle == handle;
+}
+
+static void
+purple_dbus_plugin_unload_cb(PurplePlugin *plugin, gpointer data)
+{
+	g_hash_table_foreach_remove(binding_tables,
+			purple_dbus_binding_table_is_owned_by, plugin);
+}
+
 void
 purple_dbus_register_bindings(void *handle, PurpleDBusBinding *bindings)
 {
+	PurpleDBusBindingTable *table;
+	int i;
+
+	/* Nothing can call them without a bus connection */
+	if (binding_tables == NULL)
+		return;
+
+	table = g_new(PurpleDBusBindingTable, 1);
+	table->handle = handle;
+	table->methods = g_hash_table_new(g_str_hash, g_str_equal);
+	for (i = 0; bindings[i].name; i++)
+		if (g_hash_table_lookup(table->methods, bindings[i].name) == NULL)
+			g_hash_table_insert(table->methods, (gpointer)bindings[i].name,
+					&bindings[i]);
+
+	/* A plugin that is loaded again may get its bindings back at the
+	 * same address, so replace rather than reuse what is there */
+	g_hash_table_replace(binding_tables, bindings, table);
+
+	/* The plugins are set up after us, so start watching them here */
+	if (handle != purple_dbus_get_handle() && !watching_plugins) {
+		purple_signal_connect(purple_plugins_get_handle(), "plugin-unload",
+				purple_dbus_get_handle(),
+				PURPLE_CALLBACK(purple_dbus_plugin_unload_cb), NULL);
+		watching_plugins = TRUE;
+	}
+
 	purple_signal_connect(purple_dbus_get_handle(), "dbus-method-called",
 			handle,
 			PURPLE_CALLBACK(purple_dbus_dispatch_cb),
@@ -596,6 +815,347 @@ purple_dbus_register_bindings(void *handle, PurpleDBusBinding *bindings)
 			bindings);
 }
 
+/**************************************************************************/
+/** @name Bulk queries                                                    */
+/**************************************************************************/
+
+/*
+ * Walking the buddy list a buddy and a property at a time takes tens of
+ * thousands of round trips for a big list.  These return what a buddy
+ * list or conversation window needs in one reply.
+ */
+
+/* id, name, alias, account, online, idle since, status id, status message */
+#define BUDDY_STATE_SIGNATURE "(issibiss)"
+/* id, type, account, name, title */
+#define CONVERSATION_STATE_SIGNATURE "(iiiss)"
+
+/* Removed buddies to remember before forgetting the oldest changes */
+#define REMOVED_BUDDIES_MAX 1024
+
+typedef struct
+{
+	PurpleBuddy *buddy;    /* NULL once the buddy is removed */
+	dbus_int32_t id;
+	guint seq;
+} PurpleDBusBuddyChange;
+
+/* The last change of each buddy, oldest first */
+static GQueue *buddy_changes;
+/* PurpleBuddy * -> its link in buddy_changes */
+static GHashTable *buddy_change_links;
+/* Starts out random, so that numbers from an earlier run mean nothing */
+static guint buddy_change_seq;
+/* Asking for the changes since before this gets the whole list */
+static guint buddy_changes_start;
+static guint removed_buddies;
+
+static void
+purple_dbus_iter_append_string(DBusMessageIter *iter, const char *str)
+{
+	str = null_to_empty(str);
+
+	if (!g_utf8_validate(str, -1, NULL)) {
+		gchar *tmp = purple_utf8_salvage(str);
+		dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &tmp);
+		g_free(tmp);
+	} else {
+		dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+	}
+}
+
+static void
+purple_dbus_append_buddy_state(DBusMessageIter *array, PurpleBuddy *buddy)
+{
+	PurplePresence *presence = purple_buddy_get_presence(buddy);
+	PurpleStatus *status = purple_presence_get_active_status(presence);
+	DBusMessageIter entry;
+	dbus_int32_t id, account, idle;
+	dbus_bool_t online;
+
+	id = purple_dbus_pointer_to_id(buddy);
+	account = purple_dbus_pointer_to_id(purple_buddy_get_account(buddy));
+	online = purple_presence_is_online(presence);
+	idle = purple_presence_is_idle(presence) ?
+			purple_presence_get_idle_time(presence) : 0;
+
+	dbus_message_iter_open_container(array, DBUS_TYPE_STRUCT, NULL, &entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_INT32, &id);
+	purple_dbus_iter_append_string(&entry, purple_buddy_get_name(buddy));
+	purple_dbus_iter_append_string(&entry, purple_buddy_get_alias(buddy));
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_INT32, &account);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_BOOLEAN, &online);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_INT32, &idle);
+	purple_dbus_iter_append_string(&entry,
+			status ? purple_status_get_id(status) : NULL);
+	purple_dbus_iter_append_string(&entry,
+			status ? purple_status_get_attr_string(status, "message") : NULL);
+	dbus_message_iter_close_container(array, &entry);
+}
+
+static void
+purple_dbus_append_all_buddy_states(DBusMessageIter *array,
+		PurpleAccount *account)
+{
+	PurpleBlistNode *node;
+
+	for (node = purple_blist_get_root(); node != NULL;
+			node = purple_blist_node_next(node, TRUE))
+	{
+		if (PURPLE_BLIST_NODE_IS_BUDDY(node) && (account == NULL ||
+				purple_buddy_get_account((PurpleBuddy *)node) == account))
+			purple_dbus_append_buddy_state(array, (PurpleBuddy *)node);
+	}
+}
+
+/* Makes a buddy's change the newest one */
+static PurpleDBusBuddyChange *
+purple_dbus_buddy_change_touch(PurpleBuddy *buddy)
+{
+	GList *link = g_hash_table_lookup(buddy_change_links, buddy);
+	PurpleDBusBuddyChange *change;
+
+	if (link != NULL) {
+		g_queue_unlink(buddy_changes, link);
+	} else {
+		change = g_new0(PurpleDBusBuddyChange, 1);
+		change->buddy = buddy;
+		change->id = purple_dbus_pointer_to_id(buddy);
+		link = g_list_alloc();
+		link->data = change;
+		g_hash_table_insert(buddy_change_links, buddy, link);
+	}
+
+	change = link->data;
+	change->seq = ++buddy_change_seq;
+	g_queue_push_tail_link(buddy_changes, link);
+
+	return change;
+}
+
+static void
+purple_dbus_buddy_removed_cb(PurpleBuddy *buddy)
+{
+	PurpleDBusBuddyChange *change = purple_dbus_buddy_change_touch(buddy);
+
+	change->buddy = NULL;
+	g_hash_table_remove(buddy_change_links, buddy);
+	removed_buddies++;
+
+	if (removed_buddies <= REMOVED_BUDDIES_MAX)
+		return;
+
+	/* Forget the oldest changes rather than every removed buddy ever.
+	 * Clients asking for changes from back then get the whole list. */
+	while (removed_buddies > REMOVED_BUDDIES_MAX / 2) {
+		change = g_queue_pop_head(buddy_changes);
+		if (change->buddy != NULL)
+			g_hash_table_remove(buddy_change_links, change->buddy);
+		else
+			removed_buddies--;
+		buddy_changes_start = change->seq;
+		g_free(change);
+	}
+}
+
+static void
+purple_dbus_buddy_changed_cb(PurpleBuddy *buddy)
+{
+	GList *link = g_hash_table_lookup(buddy_change_links, buddy);
+
+	/* A buddy freed without being removed, with a new one in its place */
+	if (link != NULL && ((PurpleDBusBuddyChange *)link->data)->id !=
+			purple_dbus_pointer_to_id(buddy))
+		purple_dbus_buddy_removed_cb(buddy);
+
+	purple_dbus_buddy_change_touch(buddy);
+}
+
+static void
+purple_dbus_blist_node_aliased_cb(PurpleBlistNode *node)
+{
+	if (PURPLE_BLIST_NODE_IS_BUDDY(node))
+		purple_dbus_buddy_changed_cb((PurpleBuddy *)node);
+}
+
+/* Starts keeping track of changes the first time a client asks for them */
+static void
+purple_dbus_buddy_changes_init(void)
+{
+	void *blist_handle = purple_blist_get_handle();
+	void *handle = purple_dbus_get_handle();
+	const char *signals[] = {
+		"buddy-added", "buddy-status-changed", "buddy-idle-changed",
+		"buddy-signed-on", "buddy-signed-off"
+	};
+	int i;
+
+	if (buddy_changes != NULL)
+		return;
+
+	buddy_changes = g_queue_new();
+	buddy_change_links = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	/* Nothing was tracked before now, so whatever was handed out before,
+	 * in this run or another, has to get the whole list */
+	if (buddy_change_seq == 0)
+		buddy_change_seq = g_random_int_range(1, G_MAXINT32);
+	buddy_changes_start = ++buddy_change_seq;
+
+	for (i = 0; i < G_N_ELEMENTS(signals); i++)
+		purple_signal_connect(blist_handle, signals[i], handle,
+				PURPLE_CALLBACK(purple_dbus_buddy_changed_cb), NULL);
+	purple_signal_connect(blist_handle, "buddy-removed", handle,
+			PURPLE_CALLBACK(purple_dbus_buddy_removed_cb), NULL);
+	purple_signal_connect(blist_handle, "blist-node-aliased", handle,
+			PURPLE_CALLBACK(purple_dbus_blist_node_aliased_cb), NULL);
+}
+
+static void
+purple_dbus_buddy_changes_uninit(void)
+{
+	if (buddy_changes == NULL)
+		return;
+
+	/* The signals go with the rest of ours in purple_dbus_uninit() */
+	g_queue_foreach(buddy_changes, (GFunc)g_free, NULL);
+	g_queue_free(buddy_changes);
+	buddy_changes = NULL;
+	g_hash_table_destroy(buddy_change_links);
+	buddy_change_links = NULL;
+	removed_buddies = 0;
+}
+
+static DBusMessage *
+purple_dbus_get_buddy_states(DBusMessage *message, DBusError *error)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter, array;
+	dbus_int32_t account_ID;
+	PurpleAccount *account = NULL;
+
+	dbus_message_get_args(message, error, DBUS_TYPE_INT32, &account_ID,
+			DBUS_TYPE_INVALID);
+	CHECK_ERROR(error);
+	if (account_ID != 0)
+		PURPLE_DBUS_ID_TO_POINTER(account, account_ID, PurpleAccount, error);
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			BUDDY_STATE_SIGNATURE, &array);
+	purple_dbus_append_all_buddy_states(&array, account);
+	dbus_message_iter_close_container(&iter, &array);
+
+	return reply;
+}
+
+static DBusMessage *
+purple_dbus_get_buddy_changes(DBusMessage *message, DBusError *error)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter, array;
+	dbus_uint32_t since, seq;
+	dbus_bool_t complete;
+	GList *first, *l;
+
+	dbus_message_get_args(message, error, DBUS_TYPE_UINT32, &since,
+			DBUS_TYPE_INVALID);
+	CHECK_ERROR(error);
+
+	purple_dbus_buddy_changes_init();
+
+	seq = buddy_change_seq;
+	complete = (since == 0 || since < buddy_changes_start || since > seq);
+
+	/* The changes since then are the ones at the end of the queue */
+	for (first = NULL, l = buddy_changes->tail; !complete && l != NULL;
+			first = l, l = l->prev)
+		if (((PurpleDBusBuddyChange *)l->data)->seq <= since)
+			break;
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT32, &seq);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_BOOLEAN, &complete);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			BUDDY_STATE_SIGNATURE, &array);
+	if (complete) {
+		purple_dbus_append_all_buddy_states(&array, NULL);
+	} else {
+		for (l = first; l != NULL; l = l->next) {
+			PurpleDBusBuddyChange *change = l->data;
+
+			if (change->buddy != NULL && purple_dbus_id_to_pointer(change->id,
+					PURPLE_DBUS_TYPE(PurpleBuddy)) == change->buddy)
+				purple_dbus_append_buddy_state(&array, change->buddy);
+		}
+	}
+	dbus_message_iter_close_container(&iter, &array);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			DBUS_TYPE_INT32_AS_STRING, &array);
+	for (l = complete ? NULL : first; l != NULL; l = l->next) {
+		PurpleDBusBuddyChange *change = l->data;
+
+		if (change->buddy == NULL || purple_dbus_id_to_pointer(change->id,
+				PURPLE_DBUS_TYPE(PurpleBuddy)) != change->buddy)
+			dbus_message_iter_append_basic(&array, DBUS_TYPE_INT32, &change->id);
+	}
+	dbus_message_iter_close_container(&iter, &array);
+
+	return reply;
+}
+
+static DBusMessage *
+purple_dbus_get_conversation_states(DBusMessage *message, DBusError *error)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter, array, entry;
+	GList *l;
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			CONVERSATION_STATE_SIGNATURE, &array);
+
+	for (l = purple_get_conversations(); l != NULL; l = l->next) {
+		PurpleConversation *conv = l->data;
+		dbus_int32_t id, type, account;
+
+		id = purple_dbus_pointer_to_id(conv);
+		type = purple_conversation_get_type(conv);
+		account = purple_dbus_pointer_to_id(purple_conversation_get_account(conv));
+
+		dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, NULL, &entry);
+		dbus_message_iter_append_basic(&entry, DBUS_TYPE_INT32, &id);
+		dbus_message_iter_append_basic(&entry, DBUS_TYPE_INT32, &type);
+		dbus_message_iter_append_basic(&entry, DBUS_TYPE_INT32, &account);
+		purple_dbus_iter_append_string(&entry, purple_conversation_get_name(conv));
+		purple_dbus_iter_append_string(&entry, purple_conversation_get_title(conv));
+		dbus_message_iter_close_container(&array, &entry);
+	}
+
+	dbus_message_iter_close_container(&iter, &array);
+
+	return reply;
+}
+
+static PurpleDBusBinding bulk_bindings[] = {
+	{"PurpleBlistGetBuddyStates",
+		"in\0i\0account\0out\0a" BUDDY_STATE_SIGNATURE "\0buddies\0",
+		purple_dbus_get_buddy_states},
+	{"PurpleBlistGetBuddyChanges",
+		"in\0u\0since\0out\0u\0sequence\0out\0b\0complete\0"
+		"out\0a" BUDDY_STATE_SIGNATURE "\0changed\0out\0ai\0removed\0",
+		purple_dbus_get_buddy_changes},
+	{"PurpleGetConversationStates",
+		"out\0a" CONVERSATION_STATE_SIGNATURE "\0conversations\0",
+		purple_dbus_get_conversation_states},
+	{NULL, NULL, NULL}
+};
+
 static void
 purple_dbus_dispatch_init(void)
 {
@@ -640,6 +1200,14 @@ purple_dbus_dispatch_init(void)
 
 	purple_debug_misc("dbus", "okkk\n");
 
+	binding_tables = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, (GDestroyNotify)purple_dbus_binding_table_free);
+	subscribers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)g_hash_table_destroy);
+	subscriptions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	dbus_connection_add_filter(purple_dbus_connection, purple_dbus_filter,
+			NULL, NULL);
+
 	purple_signal_register(purple_dbus_get_handle(), "dbus-method-called",
 			 purple_marshal_BOOLEAN__POINTER_POINTER,
 			 purple_value_new(PURPLE_TYPE_BOOLEAN), 2,
@@ -651,6 +1219,7 @@ purple_dbus_dispatch_init(void)
 			 purple_value_new_outgoing(PURPLE_TYPE_POINTER));
 
 	PURPLE_DBUS_REGISTER_BINDINGS(purple_dbus_get_handle());
+	purple_dbus_register_bindings(purple_dbus_get_handle(), bulk_bindings);
 }
 
 
@@ -684,6 +1253,26 @@ purple_dbus_convert_signal_name(const char *purple_name)
 	return g_name;
 }
 
+/* The D-Bus name of a signal, worked out the first time it is sent */
+static const char *
+purple_dbus_get_signal_name(const char *purple_name)
+{
+	static GHashTable *signal_names = NULL;
+	char *g_name;
+
+	if (signal_names == NULL)
+		signal_names = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, g_free);
+
+	g_name = g_hash_table_lookup(signal_names, purple_name);
+	if (g_name == NULL) {
+		g_name = purple_dbus_convert_signal_name(purple_name);
+		g_hash_table_insert(signal_names, g_strdup(purple_name), g_name);
+	}
+
+	return g_name;
+}
+
 #define my_arg(type) (ptr != NULL ? * ((type *)ptr) : va_arg(data, type))
 
 static gboolean
@@ -772,7 +1361,7 @@ purple_dbus_signal_emit_purple(const char *name, int num_values,
 {
 	DBusMessage *signal;
 	DBusMessageIter iter;
-	char *newname;
+	const char *newname;
 
 #if 0 /* this is noisy with no dbus connection */
 	g_return_if_fail(purple_dbus_connection);
@@ -791,7 +1380,14 @@ purple_dbus_signal_emit_purple(const char *name, int num_values,
 	if (!strcmp(name, "dbus-method-called"))
 		return;
 
-	newname = purple_dbus_convert_signal_name(name);
+	newname = purple_dbus_get_signal_name(name);
+
+	/* Don't build messages for signals no client wants */
+	if (signal_filtering && subscriptions != NULL &&
+			g_hash_table_size(subscriptions) > 0 &&
+			g_hash_table_lookup(subscriptions, newname) == NULL)
+		return;
+
 	signal = dbus_message_new_signal(DBUS_PATH_PURPLE, DBUS_INTERFACE_PURPLE, newname);
 	dbus_message_iter_init_append(signal, &iter);
 
@@ -804,7 +1400,6 @@ purple_dbus_signal_emit_purple(const char *name, int num_values,
 
 	dbus_connection_send(purple_dbus_connection, signal, NULL);
 
-	g_free(newname);
 	dbus_message_unref(signal);
 }
 
@@ -845,12 +1440,26 @@ purple_dbus_uninit(void)
 		return;
 
 	dbus_error_init(&error);
+	if (subscribers != NULL)
+		dbus_connection_remove_filter(purple_dbus_connection,
+				purple_dbus_filter, NULL);
 	dbus_connection_unregister_object_path(purple_dbus_connection, DBUS_PATH_PURPLE);
 	dbus_bus_release_name(purple_dbus_connection, DBUS_SERVICE_PURPLE, &error);
 	dbus_error_free(&error);
 	dbus_connection_unref(purple_dbus_connection);
 	purple_dbus_connection = NULL;
+	purple_dbus_buddy_changes_uninit();
 	purple_signals_disconnect_by_handle(purple_dbus_get_handle());
+	watching_plugins = FALSE;
+	if (subscribers != NULL) {
+		purple_signals_unregister_by_instance(purple_dbus_get_handle());
+		g_hash_table_destroy(binding_tables);
+		binding_tables = NULL;
+		g_hash_table_destroy(subscribers);
+		subscribers = NULL;
+		g_hash_table_destroy(subscriptions);
+		subscriptions = NULL;
+	}
 	g_free(init_error);
 	init_error = NULL;
 }
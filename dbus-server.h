@@ -139,6 +139,12 @@ void purple_dbus_unregister_pointer(gpointer node);
 /**
     Emits a dbus signal.
 
+    Clients can call SubscribeSignal and UnsubscribeSignal with the
+    D-Bus name of a signal ("BlaBlaBlaa").  Every signal is sent unless
+    purple_dbus_set_signal_filtering() has turned filtering on; then,
+    while any client has a subscription, only the signals somebody
+    subscribed to are.  A client's subscriptions go away with it.
+
     @param name        The name of the signal ("bla-bla-blaa")
     @param num_values  The number of parameters.
     @param values      Array of pointers to #PurpleValue objects representing
@@ -148,6 +154,29 @@ void purple_dbus_unregister_pointer(gpointer node);
 void purple_dbus_signal_emit_purple(const char *name, int num_values,
 				PurpleValue **values, va_list vargs);
 
+/**
+ * Sets whether signals are only sent when a client subscribed to them.
+ *
+ * This is off by default, since clients that don't know about
+ * SubscribeSignal would otherwise stop getting signals as soon as
+ * another client subscribed to something.
+ *
+ * @param enabled Whether to leave out signals nobody subscribed to.
+ *
+ * @see purple_dbus_signal_emit_purple()
+ * @since 2.10.0
+ */
+void purple_dbus_set_signal_filtering(gboolean enabled);
+
+/**
+ * Returns whether signals are only sent when a client subscribed to them.
+ *
+ * @return @c TRUE if signals nobody subscribed to are left out.
+ *
+ * @since 2.10.0
+ */
+gboolean purple_dbus_get_signal_filtering(void);
+
 /**
  * Returns whether Purple's D-BUS subsystem is up and running.  If it's
  * NOT running then purple_dbus_dispatch_init() failed for some reason,
@@ -23,16 +23,813 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
  */
+/* For dladdr() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "internal.h"
+#include "debug.h"
 #include "eventloop.h"
+#include "plugin.h"
 
 static PurpleEventLoopUiOps *eventloop_ui_ops = NULL;
 
+/* In microseconds, from some point in the past */
+static gint64
+eventloop_time(void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+	return g_get_monotonic_time();
+#else
+	GTimeVal now;
+
+	g_get_current_time(&now);
+	return (gint64)now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+#endif
+}
+
+/**************************************************************************
+ * Instrumentation
+ *
+ * While it's on, callbacks are called through a wrapper which times them,
+ * and the times are added up per callback function.
+ **************************************************************************/
+#define SUMMARY_SIZE 10
+
+typedef struct
+{
+	PurpleEventLoopCallbackStats *stats;
+	GSourceFunc function;
+	PurpleInputFunction input_function;
+	gpointer data;
+	guint tag;
+	gboolean running;
+	gboolean removed;           /* Removed while it was running */
+} PurpleInstrumentedCallback;
+
+static gboolean instrumented = FALSE;
+static guint slow_threshold = 100;
+static guint summary_interval = 300;
+static guint summary_source = 0;
+
+static GHashTable *callback_stats = NULL;          /* function -> stats */
+static GHashTable *instrumented_timeouts = NULL;   /* tag -> callback */
+static GHashTable *instrumented_inputs = NULL;     /* tag -> callback */
+
+/* The upper bounds, in microseconds, of the histogram's buckets */
+static const gint64 histogram_limits[PURPLE_EVENTLOOP_HISTOGRAM_SIZE - 1] = {
+	100, 1000, 10000, 100000, 1000000
+};
+
+static void
+callback_stats_find_owner(PurpleEventLoopCallbackStats *stats)
+{
+#if defined(PURPLE_PLUGINS) && defined(HAVE_DLFCN_H)
+	Dl_info info;
+	GList *l;
+
+	if (!dladdr(stats->function, &info))
+		return;
+
+	if (info.dli_sname != NULL)
+		stats->name = g_strdup(info.dli_sname);
+
+	if (info.dli_fname == NULL)
+		return;
+
+	for (l = purple_plugins_get_loaded(); l != NULL; l = l->next) {
+		PurplePlugin *plugin = l->data;
+
+		if (plugin->native_plugin && purple_strequal(plugin->path, info.dli_fname)) {
+			stats->owner = g_strdup(purple_plugin_get_id(plugin));
+			return;
+		}
+	}
+
+	/* libpurple itself, the UI, or a prpl built into one of them */
+	stats->owner = g_path_get_basename(info.dli_fname);
+#endif
+}
+
+static PurpleEventLoopCallbackStats *
+callback_stats_lookup(gpointer function, gboolean input)
+{
+	PurpleEventLoopCallbackStats *stats;
+
+	if (callback_stats == NULL)
+		callback_stats = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	stats = g_hash_table_lookup(callback_stats, function);
+	if (stats == NULL) {
+		stats = g_new0(PurpleEventLoopCallbackStats, 1);
+		stats->function = function;
+		stats->input = input;
+		callback_stats_find_owner(stats);
+		g_hash_table_insert(callback_stats, function, stats);
+	}
+
+	return stats;
+}
+
+static char *
+callback_stats_describe(const PurpleEventLoopCallbackStats *stats)
+{
+	char *name, *description;
+
+	if (stats->name != NULL)
+		name = g_strdup(stats->name);
+	else
+		name = g_strdup_printf("%p", stats->function);
+
+	if (stats->owner == NULL)
+		return name;
+
+	description = g_strdup_printf("%s (%s)", name, stats->owner);
+	g_free(name);
+
+	return description;
+}
+
+static void
+callback_stats_record(PurpleEventLoopCallbackStats *stats, gint64 elapsed)
+{
+	int bucket = 0;
+
+	stats->calls++;
+	stats->total_time += elapsed;
+	stats->max_time = MAX(stats->max_time, (guint64)elapsed);
+
+	while (bucket < PURPLE_EVENTLOOP_HISTOGRAM_SIZE - 1 &&
+			elapsed >= histogram_limits[bucket])
+		bucket++;
+	stats->histogram[bucket]++;
+
+	if (slow_threshold > 0 && elapsed >= (gint64)slow_threshold * 1000) {
+		char *description = callback_stats_describe(stats);
+
+		stats->slow_calls++;
+		purple_debug_warning("eventloop", "%s %s blocked the event loop for "
+				"%" G_GINT64_FORMAT " ms\n",
+				stats->input ? "Input handler" : "Timeout", description,
+				elapsed / 1000);
+		g_free(description);
+	}
+}
+
+static gboolean
+instrumented_timeout_cb(gpointer data)
+{
+	PurpleInstrumentedCallback *callback = data;
+	gint64 start = eventloop_time();
+	gboolean again;
+
+	callback->running = TRUE;
+	again = callback->function(callback->data);
+	callback->running = FALSE;
+
+	if (instrumented)
+		callback_stats_record(callback->stats, eventloop_time() - start);
+
+	if (callback->removed) {
+		g_free(callback);
+		return FALSE;
+	}
+
+	if (!again) {
+		g_hash_table_remove(instrumented_timeouts, GUINT_TO_POINTER(callback->tag));
+		g_free(callback);
+	}
+
+	return again;
+}
+
+static void
+instrumented_input_cb(gpointer data, gint fd, PurpleInputCondition condition)
+{
+	PurpleInstrumentedCallback *callback = data;
+	gint64 start = eventloop_time();
+
+	callback->running = TRUE;
+	callback->input_function(callback->data, fd, condition);
+	callback->running = FALSE;
+
+	if (instrumented)
+		callback_stats_record(callback->stats, eventloop_time() - start);
+
+	if (callback->removed)
+		g_free(callback);
+}
+
+static guint
+instrumented_timeout_add(guint interval, gboolean seconds,
+		GSourceFunc function, gpointer data)
+{
+	PurpleEventLoopUiOps *ops = purple_eventloop_get_ui_ops();
+	PurpleInstrumentedCallback *callback;
+
+	callback = g_new0(PurpleInstrumentedCallback, 1);
+	callback->stats = callback_stats_lookup(function, FALSE);
+	callback->function = function;
+	callback->data = data;
+
+	if (!seconds)
+		callback->tag = ops->timeout_add(interval, instrumented_timeout_cb, callback);
+	else if (ops->timeout_add_seconds)
+		callback->tag = ops->timeout_add_seconds(interval, instrumented_timeout_cb, callback);
+	else
+		callback->tag = ops->timeout_add(1000 * interval, instrumented_timeout_cb, callback);
+
+	if (instrumented_timeouts == NULL)
+		instrumented_timeouts = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_hash_table_insert(instrumented_timeouts, GUINT_TO_POINTER(callback->tag), callback);
+
+	return callback->tag;
+}
+
+/* Forgets the wrapper for a timeout or input handler that's been removed */
+static void
+instrumented_forget(GHashTable *callbacks, guint tag)
+{
+	PurpleInstrumentedCallback *callback;
+
+	if (callbacks == NULL)
+		return;
+
+	callback = g_hash_table_lookup(callbacks, GUINT_TO_POINTER(tag));
+	if (callback == NULL)
+		return;
+
+	g_hash_table_remove(callbacks, GUINT_TO_POINTER(tag));
+	if (callback->running)
+		callback->removed = TRUE;
+	else
+		g_free(callback);
+}
+
+static gint
+compare_total_time(gconstpointer a, gconstpointer b)
+{
+	const PurpleEventLoopCallbackStats *stats_a = a, *stats_b = b;
+
+	if (stats_a->total_time != stats_b->total_time)
+		return stats_a->total_time > stats_b->total_time ? -1 : 1;
+
+	return stats_b->calls - stats_a->calls;
+}
+
+static gboolean
+summary_cb(gpointer unused)
+{
+	GList *stats = purple_eventloop_get_callback_stats();
+	GList *l;
+	int i;
+
+	for (l = stats, i = 0; l != NULL && i < SUMMARY_SIZE; l = l->next, i++) {
+		PurpleEventLoopCallbackStats *callback = l->data;
+		char *description;
+
+		/* The rest haven't been called since the last reset */
+		if (callback->calls == 0)
+			break;
+
+		if (i == 0)
+			purple_debug_info("eventloop", "Callbacks that have kept the "
+					"event loop busiest:\n");
+
+		description = callback_stats_describe(callback);
+
+		purple_debug_info("eventloop", "  %s: %u calls, %.1f ms in all, "
+				"%.1f ms at most, %u slow\n", description, callback->calls,
+				callback->total_time / 1000.0, callback->max_time / 1000.0,
+				callback->slow_calls);
+		g_free(description);
+	}
+
+	g_list_free(stats);
+
+	return TRUE;
+}
+
+static void
+summary_schedule(void)
+{
+	PurpleEventLoopUiOps *ops = purple_eventloop_get_ui_ops();
+
+	if (summary_source != 0) {
+		ops->timeout_remove(summary_source);
+		summary_source = 0;
+	}
+
+	if (!instrumented || summary_interval == 0)
+		return;
+
+	if (ops->timeout_add_seconds)
+		summary_source = ops->timeout_add_seconds(summary_interval, summary_cb, NULL);
+	else
+		summary_source = ops->timeout_add(1000 * summary_interval, summary_cb, NULL);
+}
+
+void
+purple_eventloop_set_instrumented(gboolean enabled)
+{
+	if (instrumented == enabled)
+		return;
+
+	instrumented = enabled;
+	summary_schedule();
+}
+
+gboolean
+purple_eventloop_get_instrumented(void)
+{
+	return instrumented;
+}
+
+void
+purple_eventloop_set_slow_threshold(guint threshold)
+{
+	slow_threshold = threshold;
+}
+
+guint
+purple_eventloop_get_slow_threshold(void)
+{
+	return slow_threshold;
+}
+
+void
+purple_eventloop_set_summary_interval(guint interval)
+{
+	summary_interval = interval;
+	summary_schedule();
+}
+
+guint
+purple_eventloop_get_summary_interval(void)
+{
+	return summary_interval;
+}
+
+static void
+prepend_stats(gpointer function, gpointer stats, gpointer list)
+{
+	*(GList **)list = g_list_prepend(*(GList **)list, stats);
+}
+
+GList *
+purple_eventloop_get_callback_stats(void)
+{
+	GList *stats = NULL;
+
+	if (callback_stats == NULL)
+		return NULL;
+
+	g_hash_table_foreach(callback_stats, prepend_stats, &stats);
+
+	return g_list_sort(stats, compare_total_time);
+}
+
+static void
+reset_stats(gpointer function, gpointer value, gpointer unused)
+{
+	PurpleEventLoopCallbackStats *stats = value;
+
+	/* Wrappers still point at these, so they're cleared rather than freed */
+	stats->calls = 0;
+	stats->slow_calls = 0;
+	stats->total_time = 0;
+	stats->max_time = 0;
+	memset(stats->histogram, 0, sizeof(stats->histogram));
+}
+
+void
+purple_eventloop_reset_callback_stats(void)
+{
+	if (callback_stats != NULL)
+		g_hash_table_foreach(callback_stats, reset_stats, NULL);
+}
+
+/**************************************************************************
+ * Timer wheel
+ *
+ * Each level of the wheel has WHEEL_SIZE slots, and each slot of a level
+ * covers WHEEL_SIZE times as many milliseconds as one of the level below.
+ * A timer goes in the lowest level whose span covers how far off it is,
+ * in the slot its expiry time falls into.  When time reaches the start of
+ * a slot of a higher level, the timers in it are "cascaded" down a level
+ * or more, so by the time one is due it is in the bottom level, where
+ * every slot holds the timers for a single millisecond.
+ *
+ * A bitmap per level tracks which slots have timers in them, so finding
+ * when the wheel next needs to run doesn't mean walking the slots.  One
+ * UI timeout is kept for that time, and only moved when a timer due
+ * sooner than it is added.
+ **************************************************************************/
+#define WHEEL_BITS   6
+#define WHEEL_SIZE   (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 6
+
+/* The longest the driving UI timeout is ever set for (a day) */
+#define WHEEL_MAX_SLEEP (24 * 60 * 60 * 1000)
+
+/* Set in every handle of a timer in the wheel, and never in a UI's */
+#define WHEEL_HANDLE_FLAG 0x80000000
+
+typedef struct _PurpleWheelTimer PurpleWheelTimer;
+
+struct _PurpleWheelTimer
+{
+	guint handle;
+	guint64 interval;           /* In milliseconds */
+	guint64 expires;            /* When it's due, from wheel_time() */
+	GSourceFunc function;
+	gpointer data;
+
+	PurpleWheelTimer **slot;    /* The list it's in, if any */
+	PurpleWheelTimer *prev;
+	PurpleWheelTimer *next;
+	gboolean running;
+	gboolean removed;           /* Removed while it was running */
+};
+
+static struct
+{
+	PurpleWheelTimer *slots[WHEEL_LEVELS][WHEEL_SIZE];
+	guint64 occupied[WHEEL_LEVELS];
+
+	/* The timers due now, while they're being run */
+	PurpleWheelTimer *expired;
+
+	/* Everything due before this has been run */
+	guint64 now;
+
+	GHashTable *timers;         /* handle -> PurpleWheelTimer */
+	guint next_handle;
+
+	guint source;               /* The UI timeout driving the wheel */
+	guint64 source_time;        /* ...and when it's set to go off */
+} wheel;
+
+static gboolean wheel_routing = FALSE;
+
+static guint64
+wheel_time(void)
+{
+	return eventloop_time() / 1000;
+}
+
+/* How far past bit start the next set bit in bits is, going round */
+static int
+wheel_next_bit(guint64 bits, int start)
+{
+	if (start)
+		bits = (bits >> start) | (bits << (WHEEL_SIZE - start));
+
+#ifdef __GNUC__
+	return __builtin_ctzll(bits);
+#else
+	{
+		int offset = 0;
+
+		while (!(bits & 1)) {
+			bits >>= 1;
+			offset++;
+		}
+		return offset;
+	}
+#endif
+}
+
+static void
+wheel_link(PurpleWheelTimer *timer, PurpleWheelTimer **slot)
+{
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = *slot;
+	if (*slot)
+		(*slot)->prev = timer;
+	*slot = timer;
+}
+
+static void
+wheel_unlink(PurpleWheelTimer *timer)
+{
+	PurpleWheelTimer **slot = timer->slot;
+
+	if (slot == NULL)
+		return;
+
+	if (timer->prev)
+		timer->prev->next = timer->next;
+	else
+		*slot = timer->next;
+	if (timer->next)
+		timer->next->prev = timer->prev;
+	timer->slot = NULL;
+
+	if (*slot == NULL && slot != &wheel.expired) {
+		int n = slot - &wheel.slots[0][0];
+
+		wheel.occupied[n / WHEEL_SIZE] &= ~((guint64)1 << (n % WHEEL_SIZE));
+	}
+}
+
+static void
+wheel_insert(PurpleWheelTimer *timer)
+{
+	guint64 delta;
+	int level = 0, index;
+
+	/* Anything overdue is run next time round */
+	if (timer->expires < wheel.now)
+		timer->expires = wheel.now;
+
+	delta = timer->expires - wheel.now;
+	while (level < WHEEL_LEVELS - 1 &&
+			delta >= (guint64)1 << (WHEEL_BITS * (level + 1)))
+		level++;
+
+	/*
+	 * Timers too far off for the top level come back round to the same
+	 * slot until they aren't.
+	 */
+	index = (timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	wheel_link(timer, &wheel.slots[level][index]);
+	wheel.occupied[level] |= (guint64)1 << index;
+}
+
+/*
+ * The next time the wheel has anything to do: either a timer in the
+ * bottom level is due, or a slot of a higher level needs cascading.
+ */
+static guint64
+wheel_next_time(void)
+{
+	guint64 next = G_MAXUINT64;
+	int level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		int shift = WHEEL_BITS * level;
+		guint64 base, when;
+
+		if (wheel.occupied[level] == 0)
+			continue;
+
+		/* The first slot of this level that starts at or after now */
+		base = (wheel.now + ((guint64)1 << shift) - 1) >> shift;
+		when = (base + wheel_next_bit(wheel.occupied[level],
+				base & WHEEL_MASK)) << shift;
+		next = MIN(next, when);
+	}
+
+	return next;
+}
+
+static void
+wheel_cascade(int level, guint64 now)
+{
+	int index = (now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	PurpleWheelTimer *timer = wheel.slots[level][index];
+
+	wheel.slots[level][index] = NULL;
+	wheel.occupied[level] &= ~((guint64)1 << index);
+
+	while (timer != NULL) {
+		PurpleWheelTimer *next = timer->next;
+
+		wheel_insert(timer);
+		timer = next;
+	}
+}
+
+static void
+wheel_free(PurpleWheelTimer *timer)
+{
+	g_hash_table_remove(wheel.timers, GUINT_TO_POINTER(timer->handle));
+	g_free(timer);
+}
+
+static void
+wheel_run(guint64 until)
+{
+	while (g_hash_table_size(wheel.timers) > 0) {
+		guint64 now = wheel_next_time();
+		PurpleWheelTimer *timer;
+		int level, index;
+
+		if (now > until)
+			break;
+
+		wheel.now = now;
+
+		/* Higher levels first, so their timers can go on down */
+		for (level = WHEEL_LEVELS - 1; level > 0; level--)
+			if ((now & (((guint64)1 << (WHEEL_BITS * level)) - 1)) == 0)
+				wheel_cascade(level, now);
+
+		wheel.now = now + 1;
+
+		index = now & WHEEL_MASK;
+		if (wheel.slots[0][index] == NULL)
+			continue;
+
+		/* Callbacks can remove any of these, so they're kept in a list */
+		wheel.expired = wheel.slots[0][index];
+		wheel.slots[0][index] = NULL;
+		wheel.occupied[0] &= ~((guint64)1 << index);
+		for (timer = wheel.expired; timer != NULL; timer = timer->next)
+			timer->slot = &wheel.expired;
+
+		while ((timer = wheel.expired) != NULL) {
+			gboolean again;
+
+			wheel_unlink(timer);
+			timer->running = TRUE;
+			if (instrumented) {
+				gint64 start = eventloop_time();
+
+				again = timer->function(timer->data);
+				callback_stats_record(callback_stats_lookup(timer->function, FALSE),
+						eventloop_time() - start);
+			} else {
+				again = timer->function(timer->data);
+			}
+			timer->running = FALSE;
+
+			if (timer->removed || !again) {
+				wheel_unlink(timer);
+				wheel_free(timer);
+			} else if (timer->slot == NULL) {
+				/* It wasn't restarted while it ran */
+				timer->expires = wheel_time() + timer->interval;
+				wheel_insert(timer);
+			}
+		}
+	}
+
+	if (wheel.now <= until)
+		wheel.now = until + 1;
+}
+
+static gboolean wheel_dispatch(gpointer unused);
+
+/* Makes sure the UI will wake the wheel up when it next has work to do */
+static void
+wheel_schedule(void)
+{
+	PurpleEventLoopUiOps *ops = purple_eventloop_get_ui_ops();
+	guint64 next, now;
+
+	/*
+	 * An empty wheel leaves its timeout to go off harmlessly, rather
+	 * than removing it only to add another with the next timer.
+	 */
+	if (g_hash_table_size(wheel.timers) == 0)
+		return;
+
+	next = wheel_next_time();
+	if (wheel.source != 0) {
+		if (wheel.source_time <= next)
+			return;
+		ops->timeout_remove(wheel.source);
+	}
+
+	now = wheel_time();
+	next = MIN(MAX(next, now), now + WHEEL_MAX_SLEEP);
+	wheel.source_time = next;
+	wheel.source = ops->timeout_add(next - now, wheel_dispatch, NULL);
+}
+
+static gboolean
+wheel_dispatch(gpointer unused)
+{
+	wheel.source = 0;
+
+	wheel_run(wheel_time());
+	wheel_schedule();
+
+	return FALSE;
+}
+
+static guint
+wheel_add(guint64 interval, GSourceFunc function, gpointer data)
+{
+	PurpleWheelTimer *timer;
+
+	g_return_val_if_fail(function != NULL, 0);
+
+	if (wheel.timers == NULL)
+		wheel.timers = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	/* Time stands still while the wheel is empty */
+	if (g_hash_table_size(wheel.timers) == 0)
+		wheel.now = MAX(wheel.now, wheel_time());
+
+	timer = g_new0(PurpleWheelTimer, 1);
+	do {
+		wheel.next_handle = (wheel.next_handle + 1) & ~WHEEL_HANDLE_FLAG;
+		timer->handle = wheel.next_handle | WHEEL_HANDLE_FLAG;
+	} while (wheel.next_handle == 0 ||
+			g_hash_table_lookup(wheel.timers, GUINT_TO_POINTER(timer->handle)));
+
+	timer->interval = interval;
+	timer->expires = wheel_time() + interval;
+	timer->function = function;
+	timer->data = data;
+	g_hash_table_insert(wheel.timers, GUINT_TO_POINTER(timer->handle), timer);
+
+	wheel_insert(timer);
+	wheel_schedule();
+
+	return timer->handle;
+}
+
+static PurpleWheelTimer *
+wheel_lookup(guint handle)
+{
+	PurpleWheelTimer *timer;
+
+	if (wheel.timers == NULL || !(handle & WHEEL_HANDLE_FLAG))
+		return NULL;
+
+	timer = g_hash_table_lookup(wheel.timers, GUINT_TO_POINTER(handle));
+	if (timer == NULL || timer->removed)
+		return NULL;
+
+	return timer;
+}
+
+static gboolean
+wheel_remove(guint handle)
+{
+	PurpleWheelTimer *timer = wheel_lookup(handle);
+
+	if (timer == NULL)
+		return FALSE;
+
+	wheel_unlink(timer);
+	if (timer->running)
+		/* wheel_run() frees it once its callback returns */
+		timer->removed = TRUE;
+	else
+		wheel_free(timer);
+
+	return TRUE;
+}
+
+guint
+purple_timeout_wheel_add(guint interval, GSourceFunc function, gpointer data)
+{
+	return wheel_add(interval, function, data);
+}
+
+guint
+purple_timeout_wheel_add_seconds(guint interval, GSourceFunc function, gpointer data)
+{
+	return wheel_add((guint64)interval * 1000, function, data);
+}
+
+gboolean
+purple_timeout_restart(guint handle)
+{
+	PurpleWheelTimer *timer = wheel_lookup(handle);
+
+	if (timer == NULL)
+		return FALSE;
+
+	wheel_unlink(timer);
+	timer->expires = wheel_time() + timer->interval;
+	wheel_insert(timer);
+	wheel_schedule();
+
+	return TRUE;
+}
+
+void
+purple_eventloop_set_timer_wheel(gboolean enabled)
+{
+	wheel_routing = enabled;
+}
+
+gboolean
+purple_eventloop_get_timer_wheel(void)
+{
+	return wheel_routing;
+}
+
 guint
 purple_timeout_add(guint interval, GSourceFunc function, gpointer data)
 {
 	PurpleEventLoopUiOps *ops = purple_eventloop_get_ui_ops();
 
+	if (wheel_routing)
+		return purple_timeout_wheel_add(interval, function, data);
+
+	if (instrumented)
+		return instrumented_timeout_add(interval, FALSE, function, data);
+
 	return ops->timeout_add(interval, function, data);
 }
 
@@ -41,6 +838,12 @@ purple_timeout_add_seconds(guint interval, GSourceFunc function, gpointer data)
 {
 	PurpleEventLoopUiOps *ops = purple_eventloop_get_ui_ops();
 
+	if (wheel_routing)
+		return purple_timeout_wheel_add_seconds(interval, function, data);
+
+	if (instrumented)
+		return instrumented_timeout_add(interval, TRUE, function, data);
+
 	if (ops->timeout_add_seconds)
 		return ops->timeout_add_seconds(interval, function, data);
 	else
@@ -52,6 +855,11 @@ purple_timeout_remove(guint tag)
 {
 	PurpleEventLoopUiOps *ops = purple_eventloop_get_ui_ops();
 
+	if (tag & WHEEL_HANDLE_FLAG)
+		return wheel_remove(tag);
+
+	instrumented_forget(instrumented_timeouts, tag);
+
 	return ops->timeout_remove(tag);
 }
 
@@ -59,8 +867,22 @@ guint
 purple_input_add(int source, PurpleInputCondition condition, PurpleInputFunction func, gpointer user_data)
 {
 	PurpleEventLoopUiOps *ops = purple_eventloop_get_ui_ops();
+	PurpleInstrumentedCallback *callback;
 
-	return ops->input_add(source, condition, func, user_data);
+	if (!instrumented)
+		return ops->input_add(source, condition, func, user_data);
+
+	callback = g_new0(PurpleInstrumentedCallback, 1);
+	callback->stats = callback_stats_lookup(func, TRUE);
+	callback->input_function = func;
+	callback->data = user_data;
+	callback->tag = ops->input_add(source, condition, instrumented_input_cb, callback);
+
+	if (instrumented_inputs == NULL)
+		instrumented_inputs = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_hash_table_insert(instrumented_inputs, GUINT_TO_POINTER(callback->tag), callback);
+
+	return callback->tag;
 }
 
 gboolean
@@ -68,6 +890,8 @@ purple_input_remove(guint tag)
 {
 	PurpleEventLoopUiOps *ops = purple_eventloop_get_ui_ops();
 
+	instrumented_forget(instrumented_inputs, tag);
+
 	return ops->input_remove(tag);
 }
 
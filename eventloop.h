@@ -52,6 +52,42 @@ typedef void (*PurpleInputFunction)(gpointer, gint, PurpleInputCondition);
 /** @copydoc _PurpleEventLoopUiOps */
 typedef struct _PurpleEventLoopUiOps PurpleEventLoopUiOps;
 
+/**
+ * The number of buckets in the histogram of a
+ * #PurpleEventLoopCallbackStats.
+ *
+ * @since 2.10.0
+ */
+#define PURPLE_EVENTLOOP_HISTOGRAM_SIZE 6
+
+/**
+ * How long a callback has kept the event loop busy, while the event
+ * loop was instrumented.  All times are in microseconds.
+ *
+ * @see purple_eventloop_set_instrumented()
+ * @since 2.10.0
+ */
+typedef struct
+{
+	gpointer function;   /**< The callback.                              */
+	const char *name;    /**< The callback's symbol name, if known.      */
+	const char *owner;   /**< The id of the plugin the callback is in, or
+	                          the name of the file, if known.            */
+	gboolean input;      /**< Whether it's an input handler, rather than
+	                          a timeout.                                 */
+	guint calls;         /**< How many times it has been called.         */
+	guint slow_calls;    /**< How many of those were over the
+	                          threshold for slow callbacks.              */
+	guint64 total_time;  /**< How long the calls took altogether.        */
+	guint64 max_time;    /**< How long the longest call took.            */
+
+	/**
+	 * How many calls took under 0.1 ms, under 1 ms, under 10 ms, under
+	 * 100 ms, under a second, and longer.
+	 */
+	guint histogram[PURPLE_EVENTLOOP_HISTOGRAM_SIZE];
+} PurpleEventLoopCallbackStats;
+
 /** An abstraction of an application's mainloop; libpurple will use this to
  *  watch file descriptors and schedule timed callbacks.  If your application
  *  uses the glib mainloop, there is an implementation of this struct in
@@ -200,12 +236,67 @@ guint purple_timeout_add_seconds(guint interval, GSourceFunc function, gpointer
 /**
  * Removes a timeout handler.
  *
- * @param handle The handle, as returned by purple_timeout_add().
+ * @param handle The handle, as returned by purple_timeout_add(),
+ *               purple_timeout_wheel_add() or one of their variants.
  *
  * @return @c TRUE if the handler was successfully removed.
  */
 gboolean purple_timeout_remove(guint handle);
 
+/**
+ * Creates a callback timer in libpurple's timer wheel.
+ *
+ * This works like purple_timeout_add(), but rather than each timer being
+ * a timeout of the UI's, all the timers in the wheel share one.  Adding,
+ * removing and restarting them take constant time and don't touch the
+ * UI's event loop, which suits timeouts that are restarted often, such
+ * as one per connection that is pushed back whenever data arrives.
+ *
+ * The wheel must only be used from the thread running the event loop.
+ *
+ * @param interval	The time between calls of the function, in
+ *                      milliseconds.
+ * @param function	The function to call.
+ * @param data		data to pass to @a function.
+ * @return A handle to the timer which can be passed to
+ *         purple_timeout_restart() and purple_timeout_remove().
+ *
+ * @since 2.10.0
+ */
+guint purple_timeout_wheel_add(guint interval, GSourceFunc function, gpointer data);
+
+/**
+ * Creates a callback timer in libpurple's timer wheel, with an interval
+ * in seconds.
+ *
+ * @param interval	The time between calls of the function, in
+ *                      seconds.
+ * @param function	The function to call.
+ * @param data		data to pass to @a function.
+ * @return A handle to the timer which can be passed to
+ *         purple_timeout_restart() and purple_timeout_remove().
+ *
+ * @see purple_timeout_wheel_add()
+ * @since 2.10.0
+ */
+guint purple_timeout_wheel_add_seconds(guint interval, GSourceFunc function, gpointer data);
+
+/**
+ * Restarts a timer in the timer wheel, so that its function is next
+ * called a whole interval from now.  This is much cheaper than removing
+ * the timer and adding another.
+ *
+ * @param handle The handle, as returned by purple_timeout_wheel_add() or
+ *               purple_timeout_wheel_add_seconds().
+ *
+ * @return @c TRUE if the timer was restarted, or @c FALSE if @a handle
+ *         isn't a timer in the wheel (for instance, because it's a
+ *         timeout of the UI's).
+ *
+ * @since 2.10.0
+ */
+gboolean purple_timeout_restart(guint handle);
+
 /**
  * Adds an input handler.
  *
@@ -245,6 +336,120 @@ gboolean purple_input_remove(guint handle);
 int
 purple_input_get_error(int fd, int *error);
 
+/**
+ * Sets whether purple_timeout_add() and purple_timeout_add_seconds()
+ * put their timers in the timer wheel, instead of asking the UI for a
+ * timeout each.  This is off by default, since the wheel can't be used
+ * from other threads, and the UI can't group its timers for power
+ * efficiency.  Timers already added stay where they are.
+ *
+ * @param enabled Whether to use the timer wheel.
+ *
+ * @see purple_timeout_wheel_add()
+ * @since 2.10.0
+ */
+void purple_eventloop_set_timer_wheel(gboolean enabled);
+
+/**
+ * Returns whether purple_timeout_add() and purple_timeout_add_seconds()
+ * put their timers in the timer wheel.
+ *
+ * @return @c TRUE if they use the timer wheel.
+ *
+ * @since 2.10.0
+ */
+gboolean purple_eventloop_get_timer_wheel(void);
+
+/*@}*/
+
+
+/**************************************************************************/
+/** @name Instrumentation API                                             */
+/**************************************************************************/
+/*@{*/
+/**
+ * Sets whether to time the callbacks of timeouts and input handlers, so
+ * that stalls of the event loop can be traced to the callbacks which
+ * caused them.
+ *
+ * Only timeouts and input handlers added while this is on are timed,
+ * along with everything in the timer wheel.  A callback which takes
+ * longer than the threshold set with purple_eventloop_set_slow_threshold()
+ * is logged as it happens, and the busiest callbacks are logged every so
+ * often (see purple_eventloop_set_summary_interval()).
+ *
+ * @param enabled Whether to time callbacks.
+ *
+ * @see purple_eventloop_get_callback_stats()
+ * @since 2.10.0
+ */
+void purple_eventloop_set_instrumented(gboolean enabled);
+
+/**
+ * Returns whether callbacks of timeouts and input handlers are timed.
+ *
+ * @return @c TRUE if they are timed.
+ *
+ * @since 2.10.0
+ */
+gboolean purple_eventloop_get_instrumented(void);
+
+/**
+ * Sets how long a callback can run, while the event loop is
+ * instrumented, before it's logged as slow.  The default is 100 ms.
+ *
+ * @param threshold The time in milliseconds, or @c 0 not to log any.
+ *
+ * @since 2.10.0
+ */
+void purple_eventloop_set_slow_threshold(guint threshold);
+
+/**
+ * Returns how long a callback can run before it's logged as slow.
+ *
+ * @return The time in milliseconds.
+ *
+ * @since 2.10.0
+ */
+guint purple_eventloop_get_slow_threshold(void);
+
+/**
+ * Sets how often the busiest callbacks are logged while the event loop
+ * is instrumented.  The default is every five minutes.
+ *
+ * @param interval The time between summaries in seconds, or @c 0 for
+ *                 none.
+ *
+ * @since 2.10.0
+ */
+void purple_eventloop_set_summary_interval(guint interval);
+
+/**
+ * Returns how often the busiest callbacks are logged.
+ *
+ * @return The time between summaries in seconds.
+ *
+ * @since 2.10.0
+ */
+guint purple_eventloop_get_summary_interval(void);
+
+/**
+ * Returns how long each callback that has been timed has kept the event
+ * loop busy.
+ *
+ * @return A list of #PurpleEventLoopCallbackStats, busiest first.  The
+ *         list should be freed, but not what's in it.
+ *
+ * @since 2.10.0
+ */
+GList *purple_eventloop_get_callback_stats(void);
+
+/**
+ * Starts the times of all the callbacks again from nothing.
+ *
+ * @since 2.10.0
+ */
+void purple_eventloop_reset_callback_stats(void);
 
 /*@}*/
 
@@ -165,6 +165,7 @@
 
 #include "account.h"
 #include "connection.h"
+#include "xmlnode.h"
 
 /* This is for the accounts code to notify the buddy icon code that
  * it's done loading.  We may want to replace this with a signal. */
@@ -226,4 +227,111 @@ void _purple_connection_new_unregister(PurpleAccount *account, const char *passw
  */
 void _purple_connection_destroy(PurpleConnection *gc);
 
+/**
+ * Throws out every presence's cached score, for when something all the
+ * scores depend on changes.
+ *
+ * @note This is for status.c and account.c only.
+ */
+void _purple_presence_invalidate_scores(void);
+
+/**
+ * Updates a contact's priority buddy after the presence of one of its
+ * buddies changed.  Since the other buddies are as they were, only the
+ * changed buddy has to be compared with the current priority buddy.
+ *
+ * @param contact The contact.
+ * @param buddy   The buddy whose presence changed.
+ */
+void _purple_contact_update_priority_buddy(PurpleContact *contact,
+                                           PurpleBuddy *buddy);
+
+/**
+ * Starts reading files from the user directory on threads of their own,
+ * so that they are ready by the time they are asked for.  The XML files
+ * are parsed there too, and purple_util_read_xml_from_file() hands out
+ * the trees; the other files can be had from
+ * _purple_util_take_prefetched_file().
+ *
+ * @note This is for core.c only, and needs threads to be initialized.
+ *
+ * @param files     A NULL-terminated list of files to read, or @c NULL.
+ * @param xml_files A NULL-terminated list of XML files to read and parse,
+ *                  or @c NULL.
+ */
+void _purple_util_prefetch_files(const char * const *files,
+                                 const char * const *xml_files);
+
+/**
+ * Takes the contents of a file started by _purple_util_prefetch_files(),
+ * waiting for it to be read if need be.
+ *
+ * @param filename_full The full path of the file.
+ * @param contents      The contents, which the caller must g_free().
+ * @param length        If not @c NULL, the length of the contents.
+ *
+ * @return @c TRUE if the file was prefetched and could be read, otherwise
+ *         @c FALSE, in which case it should be read as usual.
+ */
+gboolean _purple_util_take_prefetched_file(const char *filename_full,
+                                           gchar **contents, gsize *length);
+
+/**
+ * Gets libxml2 ready to be used from more than one thread.
+ */
+void _purple_xmlnode_init_threads(void);
+
+/**
+ * Parses a string into an xmlnode tree away from the main thread.  The
+ * nodes aren't registered with D-Bus, and errors aren't logged.
+ *
+ * @param str  The string of xml.
+ * @param size The size of the string, or -1 if @a str is NUL-terminated.
+ *
+ * @return The new tree, or @c NULL if it couldn't be parsed.
+ */
+xmlnode *_purple_xmlnode_from_str_in_thread(const char *str, gssize size);
+
+/**
+ * Takes a tree made by _purple_xmlnode_from_str_in_thread() onto the main
+ * thread, after which it is like any other.
+ *
+ * @param node The root of the tree.
+ */
+void _purple_xmlnode_adopt(xmlnode *node);
+
+/**
+ * Frees a tree made by _purple_xmlnode_from_str_in_thread() which was
+ * never adopted.
+ *
+ * @param node The root of the tree.
+ */
+void _purple_xmlnode_free_unadopted(xmlnode *node);
+
+/**
+ * Appends a binary snapshot of an xmlnode tree, which
+ * _purple_xmlnode_from_snapshot() can turn back into the tree without
+ * parsing any XML.
+ *
+ * @param node     The root of the tree.
+ * @param snapshot The string to append the snapshot to.
+ */
+void _purple_xmlnode_to_snapshot(xmlnode *node, GString *snapshot);
+
+/**
+ * Makes an xmlnode tree from a snapshot made by
+ * _purple_xmlnode_to_snapshot().
+ *
+ * @param snapshot  The snapshot, which needn't outlive the tree.
+ * @param size      The size of the snapshot.
+ * @param in_thread Whether this is away from the main thread, in which
+ *                  case the tree has to be adopted with
+ *                  _purple_xmlnode_adopt() like a tree from
+ *                  _purple_xmlnode_from_str_in_thread().
+ *
+ * @return The new tree, or @c NULL if the snapshot isn't a valid one.
+ */
+xmlnode *_purple_xmlnode_from_snapshot(const char *snapshot, gsize size,
+                                       gboolean in_thread);
+
 #endif /* _PURPLE_INTERNAL_H_ */
@@ -0,0 +1,286 @@
+/**
+ * @file outputbatch.c Coalescing of outgoing connection writes
+ * @ingroup core
+ */
+
+/* purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#include "internal.h"
+
+#include "circbuffer.h"
+#include "debug.h"
+#include "eventloop.h"
+#include "outputbatch.h"
+
+struct _PurpleOutputBatch
+{
+	PurpleCircBuffer *buffer;
+
+	int fd;
+	PurpleSslConnection *gsc;
+
+	guint flush_timer;
+	guint watcher;
+
+	PurpleOutputBatchErrorFunc error_cb;
+	PurpleOutputBatchWrittenFunc written_cb;
+	gpointer data;
+
+	gulong writes;
+	gulong syscalls;
+};
+
+static gulong total_writes = 0;
+static gulong total_syscalls = 0;
+
+static int
+batch_get_fd(const PurpleOutputBatch *batch)
+{
+	return batch->gsc ? batch->gsc->fd : batch->fd;
+}
+
+static void
+batch_mark_written(PurpleOutputBatch *batch, gsize len)
+{
+	gsize first = purple_circ_buffer_get_max_read(batch->buffer);
+
+	if (len <= first)
+		purple_circ_buffer_mark_read(batch->buffer, len);
+	else {
+		purple_circ_buffer_mark_read(batch->buffer, first);
+		purple_circ_buffer_mark_read(batch->buffer, len - first);
+	}
+}
+
+static void
+batch_discard(PurpleOutputBatch *batch)
+{
+	gsize pending;
+
+	while ((pending = purple_circ_buffer_get_max_read(batch->buffer)) > 0)
+		purple_circ_buffer_mark_read(batch->buffer, pending);
+}
+
+static gssize
+batch_write_ssl(PurpleOutputBatch *batch)
+{
+	PurpleCircBuffer *buf = batch->buffer;
+	gsize first = purple_circ_buffer_get_max_read(buf);
+	gssize ret;
+
+	if (first == buf->bufused) {
+		ret = purple_ssl_write(batch->gsc, buf->outptr, first);
+	} else {
+		/* Linearize the wrapped data so it goes out as one record */
+		gchar *tmp = g_malloc(buf->bufused);
+		memcpy(tmp, buf->outptr, first);
+		memcpy(tmp + first, buf->buffer, buf->bufused - first);
+		ret = purple_ssl_write(batch->gsc, tmp, buf->bufused);
+		g_free(tmp);
+	}
+
+	if (ret > 0)
+		batch_mark_written(batch, ret);
+
+	return ret;
+}
+
+static void
+batch_writable_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	purple_output_batch_flush(data);
+}
+
+static gboolean
+batch_flush_cb(gpointer data)
+{
+	PurpleOutputBatch *batch = data;
+
+	batch->flush_timer = 0;
+	purple_output_batch_flush(batch);
+
+	return FALSE;
+}
+
+PurpleOutputBatch *
+purple_output_batch_new(PurpleOutputBatchErrorFunc error_cb, gpointer data)
+{
+	PurpleOutputBatch *batch = g_new0(PurpleOutputBatch, 1);
+
+	batch->buffer = purple_circ_buffer_new(512);
+	batch->fd = -1;
+	batch->error_cb = error_cb;
+	batch->data = data;
+
+	return batch;
+}
+
+void
+purple_output_batch_destroy(PurpleOutputBatch *batch)
+{
+	g_return_if_fail(batch != NULL);
+
+	if (batch->writes > 0)
+		purple_debug_misc("outputbatch",
+				"%lu writes sent in %lu system calls\n",
+				batch->writes, batch->syscalls);
+
+	if (batch->flush_timer)
+		purple_timeout_remove(batch->flush_timer);
+	if (batch->watcher)
+		purple_input_remove(batch->watcher);
+
+	purple_circ_buffer_destroy(batch->buffer);
+	g_free(batch);
+}
+
+void
+purple_output_batch_set_written_cb(PurpleOutputBatch *batch,
+		PurpleOutputBatchWrittenFunc written_cb)
+{
+	g_return_if_fail(batch != NULL);
+
+	batch->written_cb = written_cb;
+}
+
+void
+purple_output_batch_set_transport(PurpleOutputBatch *batch, int fd,
+		PurpleSslConnection *gsc)
+{
+	g_return_if_fail(batch != NULL);
+
+	/* Data queued before there was any transport at all is meant for
+	 * the first one, so only flush and drop it when switching away
+	 * from a live connection. */
+	if (batch->buffer->bufused > 0 && batch_get_fd(batch) >= 0) {
+		purple_output_batch_flush(batch);
+		if (batch->buffer->bufused > 0) {
+			purple_debug_warning("outputbatch",
+					"Discarding %" G_GSIZE_FORMAT " unsent bytes on "
+					"transport change\n", batch->buffer->bufused);
+			batch_discard(batch);
+		}
+	}
+
+	if (batch->flush_timer) {
+		purple_timeout_remove(batch->flush_timer);
+		batch->flush_timer = 0;
+	}
+	if (batch->watcher) {
+		purple_input_remove(batch->watcher);
+		batch->watcher = 0;
+	}
+
+	batch->fd = fd;
+	batch->gsc = gsc;
+
+	if (batch->buffer->bufused > 0 && batch_get_fd(batch) >= 0)
+		batch->flush_timer = purple_timeout_add(0, batch_flush_cb, batch);
+}
+
+void
+purple_output_batch_write(PurpleOutputBatch *batch, gconstpointer data,
+		gsize len)
+{
+	g_return_if_fail(batch != NULL);
+
+	if (len == 0)
+		return;
+
+	purple_circ_buffer_append(batch->buffer, data, len);
+	batch->writes++;
+	total_writes++;
+
+	/* If we're already waiting for the socket to become writable, the
+	 * data goes out with everything else queued at that point. */
+	if (batch->watcher == 0 && batch->flush_timer == 0)
+		batch->flush_timer = purple_timeout_add(0, batch_flush_cb, batch);
+}
+
+gboolean
+purple_output_batch_flush(PurpleOutputBatch *batch)
+{
+	gssize ret;
+
+	g_return_val_if_fail(batch != NULL, FALSE);
+
+	if (batch->flush_timer) {
+		purple_timeout_remove(batch->flush_timer);
+		batch->flush_timer = 0;
+	}
+
+	if (batch->buffer->bufused > 0 && batch_get_fd(batch) >= 0) {
+		if (batch->gsc)
+			ret = batch_write_ssl(batch);
+		else
+			ret = purple_circ_buffer_writev(batch->buffer, batch->fd);
+
+		batch->syscalls++;
+		total_syscalls++;
+
+		if (ret <= 0 && !(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+			int error = (ret == 0) ? EPIPE : errno;
+
+			if (batch->watcher) {
+				purple_input_remove(batch->watcher);
+				batch->watcher = 0;
+			}
+			batch_discard(batch);
+
+			if (batch->error_cb)
+				batch->error_cb(batch, error, batch->data);
+
+			return FALSE;
+		}
+
+		if (ret > 0 && batch->written_cb)
+			batch->written_cb(batch, ret, batch->data);
+	}
+
+	if (batch->buffer->bufused > 0) {
+		if (batch->watcher == 0 && batch_get_fd(batch) >= 0)
+			batch->watcher = purple_input_add(batch_get_fd(batch),
+					PURPLE_INPUT_WRITE, batch_writable_cb, batch);
+	} else if (batch->watcher) {
+		purple_input_remove(batch->watcher);
+		batch->watcher = 0;
+	}
+
+	return TRUE;
+}
+
+gsize
+purple_output_batch_get_pending(const PurpleOutputBatch *batch)
+{
+	g_return_val_if_fail(batch != NULL, 0);
+
+	return batch->buffer->bufused;
+}
+
+void
+purple_output_batch_get_stats(const PurpleOutputBatch *batch,
+		gulong *writes, gulong *syscalls)
+{
+	if (writes)
+		*writes = batch ? batch->writes : total_writes;
+	if (syscalls)
+		*syscalls = batch ? batch->syscalls : total_syscalls;
+}
@@ -0,0 +1,174 @@
+/**
+ * @file outputbatch.h Coalescing of outgoing connection writes
+ * @ingroup core
+ */
+
+/* purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#ifndef _PURPLE_OUTPUTBATCH_H_
+#define _PURPLE_OUTPUTBATCH_H_
+
+#include <glib.h>
+
+#include "sslconn.h"
+
+/**
+ * An output batch collects everything a protocol writes to its
+ * connection during one pass of the event loop, and sends it all at
+ * once when control returns to the loop: with a single writev() on a
+ * plain socket, or as a single record on an SSL connection.  Data that
+ * can't be written immediately stays queued until the socket becomes
+ * writable again.
+ */
+typedef struct _PurpleOutputBatch PurpleOutputBatch;
+
+/**
+ * Called when writing to the connection fails.  Any data that was still
+ * queued is discarded before this is called.
+ *
+ * @param batch The output batch.
+ * @param error The errno value of the failed write.
+ * @param data  The user data passed to purple_output_batch_new().
+ */
+typedef void (*PurpleOutputBatchErrorFunc)(PurpleOutputBatch *batch,
+		int error, gpointer data);
+
+/**
+ * Called when some of the queued data has been written.
+ *
+ * @param batch The output batch.
+ * @param len   How many bytes were written.
+ * @param data  The user data passed to purple_output_batch_new().
+ */
+typedef void (*PurpleOutputBatchWrittenFunc)(PurpleOutputBatch *batch,
+		gsize len, gpointer data);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates a new output batch with no transport set.
+ *
+ * @param error_cb The function to call when a write fails.
+ * @param data     User data to pass to @a error_cb.
+ *
+ * @return The new output batch.
+ *
+ * @since 2.10.0
+ */
+PurpleOutputBatch *purple_output_batch_new(PurpleOutputBatchErrorFunc error_cb,
+		gpointer data);
+
+/**
+ * Destroys an output batch.  Any data that is still queued is discarded;
+ * call purple_output_batch_flush() first to try to send it.
+ *
+ * @param batch The output batch.
+ *
+ * @since 2.10.0
+ */
+void purple_output_batch_destroy(PurpleOutputBatch *batch);
+
+/**
+ * Sets a function to call whenever queued data is written, for example
+ * to keep an idle timeout from firing while data is still going out.
+ *
+ * @param batch      The output batch.
+ * @param written_cb The function to call, or NULL.
+ *
+ * @since 2.10.0
+ */
+void purple_output_batch_set_written_cb(PurpleOutputBatch *batch,
+		PurpleOutputBatchWrittenFunc written_cb);
+
+/**
+ * Sets the connection that queued data is written to.  Whatever is still
+ * queued for the previous transport is flushed to it first, and anything
+ * that can't be written is discarded, so data never crosses from one
+ * transport to another (for example when a stream switches to TLS).
+ *
+ * @param batch The output batch.
+ * @param fd    The file descriptor to write to, or -1.  Ignored when
+ *              @a gsc is non-NULL.
+ * @param gsc   The SSL connection to write to, or NULL.
+ *
+ * @since 2.10.0
+ */
+void purple_output_batch_set_transport(PurpleOutputBatch *batch, int fd,
+		PurpleSslConnection *gsc);
+
+/**
+ * Queues data to be written.  The data is copied, and sent the next time
+ * the event loop is idle.
+ *
+ * @param batch The output batch.
+ * @param data  The data to write.
+ * @param len   The length of @a data.
+ *
+ * @since 2.10.0
+ */
+void purple_output_batch_write(PurpleOutputBatch *batch, gconstpointer data,
+		gsize len);
+
+/**
+ * Writes as much of the queued data as possible right away, instead of
+ * waiting for the event loop.  This is useful right before closing the
+ * connection.
+ *
+ * @param batch The output batch.
+ *
+ * @return FALSE if the write failed, TRUE otherwise.
+ *
+ * @since 2.10.0
+ */
+gboolean purple_output_batch_flush(PurpleOutputBatch *batch);
+
+/**
+ * Returns the number of bytes queued but not yet written.
+ *
+ * @param batch The output batch.
+ *
+ * @return The number of pending bytes.
+ *
+ * @since 2.10.0
+ */
+gsize purple_output_batch_get_pending(const PurpleOutputBatch *batch);
+
+/**
+ * Retrieves the write counters of an output batch, or the totals over all
+ * output batches.  The difference between the two values is the number of
+ * write system calls saved by batching.
+ *
+ * @param batch    The output batch, or NULL for the totals.
+ * @param writes   Return location for the number of writes queued.
+ * @param syscalls Return location for the number of system calls made.
+ *
+ * @since 2.10.0
+ */
+void purple_output_batch_get_stats(const PurpleOutputBatch *batch,
+		gulong *writes, gulong *syscalls);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PURPLE_OUTPUTBATCH_H_ */
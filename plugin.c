@@ -27,6 +27,7 @@
 #include "core.h"
 #include "dbus-maybe.h"
 #include "debug.h"
+#include "eventloop.h"
 #include "notify.h"
 #include "prefs.h"
 #include "prpl.h"
@@ -35,6 +36,7 @@
 #include "util.h"
 #include "valgrind.h"
 #include "version.h"
+#include "xmlnode.h"
 
 typedef struct
 {
@@ -62,6 +64,10 @@ static GList *protocol_plugins = NULL;
 static GList *load_queue       = NULL;
 static GList *plugin_loaders   = NULL;
 static GList *plugins_to_disable = NULL;
+
+static GHashTable *plugin_cache   = NULL;
+static GHashTable *cached_plugins = NULL;
+static guint plugin_cache_save_timer = 0;
 #endif
 
 static void (*probe_cb)(void *) = NULL;
@@ -197,50 +203,18 @@ purple_plugin_new(gboolean native, const char *path)
 	return plugin;
 }
 
-PurplePlugin *
-purple_plugin_probe(const char *filename)
-{
 #ifdef PURPLE_PLUGINS
-	PurplePlugin *plugin = NULL;
+/*
+ * Opens a plugin and reads its info.  This returns FALSE if the file
+ * isn't a plugin at all; one that can't be loaded is marked unloadable.
+ */
+static gboolean
+purple_plugin_probe_module(PurplePlugin *plugin)
+{
 	PurplePlugin *loader;
 	gpointer unpunned;
-	gchar *basename = NULL;
 	gboolean (*purple_init_plugin)(PurplePlugin *);
 
-	purple_debug_misc("plugins", "probing %s\n", filename);
-	g_return_val_if_fail(filename != NULL, NULL);
-
-	if (!g_file_test(filename, G_FILE_TEST_EXISTS))
-		return NULL;
-
-	/* If this plugin has already been probed then exit */
-	basename = purple_plugin_get_basename(filename);
-	plugin = purple_plugins_find_with_basename(basename);
-	g_free(basename);
-	if (plugin != NULL)
-	{
-		if (purple_strequal(filename, plugin->path))
-			return plugin;
-		else if (!purple_plugin_is_unloadable(plugin))
-		{
-			purple_debug_warning("plugins", "Not loading %s. "
-							"Another plugin with the same name (%s) has already been loaded.\n",
-							filename, plugin->path);
-			return plugin;
-		}
-		else
-		{
-			/* The old plugin was a different file and it was unloadable.
-			 * There's no guarantee that this new file with the same name
-			 * will be loadable, but unless it fails in one of the silent
-			 * ways and the first one didn't, it's not any worse.  The user
-			 * will still see a greyed-out plugin, which is what we want. */
-			purple_plugin_destroy(plugin);
-		}
-	}
-
-	plugin = purple_plugin_new(has_file_extension(filename, G_MODULE_SUFFIX), filename);
-
 	if (plugin->native_plugin) {
 		const char *error;
 #ifdef _WIN32
@@ -254,14 +228,14 @@ purple_plugin_probe(const char *filename)
 		 *
 		 * G_MODULE_BIND_LOCAL was added in glib 2.3.3.
 		 */
-		plugin->handle = g_module_open(filename, G_MODULE_BIND_LOCAL);
+		plugin->handle = g_module_open(plugin->path, G_MODULE_BIND_LOCAL);
 
 		if (plugin->handle == NULL)
 		{
 			const char *error = g_module_error();
-			if (error != NULL && purple_str_has_prefix(error, filename))
+			if (error != NULL && purple_str_has_prefix(error, plugin->path))
 			{
-				error = error + strlen(filename);
+				error = error + strlen(plugin->path);
 
 				/* These are just so we don't crash.  If we
 				 * got this far, they should always be true. */
@@ -283,7 +257,7 @@ purple_plugin_probe(const char *filename)
 				purple_debug_error("plugins", "%s is not loadable: %s\n",
 						 plugin->path, plugin->error);
 			}
-			plugin->handle = g_module_open(filename, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+			plugin->handle = g_module_open(plugin->path, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
 
 			if (plugin->handle == NULL)
 			{
@@ -291,8 +265,7 @@ purple_plugin_probe(const char *filename)
 				/* Restore the original error mode */
 				SetErrorMode(old_error_mode);
 #endif
-				purple_plugin_destroy(plugin);
-				return NULL;
+				return FALSE;
 			}
 			else
 			{
@@ -323,8 +296,7 @@ purple_plugin_probe(const char *filename)
 			/* Restore the original error mode */
 			SetErrorMode(old_error_mode);
 #endif
-			purple_plugin_destroy(plugin);
-			return NULL;
+			return FALSE;
 		}
 		purple_init_plugin = unpunned;
 
@@ -337,8 +309,7 @@ purple_plugin_probe(const char *filename)
 		loader = find_loader_for_plugin(plugin);
 
 		if (loader == NULL) {
-			purple_plugin_destroy(plugin);
-			return NULL;
+			return FALSE;
 		}
 
 		purple_init_plugin = PURPLE_PLUGIN_LOADER_INFO(loader)->probe;
@@ -346,8 +317,7 @@ purple_plugin_probe(const char *filename)
 
 	if (!purple_init_plugin(plugin) || plugin->info == NULL)
 	{
-		purple_plugin_destroy(plugin);
-		return NULL;
+		return FALSE;
 	}
 	else if (plugin->info->ui_requirement &&
 			!purple_strequal(plugin->info->ui_requirement, purple_core_get_ui()))
@@ -356,7 +326,7 @@ purple_plugin_probe(const char *filename)
 					purple_core_get_ui(), plugin->info->ui_requirement);
 		purple_debug_error("plugins", "%s is not loadable: The UI requirement is not met. (%s)\n", plugin->path, plugin->error);
 		plugin->unloadable = TRUE;
-		return plugin;
+		return TRUE;
 	}
 
 	/*
@@ -370,7 +340,7 @@ purple_plugin_probe(const char *filename)
 		plugin->error = g_strdup(_("This plugin has not defined an ID."));
 		purple_debug_error("plugins", "%s is not loadable: info->id is not defined.\n", plugin->path);
 		plugin->unloadable = TRUE;
-		return plugin;
+		return TRUE;
 	}
 
 	/* Really old plugins. */
@@ -440,13 +410,12 @@ purple_plugin_probe(const char *filename)
 			purple_debug_error("plugins", "%s is not loadable: Plugin magic mismatch %d (need %d)\n",
 					  plugin->path, plugin->info->magic, PURPLE_PLUGIN_MAGIC);
 			plugin->unloadable = TRUE;
-			return plugin;
+			return TRUE;
 		}
 
 		purple_debug_error("plugins", "%s is not loadable: Plugin magic mismatch %d (need %d)\n",
 				 plugin->path, plugin->info->magic, PURPLE_PLUGIN_MAGIC);
-		purple_plugin_destroy(plugin);
-		return NULL;
+		return FALSE;
 	}
 
 	if (plugin->info->major_version != PURPLE_MAJOR_VERSION ||
@@ -459,7 +428,7 @@ purple_plugin_probe(const char *filename)
 				 plugin->path, plugin->info->major_version, plugin->info->minor_version,
 				 PURPLE_MAJOR_VERSION, PURPLE_MINOR_VERSION);
 		plugin->unloadable = TRUE;
-		return plugin;
+		return TRUE;
 	}
 
 	if (plugin->info->type == PURPLE_PLUGIN_PROTOCOL)
@@ -473,7 +442,7 @@ purple_plugin_probe(const char *filename)
 			purple_debug_error("plugins", "%s is not loadable: %s\n",
 					 plugin->path, plugin->error);
 			plugin->unloadable = TRUE;
-			return plugin;
+			return TRUE;
 		}
 
 		/* For debugging, let's warn about prpl prefs. */
@@ -484,6 +453,475 @@ purple_plugin_probe(const char *filename)
 		}
 	}
 
+	return TRUE;
+}
+/**************************************************************************
+ * Probe cache
+ **************************************************************************/
+
+/*
+ * The info of the standard plugins we've probed is kept in plugin-cache.xml,
+ * keyed by path and checked against the file's mtime and size.  Plugins that
+ * haven't changed are listed from it without being opened, and only probed
+ * for real when something loads them.
+ */
+typedef struct
+{
+	time_t mtime;
+	gint64 size;
+	gboolean seen;
+	PurplePluginInfo *info;
+
+} PurplePluginCacheEntry;
+
+static PurplePluginInfo *
+plugin_info_copy(const PurplePluginInfo *info)
+{
+	PurplePluginInfo *copy;
+	GList *l;
+
+	copy = g_new0(PurplePluginInfo, 1);
+	copy->magic          = PURPLE_PLUGIN_MAGIC;
+	copy->major_version  = info->major_version;
+	copy->minor_version  = info->minor_version;
+	copy->type           = info->type;
+	copy->ui_requirement = g_strdup(info->ui_requirement);
+	copy->flags          = info->flags;
+	copy->priority       = info->priority;
+	copy->id             = g_strdup(info->id);
+	copy->name           = g_strdup(info->name);
+	copy->version        = g_strdup(info->version);
+	copy->summary        = g_strdup(info->summary);
+	copy->description    = g_strdup(info->description);
+	copy->author         = g_strdup(info->author);
+	copy->homepage       = g_strdup(info->homepage);
+
+	for (l = info->dependencies; l != NULL; l = l->next)
+		copy->dependencies = g_list_append(copy->dependencies, g_strdup(l->data));
+
+	return copy;
+}
+
+static void
+plugin_info_free(PurplePluginInfo *info)
+{
+	g_free(info->ui_requirement);
+	g_free(info->id);
+	g_free(info->name);
+	g_free(info->version);
+	g_free(info->summary);
+	g_free(info->description);
+	g_free(info->author);
+	g_free(info->homepage);
+
+	while (info->dependencies != NULL) {
+		g_free(info->dependencies->data);
+		info->dependencies = g_list_delete_link(info->dependencies,
+				info->dependencies);
+	}
+
+	g_free(info);
+}
+
+static void
+plugin_cache_entry_free(PurplePluginCacheEntry *entry)
+{
+	plugin_info_free(entry->info);
+	g_free(entry);
+}
+
+static xmlnode *
+plugin_cache_entry_to_xmlnode(const char *path, PurplePluginCacheEntry *entry)
+{
+	const PurplePluginInfo *info = entry->info;
+	const char *fields[] = {
+		"ui-requirement", info->ui_requirement,
+		"id",             info->id,
+		"name",           info->name,
+		"version",        info->version,
+		"summary",        info->summary,
+		"description",    info->description,
+		"author",         info->author,
+		"homepage",       info->homepage
+	};
+	xmlnode *node, *child;
+	char *tmp;
+	GList *l;
+	int i;
+
+	node = xmlnode_new("plugin");
+	xmlnode_set_attrib(node, "path", path);
+
+	tmp = g_strdup_printf("%" G_GINT64_FORMAT, (gint64)entry->mtime);
+	xmlnode_set_attrib(node, "mtime", tmp);
+	g_free(tmp);
+	tmp = g_strdup_printf("%" G_GINT64_FORMAT, entry->size);
+	xmlnode_set_attrib(node, "size", tmp);
+	g_free(tmp);
+	tmp = g_strdup_printf("%u.%u", info->major_version, info->minor_version);
+	xmlnode_set_attrib(node, "abi", tmp);
+	g_free(tmp);
+	tmp = g_strdup_printf("%d", info->type);
+	xmlnode_set_attrib(node, "type", tmp);
+	g_free(tmp);
+	tmp = g_strdup_printf("%lu", info->flags);
+	xmlnode_set_attrib(node, "flags", tmp);
+	g_free(tmp);
+	tmp = g_strdup_printf("%d", info->priority);
+	xmlnode_set_attrib(node, "priority", tmp);
+	g_free(tmp);
+
+	for (i = 0; i < G_N_ELEMENTS(fields); i += 2)
+	{
+		if (fields[i + 1] == NULL)
+			continue;
+
+		child = xmlnode_new_child(node, fields[i]);
+		xmlnode_insert_data(child, fields[i + 1], -1);
+	}
+
+	for (l = info->dependencies; l != NULL; l = l->next)
+	{
+		child = xmlnode_new_child(node, "dependency");
+		xmlnode_insert_data(child, l->data, -1);
+	}
+
+	return node;
+}
+
+static char *
+plugin_cache_get_child_data(xmlnode *node, const char *name)
+{
+	xmlnode *child = xmlnode_get_child(node, name);
+
+	return child != NULL ? xmlnode_get_data(child) : NULL;
+}
+
+static long
+plugin_cache_get_number_attrib(xmlnode *node, const char *attr)
+{
+	const char *value = xmlnode_get_attrib(node, attr);
+
+	return value != NULL ? strtol(value, NULL, 10) : 0;
+}
+
+static PurplePluginCacheEntry *
+plugin_cache_entry_from_xmlnode(xmlnode *node)
+{
+	PurplePluginCacheEntry *entry;
+	PurplePluginInfo *info;
+	const char *abi;
+	xmlnode *child;
+
+	info = g_new0(PurplePluginInfo, 1);
+	info->magic = PURPLE_PLUGIN_MAGIC;
+	abi = xmlnode_get_attrib(node, "abi");
+	if (abi == NULL ||
+		sscanf(abi, "%u.%u", &info->major_version, &info->minor_version) != 2)
+	{
+		info->major_version = PURPLE_MAJOR_VERSION;
+		info->minor_version = PURPLE_MINOR_VERSION;
+	}
+	info->type     = plugin_cache_get_number_attrib(node, "type");
+	info->flags    = plugin_cache_get_number_attrib(node, "flags");
+	info->priority = plugin_cache_get_number_attrib(node, "priority");
+
+	info->ui_requirement = plugin_cache_get_child_data(node, "ui-requirement");
+	info->id             = plugin_cache_get_child_data(node, "id");
+	info->name           = plugin_cache_get_child_data(node, "name");
+	info->version        = plugin_cache_get_child_data(node, "version");
+	info->summary        = plugin_cache_get_child_data(node, "summary");
+	info->description    = plugin_cache_get_child_data(node, "description");
+	info->author         = plugin_cache_get_child_data(node, "author");
+	info->homepage       = plugin_cache_get_child_data(node, "homepage");
+
+	for (child = xmlnode_get_child(node, "dependency"); child != NULL;
+			child = xmlnode_get_next_twin(child))
+	{
+		char *dep = xmlnode_get_data(child);
+
+		if (dep != NULL)
+			info->dependencies = g_list_append(info->dependencies, dep);
+	}
+
+	entry = g_new0(PurplePluginCacheEntry, 1);
+	entry->mtime = g_ascii_strtoll(xmlnode_get_attrib(node, "mtime"), NULL, 10);
+	entry->size = g_ascii_strtoll(xmlnode_get_attrib(node, "size"), NULL, 10);
+	entry->info = info;
+
+	return entry;
+}
+
+static void
+plugin_cache_load(void)
+{
+	xmlnode *root, *node;
+
+	plugin_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)plugin_cache_entry_free);
+	cached_plugins = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	root = purple_util_read_xml_from_file("plugin-cache.xml", _("plugin cache"));
+	if (root == NULL)
+		return;
+
+	/* Everything is probed again when libpurple or the UI changes */
+	if (!purple_strequal(xmlnode_get_attrib(root, "version"), "1.0") ||
+		!purple_strequal(xmlnode_get_attrib(root, "purple"), purple_core_get_version()) ||
+		!purple_strequal(xmlnode_get_attrib(root, "ui"), purple_core_get_ui()))
+	{
+		purple_debug_info("plugins", "Ignoring the plugin cache from another "
+				"version of libpurple or another UI\n");
+		xmlnode_free(root);
+		return;
+	}
+
+	for (node = xmlnode_get_child(root, "plugin"); node != NULL;
+			node = xmlnode_get_next_twin(node))
+	{
+		const char *path = xmlnode_get_attrib(node, "path");
+		PurplePluginCacheEntry *entry;
+
+		if (path == NULL || xmlnode_get_attrib(node, "mtime") == NULL ||
+			xmlnode_get_attrib(node, "size") == NULL)
+			continue;
+
+		entry = plugin_cache_entry_from_xmlnode(node);
+		if (entry->info->id == NULL || entry->info->name == NULL)
+		{
+			plugin_cache_entry_free(entry);
+			continue;
+		}
+
+		g_hash_table_replace(plugin_cache, g_strdup(path), entry);
+	}
+
+	xmlnode_free(root);
+}
+
+static void
+sync_plugin_cache(void)
+{
+	xmlnode *root;
+	GHashTableIter iter;
+	const char *path;
+	PurplePluginCacheEntry *entry;
+	char *data;
+
+	root = xmlnode_new("plugin-cache");
+	xmlnode_set_attrib(root, "version", "1.0");
+	xmlnode_set_attrib(root, "purple", purple_core_get_version());
+	if (purple_core_get_ui() != NULL)
+		xmlnode_set_attrib(root, "ui", purple_core_get_ui());
+
+	/* Anything we didn't come across this time has gone away */
+	g_hash_table_iter_init(&iter, plugin_cache);
+	while (g_hash_table_iter_next(&iter, (gpointer *)&path, (gpointer *)&entry))
+		if (entry->seen)
+			xmlnode_insert_child(root, plugin_cache_entry_to_xmlnode(path, entry));
+
+	data = xmlnode_to_formatted_str(root, NULL);
+	purple_util_write_data_to_file("plugin-cache.xml", data, -1);
+	g_free(data);
+	xmlnode_free(root);
+}
+
+static gboolean
+plugin_cache_save_cb(gpointer data)
+{
+	sync_plugin_cache();
+	plugin_cache_save_timer = 0;
+	return FALSE;
+}
+
+static void
+schedule_plugin_cache_save(void)
+{
+	if (plugin_cache_save_timer == 0)
+		plugin_cache_save_timer = purple_timeout_add_seconds(5, plugin_cache_save_cb, NULL);
+}
+
+static PurplePluginCacheEntry *
+plugin_cache_lookup(const char *filename, const struct stat *st)
+{
+	PurplePluginCacheEntry *entry;
+
+	entry = g_hash_table_lookup(plugin_cache, filename);
+	if (entry == NULL)
+		return NULL;
+
+	entry->seen = TRUE;
+
+	if (entry->mtime != st->st_mtime || entry->size != st->st_size)
+		return NULL;
+
+	return entry;
+}
+
+/* Remembers what probing a plugin found, if it's worth remembering */
+static void
+plugin_cache_store(PurplePlugin *plugin, const struct stat *st)
+{
+	PurplePluginCacheEntry *entry;
+
+	/*
+	 * Loaders and prpls are loaded as soon as they're probed, so there's
+	 * nothing to save on them.
+	 */
+	if (plugin->unloadable || plugin->error != NULL ||
+		plugin->info->type != PURPLE_PLUGIN_STANDARD)
+	{
+		if (g_hash_table_remove(plugin_cache, plugin->path))
+			schedule_plugin_cache_save();
+		return;
+	}
+
+	entry = g_new0(PurplePluginCacheEntry, 1);
+	entry->mtime = st->st_mtime;
+	entry->size = st->st_size;
+	entry->seen = TRUE;
+	entry->info = plugin_info_copy(plugin->info);
+
+	g_hash_table_replace(plugin_cache, g_strdup(plugin->path), entry);
+	schedule_plugin_cache_save();
+}
+
+/* Lists a plugin from its cache entry without opening it */
+static PurplePlugin *
+purple_plugin_new_from_cache(const char *filename, PurplePluginCacheEntry *entry)
+{
+	PurplePlugin *plugin;
+	gboolean native;
+	GList *l;
+
+	native = has_file_extension(filename, G_MODULE_SUFFIX);
+
+	/* A script can't be loaded later without its loader */
+	if (!native)
+	{
+		for (l = plugin_loaders; l != NULL; l = l->next)
+			if (loader_supports_file(l->data, filename))
+				break;
+
+		if (l == NULL)
+			return NULL;
+	}
+
+	plugin = purple_plugin_new(native, filename);
+	plugin->info = plugin_info_copy(entry->info);
+
+	g_hash_table_insert(cached_plugins, plugin, plugin);
+	plugins = g_list_append(plugins, plugin);
+
+	return plugin;
+}
+
+/*
+ * Probes a plugin that was listed from the cache, now that it's needed.
+ * This is done in place, since the UI already has the plugin.
+ */
+static gboolean
+purple_plugin_probe_cached(PurplePlugin *plugin)
+{
+	PurplePluginInfo *cached_info;
+	struct stat st;
+
+	if (cached_plugins == NULL || !g_hash_table_remove(cached_plugins, plugin))
+		return TRUE;
+
+	purple_debug_misc("plugins", "probing cached plugin %s\n", plugin->path);
+
+	cached_info = plugin->info;
+	plugin->info = NULL;
+
+	if (g_stat(plugin->path, &st) != 0 || !purple_plugin_probe_module(plugin))
+	{
+		if (plugin->handle != NULL)
+		{
+			g_module_close(plugin->handle);
+			plugin->handle = NULL;
+		}
+
+		/* Keep listing it, but greyed out */
+		plugin->info = cached_info;
+		plugin->unloadable = TRUE;
+		if (plugin->error == NULL)
+			plugin->error = g_strdup(_("Unknown error"));
+		g_hash_table_insert(cached_plugins, plugin, plugin);
+
+		if (g_hash_table_remove(plugin_cache, plugin->path))
+			schedule_plugin_cache_save();
+
+		return FALSE;
+	}
+
+	plugin_info_free(cached_info);
+	plugin_cache_store(plugin, &st);
+
+	return !plugin->unloadable;
+}
+#endif /* PURPLE_PLUGINS */
+
+PurplePlugin *
+purple_plugin_probe(const char *filename)
+{
+#ifdef PURPLE_PLUGINS
+	PurplePlugin *plugin = NULL;
+	PurplePluginCacheEntry *entry;
+	gchar *basename = NULL;
+	struct stat st;
+
+	purple_debug_misc("plugins", "probing %s\n", filename);
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	if (g_stat(filename, &st) != 0)
+		return NULL;
+
+	/* If this plugin has already been probed then exit */
+	basename = purple_plugin_get_basename(filename);
+	plugin = purple_plugins_find_with_basename(basename);
+	g_free(basename);
+	if (plugin != NULL)
+	{
+		if (purple_strequal(filename, plugin->path))
+			return plugin;
+		else if (!purple_plugin_is_unloadable(plugin))
+		{
+			purple_debug_warning("plugins", "Not loading %s. "
+							"Another plugin with the same name (%s) has already been loaded.\n",
+							filename, plugin->path);
+			return plugin;
+		}
+		else
+		{
+			/* The old plugin was a different file and it was unloadable.
+			 * There's no guarantee that this new file with the same name
+			 * will be loadable, but unless it fails in one of the silent
+			 * ways and the first one didn't, it's not any worse.  The user
+			 * will still see a greyed-out plugin, which is what we want. */
+			purple_plugin_destroy(plugin);
+		}
+	}
+
+	if (plugin_cache == NULL)
+		plugin_cache_load();
+
+	if ((entry = plugin_cache_lookup(filename, &st)) != NULL &&
+		(plugin = purple_plugin_new_from_cache(filename, entry)) != NULL)
+	{
+		return plugin;
+	}
+
+	plugin = purple_plugin_new(has_file_extension(filename, G_MODULE_SUFFIX), filename);
+
+	if (!purple_plugin_probe_module(plugin))
+	{
+		purple_plugin_destroy(plugin);
+		return NULL;
+	}
+
+	plugin_cache_store(plugin, &st);
+
 	return plugin;
 #else
 	return NULL;
@@ -516,6 +954,10 @@ purple_plugin_load(PurplePlugin *plugin)
 	if (purple_plugin_is_unloadable(plugin))
 		return FALSE;
 
+	/* A plugin listed from the probe cache hasn't been opened yet */
+	if (!purple_plugin_probe_cached(plugin))
+		return FALSE;
+
 	g_return_val_if_fail(plugin->error == NULL, FALSE);
 
 	/*
@@ -791,6 +1233,21 @@ purple_plugin_destroy(PurplePlugin *plugin)
 #ifdef PURPLE_PLUGINS
 	g_return_if_fail(plugin != NULL);
 
+	/* Plugins listed from the probe cache were never opened */
+	if (cached_plugins != NULL && g_hash_table_remove(cached_plugins, plugin))
+	{
+		plugins = g_list_remove(plugins, plugin);
+		plugin_info_free(plugin->info);
+
+		g_free(plugin->path);
+		g_free(plugin->error);
+
+		PURPLE_DBUS_UNREGISTER_POINTER(plugin);
+
+		g_free(plugin);
+		return;
+	}
+
 	if (purple_plugin_is_loaded(plugin))
 		purple_plugin_unload(plugin);
 
@@ -1205,6 +1662,22 @@ purple_plugins_uninit(void)
 		g_free(search_paths->data);
 		search_paths = g_list_delete_link(search_paths, search_paths);
 	}
+
+#ifdef PURPLE_PLUGINS
+	if (plugin_cache_save_timer != 0)
+	{
+		purple_timeout_remove(plugin_cache_save_timer);
+		plugin_cache_save_cb(NULL);
+	}
+
+	if (plugin_cache != NULL)
+	{
+		g_hash_table_destroy(plugin_cache);
+		plugin_cache = NULL;
+		g_hash_table_destroy(cached_plugins);
+		cached_plugins = NULL;
+	}
+#endif /* PURPLE_PLUGINS */
 }
 
 /**************************************************************************
@@ -262,6 +262,12 @@ PurplePlugin *purple_plugin_new(gboolean native, const char *path);
  * Probes a plugin, retrieving the information on it and adding it to the
  * list of available plugins.
  *
+ * Standard plugins that were probed before and haven't changed since
+ * (going by the file's modification time and size) are listed from the
+ * probe cache in the user's directory instead.  Their info then only has
+ * the descriptive fields and dependencies filled in, and they aren't
+ * opened until purple_plugin_load() is called on them.
+ *
  * @param filename The plugin's filename.
  *
  * @return The plugin handle.
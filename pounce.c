@@ -566,7 +566,8 @@ purple_pounces_load(void)
 		return FALSE;
 	}
 
-	if (!g_file_get_contents(filename, &contents, &length, &error)) {
+	if (!_purple_util_take_prefetched_file(filename, &contents, &length) &&
+			!g_file_get_contents(filename, &contents, &length, &error)) {
 		purple_debug(PURPLE_DEBUG_ERROR, "pounce",
 				   "Error reading pounces: %s\n", error->message);
 
@@ -1441,6 +1441,9 @@ purple_prefs_init(void)
 	purple_prefs_remove("/purple/contact/away_score");
 	purple_prefs_remove("/purple/contact/idle_score");
 
+	/* Binary snapshots of the buddy list and accounts */
+	purple_prefs_add_bool("/purple/snapshots", FALSE);
+
 	purple_prefs_load();
 	purple_prefs_update_old();
 }
@@ -83,19 +83,6 @@ static void irc_view_motd(PurplePluginAction *action)
 	g_free(title);
 }
 
-static int do_send(struct irc_conn *irc, const char *buf, gsize len)
-{
-	int ret;
-
-	if (irc->gsc) {
-		ret = purple_ssl_write(irc->gsc, buf, len);
-	} else {
-		ret = write(irc->fd, buf, len);
-	}
-
-	return ret;
-}
-
 static int irc_send_raw(PurpleConnection *gc, const char *buf, int len)
 {
 	struct irc_conn *irc = (struct irc_conn*)gc->proto_data;
@@ -107,41 +94,21 @@ static int irc_send_raw(PurpleConnection *gc, const char *buf, int len)
 }
 
 static void
-irc_send_cb(gpointer data, gint source, PurpleInputCondition cond)
+irc_output_error_cb(PurpleOutputBatch *batch, int error, gpointer data)
 {
 	struct irc_conn *irc = data;
-	int ret, writelen;
-
-	writelen = purple_circ_buffer_get_max_read(irc->outbuf);
-
-	if (writelen == 0) {
-		purple_input_remove(irc->writeh);
-		irc->writeh = 0;
-		return;
-	}
-
-	ret = do_send(irc, irc->outbuf->outptr, writelen);
+	PurpleConnection *gc = purple_account_get_connection(irc->account);
+	gchar *tmp;
 
-	if (ret < 0 && errno == EAGAIN)
-		return;
-	else if (ret <= 0) {
-		PurpleConnection *gc = purple_account_get_connection(irc->account);
-		gchar *tmp = g_strdup_printf(_("Lost connection with server: %s"),
-			g_strerror(errno));
-		purple_connection_error_reason (gc,
-			PURPLE_CONNECTION_ERROR_NETWORK_ERROR, tmp);
-		g_free(tmp);
+	/* Don't report a failed final flush on a connection being closed */
+	if (gc == NULL || irc->account->disconnecting)
 		return;
-	}
-
-	purple_circ_buffer_mark_read(irc->outbuf, ret);
 
-#if 0
-	/* We *could* try to write more if we wrote it all */
-	if (ret == write_len) {
-		irc_send_cb(data, source, cond);
-	}
-#endif
+	tmp = g_strdup_printf(_("Lost connection with server: %s"),
+		g_strerror(error));
+	purple_connection_error_reason (gc,
+		PURPLE_CONNECTION_ERROR_NETWORK_ERROR, tmp);
+	g_free(tmp);
 }
 
 int irc_send(struct irc_conn *irc, const char *buf)
@@ -159,33 +126,13 @@ int irc_send_len(struct irc_conn *irc, const char *buf, int buflen)
 	if (tosend == NULL)
 		return 0;
 
-	/* If we're not buffering writes, try to send immediately */
-	if (!irc->writeh)
-		ret = do_send(irc, tosend, buflen);
-	else {
-		ret = -1;
-		errno = EAGAIN;
-	}
+	/* Commands generated in one go (e.g. the ISONs for a large buddy
+	 * list) are coalesced and sent when we return to the event loop */
+	purple_output_batch_write(irc->output, tosend, buflen);
+	ret = buflen;
 
 	/* purple_debug(PURPLE_DEBUG_MISC, "irc", "sent%s: %s",
 		irc->gsc ? " (ssl)" : "", tosend); */
-	if (ret <= 0 && errno != EAGAIN) {
-		PurpleConnection *gc = purple_account_get_connection(irc->account);
-		gchar *tmp = g_strdup_printf(_("Lost connection with server: %s"),
-			g_strerror(errno));
-		purple_connection_error_reason (gc,
-			PURPLE_CONNECTION_ERROR_NETWORK_ERROR, tmp);
-		g_free(tmp);
-	} else if (ret < buflen) {
-		if (ret < 0)
-			ret = 0;
-		if (!irc->writeh)
-			irc->writeh = purple_input_add(
-				irc->gsc ? irc->gsc->fd : irc->fd,
-				PURPLE_INPUT_WRITE, irc_send_cb, irc);
-		purple_circ_buffer_append(irc->outbuf, tosend + ret,
-			buflen - ret);
-	}
 	g_free(tosend);
 	return ret;
 }
@@ -344,7 +291,7 @@ static void irc_login(PurpleAccount *account)
 	gc->proto_data = irc = g_new0(struct irc_conn, 1);
 	irc->fd = -1;
 	irc->account = account;
-	irc->outbuf = purple_circ_buffer_new(512);
+	irc->output = purple_output_batch_new(irc_output_error_cb, irc);
 
 	userparts = g_strsplit(username, "@", 2);
 	purple_connection_set_display_name(gc, userparts[0]);
@@ -365,6 +312,7 @@ static void irc_login(PurpleAccount *account)
 			irc->gsc = purple_ssl_connect(account, irc->server,
 					purple_account_get_int(account, "port", IRC_DEFAULT_SSL_PORT),
 					irc_login_cb_ssl, irc_ssl_connect_failure, gc);
+			purple_output_batch_set_transport(irc->output, -1, irc->gsc);
 		} else {
 			purple_connection_error_reason (gc,
 				PURPLE_CONNECTION_ERROR_NO_SSL_SUPPORT,
@@ -481,6 +429,7 @@ static void irc_login_cb(gpointer data, gint source, const gchar *error_message)
 	}
 
 	irc->fd = source;
+	purple_output_batch_set_transport(irc->output, irc->fd, NULL);
 
 	if (do_login(gc)) {
 		gc->inpa = purple_input_add(irc->fd, PURPLE_INPUT_READ, irc_input_cb, gc);
@@ -495,6 +444,7 @@ irc_ssl_connect_failure(PurpleSslConnection *gsc, PurpleSslErrorType error,
 	struct irc_conn *irc = gc->proto_data;
 
 	irc->gsc = NULL;
+	purple_output_batch_set_transport(irc->output, -1, NULL);
 
 	purple_connection_ssl_error (gc, error);
 }
@@ -506,8 +456,10 @@ static void irc_close(PurpleConnection *gc)
 	if (irc == NULL)
 		return;
 
-	if (irc->gsc || (irc->fd >= 0))
+	if (irc->gsc || (irc->fd >= 0)) {
 		irc_cmd_quit(irc, "quit", NULL, NULL);
+		purple_output_batch_flush(irc->output);
+	}
 
 	if (gc->inpa)
 		purple_input_remove(gc->inpa);
@@ -527,10 +479,7 @@ static void irc_close(PurpleConnection *gc)
 		g_string_free(irc->motd, TRUE);
 	g_free(irc->server);
 
-	if (irc->writeh)
-		purple_input_remove(irc->writeh);
-
-	purple_circ_buffer_destroy(irc->outbuf);
+	purple_output_batch_destroy(irc->output);
 
 	g_free(irc->mode_chars);
 	g_free(irc->reqnick);
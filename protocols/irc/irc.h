@@ -29,8 +29,8 @@
 #include <sasl/sasl.h>
 #endif
 
-#include "circbuffer.h"
 #include "ft.h"
+#include "outputbatch.h"
 #include "roomlist.h"
 #include "sslconn.h"
 
@@ -90,8 +90,7 @@ struct irc_conn {
 
 	gboolean quitting;
 
-	PurpleCircBuffer *outbuf;
-	guint writeh;
+	PurpleOutputBatch *output;
 
 	time_t recv_time;
 
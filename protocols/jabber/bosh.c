@@ -30,18 +30,24 @@
 #include "xmlnode.h"
 
 #include "bosh.h"
+#include "parser.h"
 
 /* The number of HTTP connections to use. This MUST be at least 2. */
 #define NUM_HTTP_CONNECTIONS      2
+/* How many HTTP connections to use at most when the server advertises hold > 1 */
+#define MAX_HTTP_CONNECTIONS      5
+/* How many requests to ask the server to hold. It may choose to hold fewer. */
+#define REQUESTED_HOLD            2
 /* How many failed connection attempts before it becomes a fatal error */
 #define MAX_FAILED_CONNECTIONS    3
-/* How long in seconds to queue up outgoing messages */
+/* How long in seconds to queue up outgoing messages when every request is busy */
 #define BUFFER_SEND_IN_SECS       1
 
 typedef struct _PurpleHTTPConnection PurpleHTTPConnection;
 
 typedef void (*PurpleBOSHConnectionConnectFunction)(PurpleBOSHConnection *conn);
-typedef void (*PurpleBOSHConnectionReceiveFunction)(PurpleBOSHConnection *conn, xmlnode *node);
+/* Returns TRUE if the stanzas inside the <body/> should be processed */
+typedef gboolean (*PurpleBOSHConnectionReceiveFunction)(PurpleBOSHConnection *conn, xmlnode *body);
 
 static char *bosh_useragent = NULL;
 
@@ -53,7 +59,8 @@ typedef enum {
 
 struct _PurpleBOSHConnection {
 	JabberStream *js;
-	PurpleHTTPConnection *connections[NUM_HTTP_CONNECTIONS];
+	PurpleHTTPConnection *connections[MAX_HTTP_CONNECTIONS];
+	int num_connections;
 
 	PurpleCircBuffer *pending;
 	PurpleBOSHConnectionConnectFunction connect_cb;
@@ -83,7 +90,12 @@ struct _PurpleBOSHConnection {
 	int max_requests;
 	int requests;
 
+	/* State of the response currently being parsed */
+	gboolean accept_stanzas;
+	gboolean awaiting_features;
+
 	guint send_timer;
+	gboolean send_timer_immediate;
 };
 
 struct _PurpleHTTPConnection {
@@ -118,7 +130,7 @@ debug_dump_http_connections(PurpleBOSHConnection *conn)
 
 	g_return_if_fail(conn != NULL);
 
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		PurpleHTTPConnection *httpconn = conn->connections[i];
 		if (httpconn == NULL)
 			purple_debug_misc("jabber", "BOSH %p->connections[%d] = (nil)\n",
@@ -246,6 +258,7 @@ jabber_bosh_connection_init(JabberStream *js, const char *url)
 	else
 		conn->ssl = FALSE;
 
+	conn->num_connections = NUM_HTTP_CONNECTIONS;
 	conn->connections[0] = jabber_bosh_http_connection_init(conn);
 
 	return conn;
@@ -264,7 +277,7 @@ jabber_bosh_connection_destroy(PurpleBOSHConnection *conn)
 
 	purple_circ_buffer_destroy(conn->pending);
 
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < MAX_HTTP_CONNECTIONS; ++i) {
 		if (conn->connections[i])
 			jabber_bosh_http_connection_destroy(conn->connections[i]);
 	}
@@ -277,6 +290,13 @@ gboolean jabber_bosh_connection_is_ssl(PurpleBOSHConnection *conn)
 	return conn->ssl;
 }
 
+static int
+jabber_bosh_connection_max_requests(PurpleBOSHConnection *conn)
+{
+	/* Without a 'requests' attribute, assume hold + 1 */
+	return conn->max_requests > 0 ? conn->max_requests : conn->num_connections;
+}
+
 static PurpleHTTPConnection *
 find_available_http_connection(PurpleBOSHConnection *conn)
 {
@@ -292,7 +312,7 @@ find_available_http_connection(PurpleBOSHConnection *conn)
 				conn->connections[0] : NULL;
 
 	/* First loop, look for a connection that's ready */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		if (conn->connections[i] &&
 				conn->connections[i]->state == HTTP_CONN_CONNECTED &&
 				conn->connections[i]->requests == 0)
@@ -300,14 +320,14 @@ find_available_http_connection(PurpleBOSHConnection *conn)
 	}
 
 	/* Second loop, is something currently connecting? If so, just queue up. */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		if (conn->connections[i] &&
 				conn->connections[i]->state == HTTP_CONN_CONNECTING)
 			return NULL;
 	}
 
 	/* Third loop, is something offline that we can connect? */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		if (conn->connections[i] &&
 				conn->connections[i]->state == HTTP_CONN_OFFLINE) {
 			purple_debug_info("jabber", "bosh: Reconnecting httpconn "
@@ -318,7 +338,7 @@ find_available_http_connection(PurpleBOSHConnection *conn)
 	}
 
 	/* Fourth loop, look for one that's NULL and create a new connection */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		if (!conn->connections[i]) {
 			conn->connections[i] = jabber_bosh_http_connection_init(conn);
 			purple_debug_info("jabber", "bosh: Creating and connecting new httpconn "
@@ -354,9 +374,30 @@ jabber_bosh_connection_send(PurpleBOSHConnection *conn,
 		if (purple_debug_is_verbose())
 			purple_debug_misc("jabber", "bosh: %p has %" G_GSIZE_FORMAT " bytes in "
 			                  "the buffer.\n", conn, conn->pending->bufused);
-		if (conn->send_timer == 0)
+
+		if (conn->state == BOSH_CONN_ONLINE &&
+				conn->requests < jabber_bosh_connection_max_requests(conn)) {
+			/*
+			 * A request slot is free, so holding the data back only adds
+			 * latency. Just let the rest of this event loop pass add to it.
+			 */
+			if (conn->send_timer != 0 && !conn->send_timer_immediate) {
+				purple_timeout_remove(conn->send_timer);
+				conn->send_timer = 0;
+			}
+			if (conn->send_timer == 0) {
+				conn->send_timer = purple_timeout_add(0, send_timer_cb, conn);
+				conn->send_timer_immediate = TRUE;
+			}
+		} else if (conn->send_timer == 0) {
+			/*
+			 * Every request is busy; the data goes out with the request
+			 * made when the next response arrives, or when this fires.
+			 */
 			conn->send_timer = purple_timeout_add_seconds(BUFFER_SEND_IN_SECS,
 					send_timer_cb, conn);
+			conn->send_timer_immediate = FALSE;
+		}
 		return;
 	}
 
@@ -449,6 +490,7 @@ send_timer_cb(gpointer data)
 
 	bosh = data;
 	bosh->send_timer = 0;
+	bosh->send_timer_immediate = FALSE;
 
 	jabber_bosh_connection_send(bosh, PACKET_FLUSH, NULL);
 
@@ -486,53 +528,27 @@ jabber_bosh_disable_pipelining(PurpleBOSHConnection *bosh)
 	}
 }
 
-static void jabber_bosh_connection_received(PurpleBOSHConnection *conn, xmlnode *node) {
-	xmlnode *child;
-	JabberStream *js = conn->js;
+static gboolean jabber_bosh_connection_received(PurpleBOSHConnection *conn, xmlnode *node) {
+	g_return_val_if_fail(node != NULL, FALSE);
 
-	g_return_if_fail(node != NULL);
-	if (jabber_bosh_connection_error_check(conn, node))
-		return;
-
-	child = node->child;
-	while (child != NULL) {
-		/* jabber_process_packet might free child */
-		xmlnode *next = child->next;
-		if (child->type == XMLNODE_TYPE_TAG) {
-			const char *xmlns = xmlnode_get_namespace(child);
-			/*
-			 * Workaround for non-compliant servers that don't stamp
-			 * the right xmlns on these packets.  See #11315.
-			 */
-			if ((xmlns == NULL /* shouldn't happen, but is equally wrong */ ||
-					g_str_equal(xmlns, NS_BOSH)) &&
-				(g_str_equal(child->name, "iq") ||
-				 g_str_equal(child->name, "message") ||
-				 g_str_equal(child->name, "presence"))) {
-				xmlnode_set_namespace(child, NS_XMPP_CLIENT);
-			}
-			jabber_process_packet(js, &child);
-		}
-
-		child = next;
-	}
+	return !jabber_bosh_connection_error_check(conn, node);
 }
 
-static void boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
+static gboolean boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
 	JabberStream *js = conn->js;
 	const char *sid, *version;
-	const char *inactivity, *requests;
-	xmlnode *packet;
+	const char *inactivity, *requests, *hold;
 
-	g_return_if_fail(node != NULL);
+	g_return_val_if_fail(node != NULL, FALSE);
 	if (jabber_bosh_connection_error_check(conn, node))
-		return;
+		return FALSE;
 
 	sid = xmlnode_get_attrib(node, "sid");
 	version = xmlnode_get_attrib(node, "ver");
 
 	inactivity = xmlnode_get_attrib(node, "inactivity");
 	requests = xmlnode_get_attrib(node, "requests");
+	hold = xmlnode_get_attrib(node, "hold");
 
 	if (sid) {
 		conn->sid = g_strdup(sid);
@@ -540,7 +556,7 @@ static void boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
 		purple_connection_error_reason(js->gc,
 		        PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
 		        _("No session ID given"));
-		return;
+		return FALSE;
 	}
 
 	if (version) {
@@ -557,7 +573,7 @@ static void boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
 			purple_connection_error_reason(js->gc,
 			        PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
 			        _("Unsupported version of BOSH protocol"));
-			return;
+			return FALSE;
 		}
 	} else {
 		purple_debug_info("jabber", "Missing version in BOSH initiation\n");
@@ -573,25 +589,82 @@ static void boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
 			/* TODO: Can this check fail? It shouldn't */
 			js->max_inactivity -= 5; /* rounding */
 
-			if (js->inactivity_timer == 0) {
-				purple_debug_misc("jabber", "Starting BOSH inactivity timer "
-						"for %d secs (compensating for rounding)\n",
-						js->max_inactivity);
-				jabber_stream_restart_inactivity_timer(js);
+			/* Restarting a running timer would keep the old interval */
+			if (js->inactivity_timer != 0) {
+				purple_timeout_remove(js->inactivity_timer);
+				js->inactivity_timer = 0;
 			}
+
+			purple_debug_misc("jabber", "Starting BOSH inactivity timer "
+					"for %d secs (compensating for rounding)\n",
+					js->max_inactivity);
+			jabber_stream_restart_inactivity_timer(js);
 		}
 	}
 
 	if (requests)
 		conn->max_requests = atoi(requests);
 
+	if (hold) {
+		/* The server will sit on this many requests; keep one more free */
+		int held = atoi(hold);
+		if (held > 1) {
+			conn->num_connections = MIN(held + 1, MAX_HTTP_CONNECTIONS);
+			purple_debug_info("jabber", "BOSH: server holds %d requests, using "
+			                  "up to %d connections\n", held, conn->num_connections);
+		}
+	}
+
 	jabber_stream_set_state(js, JABBER_STREAM_AUTHENTICATING);
 
-	/* FIXME: Depending on receiving features might break with some hosts */
-	packet = xmlnode_get_child(node, "features");
+	/*
+	 * The stream features follow as a child of this <body/>.
+	 * FIXME: Depending on receiving features might break with some hosts
+	 */
 	conn->state = BOSH_CONN_ONLINE;
 	conn->receive_cb = jabber_bosh_connection_received;
-	jabber_stream_features_parse(js, packet);
+	conn->awaiting_features = TRUE;
+	return TRUE;
+}
+
+void
+jabber_bosh_connection_body_start(PurpleBOSHConnection *conn, xmlnode *body)
+{
+	g_return_if_fail(conn->receive_cb != NULL);
+
+	conn->accept_stanzas = conn->receive_cb(conn, body);
+}
+
+void
+jabber_bosh_connection_stanza_received(PurpleBOSHConnection *conn,
+                                       xmlnode **packet)
+{
+	xmlnode *child = *packet;
+	const char *xmlns;
+
+	if (!conn->accept_stanzas)
+		return;
+
+	if (conn->awaiting_features && g_str_equal(child->name, "features")) {
+		conn->awaiting_features = FALSE;
+		jabber_stream_features_parse(conn->js, child);
+		return;
+	}
+
+	xmlns = xmlnode_get_namespace(child);
+	/*
+	 * Workaround for non-compliant servers that don't stamp
+	 * the right xmlns on these packets.  See #11315.
+	 */
+	if ((xmlns == NULL /* shouldn't happen, but is equally wrong */ ||
+			g_str_equal(xmlns, NS_BOSH)) &&
+		(g_str_equal(child->name, "iq") ||
+		 g_str_equal(child->name, "message") ||
+		 g_str_equal(child->name, "presence"))) {
+		xmlnode_set_namespace(child, NS_XMPP_CLIENT);
+	}
+
+	jabber_process_packet(conn->js, packet);
 }
 
 static void jabber_bosh_connection_boot(PurpleBOSHConnection *conn) {
@@ -608,10 +681,11 @@ static void jabber_bosh_connection_boot(PurpleBOSHConnection *conn) {
 /* TODO: This should be adjusted/adjustable automatically according to
  * realtime network behavior */
 	                "wait='60' "
-	                "hold='1' "
+	                "hold='%d' "
 	                "xmlns='" NS_BOSH "'/>",
 	                conn->js->user->domain,
-	                ++conn->rid);
+	                ++conn->rid,
+	                REQUESTED_HOLD);
 
 	purple_debug_misc("jabber", "SendBOSH Boot %s(%" G_GSIZE_FORMAT "): %s\n",
 	                  conn->ssl ? "(ssl)" : "", buf->len, buf->str);
@@ -622,13 +696,13 @@ static void jabber_bosh_connection_boot(PurpleBOSHConnection *conn) {
 
 /**
  * Handle one complete BOSH response. This is a <body> node containing
- * any number of XMPP stanzas.
+ * any number of XMPP stanzas, which the stream parser hands to
+ * jabber_bosh_connection_stanza_received() one at a time as they complete.
  */
 static void
 http_received_cb(const char *data, int len, PurpleBOSHConnection *conn)
 {
-	xmlnode *node;
-	gchar *message;
+	JabberStream *js = conn->js;
 
 	if (conn->failed_connections)
 		/* We've got some data, so reset the number of failed connections */
@@ -636,19 +710,29 @@ http_received_cb(const char *data, int len, PurpleBOSHConnection *conn)
 
 	g_return_if_fail(conn->receive_cb);
 
-	node = xmlnode_from_str(data, len);
-
-	message = g_strndup(data, len);
-	purple_debug_info("jabber", "RecvBOSH %s(%d): %s\n",
-	                  conn->ssl ? "(ssl)" : "", len, message);
-	g_free(message);
-
-	if (node) {
-		conn->receive_cb(conn, node);
-		xmlnode_free(node);
-	} else {
+	purple_debug_info("jabber", "RecvBOSH %s(%d): %.*s\n",
+	                  conn->ssl ? "(ssl)" : "", len, len, data);
+
+	conn->accept_stanzas = FALSE;
+	jabber_parser_setup(js);
+	jabber_parser_process(js, data, len);
+	jabber_parser_free(js);
+
+	if (js->current) {
+		/* The body was cut short; drop the partial stanza */
+		xmlnode *root = js->current;
+		while (root->parent)
+			root = root->parent;
+		js->current = NULL;
+		xmlnode_free(root);
 		purple_debug_warning("jabber", "BOSH: Received invalid XML\n");
 	}
+
+	if (conn->awaiting_features) {
+		/* The boot response came without any stream features */
+		conn->awaiting_features = FALSE;
+		jabber_stream_features_parse(js, NULL);
+	}
 }
 
 void jabber_bosh_connection_send_raw(PurpleBOSHConnection *conn,
@@ -40,4 +40,8 @@ void jabber_bosh_connection_send_keepalive(PurpleBOSHConnection *conn);
 void jabber_bosh_connection_connect(PurpleBOSHConnection *conn);
 void jabber_bosh_connection_close(PurpleBOSHConnection *conn);
 void jabber_bosh_connection_send_raw(PurpleBOSHConnection *conn, const char *data);
+
+/* Called by the stream parser while it works through a BOSH response */
+void jabber_bosh_connection_body_start(PurpleBOSHConnection *conn, xmlnode *body);
+void jabber_bosh_connection_stanza_received(PurpleBOSHConnection *conn, xmlnode **packet);
 #endif /* PURPLE_JABBER_BOSH_H_ */
@@ -376,91 +376,41 @@ void jabber_process_packet(JabberStream *js, xmlnode **packet)
 	}
 }
 
-static int jabber_do_send(JabberStream *js, const char *data, int len)
-{
-	int ret;
-
-	if (js->gsc)
-		ret = purple_ssl_write(js->gsc, data, len);
-	else
-		ret = write(js->fd, data, len);
-
-	return ret;
-}
-
-static void jabber_send_cb(gpointer data, gint source, PurpleInputCondition cond)
+static void
+jabber_output_error_cb(PurpleOutputBatch *batch, int error, gpointer data)
 {
 	JabberStream *js = data;
-	int ret, writelen;
-	writelen = purple_circ_buffer_get_max_read(js->write_buffer);
-
-	if (writelen == 0) {
-		purple_input_remove(js->writeh);
-		js->writeh = 0;
-		return;
-	}
-
-	ret = jabber_do_send(js, js->write_buffer->outptr, writelen);
+	PurpleAccount *account = purple_connection_get_account(js->gc);
+	gchar *tmp;
 
-	if (ret < 0 && errno == EAGAIN)
-		return;
-	else if (ret <= 0) {
-		gchar *tmp = g_strdup_printf(_("Lost connection with server: %s"),
-				g_strerror(errno));
-		purple_connection_error_reason(js->gc,
-			PURPLE_CONNECTION_ERROR_NETWORK_ERROR, tmp);
-		g_free(tmp);
+	/*
+	 * The server may have closed the socket (on a stream error), so if
+	 * we're disconnecting, don't generate (possibly another) error that
+	 * (for some UIs) would mask the first.
+	 */
+	if (account->disconnecting)
 		return;
-	}
 
-	purple_circ_buffer_mark_read(js->write_buffer, ret);
+	tmp = g_strdup_printf(_("Lost connection with server: %s"),
+			g_strerror(error));
+	purple_connection_error_reason(js->gc,
+		PURPLE_CONNECTION_ERROR_NETWORK_ERROR, tmp);
+	g_free(tmp);
 }
 
 static gboolean do_jabber_send_raw(JabberStream *js, const char *data, int len)
 {
-	int ret;
-	gboolean success = TRUE;
-
 	g_return_val_if_fail(len > 0, FALSE);
 
 	if (js->state == JABBER_STREAM_CONNECTED)
 		jabber_stream_restart_inactivity_timer(js);
 
-	if (js->writeh == 0)
-		ret = jabber_do_send(js, data, len);
-	else {
-		ret = -1;
-		errno = EAGAIN;
-	}
-
-	if (ret < 0 && errno != EAGAIN) {
-		PurpleAccount *account = purple_connection_get_account(js->gc);
-		/*
-		 * The server may have closed the socket (on a stream error), so if
-		 * we're disconnecting, don't generate (possibly another) error that
-		 * (for some UIs) would mask the first.
-		 */
-		if (!account->disconnecting) {
-			gchar *tmp = g_strdup_printf(_("Lost connection with server: %s"),
-					g_strerror(errno));
-			purple_connection_error_reason(js->gc,
-				PURPLE_CONNECTION_ERROR_NETWORK_ERROR, tmp);
-			g_free(tmp);
-		}
-
-		success = FALSE;
-	} else if (ret < len) {
-		if (ret < 0)
-			ret = 0;
-		if (js->writeh == 0)
-			js->writeh = purple_input_add(
-				js->gsc ? js->gsc->fd : js->fd,
-				PURPLE_INPUT_WRITE, jabber_send_cb, js);
-		purple_circ_buffer_append(js->write_buffer,
-			data + ret, len - ret);
-	}
+	/* Stanzas generated while handling one event (presence to every
+	 * MUC, roster pushes, ...) are sent together once we return to the
+	 * event loop; write errors are reported via jabber_output_error_cb. */
+	purple_output_batch_write(js->output, data, len);
 
-	return success;
+	return TRUE;
 }
 
 void jabber_send_raw(JabberStream *js, const char *data, int len)
@@ -824,6 +774,7 @@ jabber_login_callback(gpointer data, gint source, const gchar *error)
 	js->srv_rec = NULL;
 
 	js->fd = source;
+	purple_output_batch_set_transport(js->output, js->fd, NULL);
 
 	if(js->state == JABBER_STREAM_CONNECTING)
 		jabber_send_raw(js, "<?xml version='1.0' ?>", -1);
@@ -844,6 +795,7 @@ jabber_ssl_connect_failure(PurpleSslConnection *gsc, PurpleSslErrorType error,
 
 	js = gc->proto_data;
 	js->gsc = NULL;
+	purple_output_batch_set_transport(js->output, -1, NULL);
 
 	purple_connection_ssl_error (gc, error);
 }
@@ -852,10 +804,14 @@ static void tls_init(JabberStream *js)
 {
 	purple_input_remove(js->gc->inpa);
 	js->gc->inpa = 0;
+	/* Anything still queued must go out in the clear before the TLS
+	 * handshake starts */
+	purple_output_batch_set_transport(js->output, -1, NULL);
 	js->gsc = purple_ssl_connect_with_host_fd(js->gc->account, js->fd,
 			jabber_login_callback_ssl, jabber_ssl_connect_failure, js->certificate_CN, js->gc);
 	/* The fd is no longer our concern */
 	js->fd = -1;
+	purple_output_batch_set_transport(js->output, -1, js->gsc);
 }
 
 static gboolean jabber_login_connect(JabberStream *js, const char *domain, const char *host, int port,
@@ -992,7 +948,7 @@ jabber_stream_new(PurpleAccount *account)
 	js->chats = g_hash_table_new_full(g_str_hash, g_str_equal,
 			g_free, (GDestroyNotify)jabber_chat_free);
 	js->next_id = g_random_int();
-	js->write_buffer = purple_circ_buffer_new(512);
+	js->output = purple_output_batch_new(jabber_output_error_cb, js);
 	js->old_length = 0;
 	js->keepalive_timeout = 0;
 	js->max_inactivity = DEFAULT_INACTIVITY_TIME;
@@ -1053,6 +1009,7 @@ jabber_stream_connect(JabberStream *js)
 			js->gsc = purple_ssl_connect(account, js->certificate_CN,
 					purple_account_get_int(account, "port", 5223),
 					jabber_login_callback_ssl, jabber_ssl_connect_failure, gc);
+			purple_output_batch_set_transport(js->output, -1, js->gsc);
 			if (!js->gsc) {
 				purple_connection_error_reason(gc,
 					PURPLE_CONNECTION_ERROR_NO_SSL_SUPPORT,
@@ -1594,8 +1551,10 @@ void jabber_close(PurpleConnection *gc)
 
 	if (js->bosh)
 		jabber_bosh_connection_close(js->bosh);
-	else if ((js->gsc && js->gsc->fd > 0) || js->fd > 0)
+	else if ((js->gsc && js->gsc->fd > 0) || js->fd > 0) {
 		jabber_send_raw(js, "</stream:stream>", -1);
+		purple_output_batch_flush(js->output);
+	}
 
 	if (js->srv_query_data)
 		purple_srv_cancel(js->srv_query_data);
@@ -1653,10 +1612,8 @@ void jabber_close(PurpleConnection *gc)
 	g_free(js->avatar_hash);
 	g_free(js->caps_hash);
 
-	if (js->write_buffer)
-		purple_circ_buffer_destroy(js->write_buffer);
-	if(js->writeh)
-		purple_input_remove(js->writeh);
+	if (js->output)
+		purple_output_batch_destroy(js->output);
 	if (js->auth_mech && js->auth_mech->dispose)
 		js->auth_mech->dispose(js);
 #ifdef HAVE_CYRUS_SASL
@@ -2107,6 +2064,10 @@ inactivity_cb(gpointer data)
 
 void jabber_stream_restart_inactivity_timer(JabberStream *js)
 {
+	/* This happens for everything sent, so push the timer back in place */
+	if (purple_timeout_restart(js->inactivity_timer))
+		return;
+
 	if (js->inactivity_timer != 0) {
 		purple_timeout_remove(js->inactivity_timer);
 		js->inactivity_timer = 0;
@@ -2115,8 +2076,8 @@ void jabber_stream_restart_inactivity_timer(JabberStream *js)
 	g_return_if_fail(js->max_inactivity > 0);
 
 	js->inactivity_timer =
-		purple_timeout_add_seconds(js->max_inactivity,
-		                           inactivity_cb, js);
+		purple_timeout_wheel_add_seconds(js->max_inactivity,
+		                                 inactivity_cb, js);
 }
 
 const char *jabber_list_icon(PurpleAccount *a, PurpleBuddy *b)
@@ -3921,6 +3882,7 @@ jabber_do_uninit(void)
 #endif
 
 	jabber_auth_uninit();
+	jabber_id_cache_uninit();
 	jabber_features_destroy();
 	jabber_identities_destroy();
 
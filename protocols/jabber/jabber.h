@@ -62,6 +62,7 @@ typedef struct _JabberStream JabberStream;
 #include "dnssrv.h"
 #include "media.h"
 #include "mediamanager.h"
+#include "outputbatch.h"
 #include "roomlist.h"
 #include "sslconn.h"
 
@@ -189,8 +190,7 @@ struct _JabberStream
 
 	GSList *pending_buddy_info_requests;
 
-	PurpleCircBuffer *write_buffer;
-	guint writeh;
+	PurpleOutputBatch *output;
 
 	gboolean reinit;
 
@@ -36,9 +36,38 @@
 #ifdef USE_IDN
 #include <idna.h>
 #include <stringprep.h>
-static char idn_buffer[1024];
+/* Each caller uses its own buffer of this size, so that JIDs can be
+ * prepared from several threads at once. */
+#define IDN_BUFFER_SIZE 1024
 #endif
 
+/*
+ * Parsed JIDs are interned in a bounded cache keyed by the raw string, so
+ * that the same JID seen over and over again (in every presence, and in
+ * every purple_normalize() of a buddy name) is only validated and
+ * stringprepped once.  The cache has two generations: once the current
+ * one holds JID_CACHE_SIZE entries, the previous generation is dropped and
+ * the current one takes its place.  An entry that is looked up again is
+ * moved to the current generation, so entries stay alive for at least
+ * JID_CACHE_SIZE insertions after their last use.
+ */
+#define JID_CACHE_SIZE 2048
+
+typedef struct {
+	JabberID jid; /* Must be first, see jabber_id_unref() */
+	char *bare;
+	char *full;
+	/* The raw string ended with a '/' and no resource */
+	gboolean trailing_slash;
+	gint ref;
+} JabberIDCacheEntry;
+
+G_LOCK_DEFINE_STATIC(jid_cache);
+static GHashTable *jid_cache_current = NULL;
+static GHashTable *jid_cache_old = NULL;
+/* The entry of each thread's last jabber_normalize() result */
+static GStaticPrivate jid_cache_normalized = G_STATIC_PRIVATE_INIT;
+
 #ifdef USE_IDN
 static gboolean jabber_nodeprep(char *str, size_t buflen)
 {
@@ -61,6 +90,7 @@ jabber_idn_validate(const char *str, const char *at, const char *slash,
 	int domain_len = 0;
 	int resource_len = 0;
 	char *out;
+	char idn_buffer[IDN_BUFFER_SIZE];
 	JabberID *jid;
 
 	/* Ensure no parts are > 1023 bytes */
@@ -168,6 +198,7 @@ gboolean jabber_nodeprep_validate(const char *str)
 {
 #ifdef USE_IDN
 	gboolean result;
+	char idn_buffer[IDN_BUFFER_SIZE];
 #else
 	const char *c;
 #endif
@@ -247,6 +278,7 @@ gboolean jabber_resourceprep_validate(const char *str)
 {
 #ifdef USE_IDN
 	gboolean result;
+	char idn_buffer[IDN_BUFFER_SIZE];
 #else
 	const char *c;
 #endif
@@ -280,6 +312,7 @@ char *jabber_saslprep(const char *in)
 {
 #ifdef USE_IDN
 	char *out;
+	char idn_buffer[IDN_BUFFER_SIZE];
 
 	g_return_val_if_fail(in != NULL, NULL);
 	g_return_val_if_fail(strlen(in) <= sizeof(idn_buffer) - 1, NULL);
@@ -508,6 +541,183 @@ jabber_id_free(JabberID *jid)
 	}
 }
 
+static void
+jid_cache_entry_unref(JabberIDCacheEntry *entry)
+{
+	if (g_atomic_int_dec_and_test(&entry->ref)) {
+		g_free(entry->jid.node);
+		g_free(entry->jid.domain);
+		g_free(entry->jid.resource);
+		g_free(entry->bare);
+		g_free(entry->full);
+		g_free(entry);
+	}
+}
+
+/* Takes over the caller's reference.  Must be called with the lock held. */
+static void
+jid_cache_insert(const char *str, JabberIDCacheEntry *entry)
+{
+	if (jid_cache_current == NULL)
+		jid_cache_current = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, (GDestroyNotify)jid_cache_entry_unref);
+
+	if (g_hash_table_size(jid_cache_current) >= JID_CACHE_SIZE) {
+		if (jid_cache_old != NULL)
+			g_hash_table_destroy(jid_cache_old);
+		jid_cache_old = jid_cache_current;
+		jid_cache_current = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, (GDestroyNotify)jid_cache_entry_unref);
+	}
+
+	g_hash_table_replace(jid_cache_current, g_strdup(str), entry);
+}
+
+/*
+ * Returns a new reference to the cached entry for str, or NULL if there
+ * is none.  Must be called with the lock held.
+ */
+static JabberIDCacheEntry *
+jid_cache_find(const char *str)
+{
+	JabberIDCacheEntry *entry = NULL;
+
+	if (jid_cache_current != NULL)
+		entry = g_hash_table_lookup(jid_cache_current, str);
+	if (entry == NULL && jid_cache_old != NULL) {
+		entry = g_hash_table_lookup(jid_cache_old, str);
+		if (entry != NULL) {
+			/* Still in use, keep it around for another generation */
+			g_atomic_int_inc(&entry->ref);
+			jid_cache_insert(str, entry);
+		}
+	}
+	if (entry != NULL)
+		g_atomic_int_inc(&entry->ref);
+
+	return entry;
+}
+
+/*
+ * Returns a new reference to the cache entry for str, parsing it if it
+ * isn't cached yet.  JIDs with a trailing slash are accepted here; callers
+ * that don't allow them must check entry->trailing_slash.
+ */
+static JabberIDCacheEntry *
+jid_cache_lookup(const char *str)
+{
+	JabberIDCacheEntry *entry, *cached;
+	JabberID *jid;
+	const char *slash;
+
+	if (str == NULL)
+		return NULL;
+
+	G_LOCK(jid_cache);
+	entry = jid_cache_find(str);
+	G_UNLOCK(jid_cache);
+	if (entry != NULL)
+		return entry;
+
+	/* The expensive part happens outside of the lock */
+	jid = jabber_id_new_internal(str, TRUE);
+	if (jid == NULL)
+		return NULL;
+
+	entry = g_new0(JabberIDCacheEntry, 1);
+	entry->jid = *jid;
+	g_free(jid);
+	entry->bare = jabber_id_get_bare_jid(&entry->jid);
+	entry->full = jabber_id_get_full_jid(&entry->jid);
+	slash = strchr(str, '/');
+	entry->trailing_slash = (slash != NULL && slash[1] == '\0');
+	/* One reference for the cache and one for the caller */
+	entry->ref = 2;
+
+	/* Another thread may have parsed the same JID in the meantime */
+	G_LOCK(jid_cache);
+	cached = jid_cache_find(str);
+	if (cached == NULL)
+		jid_cache_insert(str, entry);
+	G_UNLOCK(jid_cache);
+
+	if (cached != NULL) {
+		entry->ref = 1;
+		jid_cache_entry_unref(entry);
+		return cached;
+	}
+
+	return entry;
+}
+
+/* Like jid_cache_lookup(), but with the validation rules of jabber_id_new() */
+static JabberIDCacheEntry *
+jid_cache_lookup_strict(const char *str)
+{
+	JabberIDCacheEntry *entry = jid_cache_lookup(str);
+
+	if (entry != NULL && entry->trailing_slash) {
+		jid_cache_entry_unref(entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+const JabberID *
+jabber_id_intern(const char *str)
+{
+	JabberIDCacheEntry *entry = jid_cache_lookup_strict(str);
+
+	return entry ? &entry->jid : NULL;
+}
+
+const JabberID *
+jabber_id_ref(const JabberID *jid)
+{
+	g_return_val_if_fail(jid != NULL, NULL);
+
+	g_atomic_int_inc(&((JabberIDCacheEntry *)jid)->ref);
+	return jid;
+}
+
+void
+jabber_id_unref(const JabberID *jid)
+{
+	if (jid != NULL)
+		jid_cache_entry_unref((JabberIDCacheEntry *)jid);
+}
+
+const char *
+jabber_id_interned_get_bare_jid(const JabberID *jid)
+{
+	g_return_val_if_fail(jid != NULL, NULL);
+
+	return ((const JabberIDCacheEntry *)jid)->bare;
+}
+
+const char *
+jabber_id_interned_get_full_jid(const JabberID *jid)
+{
+	g_return_val_if_fail(jid != NULL, NULL);
+
+	return ((const JabberIDCacheEntry *)jid)->full;
+}
+
+void
+jabber_id_cache_uninit(void)
+{
+	G_LOCK(jid_cache);
+	if (jid_cache_old != NULL)
+		g_hash_table_destroy(jid_cache_old);
+	if (jid_cache_current != NULL)
+		g_hash_table_destroy(jid_cache_current);
+	jid_cache_old = jid_cache_current = NULL;
+	G_UNLOCK(jid_cache);
+
+	g_static_private_set(&jid_cache_normalized, NULL, NULL);
+}
+
 
 gboolean
 jabber_id_equal(const JabberID *jid1, const JabberID *jid2)
@@ -529,28 +739,28 @@ jabber_id_equal(const JabberID *jid1, const JabberID *jid2)
 
 char *jabber_get_domain(const char *in)
 {
-	JabberID *jid = jabber_id_new(in);
+	const JabberID *jid = jabber_id_intern(in);
 	char *out;
 
 	if (!jid)
 		return NULL;
 
 	out = g_strdup(jid->domain);
-	jabber_id_free(jid);
+	jabber_id_unref(jid);
 
 	return out;
 }
 
 char *jabber_get_resource(const char *in)
 {
-	JabberID *jid = jabber_id_new(in);
+	const JabberID *jid = jabber_id_intern(in);
 	char *out;
 
 	if(!jid)
 		return NULL;
 
 	out = g_strdup(jid->resource);
-	jabber_id_free(jid);
+	jabber_id_unref(jid);
 
 	return out;
 }
@@ -569,13 +779,13 @@ jabber_id_to_bare_jid(const JabberID *jid)
 char *
 jabber_get_bare_jid(const char *in)
 {
-	JabberID *jid = jabber_id_new(in);
+	const JabberID *jid = jabber_id_intern(in);
 	char *out;
 
 	if (!jid)
 		return NULL;
-	out = jabber_id_get_bare_jid(jid);
-	jabber_id_free(jid);
+	out = g_strdup(jabber_id_interned_get_bare_jid(jid));
+	jabber_id_unref(jid);
 
 	return out;
 }
@@ -621,37 +831,55 @@ jabber_jid_is_domain(const char *jid)
 JabberID *
 jabber_id_new(const char *str)
 {
-	return jabber_id_new_internal(str, FALSE);
+	const JabberID *cached = jabber_id_intern(str);
+	JabberID *jid;
+
+	if (cached == NULL)
+		return NULL;
+
+	/* Callers own (and may modify) the result, so hand out a copy */
+	jid = g_new0(JabberID, 1);
+	jid->node = g_strdup(cached->node);
+	jid->domain = g_strdup(cached->domain);
+	jid->resource = g_strdup(cached->resource);
+	jabber_id_unref(cached);
+
+	return jid;
 }
 
+/*
+ * The returned string belongs to the JID cache.  It stays valid at least
+ * until the next call in the same thread, and for as long as the JID
+ * stays cached (JID_CACHE_SIZE further lookups of other JIDs) after that.
+ */
 const char *jabber_normalize(const PurpleAccount *account, const char *in)
 {
 	PurpleConnection *gc = account ? account->gc : NULL;
 	JabberStream *js = gc ? gc->proto_data : NULL;
-	static char buf[3072]; /* maximum legal length of a jabber jid */
-	JabberID *jid;
+	JabberIDCacheEntry *entry;
+	const char *out;
 
-	jid = jabber_id_new_internal(in, TRUE);
-	if(!jid)
+	entry = jid_cache_lookup(in);
+	if(!entry)
 		return NULL;
 
-	if(js && jid->node && jid->resource &&
-			jabber_chat_find(js, jid->node, jid->domain))
-		g_snprintf(buf, sizeof(buf), "%s@%s/%s", jid->node, jid->domain,
-				jid->resource);
+	if(js && entry->jid.node && entry->jid.resource &&
+			jabber_chat_find(js, entry->jid.node, entry->jid.domain))
+		out = entry->full;
 	else
-		g_snprintf(buf, sizeof(buf), "%s%s%s", jid->node ? jid->node : "",
-				jid->node ? "@" : "", jid->domain);
+		out = entry->bare;
 
-	jabber_id_free(jid);
+	/* Keep the entry alive for the caller, in place of the last one */
+	g_static_private_set(&jid_cache_normalized, entry,
+			(GDestroyNotify)jid_cache_entry_unref);
 
-	return buf;
+	return out;
 }
 
 gboolean
 jabber_is_own_server(JabberStream *js, const char *str)
 {
-	JabberID *jid;
+	const JabberID *jid;
 	gboolean equal;
 
 	if (str == NULL)
@@ -659,21 +887,21 @@ jabber_is_own_server(JabberStream *js, const char *str)
 
 	g_return_val_if_fail(*str != '\0', FALSE);
 
-	jid = jabber_id_new(str);
+	jid = jabber_id_intern(str);
 	if (!jid)
 		return FALSE;
 
 	equal = (jid->node == NULL &&
 	         g_str_equal(jid->domain, js->user->domain) &&
 	         jid->resource == NULL);
-	jabber_id_free(jid);
+	jabber_id_unref(jid);
 	return equal;
 }
 
 gboolean
 jabber_is_own_account(JabberStream *js, const char *str)
 {
-	JabberID *jid;
+	const JabberID *jid;
 	gboolean equal;
 
 	if (str == NULL)
@@ -681,7 +909,7 @@ jabber_is_own_account(JabberStream *js, const char *str)
 
 	g_return_val_if_fail(*str != '\0', FALSE);
 
-	jid = jabber_id_new(str);
+	jid = jabber_id_intern(str);
 	if (!jid)
 		return FALSE;
 
@@ -689,7 +917,7 @@ jabber_is_own_account(JabberStream *js, const char *str)
 	         g_str_equal(jid->domain, js->user->domain) &&
 	         (jid->resource == NULL ||
 	             g_str_equal(jid->resource, js->user->resource)));
-	jabber_id_free(jid);
+	jabber_id_unref(jid);
 	return equal;
 }
 
@@ -53,6 +53,31 @@ gboolean jabber_id_equal(const JabberID *jid1, const JabberID *jid2);
 
 void jabber_id_free(JabberID *jid);
 
+/**
+ * Look up str in the JID cache, parsing and validating it (with the same
+ * rules as jabber_id_new()) only if it hasn't been seen recently.
+ *
+ * The returned JabberID is shared and immutable: it must not be modified
+ * or freed with jabber_id_free().  Release it with jabber_id_unref().
+ *
+ * @return A new reference to the interned JabberID, or NULL if str is not
+ *         a valid JID.
+ */
+const JabberID *jabber_id_intern(const char *str);
+const JabberID *jabber_id_ref(const JabberID *jid);
+void jabber_id_unref(const JabberID *jid);
+
+/**
+ * The precomputed bare ("node@domain") and full ("node@domain/resource")
+ * forms of an interned JID.  These are owned by the JID and valid as
+ * long as a reference to it is held.
+ */
+const char *jabber_id_interned_get_bare_jid(const JabberID *jid);
+const char *jabber_id_interned_get_full_jid(const JabberID *jid);
+
+/** Drops all cached JIDs. */
+void jabber_id_cache_uninit(void);
+
 char *jabber_get_domain(const char *jid);
 char *jabber_get_resource(const char *jid);
 char *jabber_get_bare_jid(const char *jid);
@@ -821,76 +821,52 @@ jabber_message_get_mimetype_from_ext(const gchar *ext)
 }
 
 static GList *
-jabber_message_xhtml_find_smileys(const char *xhtml)
+jabber_message_xhtml_find_smileys(const GList *matches)
 {
-	GList *smileys = purple_smileys_get_all();
 	GList *found_smileys = NULL;
 
-	for (; smileys ; smileys = g_list_delete_link(smileys, smileys)) {
-		PurpleSmiley *smiley = (PurpleSmiley *) smileys->data;
+	for (; matches ; matches = g_list_next(matches)) {
+		const PurpleSmileyMatch *match = matches->data;
 
-		const gchar *shortcut = purple_smiley_get_shortcut(smiley);
-		const gssize len = strlen(shortcut);
-
-		gchar *escaped = g_markup_escape_text(shortcut, len);
-		const char *pos = strstr(xhtml, escaped);
-
-		if (pos) {
-			found_smileys = g_list_append(found_smileys, smiley);
-		}
-
-		g_free(escaped);
+		if (!g_list_find(found_smileys, match->smiley))
+			found_smileys = g_list_prepend(found_smileys, match->smiley);
 	}
 
-	return found_smileys;
+	return g_list_reverse(found_smileys);
 }
 
 static gchar *
-jabber_message_get_smileyfied_xhtml(const gchar *xhtml, const GList *smileys)
+jabber_message_get_smileyfied_xhtml(const gchar *xhtml, const GList *matches)
 {
 	/* create XML element for all smileys (img tags) */
 	GString *result = g_string_new(NULL);
-	int pos = 0;
-	int length = strlen(xhtml);
-
-	while (pos < length) {
-		const GList *iterator;
-		gboolean found_smiley = FALSE;
-
-		for (iterator = smileys ; iterator ;
-			iterator = g_list_next(iterator)) {
-			const PurpleSmiley *smiley = (PurpleSmiley *) iterator->data;
-			const gchar *shortcut = purple_smiley_get_shortcut(smiley);
-			const gssize len = strlen(shortcut);
-			gchar *escaped = g_markup_escape_text(shortcut, len);
-
-			if (g_str_has_prefix(&(xhtml[pos]), escaped)) {
-				/* we found the current smiley at this position */
-				const JabberData *data =
-					jabber_data_find_local_by_alt(shortcut);
-				xmlnode *img = jabber_data_get_xhtml_im(data, shortcut);
-				int len;
-				gchar *img_text = xmlnode_to_str(img, &len);
-
-				found_smiley = TRUE;
-				result = g_string_append(result, img_text);
-				g_free(img_text);
-				pos += strlen(escaped);
-				g_free(escaped);
-				xmlnode_free(img);
-				break;
-			} else {
-				/* cleanup from the before the next round... */
-				g_free(escaped);
-			}
-		}
-		if (!found_smiley) {
-			/* there was no smiley here, just copy one byte */
-			result = g_string_append_c(result, xhtml[pos]);
-			pos++;
-		}
+	gsize pos = 0;
+
+	for (; matches ; matches = g_list_next(matches)) {
+		const PurpleSmileyMatch *match = matches->data;
+		const gchar *shortcut;
+		const JabberData *data;
+		xmlnode *img;
+		gchar *img_text;
+		int len;
+
+		/* copy the text up to the smiley, then the smiley itself */
+		result = g_string_append_len(result, &(xhtml[pos]),
+			match->offset - pos);
+
+		shortcut = purple_smiley_get_shortcut(match->smiley);
+		data = jabber_data_find_local_by_alt(shortcut);
+		img = jabber_data_get_xhtml_im(data, shortcut);
+		img_text = xmlnode_to_str(img, &len);
+		result = g_string_append(result, img_text);
+		g_free(img_text);
+		xmlnode_free(img);
+
+		pos = match->offset + match->length;
 	}
 
+	result = g_string_append(result, &(xhtml[pos]));
+
 	return g_string_free(result, FALSE);
 }
 
@@ -929,6 +905,27 @@ jabber_conv_support_custom_smileys(JabberStream *js,
 	}
 }
 
+/* Only smileys small enough to send are put in the message */
+static gboolean
+jabber_message_smiley_is_sendable(PurpleSmiley *smiley, gpointer data)
+{
+	gboolean *has_too_large_smiley = data;
+	PurpleStoredImage *image = purple_smiley_get_stored_image(smiley);
+	gboolean sendable = purple_imgstore_get_size(image) <= JABBER_DATA_MAX_SIZE;
+
+	purple_imgstore_unref(image);
+
+	if (!sendable) {
+		*has_too_large_smiley = TRUE;
+		purple_debug_warning("jabber", "Refusing to send smiley %s "
+				"(too large, max is %d)\n",
+				purple_smiley_get_shortcut(smiley),
+				JABBER_DATA_MAX_SIZE);
+	}
+
+	return sendable;
+}
+
 static char *
 jabber_message_smileyfy_xhtml(JabberMessage *jm, const char *xhtml)
 {
@@ -938,13 +935,20 @@ jabber_message_smileyfy_xhtml(JabberMessage *jm, const char *xhtml)
 			account);
 
 	if (jabber_conv_support_custom_smileys(jm->js, conv, jm->to)) {
-		GList *found_smileys = jabber_message_xhtml_find_smileys(xhtml);
+		gboolean has_too_large_smiley = FALSE;
+		GList *matches = purple_smileys_find_all_filtered(xhtml, TRUE,
+			jabber_message_smiley_is_sendable, &has_too_large_smiley);
+
+		if (has_too_large_smiley) {
+			purple_conversation_write(conv, NULL,
+			    _("A custom smiley in the message is too large to send."),
+				PURPLE_MESSAGE_ERROR, time(NULL));
+		}
 
-		if (found_smileys) {
+		if (matches) {
+			GList *found_smileys = jabber_message_xhtml_find_smileys(matches);
 			gchar *smileyfied_xhtml = NULL;
 			const GList *iterator;
-			GList *valid_smileys = NULL;
-			gboolean has_too_large_smiley = FALSE;
 
 			for (iterator = found_smileys; iterator ;
 				iterator = g_list_next(iterator)) {
@@ -952,43 +956,30 @@ jabber_message_smileyfy_xhtml(JabberMessage *jm, const char *xhtml)
 				const gchar *shortcut = purple_smiley_get_shortcut(smiley);
 				const JabberData *data =
 					jabber_data_find_local_by_alt(shortcut);
-				PurpleStoredImage *image = purple_smiley_get_stored_image(smiley);
-
-				if (purple_imgstore_get_size(image) <= JABBER_DATA_MAX_SIZE) {
-					/* the object has not been sent before */
-					if (!data) {
-						const gchar *ext = purple_imgstore_get_extension(image);
-						JabberStream *js = jm->js;
-
-						JabberData *new_data =
-							jabber_data_create_from_data(purple_imgstore_get_data(image),
-								purple_imgstore_get_size(image),
-								jabber_message_get_mimetype_from_ext(ext), FALSE, js);
-						purple_debug_info("jabber",
-							"cache local smiley alt = %s, cid = %s\n",
-							shortcut, jabber_data_get_cid(new_data));
-						jabber_data_associate_local(new_data, shortcut);
-					}
-					valid_smileys = g_list_append(valid_smileys, smiley);
-				} else {
-					has_too_large_smiley = TRUE;
-					purple_debug_warning("jabber", "Refusing to send smiley %s "
-							"(too large, max is %d)\n",
-							purple_smiley_get_shortcut(smiley),
-							JABBER_DATA_MAX_SIZE);
-				}
-			}
 
-			if (has_too_large_smiley) {
-				purple_conversation_write(conv, NULL,
-				    _("A custom smiley in the message is too large to send."),
-					PURPLE_MESSAGE_ERROR, time(NULL));
+				/* the object has not been sent before */
+				if (!data) {
+					PurpleStoredImage *image = purple_smiley_get_stored_image(smiley);
+					const gchar *ext = purple_imgstore_get_extension(image);
+					JabberStream *js = jm->js;
+
+					JabberData *new_data =
+						jabber_data_create_from_data(purple_imgstore_get_data(image),
+							purple_imgstore_get_size(image),
+							jabber_message_get_mimetype_from_ext(ext), FALSE, js);
+					purple_debug_info("jabber",
+						"cache local smiley alt = %s, cid = %s\n",
+						shortcut, jabber_data_get_cid(new_data));
+					jabber_data_associate_local(new_data, shortcut);
+					purple_imgstore_unref(image);
+				}
 			}
 
-			smileyfied_xhtml =
-				jabber_message_get_smileyfied_xhtml(xhtml, valid_smileys);
+			smileyfied_xhtml = jabber_message_get_smileyfied_xhtml(xhtml,
+				matches);
 			g_list_free(found_smileys);
-			g_list_free(valid_smileys);
+			for (; matches ; matches = g_list_delete_link(matches, matches))
+				g_free(matches->data);
 
 			return smileyfied_xhtml;
 		}
@@ -43,7 +43,14 @@ jabber_parser_element_start_libxml(void *user_data,
 
 	if(!element_name) {
 		return;
-	} else if (js->stream_id == NULL) {
+	} else if (js->bosh && js->current == NULL &&
+			(0 != xmlStrcmp(element_name, (xmlChar *) "body") ||
+			 0 != xmlStrcmp(namespace, (xmlChar *) NS_BOSH))) {
+		/* Every BOSH response is its own document wrapped in a <body/> */
+		purple_debug_warning("jabber", "BOSH: Expecting body, got %s with "
+		                     "xmlns %s\n", element_name, namespace);
+		return;
+	} else if (!js->bosh && js->stream_id == NULL) {
 		/* Sanity checking! */
 		if (0 != xmlStrcmp(element_name, (xmlChar *) "stream") ||
 				0 != xmlStrcmp(namespace, (xmlChar *) NS_XMPP_STREAMS)) {
@@ -148,9 +155,40 @@ jabber_parser_element_start_libxml(void *user_data,
 		}
 
 		js->current = node;
+
+		/*
+		 * The <body/> wrapper of a BOSH response only carries session
+		 * attributes, so hand those over now; its children are dispatched
+		 * one by one as they complete (see the end handler).
+		 */
+		if (js->bosh && node->parent == NULL)
+			jabber_bosh_connection_body_start(js->bosh, node);
 	}
 }
 
+static void
+jabber_parser_unlink_child(xmlnode *parent, xmlnode *child)
+{
+	xmlnode *prev = NULL, *sibling;
+
+	for (sibling = parent->child; sibling && sibling != child;
+			sibling = sibling->next)
+		prev = sibling;
+
+	if (sibling == NULL)
+		return;
+
+	if (prev)
+		prev->next = child->next;
+	else
+		parent->child = child->next;
+	if (parent->lastchild == child)
+		parent->lastchild = prev;
+
+	child->parent = NULL;
+	child->next = NULL;
+}
+
 static void
 jabber_parser_element_end_libxml(void *user_data, const xmlChar *element_name,
 				 const xmlChar *prefix, const xmlChar *namespace)
@@ -161,11 +199,27 @@ jabber_parser_element_end_libxml(void *user_data, const xmlChar *element_name,
 		return;
 
 	if(js->current->parent) {
-		if(!xmlStrcmp((xmlChar*) js->current->name, element_name))
+		if(xmlStrcmp((xmlChar*) js->current->name, element_name))
+			return;
+
+		if (js->bosh && js->current->parent->parent == NULL) {
+			/* A stanza inside a BOSH <body/>; don't wait for the rest */
+			xmlnode *packet = js->current;
+			js->current = packet->parent;
+			jabber_parser_unlink_child(js->current, packet);
+			jabber_bosh_connection_stanza_received(js->bosh, &packet);
+			if (packet != NULL)
+				xmlnode_free(packet);
+		} else
 			js->current = js->current->parent;
 	} else {
 		xmlnode *packet = js->current;
 		js->current = NULL;
+		if (js->bosh) {
+			/* The stanzas of this <body/> have all been dispatched */
+			xmlnode_free(packet);
+			return;
+		}
 		jabber_process_packet(js, &packet);
 		if (packet != NULL)
 			xmlnode_free(packet);
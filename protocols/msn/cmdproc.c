@@ -88,25 +88,21 @@ show_debug_cmd(MsnCmdProc *cmdproc, gboolean incoming, const char *command)
 {
 	MsnServConn *servconn;
 	const char *names[] = { "NS", "SB" };
-	char *show;
 	char tmp;
 	size_t len;
 
 	servconn = cmdproc->servconn;
 	len = strlen(command);
-	show = g_strdup(command);
 
 	tmp = (incoming) ? 'S' : 'C';
 
-	if ((show[len - 1] == '\n') && (show[len - 2] == '\r'))
+	if (len >= 2 && (command[len - 1] == '\n') && (command[len - 2] == '\r'))
 	{
-		show[len - 2] = '\0';
+		len -= 2;
 	}
 
-	purple_debug_misc("msn", "%c: %s %03d: %s\n", tmp,
-					names[servconn->type], servconn->num, show);
-
-	g_free(show);
+	purple_debug_misc("msn", "%c: %s %03d: %.*s\n", tmp,
+					names[servconn->type], servconn->num, (int)len, command);
 }
 
 gboolean
@@ -51,8 +51,27 @@ msn_command_from_string(const char *string)
 
 	if (param_start)
 	{
+		char *c;
+		int count = 1;
+
 		*param_start++ = '\0';
-		cmd->params = g_strsplit_set(param_start, " ", 0);
+
+		/*
+		 * The parameters point into our copy of the command, so that
+		 * there is just one allocation for all of them.  Like
+		 * g_strsplit_set, every space ends one.
+		 */
+		for (c = param_start; (c = strchr(c, ' ')) != NULL; c++)
+			count++;
+
+		cmd->params = g_new(char *, count + 1);
+		cmd->params[0] = param_start;
+		for (c = param_start, count = 1; (c = strchr(c, ' ')) != NULL; )
+		{
+			*c++ = '\0';
+			cmd->params[count++] = c;
+		}
+		cmd->params[count] = NULL;
 	}
 
 	if (cmd->params != NULL)
@@ -84,7 +103,7 @@ msn_command_destroy(MsnCommand *cmd)
 {
 	g_free(cmd->payload);
 	g_free(cmd->command);
-	g_strfreev(cmd->params);
+	g_free(cmd->params);
 	g_free(cmd);
 }
 
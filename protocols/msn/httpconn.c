@@ -338,11 +338,8 @@ read_cb(gpointer data, gint source, PurpleInputCondition cond)
 		return;
 	}
 
-	g_free(servconn->rx_buf);
-	servconn->rx_buf = result_msg;
-	servconn->rx_len = result_len;
-
-	msn_servconn_process_data(servconn);
+	msn_servconn_feed_data(servconn, result_msg, result_len);
+	g_free(result_msg);
 }
 
 static void
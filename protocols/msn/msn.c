@@ -1458,24 +1458,23 @@ static void msn_emoticon_destroy(MsnEmoticon *emoticon)
 static GSList* msn_msg_grab_emoticons(const char *msg, const char *username)
 {
 	GSList *list;
-	GList *smileys;
+	GList *matches;
 	PurpleSmiley *smiley;
 	PurpleStoredImage *img;
-	char *ptr;
 	MsnEmoticon *emoticon;
-	int length;
+	GHashTable *seen;
 
 	list = NULL;
-	smileys = purple_smileys_get_all();
-	length = strlen(msg);
+	matches = purple_smileys_find_all(msg, FALSE);
+	seen = g_hash_table_new(g_direct_hash, g_direct_equal);
 
-	for (; smileys; smileys = g_list_delete_link(smileys, smileys)) {
-		smiley = smileys->data;
+	for (; matches; matches = g_list_delete_link(matches, matches)) {
+		smiley = ((PurpleSmileyMatch *)matches->data)->smiley;
+		g_free(matches->data);
 
-		ptr = g_strstr_len(msg, length, purple_smiley_get_shortcut(smiley));
-
-		if (!ptr)
+		if (g_hash_table_lookup(seen, smiley))
 			continue;
+		g_hash_table_insert(seen, smiley, smiley);
 
 		img = purple_smiley_get_stored_image(smiley);
 
@@ -1490,6 +1489,8 @@ static GSList* msn_msg_grab_emoticons(const char *msg, const char *username)
 		list = g_slist_prepend(list, emoticon);
 	}
 
+	g_hash_table_destroy(seen);
+
 	return list;
 }
 
@@ -29,6 +29,10 @@
 
 static void read_cb(gpointer data, gint source, PurpleInputCondition cond);
 static void servconn_timeout_renew(MsnServConn *servconn);
+static void servconn_output_error_cb(PurpleOutputBatch *batch, int error,
+		gpointer data);
+static void servconn_output_written_cb(PurpleOutputBatch *batch, gsize len,
+		gpointer data);
 
 /**************************************************************************
  * Main
@@ -53,8 +57,10 @@ msn_servconn_new(MsnSession *session, MsnServConnType type)
 
 	servconn->num = session->servconns_count++;
 
-	servconn->tx_buf = purple_circ_buffer_new(MSN_BUF_LEN);
-	servconn->tx_handler = 0;
+	servconn->output = purple_output_batch_new(servconn_output_error_cb,
+			servconn);
+	purple_output_batch_set_written_cb(servconn->output,
+			servconn_output_written_cb);
 	servconn->timeout_sec = 0;
 	servconn->timeout_handle = 0;
 
@@ -84,13 +90,12 @@ msn_servconn_destroy(MsnServConn *servconn)
 
 	g_free(servconn->host);
 
-	purple_circ_buffer_destroy(servconn->tx_buf);
-	if (servconn->tx_handler > 0)
-		purple_input_remove(servconn->tx_handler);
+	purple_output_batch_destroy(servconn->output);
 	if (servconn->timeout_handle > 0)
 		purple_timeout_remove(servconn->timeout_handle);
 
 	msn_cmdproc_destroy(servconn->cmdproc);
+	g_free(servconn->rx_buf);
 	g_free(servconn);
 }
 
@@ -190,6 +195,7 @@ connect_cb(gpointer data, gint source, const char *error_message)
 	if (source >= 0)
 	{
 		servconn->connected = TRUE;
+		purple_output_batch_set_transport(servconn->output, source, NULL);
 
 		/* Someone wants to know we connected. */
 		servconn->connect_cb(servconn);
@@ -274,6 +280,8 @@ msn_servconn_disconnect(MsnServConn *servconn)
 		return;
 	}
 
+	servconn->connected = FALSE;
+
 	if (servconn->inpa > 0)
 	{
 		purple_input_remove(servconn->inpa);
@@ -286,14 +294,15 @@ msn_servconn_disconnect(MsnServConn *servconn)
 		servconn->timeout_handle = 0;
 	}
 
+	/* Get anything still queued (such as OUT) on the wire before closing */
+	purple_output_batch_set_transport(servconn->output, -1, NULL);
+
 	close(servconn->fd);
 
-	servconn->rx_buf = NULL;
+	/* The buffer itself may still be in use by msn_servconn_process_data */
 	servconn->rx_len = 0;
 	servconn->payload_len = 0;
 
-	servconn->connected = FALSE;
-
 	if (servconn->disconnect_cb != NULL)
 		servconn->disconnect_cb(servconn);
 }
@@ -309,13 +318,18 @@ servconn_idle_timeout_cb(MsnServConn *servconn)
 static void
 servconn_timeout_renew(MsnServConn *servconn)
 {
+	/* This happens for every packet, so push the timer back in place */
+	if (servconn->connected && servconn->timeout_sec &&
+			purple_timeout_restart(servconn->timeout_handle))
+		return;
+
 	if (servconn->timeout_handle) {
 		purple_timeout_remove(servconn->timeout_handle);
 		servconn->timeout_handle = 0;
 	}
 
 	if (servconn->connected && servconn->timeout_sec) {
-		servconn->timeout_handle = purple_timeout_add_seconds(
+		servconn->timeout_handle = purple_timeout_wheel_add_seconds(
 			servconn->timeout_sec, (GSourceFunc)servconn_idle_timeout_cb, servconn);
 	}
 }
@@ -323,37 +337,33 @@ servconn_timeout_renew(MsnServConn *servconn)
 void
 msn_servconn_set_idle_timeout(MsnServConn *servconn, guint seconds)
 {
+	/* A restarted timer would keep the old interval */
+	if (servconn->timeout_handle && seconds != servconn->timeout_sec) {
+		purple_timeout_remove(servconn->timeout_handle);
+		servconn->timeout_handle = 0;
+	}
+
 	servconn->timeout_sec = seconds;
 	if (servconn->connected)
 		servconn_timeout_renew(servconn);
 }
 
 static void
-servconn_write_cb(gpointer data, gint source, PurpleInputCondition cond)
+servconn_output_error_cb(PurpleOutputBatch *batch, int error, gpointer data)
 {
 	MsnServConn *servconn = data;
-	gssize ret;
-	int writelen;
 
-	writelen = purple_circ_buffer_get_max_read(servconn->tx_buf);
-
-	if (writelen == 0) {
-		purple_input_remove(servconn->tx_handler);
-		servconn->tx_handler = 0;
+	/* A failed final flush while disconnecting is not worth reporting */
+	if (!servconn->connected)
 		return;
-	}
 
-	ret = write(servconn->fd, servconn->tx_buf->outptr, writelen);
-
-	if (ret < 0 && errno == EAGAIN)
-		return;
-	else if (ret <= 0) {
-		msn_servconn_got_error(servconn, MSN_SERVCONN_ERROR_WRITE, NULL);
-		return;
-	}
+	msn_servconn_got_error(servconn, MSN_SERVCONN_ERROR_WRITE, NULL);
+}
 
-	purple_circ_buffer_mark_read(servconn->tx_buf, ret);
-	servconn_timeout_renew(servconn);
+static void
+servconn_output_written_cb(PurpleOutputBatch *batch, gsize len, gpointer data)
+{
+	servconn_timeout_renew(data);
 }
 
 gssize
@@ -365,38 +375,10 @@ msn_servconn_write(MsnServConn *servconn, const char *buf, size_t len)
 
 	if (!servconn->session->http_method)
 	{
-		if (servconn->tx_handler == 0) {
-			switch (servconn->type)
-			{
-				case MSN_SERVCONN_NS:
-				case MSN_SERVCONN_SB:
-					ret = write(servconn->fd, buf, len);
-					break;
-#if 0
-				case MSN_SERVCONN_DC:
-					ret = write(servconn->fd, &buf, sizeof(len));
-					ret = write(servconn->fd, buf, len);
-					break;
-#endif
-				default:
-					ret = write(servconn->fd, buf, len);
-					break;
-			}
-		} else {
-			ret = -1;
-			errno = EAGAIN;
-		}
-
-		if (ret < 0 && errno == EAGAIN)
-			ret = 0;
-		if (ret >= 0 && ret < len) {
-			if (servconn->tx_handler == 0)
-				servconn->tx_handler = purple_input_add(
-					servconn->fd, PURPLE_INPUT_WRITE,
-					servconn_write_cb, servconn);
-			purple_circ_buffer_append(servconn->tx_buf, buf + ret,
-				len - ret);
-		}
+		/* Commands are coalesced and sent when we return to the event
+		 * loop; write errors are reported via servconn_output_error_cb */
+		purple_output_batch_write(servconn->output, buf, len);
+		ret = len;
 	}
 	else
 	{
@@ -412,11 +394,25 @@ msn_servconn_write(MsnServConn *servconn, const char *buf, size_t len)
 	return ret;
 }
 
+/*
+ * Makes room for at least want more bytes, and the NUL that is kept after
+ * the data, at the end of the receive buffer.
+ */
+static void
+servconn_rx_reserve(MsnServConn *servconn, gsize want)
+{
+	gsize need = servconn->rx_len + want + 1;
+
+	if (need > servconn->rx_size) {
+		servconn->rx_size = MAX(servconn->rx_size * 2, need);
+		servconn->rx_buf = g_realloc(servconn->rx_buf, servconn->rx_size);
+	}
+}
+
 static void
 read_cb(gpointer data, gint source, PurpleInputCondition cond)
 {
 	MsnServConn *servconn;
-	char buf[MSN_BUF_LEN];
 	gssize len;
 
 	servconn = data;
@@ -424,7 +420,10 @@ read_cb(gpointer data, gint source, PurpleInputCondition cond)
 	if (servconn->type == MSN_SERVCONN_NS)
 		servconn->session->account->gc->last_received = time(NULL);
 
-	len = read(servconn->fd, buf, sizeof(buf) - 1);
+	/* Read straight onto the end of whatever is waiting to be processed */
+	servconn_rx_reserve(servconn, MSN_BUF_LEN);
+	len = read(servconn->fd, servconn->rx_buf + servconn->rx_len,
+		servconn->rx_size - servconn->rx_len - 1);
 	if (len < 0 && errno == EAGAIN)
 		return;
 	if (len <= 0) {
@@ -436,72 +435,75 @@ read_cb(gpointer data, gint source, PurpleInputCondition cond)
 		return;
 	}
 
-	buf[len] = '\0';
-
-	servconn->rx_buf = g_realloc(servconn->rx_buf, len + servconn->rx_len + 1);
-	memcpy(servconn->rx_buf + servconn->rx_len, buf, len + 1);
 	servconn->rx_len += len;
+	servconn->rx_buf[servconn->rx_len] = '\0';
 
 	servconn = msn_servconn_process_data(servconn);
 	if (servconn)
 		servconn_timeout_renew(servconn);
 }
 
+MsnServConn *
+msn_servconn_feed_data(MsnServConn *servconn, const char *data, gsize len)
+{
+	servconn_rx_reserve(servconn, len);
+	memcpy(servconn->rx_buf + servconn->rx_len, data, len);
+	servconn->rx_len += len;
+	servconn->rx_buf[servconn->rx_len] = '\0';
+
+	return msn_servconn_process_data(servconn);
+}
+
 MsnServConn *msn_servconn_process_data(MsnServConn *servconn)
 {
-	char *cur, *end, *old_rx_buf;
-	int cur_len;
+	char *cur, *end, *buf_end;
 
-	end = old_rx_buf = servconn->rx_buf;
+	cur = servconn->rx_buf;
+	buf_end = cur + servconn->rx_len;
 
 	servconn->processing = TRUE;
 
-	do
+	while (servconn->connected && !servconn->wasted && cur < buf_end)
 	{
-		cur = end;
-
 		if (servconn->payload_len)
 		{
-			if (servconn->payload_len > servconn->rx_len)
+			gsize payload_len = servconn->payload_len;
+
+			if (payload_len > (gsize)(buf_end - cur))
 				/* The payload is still not complete. */
 				break;
 
-			cur_len = servconn->payload_len;
-			end += cur_len;
+			servconn->payload_len = 0;
+			msn_cmdproc_process_payload(servconn->cmdproc, cur, payload_len);
+			cur += payload_len;
 		}
 		else
 		{
-			end = strstr(cur, "\r\n");
+			/* Commands end with \r\n; a bare \n doesn't count */
+			end = cur;
+			while ((end = memchr(end, '\n', buf_end - end)) != NULL &&
+					(end == cur || end[-1] != '\r'))
+				end++;
 
 			if (end == NULL)
 				/* The command is still not complete. */
 				break;
 
-			*end = '\0';
-			end += 2;
-			cur_len = end - cur;
-		}
-
-		servconn->rx_len -= cur_len;
-
-		if (servconn->payload_len)
-		{
-			msn_cmdproc_process_payload(servconn->cmdproc, cur, cur_len);
-			servconn->payload_len = 0;
-		}
-		else
-		{
+			end[-1] = '\0';
 			msn_cmdproc_process_cmd_text(servconn->cmdproc, cur);
+			cur = end + 1;
 			servconn->payload_len = servconn->cmdproc->last_cmd->payload_len;
 		}
-	} while (servconn->connected && !servconn->wasted && servconn->rx_len > 0);
+	}
 
 	if (servconn->connected && !servconn->wasted)
 	{
-		if (servconn->rx_len > 0)
-			servconn->rx_buf = g_memdup(cur, servconn->rx_len);
-		else
-			servconn->rx_buf = NULL;
+		/* Move the incomplete command or payload to the front */
+		servconn->rx_len = buf_end - cur;
+		if (cur != servconn->rx_buf && servconn->rx_len > 0)
+			memmove(servconn->rx_buf, cur, servconn->rx_len);
+		if (servconn->rx_buf != NULL)
+			servconn->rx_buf[servconn->rx_len] = '\0';
 	}
 
 	servconn->processing = FALSE;
@@ -511,7 +513,6 @@ MsnServConn *msn_servconn_process_data(MsnServConn *servconn)
 		servconn = NULL;
 	}
 
-	g_free(old_rx_buf);
 	return servconn;
 }
 
@@ -47,6 +47,7 @@ typedef enum
 } MsnServConnType;
 
 #include "internal.h"
+#include "outputbatch.h"
 #include "proxy.h"
 
 #include "cmdproc.h"
@@ -78,15 +79,16 @@ struct _MsnServConn
 	int fd; /**< The connection's file descriptor. */
 	int inpa; /**< The connection's input handler. */
 
-	char *rx_buf; /**< The receive buffer. */
-	int rx_len; /**< The receive buffer lenght. */
+	char *rx_buf; /**< The receive buffer.  Data that hasn't been
+					processed yet is kept at the front of it. */
+	gsize rx_size; /**< The size of the receive buffer. */
+	gsize rx_len; /**< The length of the data in the receive buffer. */
 
 	size_t payload_len; /**< The length of the payload.
 						  It's only set when we've received a command that
 						  has a payload. */
 
-	PurpleCircBuffer *tx_buf;
-	guint tx_handler;
+	PurpleOutputBatch *output; /**< Coalesces outgoing commands. */
 	guint timeout_sec;
 	guint timeout_handle;
 
@@ -182,6 +184,19 @@ void msn_servconn_got_error(MsnServConn *servconn, MsnServConnError error,
  */
 MsnServConn *msn_servconn_process_data(MsnServConn *servconn);
 
+/**
+ * Add data received some other way than from the socket, such as through
+ * the HTTP method, to servconn->rx_buf and process it.
+ *
+ * @param servconn The servconn.
+ * @param data     The data received.
+ * @param len      The length of the data.
+ *
+ * @return @c NULL if servconn was destroyed, 'servconn' otherwise.
+ */
+MsnServConn *msn_servconn_feed_data(MsnServConn *servconn, const char *data,
+                                    gsize len);
+
 /**
  * Set a idle timeout fot this servconn
  *
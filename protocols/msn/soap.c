@@ -39,49 +39,92 @@
 
 #define SOAP_TIMEOUT (5 * 60)
 
+/*
+ * How many connections to open to one host.  Each one still carries a
+ * single request at a time, so a response is always matched to the
+ * request that was sent on its connection.
+ */
+#define SOAP_MAX_CONNECTIONS 4
+
 typedef struct _MsnSoapRequest {
+	guint id;
 	char *path;
 	MsnSoapMessage *message;
 	gboolean secure;
 	MsnSoapCallback cb;
 	gpointer cb_data;
+	/* Some of it went out, so it may have been acted on */
+	gboolean written;
 } MsnSoapRequest;
 
+typedef struct _MsnSoapHost MsnSoapHost;
+
 typedef struct _MsnSoapConnection {
-	MsnSession *session;
-	char *host;
+	MsnSoapHost *host;
 
-	time_t last_used;
 	PurpleSslConnection *ssl;
 	gboolean connected;
 
 	guint event_handle;
-	guint run_timer;
 	GString *buf;
 	gsize handled_len;
 	gsize body_len;
+	gsize body_read;
+	xmlnode_parser *parser;
 	int response_code;
 	gboolean headers_done;
 	gboolean close_when_done;
 
 	MsnSoapMessage *message;
 
-	GQueue *queue;
 	MsnSoapRequest *current_request;
 } MsnSoapConnection;
 
-static gboolean msn_soap_connection_run(gpointer data);
+/* The connections to one host, which share its queue of requests */
+struct _MsnSoapHost {
+	MsnSession *session;
+	char *name;
+	char *hostname;
+	int port;
+
+	time_t last_used;
+	guint run_timer;
+	guint next_id;
+
+	GQueue *queue;
+	MsnSoapConnection *conns[SOAP_MAX_CONNECTIONS];
+};
+
+static gboolean msn_soap_host_run(gpointer data);
 
 static MsnSoapConnection *
-msn_soap_connection_new(MsnSession *session, const char *host)
+msn_soap_connection_new(MsnSoapHost *host)
 {
 	MsnSoapConnection *conn = g_new0(MsnSoapConnection, 1);
-	conn->session = session;
-	conn->host = g_strdup(host);
-	conn->queue = g_queue_new();
+	conn->host = host;
 	return conn;
 }
 
+/* name is a host name, with a port number after it unless it's 443 */
+static MsnSoapHost *
+msn_soap_host_new(MsnSession *session, const char *name)
+{
+	MsnSoapHost *host = g_new0(MsnSoapHost, 1);
+	const char *colon = strrchr(name, ':');
+
+	host->session = session;
+	host->name = g_strdup(name);
+	if (colon != NULL && sscanf(colon + 1, "%d", &host->port) == 1) {
+		host->hostname = g_strndup(name, colon - name);
+	} else {
+		host->hostname = g_strdup(name);
+		host->port = 443;
+	}
+	host->queue = g_queue_new();
+
+	return host;
+}
+
 static void
 msn_soap_message_destroy(MsnSoapMessage *message)
 {
@@ -110,11 +153,6 @@ msn_soap_connection_sanitize(MsnSoapConnection *conn, gboolean disconnect)
 		conn->event_handle = 0;
 	}
 
-	if (conn->run_timer) {
-		purple_timeout_remove(conn->run_timer);
-		conn->run_timer = 0;
-	}
-
 	if (conn->message) {
 		msn_soap_message_destroy(conn->message);
 		conn->message = NULL;
@@ -125,6 +163,13 @@ msn_soap_connection_sanitize(MsnSoapConnection *conn, gboolean disconnect)
 		conn->buf = NULL;
 	}
 
+	if (conn->parser) {
+		xmlnode *node = xmlnode_parser_finish(conn->parser);
+		if (node)
+			xmlnode_free(node);
+		conn->parser = NULL;
+	}
+
 	if (conn->ssl && (disconnect || conn->close_when_done)) {
 		purple_ssl_close(conn->ssl);
 		conn->ssl = NULL;
@@ -156,21 +201,38 @@ msn_soap_connection_destroy(MsnSoapConnection *conn)
 	}
 
 	msn_soap_connection_sanitize(conn, TRUE);
-	g_queue_foreach(conn->queue, msn_soap_connection_destroy_foreach_cb, conn);
-	g_queue_free(conn->queue);
-
-	g_free(conn->host);
 	g_free(conn);
 }
 
+static void
+msn_soap_host_destroy(MsnSoapHost *host)
+{
+	int i;
+
+	if (host->run_timer)
+		purple_timeout_remove(host->run_timer);
+
+	for (i = 0; i < SOAP_MAX_CONNECTIONS; i++) {
+		if (host->conns[i])
+			msn_soap_connection_destroy(host->conns[i]);
+	}
+
+	g_queue_foreach(host->queue, msn_soap_connection_destroy_foreach_cb, host);
+	g_queue_free(host->queue);
+
+	g_free(host->name);
+	g_free(host->hostname);
+	g_free(host);
+}
+
 static gboolean
 msn_soap_cleanup_each(gpointer key, gpointer value, gpointer data)
 {
-	MsnSoapConnection *conn = value;
+	MsnSoapHost *host = value;
 	time_t *t = data;
 
-	if ((*t - conn->last_used) > SOAP_TIMEOUT * 2) {
-		purple_debug_info("soap", "cleaning up soap conn %p\n", conn);
+	if ((*t - host->last_used) > SOAP_TIMEOUT * 2) {
+		purple_debug_info("soap", "cleaning up soap host %s\n", host->name);
 		return TRUE;
 	}
 
@@ -197,30 +259,37 @@ msn_soap_cleanup_for_session(gpointer data)
 	return FALSE;
 }
 
-static MsnSoapConnection *
-msn_soap_get_connection(MsnSession *session, const char *host)
+static MsnSoapHost *
+msn_soap_get_host(MsnSession *session, const char *name)
 {
-	MsnSoapConnection *conn = NULL;
+	MsnSoapHost *host = NULL;
 
 	if (session->soap_table) {
-		conn = g_hash_table_lookup(session->soap_table, host);
+		host = g_hash_table_lookup(session->soap_table, name);
 	} else {
 		session->soap_table = g_hash_table_new_full(g_str_hash, g_str_equal,
-			NULL, (GDestroyNotify)msn_soap_connection_destroy);
+			NULL, (GDestroyNotify)msn_soap_host_destroy);
 	}
 
 	if (session->soap_cleanup_handle == 0)
 		session->soap_cleanup_handle = purple_timeout_add_seconds(SOAP_TIMEOUT,
 			msn_soap_cleanup_for_session, session);
 
-	if (conn == NULL) {
-		conn = msn_soap_connection_new(session, host);
-		g_hash_table_insert(session->soap_table, conn->host, conn);
+	if (host == NULL) {
+		host = msn_soap_host_new(session, name);
+		g_hash_table_insert(session->soap_table, host->name, host);
 	}
 
-	conn->last_used = time(NULL);
+	host->last_used = time(NULL);
 
-	return conn;
+	return host;
+}
+
+static void
+msn_soap_host_schedule(MsnSoapHost *host)
+{
+	if (host->run_timer == 0)
+		host->run_timer = purple_timeout_add(0, msn_soap_host_run, host);
 }
 
 static void
@@ -228,7 +297,7 @@ msn_soap_connection_handle_next(MsnSoapConnection *conn)
 {
 	msn_soap_connection_sanitize(conn, FALSE);
 
-	conn->run_timer = purple_timeout_add(0, msn_soap_connection_run, conn);
+	msn_soap_host_schedule(conn->host);
 }
 
 static void
@@ -236,9 +305,10 @@ msn_soap_message_send_internal(MsnSession *session, MsnSoapMessage *message,
 	const char *host, const char *path, gboolean secure,
 	MsnSoapCallback cb, gpointer cb_data, gboolean first)
 {
-	MsnSoapConnection *conn = msn_soap_get_connection(session, host);
+	MsnSoapHost *soap_host = msn_soap_get_host(session, host);
 	MsnSoapRequest *req = g_new0(MsnSoapRequest, 1);
 
+	req->id = ++soap_host->next_id;
 	req->path = g_strdup(path);
 	req->message = message;
 	req->secure = secure;
@@ -246,14 +316,12 @@ msn_soap_message_send_internal(MsnSession *session, MsnSoapMessage *message,
 	req->cb_data = cb_data;
 
 	if (first) {
-		g_queue_push_head(conn->queue, req);
+		g_queue_push_head(soap_host->queue, req);
 	} else {
-		g_queue_push_tail(conn->queue, req);
+		g_queue_push_tail(soap_host->queue, req);
 	}
 
-	if (conn->run_timer == 0)
-		conn->run_timer = purple_timeout_add(0, msn_soap_connection_run,
-			conn);
+	msn_soap_host_schedule(soap_host);
 }
 
 void
@@ -272,17 +340,25 @@ static gboolean
 msn_soap_handle_redirect(MsnSoapConnection *conn, const char *url)
 {
 	char *host;
+	int port;
 	char *path;
 
-	if (purple_url_parse(url, &host, NULL, &path, NULL, NULL)) {
+	if (purple_url_parse(url, &host, &port, &path, NULL, NULL)) {
 		MsnSoapRequest *req = conn->current_request;
+		char *name;
 		conn->current_request = NULL;
 
-		msn_soap_message_send_internal(conn->session, req->message, host, path,
-			req->secure, req->cb, req->cb_data, TRUE);
+		if (port == 443)
+			name = g_strdup(host);
+		else
+			name = g_strdup_printf("%s:%d", host, port);
+
+		msn_soap_message_send_internal(conn->host->session, req->message,
+			name, path, req->secure, req->cb, req->cb_data, TRUE);
 
 		msn_soap_request_destroy(req, TRUE);
 
+		g_free(name);
 		g_free(host);
 		g_free(path);
 
@@ -325,7 +401,7 @@ msn_soap_handle_body(MsnSoapConnection *conn, MsnSoapMessage *response)
 					reasondata = xmlnode_get_data(reason);
 
 				msn_soap_connection_sanitize(conn, TRUE);
-				msn_session_set_error(conn->session, MSN_ERROR_AUTH,
+				msn_session_set_error(conn->host->session, MSN_ERROR_AUTH,
 					reasondata);
 
 				g_free(reasondata);
@@ -381,9 +457,9 @@ msn_soap_process(MsnSoapConnection *conn)
 					conn->ssl = NULL;
 					handled = TRUE;
 					break;
-				} else if (conn->response_code == 503 && conn->session->login_step < MSN_LOGIN_STEP_END) {
+				} else if (conn->response_code == 503 && conn->host->session->login_step < MSN_LOGIN_STEP_END) {
 					msn_soap_connection_sanitize(conn, TRUE);
-					msn_session_set_error(conn->session, MSN_ERROR_SERV_UNAVAILABLE, NULL);
+					msn_session_set_error(conn->host->session, MSN_ERROR_SERV_UNAVAILABLE, NULL);
 					return;
 				}
 			} else if (cursor == linebreak) {
@@ -424,7 +500,7 @@ msn_soap_process(MsnSoapConnection *conn)
 					}
 
 					msn_soap_connection_sanitize(conn, TRUE);
-					msn_session_set_error(conn->session, MSN_ERROR_AUTH,
+					msn_session_set_error(conn->host->session, MSN_ERROR_AUTH,
 						error ? purple_url_decode(error) : NULL);
 
 					g_free(line);
@@ -446,13 +522,34 @@ msn_soap_process(MsnSoapConnection *conn)
 	}
 
 	if (!handled && conn->headers_done) {
-		if (conn->buf->len - conn->handled_len >=
-			conn->body_len) {
-			xmlnode *node = xmlnode_from_str(cursor, conn->body_len);
+		gsize len = MIN(conn->buf->len - conn->handled_len,
+			conn->body_len - conn->body_read);
+
+		/* Parse the body as it arrives rather than holding all of it */
+		if (conn->parser == NULL)
+			conn->parser = xmlnode_parser_new();
+
+		if (len > 0) {
+			xmlnode_parser_feed(conn->parser, cursor, len);
+			conn->body_read += len;
+			conn->handled_len += len;
+		}
+
+		if (conn->handled_len == conn->buf->len) {
+			g_string_truncate(conn->buf, 0);
+			conn->handled_len = 0;
+		}
+
+		if (conn->body_read >= conn->body_len) {
+			xmlnode *node = xmlnode_parser_finish(conn->parser);
+			conn->parser = NULL;
+
+			if (conn->current_request)
+				purple_debug_info("soap", "response %d to request %u\n",
+					conn->response_code, conn->current_request->id);
 
 			if (node == NULL) {
-				purple_debug_info("soap", "Malformed SOAP response: %s\n",
-					cursor);
+				purple_debug_info("soap", "Malformed SOAP response\n");
 			} else {
 				MsnSoapMessage *message = conn->message;
 				conn->message = NULL;
@@ -554,6 +651,7 @@ msn_soap_write_cb_internal(gpointer data, gint fd, PurpleInputCondition cond,
 	}
 
 	conn->handled_len += written;
+	conn->current_request->written = TRUE;
 
 	if (conn->handled_len < conn->buf->len)
 		return TRUE;
@@ -563,6 +661,7 @@ msn_soap_write_cb_internal(gpointer data, gint fd, PurpleInputCondition cond,
 	conn->buf = NULL;
 	conn->handled_len = 0;
 	conn->body_len = 0;
+	conn->body_read = 0;
 	conn->response_code = 0;
 	conn->headers_done = FALSE;
 	conn->close_when_done = FALSE;
@@ -584,11 +683,34 @@ msn_soap_error_cb(PurpleSslConnection *ssl, PurpleSslErrorType error,
 		gpointer data)
 {
 	MsnSoapConnection *conn = data;
+	MsnSoapHost *host = conn->host;
+	int i;
 
 	/* sslconn already frees the connection in case of error */
 	conn->ssl = NULL;
+	conn->connected = FALSE;
+
+	/* A request that never went out goes back to the front of the queue.
+	 * One that did can't safely be sent again, so it gets no response. */
+	if (conn->current_request) {
+		MsnSoapRequest *req = conn->current_request;
+		conn->current_request = NULL;
 
-	g_hash_table_remove(conn->session->soap_table, conn->host);
+		if (req->written)
+			msn_soap_connection_destroy_foreach_cb(req, conn);
+		else
+			g_queue_push_head(host->queue, req);
+	}
+
+	/* The other connections to the host can carry on with the queue */
+	for (i = 0; i < SOAP_MAX_CONNECTIONS; i++) {
+		if (host->conns[i] && host->conns[i]->ssl) {
+			msn_soap_connection_handle_next(conn);
+			return;
+		}
+	}
+
+	g_hash_table_remove(host->session->soap_table, host->name);
 }
 
 static void
@@ -599,8 +721,7 @@ msn_soap_connected_cb(gpointer data, PurpleSslConnection *ssl,
 
 	conn->connected = TRUE;
 
-	if (conn->run_timer == 0)
-		conn->run_timer = purple_timeout_add(0, msn_soap_connection_run, conn);
+	msn_soap_host_schedule(conn->host);
 }
 
 MsnSoapMessage *
@@ -614,73 +735,104 @@ msn_soap_message_new(const char *action, xmlnode *xml)
 	return message;
 }
 
+static void
+msn_soap_connection_send(MsnSoapConnection *conn, MsnSoapRequest *req)
+{
+	int len = -1;
+	char *body = xmlnode_to_str(req->message->xml, &len);
+	GSList *iter;
+
+	conn->buf = g_string_new("");
+
+	g_string_append_printf(conn->buf,
+		"POST /%s HTTP/1.1\r\n"
+		"SOAPAction: %s\r\n"
+		"Content-Type:text/xml; charset=utf-8\r\n"
+		"User-Agent: Mozilla/4.0 (compatible; MSIE 6.0; Windows NT 5.1)\r\n"
+		"Accept: */*\r\n"
+		"Host: %s\r\n"
+		"Content-Length: %d\r\n"
+		"Connection: Keep-Alive\r\n"
+		"Cache-Control: no-cache\r\n",
+		req->path, req->message->action ? req->message->action : "",
+		conn->host->name, len);
+
+	for (iter = req->message->headers; iter; iter = iter->next) {
+		g_string_append(conn->buf, (char *)iter->data);
+		g_string_append(conn->buf, "\r\n");
+	}
+
+	g_string_append(conn->buf, "\r\n");
+	g_string_append(conn->buf, body);
+
+	purple_debug_info("soap", "sending request %u to %s\n", req->id,
+		conn->host->name);
+	if (req->secure && !purple_debug_is_unsafe())
+		purple_debug_misc("soap", "Sending secure request.\n");
+	else
+		purple_debug_misc("soap", "%s\n", conn->buf->str);
+
+	conn->handled_len = 0;
+	conn->current_request = req;
+
+	if (conn->event_handle)
+		purple_input_remove(conn->event_handle);
+	conn->event_handle = purple_input_add(conn->ssl->fd,
+		PURPLE_INPUT_WRITE, msn_soap_write_cb, conn);
+	if (!msn_soap_write_cb_internal(conn, conn->ssl->fd, PURPLE_INPUT_WRITE, TRUE)) {
+		/* Not connected => reconnect and retry */
+		purple_debug_info("soap", "not connected, reconnecting\n");
+
+		conn->connected = FALSE;
+		conn->current_request = NULL;
+		msn_soap_connection_sanitize(conn, FALSE);
+
+		g_queue_push_head(conn->host->queue, req);
+		msn_soap_host_schedule(conn->host);
+	}
+
+	g_free(body);
+}
+
 static gboolean
-msn_soap_connection_run(gpointer data)
+msn_soap_host_run(gpointer data)
 {
-	MsnSoapConnection *conn = data;
-	MsnSoapRequest *req = g_queue_peek_head(conn->queue);
+	MsnSoapHost *host = data;
+	guint waiting;
+	int i;
 
-	conn->run_timer = 0;
+	host->run_timer = 0;
 
-	if (req) {
-		if (conn->ssl == NULL) {
-			conn->ssl = purple_ssl_connect(conn->session->account, conn->host,
-				443, msn_soap_connected_cb, msn_soap_error_cb, conn);
-		} else if (conn->connected) {
-			int len = -1;
-			char *body = xmlnode_to_str(req->message->xml, &len);
-			GSList *iter;
-
-			g_queue_pop_head(conn->queue);
-
-			conn->buf = g_string_new("");
-
-			g_string_append_printf(conn->buf,
-				"POST /%s HTTP/1.1\r\n"
-				"SOAPAction: %s\r\n"
-				"Content-Type:text/xml; charset=utf-8\r\n"
-				"User-Agent: Mozilla/4.0 (compatible; MSIE 6.0; Windows NT 5.1)\r\n"
-				"Accept: */*\r\n"
-				"Host: %s\r\n"
-				"Content-Length: %d\r\n"
-				"Connection: Keep-Alive\r\n"
-				"Cache-Control: no-cache\r\n",
-				req->path, req->message->action ? req->message->action : "",
-				conn->host, len);
-
-			for (iter = req->message->headers; iter; iter = iter->next) {
-				g_string_append(conn->buf, (char *)iter->data);
-				g_string_append(conn->buf, "\r\n");
-			}
+	/* Give the idle connections something to do first */
+	for (i = 0; i < SOAP_MAX_CONNECTIONS && !g_queue_is_empty(host->queue); i++) {
+		MsnSoapConnection *conn = host->conns[i];
 
-			g_string_append(conn->buf, "\r\n");
-			g_string_append(conn->buf, body);
+		if (conn && conn->ssl && conn->connected && conn->current_request == NULL)
+			msn_soap_connection_send(conn, g_queue_pop_head(host->queue));
+	}
 
-			if (req->secure && !purple_debug_is_unsafe())
-				purple_debug_misc("soap", "Sending secure request.\n");
-			else
-				purple_debug_misc("soap", "%s\n", conn->buf->str);
+	/* Each connection still being opened will take one of the rest */
+	waiting = g_queue_get_length(host->queue);
+	for (i = 0; i < SOAP_MAX_CONNECTIONS && waiting > 0; i++) {
+		MsnSoapConnection *conn = host->conns[i];
 
-			conn->handled_len = 0;
-			conn->current_request = req;
-
-			if (conn->event_handle)
-				purple_input_remove(conn->event_handle);
-			conn->event_handle = purple_input_add(conn->ssl->fd,
-				PURPLE_INPUT_WRITE, msn_soap_write_cb, conn);
-			if (!msn_soap_write_cb_internal(conn, conn->ssl->fd, PURPLE_INPUT_WRITE, TRUE)) {
-				/* Not connected => reconnect and retry */
-				purple_debug_info("soap", "not connected, reconnecting\n");
-
-				conn->connected = FALSE;
-				conn->current_request = NULL;
-				msn_soap_connection_sanitize(conn, FALSE);
-
-				g_queue_push_head(conn->queue, req);
-				conn->run_timer = purple_timeout_add(0, msn_soap_connection_run, conn);
-			}
+		if (conn && conn->ssl && !conn->connected)
+			waiting--;
+	}
+
+	/* And open new ones for whatever is left over */
+	for (i = 0; i < SOAP_MAX_CONNECTIONS && waiting > 0; i++) {
+		MsnSoapConnection *conn = host->conns[i];
 
-			g_free(body);
+		if (conn == NULL)
+			conn = host->conns[i] = msn_soap_connection_new(host);
+
+		if (conn->ssl == NULL) {
+			conn->connected = FALSE;
+			conn->ssl = purple_ssl_connect(host->session->account,
+				host->hostname, host->port, msn_soap_connected_cb,
+				msn_soap_error_cb, conn);
+			waiting--;
 		}
 	}
 
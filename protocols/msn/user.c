@@ -209,13 +209,28 @@ msn_user_set_state(MsnUser *user, const char *state)
 	user->status = status;
 }
 
+/*
+ * The user list looks users up by passport, uid and mobile phone, so keep
+ * it in the loop whenever one of those changes.
+ */
+static gboolean
+msn_user_unindex(MsnUser *user)
+{
+	return user->userlist != NULL && msn_userlist_unindex_user(user->userlist, user);
+}
+
 void
 msn_user_set_passport(MsnUser *user, const char *passport)
 {
+	gboolean listed;
+
 	g_return_if_fail(user != NULL);
 
+	listed = msn_user_unindex(user);
 	g_free(user->passport);
 	user->passport = g_strdup(passport);
+	if (listed)
+		msn_userlist_index_user(user->userlist, user);
 }
 
 gboolean
@@ -250,10 +265,15 @@ msn_user_set_statusline(MsnUser *user, const char *statusline)
 void
 msn_user_set_uid(MsnUser *user, const char *uid)
 {
+	gboolean listed;
+
 	g_return_if_fail(user != NULL);
 
+	listed = msn_user_unindex(user);
 	g_free(user->uid);
 	user->uid = g_strdup(uid);
+	if (listed)
+		msn_userlist_index_user(user->userlist, user);
 }
 
 void
@@ -481,17 +501,22 @@ msn_user_set_work_phone(MsnUser *user, const char *number)
 void
 msn_user_set_mobile_phone(MsnUser *user, const char *number)
 {
+	gboolean listed;
+
 	g_return_if_fail(user != NULL);
 
 	if (!number && !user->extinfo)
 		return;
 
+	listed = msn_user_unindex(user);
 	if (user->extinfo)
 		g_free(user->extinfo->phone_mobile);
 	else
 		user->extinfo = g_new0(MsnUserExtendedInfo, 1);
 
 	user->extinfo->phone_mobile = g_strdup(number);
+	if (listed)
+		msn_userlist_index_user(user->userlist, user);
 }
 
 void
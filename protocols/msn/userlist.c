@@ -200,6 +200,10 @@ msn_userlist_new(MsnSession *session)
 	userlist->session = session;
 	userlist->buddy_icon_requests = g_queue_new();
 
+	userlist->users_by_passport = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	userlist->users_by_uid = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	userlist->users_by_phone = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
 	/* buddy_icon_window is the number of allowed simultaneous buddy icon requests.
 	 * XXX With smarter rate limiting code, we could allow more at once... 5 was the limit set when
 	 * we weren't retrieiving any more than 5 per MSN session. */
@@ -208,12 +212,29 @@ msn_userlist_new(MsnSession *session)
 	return userlist;
 }
 
+static void
+userlist_index_free_bucket(gpointer key, gpointer value, gpointer user_data)
+{
+	g_slist_free(value);
+}
+
+static void
+userlist_index_destroy(GHashTable *index)
+{
+	g_hash_table_foreach(index, userlist_index_free_bucket, NULL);
+	g_hash_table_destroy(index);
+}
+
 void
 msn_userlist_destroy(MsnUserList *userlist)
 {
 	GList *l;
 
 	/*destroy userlist*/
+	userlist_index_destroy(userlist->users_by_passport);
+	userlist_index_destroy(userlist->users_by_uid);
+	userlist_index_destroy(userlist->users_by_phone);
+
 	for (l = userlist->users; l != NULL; l = l->next)
 	{
 		msn_user_unref(l->data);
@@ -252,16 +273,94 @@ msn_userlist_find_add_user(MsnUserList *userlist, const char *passport, const ch
 	return user;
 }
 
+/*
+ * The indexes map a case-folded key to every user with that key, the
+ * most recently indexed one first, which is the one the lookups return.
+ * It is nearly always a single user.
+ */
+static void
+userlist_index_add(GHashTable *index, const char *value, MsnUser *user)
+{
+	char *key;
+	GSList *bucket;
+
+	if (value == NULL)
+		return;
+
+	key = g_ascii_strdown(value, -1);
+	bucket = g_hash_table_lookup(index, key);
+	/* If the key is already there this keeps the old key and frees ours */
+	g_hash_table_insert(index, key, g_slist_prepend(bucket, user));
+}
+
+static gboolean
+userlist_index_remove(GHashTable *index, const char *value, MsnUser *user)
+{
+	char *key;
+	GSList *bucket;
+	gboolean found;
+
+	if (value == NULL)
+		return FALSE;
+
+	key = g_ascii_strdown(value, -1);
+	bucket = g_hash_table_lookup(index, key);
+	found = (g_slist_find(bucket, user) != NULL);
+
+	if (found) {
+		bucket = g_slist_remove(bucket, user);
+		if (bucket != NULL) {
+			g_hash_table_insert(index, key, bucket);
+			return TRUE;
+		}
+		g_hash_table_remove(index, key);
+	}
+
+	g_free(key);
+	return found;
+}
+
+static MsnUser *
+userlist_index_lookup(GHashTable *index, const char *value)
+{
+	char *key;
+	GSList *bucket;
+
+	key = g_ascii_strdown(value, -1);
+	bucket = g_hash_table_lookup(index, key);
+	g_free(key);
+
+	return bucket ? bucket->data : NULL;
+}
+
+void
+msn_userlist_index_user(MsnUserList *userlist, MsnUser *user)
+{
+	userlist_index_add(userlist->users_by_passport, user->passport, user);
+	userlist_index_add(userlist->users_by_uid, user->uid, user);
+	userlist_index_add(userlist->users_by_phone, msn_user_get_mobile_phone(user), user);
+}
+
+gboolean
+msn_userlist_unindex_user(MsnUserList *userlist, MsnUser *user)
+{
+	userlist_index_remove(userlist->users_by_uid, user->uid, user);
+	userlist_index_remove(userlist->users_by_phone, msn_user_get_mobile_phone(user), user);
+	return userlist_index_remove(userlist->users_by_passport, user->passport, user);
+}
+
 void
 msn_userlist_add_user(MsnUserList *userlist, MsnUser *user)
 {
 	msn_user_ref(user);
 	userlist->users = g_list_prepend(userlist->users, user);
+	msn_userlist_index_user(userlist, user);
 }
 
 void
 msn_userlist_remove_user(MsnUserList *userlist, MsnUser *user)
 {
+	msn_userlist_unindex_user(userlist, user);
 	userlist->users = g_list_remove(userlist->users, user);
 	g_queue_remove(userlist->buddy_icon_requests, user);
 	msn_user_unref(user);
@@ -270,62 +369,25 @@ msn_userlist_remove_user(MsnUserList *userlist, MsnUser *user)
 MsnUser *
 msn_userlist_find_user(MsnUserList *userlist, const char *passport)
 {
-	GList *l;
-
 	g_return_val_if_fail(passport != NULL, NULL);
 
-	for (l = userlist->users; l != NULL; l = l->next)
-	{
-		MsnUser *user = (MsnUser *)l->data;
-
-		g_return_val_if_fail(user->passport != NULL, NULL);
-
-		if (!g_ascii_strcasecmp(passport, user->passport)){
-			return user;
-		}
-	}
-
-	return NULL;
+	return userlist_index_lookup(userlist->users_by_passport, passport);
 }
 
 MsnUser *
 msn_userlist_find_user_with_id(MsnUserList *userlist, const char *uid)
 {
-	GList *l;
-
 	g_return_val_if_fail(uid != NULL, NULL);
 
-	for (l = userlist->users; l != NULL; l = l->next) {
-		MsnUser *user = (MsnUser *)l->data;
-
-		if (user->uid == NULL) {
-			continue;
-		}
-
-		if ( !g_ascii_strcasecmp(uid, user->uid) ) {
-			return user;
-		}
-	}
-
-	return NULL;
+	return userlist_index_lookup(userlist->users_by_uid, uid);
 }
 
 MsnUser *
 msn_userlist_find_user_with_mobile_phone(MsnUserList *userlist, const char *number)
 {
-	GList *l;
-
 	g_return_val_if_fail(number != NULL, NULL);
 
-	for (l = userlist->users; l != NULL; l = l->next) {
-		MsnUser *user = (MsnUser *)l->data;
-		const char *user_number = msn_user_get_mobile_phone(user);
-
-		if (user_number && !g_ascii_strcasecmp(number, user_number))
-			return user;
-	}
-
-	return NULL;
+	return userlist_index_lookup(userlist->users_by_phone, number);
 }
 
 void
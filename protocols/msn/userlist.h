@@ -56,6 +56,12 @@ struct _MsnUserList
 	GList *users; /* Contains MsnUsers */
 	GList *groups; /* Contains MsnGroups */
 
+	/* Case-folded passport, uid and mobile phone -> GSList of MsnUsers,
+	 * most recently indexed first.  The users list holds the refs. */
+	GHashTable *users_by_passport;
+	GHashTable *users_by_uid;
+	GHashTable *users_by_phone;
+
 	GQueue *buddy_icon_requests;
 	int buddy_icon_window;
 	guint buddy_icon_request_timer;
@@ -71,6 +77,11 @@ void msn_userlist_destroy(MsnUserList *userlist);
 void msn_userlist_add_user(MsnUserList *userlist, MsnUser *user);
 void msn_userlist_remove_user(MsnUserList *userlist, MsnUser *user);
 
+/* Bracket any change to a user's passport, uid or mobile phone with these.
+ * unindex returns TRUE if the user is on the list and must be reindexed. */
+gboolean msn_userlist_unindex_user(MsnUserList *userlist, MsnUser *user);
+void msn_userlist_index_user(MsnUserList *userlist, MsnUser *user);
+
 MsnUser * msn_userlist_find_user(MsnUserList *userlist, const char *passport);
 MsnUser * msn_userlist_find_add_user(MsnUserList *userlist,
 				const char *passport, const char *friendly_name);
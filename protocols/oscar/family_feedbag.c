@@ -46,6 +46,8 @@
 #include "oscar.h"
 #include "debug.h"
 
+#include <ctype.h>
+
 static int aim_ssi_addmoddel(OscarData *od);
 
 /**
@@ -104,6 +106,142 @@ aim_ssi_item_debug_append(GString *str, char *prefix, struct aim_ssi_item *item)
 		item->name ? item->name : "(null)");
 }
 
+#define AIM_SSI_ITEM_KEY(gid, bid) ((((guint32)(gid)) << 16) | (bid))
+
+/**
+ * Fold a name the same way oscar_util_name_compare() does, so that two
+ * names compare equal exactly when their keys are the same string.
+ */
+static gchar *
+aim_ssi_itemindex_namekey(const char *name)
+{
+	gchar *key, *cur;
+
+	key = cur = g_malloc(strlen(name) + 1);
+	for (; *name != '\0'; name++)
+		if (*name != ' ')
+			*cur++ = toupper(*name);
+	*cur = '\0';
+
+	return key;
+}
+
+/* Orders items the same way aim_ssi_itemlist_add() orders the list */
+static gint
+aim_ssi_itemindex_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct aim_ssi_item *item1 = a, *item2 = b;
+	guint32 key1 = AIM_SSI_ITEM_KEY(item1->gid, item1->bid);
+	guint32 key2 = AIM_SSI_ITEM_KEY(item2->gid, item2->bid);
+
+	return (key1 > key2) - (key1 < key2);
+}
+
+static struct aim_ssi_itemindex *
+aim_ssi_itemindex_new(void)
+{
+	struct aim_ssi_itemindex *index;
+
+	index = g_new0(struct aim_ssi_itemindex, 1);
+	index->ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+	index->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	return index;
+}
+
+static void
+aim_ssi_itemindex_free_bucket(gpointer key, gpointer value, gpointer user_data)
+{
+	g_slist_free(value);
+}
+
+static void
+aim_ssi_itemindex_free(struct aim_ssi_itemindex *index)
+{
+	g_hash_table_foreach(index->names, aim_ssi_itemindex_free_bucket, NULL);
+	g_hash_table_destroy(index->names);
+	g_hash_table_destroy(index->ids);
+	g_slist_free(index->unnamed);
+	g_free(index);
+}
+
+/**
+ * Find every item with the given name, whatever its type.
+ *
+ * @return The bucket for that name, which belongs to the index.
+ */
+static GSList *
+aim_ssi_itemindex_lookup_name(struct aim_ssi_itemindex *index, const char *name)
+{
+	gchar *key;
+	GSList *bucket;
+
+	key = aim_ssi_itemindex_namekey(name);
+	bucket = g_hash_table_lookup(index->names, key);
+	g_free(key);
+
+	return bucket;
+}
+
+static void
+aim_ssi_itemindex_add_name(struct aim_ssi_item *item)
+{
+	struct aim_ssi_itemindex *index = item->index;
+	gchar *key;
+	GSList *bucket;
+
+	if (item->name == NULL) {
+		index->unnamed = g_slist_insert_sorted(index->unnamed, item, aim_ssi_itemindex_cmp);
+		return;
+	}
+
+	key = aim_ssi_itemindex_namekey(item->name);
+	bucket = g_hash_table_lookup(index->names, key);
+	bucket = g_slist_insert_sorted(bucket, item, aim_ssi_itemindex_cmp);
+	/* If the name is already there this keeps the old key and frees ours */
+	g_hash_table_insert(index->names, key, bucket);
+}
+
+static void
+aim_ssi_itemindex_remove_name(struct aim_ssi_item *item)
+{
+	struct aim_ssi_itemindex *index = item->index;
+	gchar *key;
+	GSList *bucket;
+
+	if (item->name == NULL) {
+		index->unnamed = g_slist_remove(index->unnamed, item);
+		return;
+	}
+
+	key = aim_ssi_itemindex_namekey(item->name);
+	bucket = g_hash_table_lookup(index->names, key);
+	bucket = g_slist_remove(bucket, item);
+	if (bucket != NULL) {
+		g_hash_table_insert(index->names, key, bucket);
+	} else {
+		g_hash_table_remove(index->names, key);
+		g_free(key);
+	}
+}
+
+/**
+ * Locally change the name of an item, keeping the name index current.
+ *
+ * @param item The item to rename.
+ * @param name The new name, or NULL to remove the name.
+ */
+static void
+aim_ssi_itemlist_rename(struct aim_ssi_item *item, const char *name)
+{
+	char *newname = g_strdup(name);
+
+	aim_ssi_itemindex_remove_name(item);
+	g_free(item->name);
+	item->name = newname;
+	aim_ssi_itemindex_add_name(item);
+}
+
 /**
  * Locally rebuild the 0x00c8 TLV in the additional data of the given group.
  *
@@ -167,12 +305,17 @@ aim_ssi_itemlist_rebuildgroup(struct aim_ssi_item *list, const char *name)
  * @param data The additional data for the new item.
  * @return A pointer to the newly created item.
  */
-static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, const char *name, guint16 gid, guint16 bid, guint16 type, GSList *data)
+struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, const char *name, guint16 gid, guint16 bid, guint16 type, GSList *data)
 {
 	gboolean exists;
-	struct aim_ssi_item *cur, *new;
+	struct aim_ssi_item *cur, *prev = NULL, *new;
+	struct aim_ssi_itemindex *index;
+
+	/* The first item of a list creates the index the rest will share */
+	index = (*list != NULL) ? (*list)->index : aim_ssi_itemindex_new();
 
 	new = g_new(struct aim_ssi_item, 1);
+	new->index = index;
 
 	/* Set the name */
 	new->name = g_strdup(name);
@@ -213,13 +356,7 @@ static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, con
 		if (new->bid == 0xFFFF) {
 			do {
 				new->bid += 0x0001;
-				exists = FALSE;
-				for (cur = *list; cur != NULL; cur = cur->next)
-					if (cur->bid == new->bid && cur->gid == new->gid) {
-						exists = TRUE;
-						break;
-					}
-			} while (exists);
+			} while (g_hash_table_lookup(index->ids, GUINT_TO_POINTER(AIM_SSI_ITEM_KEY(new->gid, new->bid))));
 		}
 	}
 
@@ -235,7 +372,6 @@ static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, con
 			new->next = *list;
 			*list = new;
 		} else {
-			struct aim_ssi_item *prev;
 			for ((prev=*list, cur=(*list)->next); (cur && ((new->gid > cur->gid) || ((new->gid == cur->gid) && (new->bid > cur->bid)))); prev=cur, cur=cur->next);
 			new->next = prev->next;
 			prev->next = new;
@@ -245,6 +381,11 @@ static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, con
 		*list = new;
 	}
 
+	/* Only the first of several items with the same IDs is in the ID index */
+	if (!prev || (prev->gid != new->gid) || (prev->bid != new->bid))
+		g_hash_table_insert(index->ids, GUINT_TO_POINTER(AIM_SSI_ITEM_KEY(new->gid, new->bid)), new);
+	aim_ssi_itemindex_add_name(new);
+
 	return new;
 }
 
@@ -255,11 +396,25 @@ static struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, con
  * @param del A pointer to the item you want to remove from the list.
  * @return Return 0 if no errors, otherwise return the error number.
  */
-static int aim_ssi_itemlist_del(struct aim_ssi_item **list, struct aim_ssi_item *del)
+int aim_ssi_itemlist_del(struct aim_ssi_item **list, struct aim_ssi_item *del)
 {
+	struct aim_ssi_itemindex *index;
+	gpointer key;
+
 	if (!(*list) || !del)
 		return -EINVAL;
 
+	/* Remove the item from the index, promoting a duplicate if there is one */
+	index = del->index;
+	key = GUINT_TO_POINTER(AIM_SSI_ITEM_KEY(del->gid, del->bid));
+	if (g_hash_table_lookup(index->ids, key) == del) {
+		if (del->next && (del->next->gid == del->gid) && (del->next->bid == del->bid))
+			g_hash_table_insert(index->ids, key, del->next);
+		else
+			g_hash_table_remove(index->ids, key);
+	}
+	aim_ssi_itemindex_remove_name(del);
+
 	/* Remove the item from the list */
 	if (*list == del) {
 		*list = (*list)->next;
@@ -275,6 +430,10 @@ static int aim_ssi_itemlist_del(struct aim_ssi_item **list, struct aim_ssi_item
 	aim_tlvlist_free(del->data);
 	g_free(del);
 
+	/* The last item out takes the index with it */
+	if (*list == NULL)
+		aim_ssi_itemindex_free(index);
+
 	return 0;
 }
 
@@ -339,11 +498,9 @@ static gboolean aim_ssi_itemlist_valid(struct aim_ssi_item *list, struct aim_ssi
  */
 struct aim_ssi_item *aim_ssi_itemlist_find(struct aim_ssi_item *list, guint16 gid, guint16 bid)
 {
-	struct aim_ssi_item *cur;
-	for (cur=list; cur; cur=cur->next)
-		if ((cur->gid == gid) && (cur->bid == bid))
-			return cur;
-	return NULL;
+	if (!list)
+		return NULL;
+	return g_hash_table_lookup(list->index->ids, GUINT_TO_POINTER(AIM_SSI_ITEM_KEY(gid, bid)));
 }
 
 /**
@@ -359,35 +516,42 @@ struct aim_ssi_item *aim_ssi_itemlist_find(struct aim_ssi_item *list, guint16 gi
 struct aim_ssi_item *aim_ssi_itemlist_finditem(struct aim_ssi_item *list, const char *gn, const char *bn, guint16 type)
 {
 	struct aim_ssi_item *cur;
+	GSList *l;
 	if (!list)
 		return NULL;
 
 	if (gn && bn) { /* For finding buddies in groups */
-		for (cur=list; cur; cur=cur->next)
-			if ((cur->type == type) && (cur->name) && !(oscar_util_name_compare(cur->name, bn))) {
-				struct aim_ssi_item *curg;
-				for (curg=list; curg; curg=curg->next)
-					if ((curg->type == AIM_SSI_TYPE_GROUP) && (curg->gid == cur->gid) && (curg->name) && !(oscar_util_name_compare(curg->name, gn)))
+		GSList *groups = aim_ssi_itemindex_lookup_name(list->index, gn);
+		for (l = aim_ssi_itemindex_lookup_name(list->index, bn); l; l = l->next) {
+			cur = l->data;
+			if (cur->type == type) {
+				GSList *lg;
+				for (lg = groups; lg; lg = lg->next) {
+					struct aim_ssi_item *curg = lg->data;
+					if ((curg->type == AIM_SSI_TYPE_GROUP) && (curg->gid == cur->gid))
 						return cur;
+				}
 			}
+		}
 
 	} else if (gn) { /* For finding groups */
-		for (cur=list; cur; cur=cur->next) {
-			if ((cur->type == type) && (cur->bid == 0x0000) && (cur->name) && !(oscar_util_name_compare(cur->name, gn))) {
+		for (l = aim_ssi_itemindex_lookup_name(list->index, gn); l; l = l->next) {
+			cur = l->data;
+			if ((cur->type == type) && (cur->bid == 0x0000))
 				return cur;
-			}
 		}
 
 	} else if (bn) { /* For finding permits, denies, and ignores */
-		for (cur=list; cur; cur=cur->next) {
-			if ((cur->type == type) && (cur->name) && !(oscar_util_name_compare(cur->name, bn))) {
+		for (l = aim_ssi_itemindex_lookup_name(list->index, bn); l; l = l->next) {
+			cur = l->data;
+			if (cur->type == type)
 				return cur;
-			}
 		}
 
 	/* For stuff without names--permit deny setting, visibility mask, etc. */
-	} else for (cur=list; cur; cur=cur->next) {
-		if ((cur->type == type) && (!cur->name))
+	} else for (l = list->index->unnamed; l; l = l->next) {
+		cur = l->data;
+		if (cur->type == type)
 			return cur;
 	}
 
@@ -523,6 +687,83 @@ gboolean aim_ssi_waitingforauth(struct aim_ssi_item *list, const char *gn, const
 	return FALSE;
 }
 
+static struct aim_ssi_tmp **
+aim_ssi_tmp_append(struct aim_ssi_tmp **tail, guint16 action, struct aim_ssi_item *item)
+{
+	struct aim_ssi_tmp *new;
+
+	new = g_new(struct aim_ssi_tmp, 1);
+	new->action = action;
+	new->ack = 0xffff;
+	new->name = NULL;
+	new->item = item;
+	new->next = NULL;
+	*tail = new;
+
+	return &new->next;
+}
+
+/**
+ * Compare the official and the local list and create an aim_ssi_tmp for
+ * each difference.  Only one kind of change is returned at a time: if
+ * there are any deletions, only deletions; else additions; else
+ * modifications.
+ *
+ * Both lists are kept in ascending order of group ID# and buddy ID#, so
+ * this is a single merge-style pass over each of them.
+ *
+ * @param official The list as the server has it.
+ * @param local The list as we want it to be.
+ * @param max The maximum number of differences to return.
+ * @return A newly allocated list of aim_ssi_tmp's, or NULL if there are
+ *         no differences.  The items they point to belong to the lists.
+ */
+struct aim_ssi_tmp *aim_ssi_itemlist_diff(struct aim_ssi_item *official, struct aim_ssi_item *local, int max)
+{
+	struct aim_ssi_item *cur1, *cur2;
+	struct aim_ssi_tmp *diff = NULL, **tail = &diff;
+	int n = 0;
+
+	/* Deletions */
+	cur2 = local;
+	for (cur1=official; cur1 && (n < max); cur1=cur1->next) {
+		while (cur2 && (AIM_SSI_ITEM_KEY(cur2->gid, cur2->bid) < AIM_SSI_ITEM_KEY(cur1->gid, cur1->bid)))
+			cur2 = cur2->next;
+		if (!cur2 || (cur2->gid != cur1->gid) || (cur2->bid != cur1->bid)) {
+			n++;
+			tail = aim_ssi_tmp_append(tail, SNAC_SUBTYPE_FEEDBAG_DEL, cur1);
+		}
+	}
+	if (diff)
+		return diff;
+
+	/* Additions */
+	cur2 = official;
+	for (cur1=local; cur1 && (n < max); cur1=cur1->next) {
+		while (cur2 && (AIM_SSI_ITEM_KEY(cur2->gid, cur2->bid) < AIM_SSI_ITEM_KEY(cur1->gid, cur1->bid)))
+			cur2 = cur2->next;
+		if (!cur2 || (cur2->gid != cur1->gid) || (cur2->bid != cur1->bid)) {
+			n++;
+			tail = aim_ssi_tmp_append(tail, SNAC_SUBTYPE_FEEDBAG_ADD, cur1);
+		}
+	}
+	if (diff)
+		return diff;
+
+	/* Modifications */
+	cur2 = official;
+	for (cur1=local; cur1 && (n < max); cur1=cur1->next) {
+		while (cur2 && (AIM_SSI_ITEM_KEY(cur2->gid, cur2->bid) < AIM_SSI_ITEM_KEY(cur1->gid, cur1->bid)))
+			cur2 = cur2->next;
+		if (cur2 && (cur2->gid == cur1->gid) && (cur2->bid == cur1->bid) && (aim_ssi_itemlist_cmp(cur1, cur2))) {
+			n++;
+			tail = aim_ssi_tmp_append(tail, SNAC_SUBTYPE_FEEDBAG_MOD, cur1);
+		}
+	}
+
+	return diff;
+}
+
 /**
  * If there are changes, then create temporary items and
  * call addmoddel.
@@ -532,16 +773,9 @@ gboolean aim_ssi_waitingforauth(struct aim_ssi_item *list, const char *gn, const
  */
 static int aim_ssi_sync(OscarData *od)
 {
-	struct aim_ssi_item *cur1, *cur2;
-	struct aim_ssi_tmp *cur, *new;
-	int n = 0;
-	GString *debugstr = g_string_new("");
-
-	/*
-	 * The variable "n" is used to limit the number of addmoddel's that
-	 * are performed in a single SNAC.  It will hopefully keep the size
-	 * of the SNAC below the maximum SNAC size.
-	 */
+	struct aim_ssi_item *cur1;
+	struct aim_ssi_tmp *cur;
+	GString *debugstr;
 
 	if (!od)
 		return -EINVAL;
@@ -550,76 +784,22 @@ static int aim_ssi_sync(OscarData *od)
 	if (od->ssi.waiting_for_ack)
 		return 0;
 
+	debugstr = g_string_new("");
+
 	/*
-	 * Compare the 2 lists and create an aim_ssi_tmp for each difference.
 	 * We should only send either additions, modifications, or deletions
-	 * before waiting for an acknowledgement.  So first do deletions, then
-	 * additions, then modifications.  Also, both the official and the local
-	 * list should be in ascending numerical order for the group ID#s and the
-	 * buddy ID#s, which makes things more efficient.  I think.
+	 * before waiting for an acknowledgement.  The limit of 15 will
+	 * hopefully keep the size of the SNAC below the maximum SNAC size.
 	 */
-
-	/* Deletions */
 	if (!od->ssi.pending) {
-		for (cur1=od->ssi.official; cur1 && (n < 15); cur1=cur1->next) {
-			if (!aim_ssi_itemlist_find(od->ssi.local, cur1->gid, cur1->bid)) {
-				n++;
-				new = g_new(struct aim_ssi_tmp, 1);
-				new->action = SNAC_SUBTYPE_FEEDBAG_DEL;
-				new->ack = 0xffff;
-				new->name = NULL;
-				new->item = cur1;
-				new->next = NULL;
-				if (od->ssi.pending) {
-					for (cur=od->ssi.pending; cur->next; cur=cur->next);
-					cur->next = new;
-				} else
-					od->ssi.pending = new;
-			       	aim_ssi_item_debug_append(debugstr, "Deleting item ", cur1);
-			}
-		}
-	}
-
-	/* Additions */
-	if (!od->ssi.pending) {
-		for (cur1=od->ssi.local; cur1 && (n < 15); cur1=cur1->next) {
-			if (!aim_ssi_itemlist_find(od->ssi.official, cur1->gid, cur1->bid)) {
-				n++;
-				new = g_new(struct aim_ssi_tmp, 1);
-				new->action = SNAC_SUBTYPE_FEEDBAG_ADD;
-				new->ack = 0xffff;
-				new->name = NULL;
-				new->item = cur1;
-				new->next = NULL;
-				if (od->ssi.pending) {
-					for (cur=od->ssi.pending; cur->next; cur=cur->next);
-					cur->next = new;
-				} else
-					od->ssi.pending = new;
-			       	aim_ssi_item_debug_append(debugstr, "Adding item ", cur1);
-			}
-		}
-	}
-
-	/* Modifications */
-	if (!od->ssi.pending) {
-		for (cur1=od->ssi.local; cur1 && (n < 15); cur1=cur1->next) {
-			cur2 = aim_ssi_itemlist_find(od->ssi.official, cur1->gid, cur1->bid);
-			if (cur2 && (aim_ssi_itemlist_cmp(cur1, cur2))) {
-				n++;
-				new = g_new(struct aim_ssi_tmp, 1);
-				new->action = SNAC_SUBTYPE_FEEDBAG_MOD;
-				new->ack = 0xffff;
-				new->name = NULL;
-				new->item = cur1;
-				new->next = NULL;
-				if (od->ssi.pending) {
-					for (cur=od->ssi.pending; cur->next; cur=cur->next);
-					cur->next = new;
-				} else
-					od->ssi.pending = new;
-			       	aim_ssi_item_debug_append(debugstr, "Modifying item ", cur1);
-			}
+		od->ssi.pending = aim_ssi_itemlist_diff(od->ssi.official, od->ssi.local, 15);
+		for (cur = od->ssi.pending; cur; cur = cur->next) {
+			if (cur->action == SNAC_SUBTYPE_FEEDBAG_DEL)
+				aim_ssi_item_debug_append(debugstr, "Deleting item ", cur->item);
+			else if (cur->action == SNAC_SUBTYPE_FEEDBAG_ADD)
+				aim_ssi_item_debug_append(debugstr, "Adding item ", cur->item);
+			else
+				aim_ssi_item_debug_append(debugstr, "Modifying item ", cur->item);
 		}
 	}
 	if (debugstr->len > 0) {
@@ -673,6 +853,11 @@ aim_ssi_freelist(OscarData *od)
 	struct aim_ssi_item *cur, *del;
 	struct aim_ssi_tmp *curtmp, *deltmp;
 
+	if (od->ssi.official)
+		aim_ssi_itemindex_free(od->ssi.official->index);
+	if (od->ssi.local)
+		aim_ssi_itemindex_free(od->ssi.local->index);
+
 	cur = od->ssi.official;
 	while (cur) {
 		del = cur;
@@ -1019,8 +1204,7 @@ int aim_ssi_rename_group(OscarData *od, const char *oldgn, const char *newgn)
 	if (!(group = aim_ssi_itemlist_finditem(od->ssi.local, oldgn, NULL, AIM_SSI_TYPE_GROUP)))
 		return -EINVAL;
 
-	g_free(group->name);
-	group->name = g_strdup(newgn);
+	aim_ssi_itemlist_rename(group, newgn);
 
 	/* Sync our local list with the server list */
 	return aim_ssi_sync(od);
@@ -1418,16 +1602,14 @@ static int parsemod(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 		/* Replace the 2 local items with the given one */
 		if ((item = aim_ssi_itemlist_find(od->ssi.local, gid, bid))) {
 			item->type = type;
-			g_free(item->name);
-			item->name = g_strdup(name);
+			aim_ssi_itemlist_rename(item, name);
 			aim_tlvlist_free(item->data);
 			item->data = aim_tlvlist_copy(data);
 		}
 
 		if ((item = aim_ssi_itemlist_find(od->ssi.official, gid, bid))) {
 			item->type = type;
-			g_free(item->name);
-			item->name = g_strdup(name);
+			aim_ssi_itemlist_rename(item, name);
 			aim_tlvlist_free(item->data);
 			item->data = aim_tlvlist_copy(data);
 		}
@@ -1515,8 +1697,7 @@ static int parseack(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 				if (aim_ssi_itemlist_valid(od->ssi.local, cur->item)) {
 					struct aim_ssi_item *cur1;
 					if ((cur1 = aim_ssi_itemlist_find(od->ssi.official, cur->item->gid, cur->item->bid))) {
-						g_free(cur->item->name);
-						cur->item->name = g_strdup(cur1->name);
+						aim_ssi_itemlist_rename(cur->item, cur1->name);
 						aim_tlvlist_free(cur->item->data);
 						cur->item->data = aim_tlvlist_copy(cur1->data);
 					}
@@ -1545,8 +1726,7 @@ static int parseack(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 				if (aim_ssi_itemlist_valid(od->ssi.local, cur->item)) {
 					struct aim_ssi_item *cur1;
 					if ((cur1 = aim_ssi_itemlist_find(od->ssi.official, cur->item->gid, cur->item->bid))) {
-						g_free(cur1->name);
-						cur1->name = g_strdup(cur->item->name);
+						aim_ssi_itemlist_rename(cur1, cur->item->name);
 						aim_tlvlist_free(cur1->data);
 						cur1->data = aim_tlvlist_copy(cur->item->data);
 					}
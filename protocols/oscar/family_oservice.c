@@ -341,7 +341,7 @@ rateresp(OscarData *od, FlapConnection *conn, aim_module_t *mod, FlapFrame *fram
 		struct timeval now;
 
 		gettimeofday(&now, NULL);
-		rateclass = g_new(struct rateclass, 1);
+		rateclass = g_new0(struct rateclass, 1);
 
 		rateclass->classid = byte_stream_get16(bs);
 		rateclass->windowsize = byte_stream_get32(bs);
@@ -506,6 +506,9 @@ ratechange(OscarData *od, FlapConnection *conn, aim_module_t *mod, FlapFrame *fr
 				"limit. Please wait 10 seconds and try again.\n");
 	}
 
+	/* The deadline for anything queued in this rateclass has moved */
+	flap_connection_schedule_queued_snacs(conn);
+
 	return 1;
 }
 
@@ -33,6 +33,11 @@
 #include "win32dep.h"
 #endif
 
+/* How much to read from the socket at once; big enough for many FLAPs */
+#define FLAP_RECV_CHUNK_SIZE 16384
+/* How often to look at a rateclass that has no predictable deadline */
+#define FLAP_RATECLASS_RETRY_MS 1000
+
 /**
  * This sends a channel 1 SNAC containing the FLAP version.
  * The FLAP version is sent by itself at the beginning of every
@@ -117,6 +122,15 @@ flap_connection_get_rateclass(FlapConnection *conn, guint16 family, guint16 subt
 	return conn->default_rateclass;
 }
 
+/*
+ * Milliseconds between the last SNAC sent in this rateclass and now.
+ */
+static unsigned long
+rateclass_get_timediff(struct rateclass *rateclass, const struct timeval *now)
+{
+	return (now->tv_sec - rateclass->last.tv_sec) * 1000 + (now->tv_usec - rateclass->last.tv_usec) / 1000;
+}
+
 /*
  * Attempt to calculate what our new current average would be if we
  * were to send a SNAC in this rateclass at the given time.
@@ -128,12 +142,54 @@ rateclass_get_new_current(FlapConnection *conn, struct rateclass *rateclass, str
 	guint32 current;
 
 	/* This formula is documented at http://dev.aol.com/aim/oscar/#RATELIMIT */
-	timediff = (now->tv_sec - rateclass->last.tv_sec) * 1000 + (now->tv_usec - rateclass->last.tv_usec) / 1000;
+	timediff = rateclass_get_timediff(rateclass, now);
 	current = ((rateclass->current * (rateclass->windowsize - 1)) + timediff) / rateclass->windowsize;
 
 	return MIN(current, rateclass->max);
 }
 
+/**
+ * Work out how long we have to wait before a SNAC in this rateclass
+ * can be sent without the average dropping to the alert level.  This
+ * is rateclass_get_new_current() solved for the time difference: the
+ * new average is above alert once
+ * current * (windowsize - 1) + timediff >= (alert + 1) * windowsize.
+ *
+ * @return The number of milliseconds from now, or 0 if a SNAC could
+ *         be sent right away.
+ */
+guint
+flap_connection_rateclass_get_wait(struct rateclass *rateclass, const struct timeval *now)
+{
+	gint64 needed;
+	unsigned long timediff;
+
+	if (rateclass->dropping_snacs || rateclass->max <= rateclass->alert)
+		/*
+		 * The server will tell us when this changes, and we'll be
+		 * rescheduled then.  Check back every so often anyway.
+		 */
+		return FLAP_RATECLASS_RETRY_MS;
+
+	if (rateclass->windowsize == 0)
+		return 0;
+
+	needed = (gint64)(rateclass->alert + 1) * rateclass->windowsize -
+			(gint64)rateclass->current * (rateclass->windowsize - 1);
+	timediff = rateclass_get_timediff(rateclass, now);
+	if (needed <= 0 || (gint64)timediff >= needed)
+		return 0;
+
+	return (guint)(needed - timediff);
+}
+
+static gboolean
+rateclass_has_queued_snacs(struct rateclass *rateclass)
+{
+	return (rateclass->queued_snacs != NULL && !g_queue_is_empty(rateclass->queued_snacs)) ||
+			(rateclass->queued_lowpriority_snacs != NULL && !g_queue_is_empty(rateclass->queued_lowpriority_snacs));
+}
+
 /*
  * Attempt to send the contents of a given queue
  *
@@ -141,62 +197,103 @@ rateclass_get_new_current(FlapConnection *conn, struct rateclass *rateclass, str
  *         empty; FALSE if rate limiting prevented it from being
  *         emptied.
  */
-static gboolean flap_connection_send_snac_queue(FlapConnection *conn, struct timeval now, GQueue *queue)
+static gboolean flap_connection_send_snac_queue(FlapConnection *conn, struct rateclass *rateclass, struct timeval *now, GQueue *queue)
 {
+	if (queue == NULL)
+		return TRUE;
+
 	while (!g_queue_is_empty(queue))
 	{
 		QueuedSnac *queued_snac;
-		struct rateclass *rateclass;
-
-		queued_snac = g_queue_peek_head(queue);
-
-		rateclass = flap_connection_get_rateclass(conn, queued_snac->family, queued_snac->subtype);
-		if (rateclass != NULL)
-		{
-			guint32 new_current;
+		guint32 new_current;
 
-			new_current = rateclass_get_new_current(conn, rateclass, &now);
+		new_current = rateclass_get_new_current(conn, rateclass, now);
 
-			if (rateclass->dropping_snacs || new_current <= rateclass->alert)
-				/* Not ready to send this SNAC yet--keep waiting. */
-				return FALSE;
+		if (rateclass->dropping_snacs || new_current <= rateclass->alert)
+			/* Not ready to send this SNAC yet--keep waiting. */
+			return FALSE;
 
-			rateclass->current = new_current;
-			rateclass->last.tv_sec = now.tv_sec;
-			rateclass->last.tv_usec = now.tv_usec;
-		}
+		rateclass->current = new_current;
+		rateclass->last.tv_sec = now->tv_sec;
+		rateclass->last.tv_usec = now->tv_usec;
 
+		queued_snac = g_queue_pop_head(queue);
 		flap_connection_send(conn, queued_snac->frame);
 		g_free(queued_snac);
-		g_queue_pop_head(queue);
 	}
 
 	/* We emptied the queue */
 	return TRUE;
 }
 
+static gboolean flap_connection_send_queued(gpointer data);
+
+/**
+ * Arm the queue timer for the moment the first rateclass with queued
+ * SNACs is allowed to send again, or remove it if nothing is queued.
+ * This should be called whenever the queues or the rate parameters
+ * change.
+ */
+void
+flap_connection_schedule_queued_snacs(FlapConnection *conn)
+{
+	struct timeval now;
+	GSList *l;
+	gboolean queued = FALSE;
+	guint wait = G_MAXUINT;
+
+	gettimeofday(&now, NULL);
+
+	for (l = conn->rateclasses; l != NULL; l = l->next)
+	{
+		struct rateclass *rateclass = l->data;
+
+		if (!rateclass_has_queued_snacs(rateclass))
+			continue;
+
+		queued = TRUE;
+		wait = MIN(wait, flap_connection_rateclass_get_wait(rateclass, &now));
+	}
+
+	if (conn->queued_timeout != 0)
+	{
+		purple_timeout_remove(conn->queued_timeout);
+		conn->queued_timeout = 0;
+	}
+
+	if (queued)
+		conn->queued_timeout = purple_timeout_add(wait, flap_connection_send_queued, conn);
+}
+
 static gboolean flap_connection_send_queued(gpointer data)
 {
 	FlapConnection *conn;
 	struct timeval now;
+	GSList *l;
 
 	conn = data;
+	conn->queued_timeout = 0;
 	gettimeofday(&now, NULL);
 
-	purple_debug_info("oscar", "Attempting to send %u queued SNACs and %u queued low-priority SNACs for %p\n",
-					  (conn->queued_snacs ? conn->queued_snacs->length : 0),
-					  (conn->queued_lowpriority_snacs ? conn->queued_lowpriority_snacs->length : 0),
-					  conn);
-	if (!conn->queued_snacs || flap_connection_send_snac_queue(conn, now, conn->queued_snacs)) {
-		if (!conn->queued_lowpriority_snacs || flap_connection_send_snac_queue(conn, now, conn->queued_lowpriority_snacs)) {
-			/* Both queues emptied. */
-			conn->queued_timeout = 0;
-			return FALSE;
-		}
+	for (l = conn->rateclasses; l != NULL; l = l->next)
+	{
+		struct rateclass *rateclass = l->data;
+
+		if (!rateclass_has_queued_snacs(rateclass))
+			continue;
+
+		purple_debug_info("oscar", "Attempting to send %u queued SNACs and %u queued low-priority SNACs in rateclass 0x%04hx for %p\n",
+						  (rateclass->queued_snacs ? rateclass->queued_snacs->length : 0),
+						  (rateclass->queued_lowpriority_snacs ? rateclass->queued_lowpriority_snacs->length : 0),
+						  rateclass->classid, conn);
+
+		if (flap_connection_send_snac_queue(conn, rateclass, &now, rateclass->queued_snacs))
+			flap_connection_send_snac_queue(conn, rateclass, &now, rateclass->queued_lowpriority_snacs);
 	}
 
-	/* We couldn't send all our SNACs. Keep trying */
-	return TRUE;
+	flap_connection_schedule_queued_snacs(conn);
+
+	return FALSE;
 }
 
 /**
@@ -230,9 +327,16 @@ flap_connection_send_snac_with_priority(OscarData *od, FlapConnection *conn, gui
 		byte_stream_putbs(&frame->data, data, length);
 	}
 
-	if (conn->queued_timeout != 0)
+	rateclass = flap_connection_get_rateclass(conn, family, subtype);
+	if (rateclass != NULL &&
+			((rateclass->queued_snacs != NULL && !g_queue_is_empty(rateclass->queued_snacs)) ||
+			 (!high_priority && rateclass->queued_lowpriority_snacs != NULL &&
+			  !g_queue_is_empty(rateclass->queued_lowpriority_snacs))))
+	{
+		/* Don't jump ahead of what's already waiting in this rateclass */
 		enqueue = TRUE;
-	else if ((rateclass = flap_connection_get_rateclass(conn, family, subtype)) != NULL)
+	}
+	else if (rateclass != NULL)
 	{
 		struct timeval now;
 		guint32 new_current;
@@ -265,17 +369,16 @@ flap_connection_send_snac_with_priority(OscarData *od, FlapConnection *conn, gui
 		queued_snac->frame = frame;
 
 		if (high_priority) {
-			if (!conn->queued_snacs)
-				conn->queued_snacs = g_queue_new();
-			g_queue_push_tail(conn->queued_snacs, queued_snac);
+			if (!rateclass->queued_snacs)
+				rateclass->queued_snacs = g_queue_new();
+			g_queue_push_tail(rateclass->queued_snacs, queued_snac);
 		} else {
-			if (!conn->queued_lowpriority_snacs)
-				conn->queued_lowpriority_snacs = g_queue_new();
-			g_queue_push_tail(conn->queued_lowpriority_snacs, queued_snac);
+			if (!rateclass->queued_lowpriority_snacs)
+				rateclass->queued_lowpriority_snacs = g_queue_new();
+			g_queue_push_tail(rateclass->queued_lowpriority_snacs, queued_snac);
 		}
 
-		if (conn->queued_timeout == 0)
-			conn->queued_timeout = purple_timeout_add(500, flap_connection_send_queued, conn);
+		flap_connection_schedule_queued_snacs(conn);
 
 		return;
 	}
@@ -407,8 +510,9 @@ flap_connection_close(OscarData *od, FlapConnection *conn)
 		conn->gsc = NULL;
 	}
 
-	g_free(conn->buffer_incoming.data.data);
-	conn->buffer_incoming.data.data = NULL;
+	g_free(conn->buffer_incoming);
+	conn->buffer_incoming = NULL;
+	conn->buffer_incoming_len = conn->buffer_incoming_size = 0;
 
 	purple_circ_buffer_destroy(conn->buffer_outgoing);
 	conn->buffer_outgoing = NULL;
@@ -426,6 +530,22 @@ flap_frame_destroy(FlapFrame *frame)
 	g_free(frame);
 }
 
+static void
+flap_connection_free_snac_queue(GQueue *queue)
+{
+	if (queue == NULL)
+		return;
+
+	while (!g_queue_is_empty(queue))
+	{
+		QueuedSnac *queued_snac;
+		queued_snac = g_queue_pop_head(queue);
+		flap_frame_destroy(queued_snac->frame);
+		g_free(queued_snac);
+	}
+	g_queue_free(queue);
+}
+
 static gboolean
 flap_connection_destroy_cb(gpointer data)
 {
@@ -506,34 +626,15 @@ flap_connection_destroy_cb(gpointer data)
 	g_slist_free(conn->groups);
 	while (conn->rateclasses != NULL)
 	{
-		g_free(conn->rateclasses->data);
+		struct rateclass *rateclass = conn->rateclasses->data;
+		flap_connection_free_snac_queue(rateclass->queued_snacs);
+		flap_connection_free_snac_queue(rateclass->queued_lowpriority_snacs);
+		g_free(rateclass);
 		conn->rateclasses = g_slist_delete_link(conn->rateclasses, conn->rateclasses);
 	}
 
 	g_hash_table_destroy(conn->rateclass_members);
 
-	if (conn->queued_snacs) {
-		while (!g_queue_is_empty(conn->queued_snacs))
-		{
-			QueuedSnac *queued_snac;
-			queued_snac = g_queue_pop_head(conn->queued_snacs);
-			flap_frame_destroy(queued_snac->frame);
-			g_free(queued_snac);
-		}
-		g_queue_free(conn->queued_snacs);
-	}
-
-	if (conn->queued_lowpriority_snacs) {
-		while (!g_queue_is_empty(conn->queued_lowpriority_snacs))
-		{
-			QueuedSnac *queued_snac;
-			queued_snac = g_queue_pop_head(conn->queued_lowpriority_snacs);
-			flap_frame_destroy(queued_snac->frame);
-			g_free(queued_snac);
-		}
-		g_queue_free(conn->queued_lowpriority_snacs);
-	}
-
 	if (conn->queued_timeout > 0)
 		purple_timeout_remove(conn->queued_timeout);
 
@@ -735,7 +836,7 @@ flap_frame_new(OscarData *od, guint16 channel, int datalen)
 static void
 parse_snac(OscarData *od, FlapConnection *conn, FlapFrame *frame)
 {
-	aim_module_t *cur;
+	aim_module_t **cur;
 	aim_modsnac_t snac;
 
 	if (byte_stream_bytes_left(&frame->data) < 10)
@@ -767,13 +868,8 @@ parse_snac(OscarData *od, FlapConnection *conn, FlapFrame *frame)
 		byte_stream_advance(&frame->data, byte_stream_get16(&frame->data));
 	}
 
-	for (cur = (aim_module_t *)od->modlistv; cur; cur = cur->next) {
-
-		if (!(cur->flags & AIM_MODFLAG_MULTIFAMILY) &&
-				(cur->family != snac.family))
-			continue;
-
-		if (cur->snachandler(od, conn, cur, frame, &snac, &frame->data))
+	for (cur = aim__findsnacmodules(od, snac.family); *cur; cur++) {
+		if ((*cur)->snachandler(od, conn, *cur, frame, &snac, &frame->data))
 			return;
 	}
 }
@@ -781,20 +877,15 @@ parse_snac(OscarData *od, FlapConnection *conn, FlapFrame *frame)
 static void
 parse_fakesnac(OscarData *od, FlapConnection *conn, FlapFrame *frame, guint16 family, guint16 subtype)
 {
-	aim_module_t *cur;
+	aim_module_t **cur;
 	aim_modsnac_t snac;
 
 	snac.family = family;
 	snac.subtype = subtype;
 	snac.flags = snac.id = 0;
 
-	for (cur = (aim_module_t *)od->modlistv; cur; cur = cur->next) {
-
-		if (!(cur->flags & AIM_MODFLAG_MULTIFAMILY) &&
-				(cur->family != snac.family))
-			continue;
-
-		if (cur->snachandler(od, conn, cur, frame, &snac, &frame->data))
+	for (cur = aim__findsnacmodules(od, snac.family); *cur; cur++) {
+		if ((*cur)->snachandler(od, conn, *cur, frame, &snac, &frame->data))
 			return;
 	}
 }
@@ -870,11 +961,71 @@ parse_flap(OscarData *od, FlapConnection *conn, FlapFrame *frame)
 	}
 }
 
+/**
+ * Handle every complete FLAP at the start of conn->buffer_incoming and
+ * move whatever is left over (the start of the next FLAP) to the front.
+ *
+ * The frames are parsed in place, so handlers must not hold on to
+ * frame->data after they return (they never could).
+ *
+ * @return FALSE if the connection is being torn down and no more data
+ *         should be read from it.
+ */
+static gboolean
+flap_connection_parse_buffer(FlapConnection *conn)
+{
+	guint8 *cursor = conn->buffer_incoming;
+	gsize left = conn->buffer_incoming_len;
+	FlapFrame frame;
+
+	while (left >= 6)
+	{
+		guint16 payloadlen;
+
+		/* All FLAP frames must start with the byte 0x2a */
+		if (aimutil_get8(cursor) != 0x2a)
+		{
+			flap_connection_schedule_destroy(conn,
+					OSCAR_DISCONNECT_INVALID_DATA, NULL);
+			return FALSE;
+		}
+
+		payloadlen = aimutil_get16(cursor + 4);
+		if (left < 6 + (gsize)payloadlen)
+			/* Waiting for more data to arrive */
+			break;
+
+		frame.channel = aimutil_get8(cursor + 1);
+		frame.seqnum = aimutil_get16(cursor + 2);
+		frame.data.data = cursor + 6;
+		frame.data.len = payloadlen;
+		frame.data.offset = 0;
+
+		parse_flap(conn->od, conn, &frame);
+
+		cursor += 6 + payloadlen;
+		left -= 6 + payloadlen;
+
+		if (conn->buffer_incoming == NULL)
+			/* The connection was closed by the handler */
+			return FALSE;
+	}
+
+	if (cursor != conn->buffer_incoming)
+	{
+		conn->lastactivity = time(NULL);
+		memmove(conn->buffer_incoming, cursor, left);
+		conn->buffer_incoming_len = left;
+	}
+
+	return TRUE;
+}
+
 /**
  * Read in all available data on the socket for a given connection.
- * All complete FLAPs handled immedate after they're received.
- * Incomplete FLAP data is stored locally and appended to the next
- * time this callback is triggered.
+ * Data is read in large chunks and every complete FLAP in the buffer
+ * is handled before the next read.  An incomplete FLAP at the end of
+ * the buffer is kept and completed the next time this is triggered.
  *
  * This is called by flap_connection_recv_cb and
  * flap_connection_recv_cb_ssl for unencrypted/encrypted connections.
@@ -882,113 +1033,72 @@ parse_flap(OscarData *od, FlapConnection *conn, FlapFrame *frame)
 static void
 flap_connection_recv(FlapConnection *conn)
 {
-	gpointer buf;
-	gsize buflen;
+	gsize needed, buflen;
 	gssize read;
 
 	/* Read data until we run out of data and break out of the loop */
 	while (TRUE)
 	{
-		/* Start reading a new FLAP */
-		if (conn->buffer_incoming.data.data == NULL)
+		/* Make sure there's room for a chunk, or for the current FLAP if bigger */
+		needed = FLAP_RECV_CHUNK_SIZE;
+		if (conn->buffer_incoming_len >= 6)
+			needed = MAX(needed, 6 + (gsize)aimutil_get16(conn->buffer_incoming + 4));
+		if (conn->buffer_incoming_size < needed)
 		{
-			buf = conn->header + conn->header_received;
-			buflen = 6 - conn->header_received;
-
-			/* Read the first 6 bytes (the FLAP header) */
-			if (conn->gsc)
-				read = purple_ssl_read(conn->gsc, buf, buflen);
-			else
-				read = recv(conn->fd, buf, buflen, 0);
-
-			/* Check if the FLAP server closed the connection */
-			if (read == 0)
-			{
-				flap_connection_schedule_destroy(conn,
-						OSCAR_DISCONNECT_REMOTE_CLOSED, NULL);
-				break;
-			}
-
-			/* If there was an error then close the connection */
-			if (read < 0)
-			{
-				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
-					/* No worries */
-					break;
-
-				/* Error! */
-				flap_connection_schedule_destroy(conn,
-						OSCAR_DISCONNECT_LOST_CONNECTION, g_strerror(errno));
-				break;
-			}
-			conn->od->gc->last_received = time(NULL);
+			conn->buffer_incoming = g_realloc(conn->buffer_incoming, needed);
+			conn->buffer_incoming_size = needed;
+		}
 
-			/* If we don't even have a complete FLAP header then do nothing */
-			conn->header_received += read;
-			if (conn->header_received < 6)
-				break;
+		buflen = conn->buffer_incoming_size - conn->buffer_incoming_len;
+		if (conn->gsc)
+			read = purple_ssl_read(conn->gsc,
+					conn->buffer_incoming + conn->buffer_incoming_len, buflen);
+		else
+			read = recv(conn->fd,
+					conn->buffer_incoming + conn->buffer_incoming_len, buflen, 0);
 
-			/* All FLAP frames must start with the byte 0x2a */
-			if (aimutil_get8(&conn->header[0]) != 0x2a)
-			{
-				flap_connection_schedule_destroy(conn,
-						OSCAR_DISCONNECT_INVALID_DATA, NULL);
-				break;
-			}
-
-			/* Initialize a new temporary FlapFrame for incoming data */
-			conn->buffer_incoming.channel = aimutil_get8(&conn->header[1]);
-			conn->buffer_incoming.seqnum = aimutil_get16(&conn->header[2]);
-			conn->buffer_incoming.data.len = aimutil_get16(&conn->header[4]);
-			conn->buffer_incoming.data.data = g_new(guint8, conn->buffer_incoming.data.len);
-			conn->buffer_incoming.data.offset = 0;
+		/* Check if the FLAP server closed the connection */
+		if (read == 0)
+		{
+			flap_connection_schedule_destroy(conn,
+					OSCAR_DISCONNECT_REMOTE_CLOSED, NULL);
+			break;
 		}
 
-		buflen = conn->buffer_incoming.data.len - conn->buffer_incoming.data.offset;
-		if (buflen)
+		/* If there was an error then close the connection */
+		if (read < 0)
 		{
-			buf = &conn->buffer_incoming.data.data[conn->buffer_incoming.data.offset];
-			/* Read data into the temporary FlapFrame until it is complete */
-			if (conn->gsc)
-				read = purple_ssl_read(conn->gsc, buf, buflen);
-			else
-				read = recv(conn->fd, buf, buflen, 0);
-
-			/* Check if the FLAP server closed the connection */
-			if (read == 0)
-			{
-				flap_connection_schedule_destroy(conn,
-						OSCAR_DISCONNECT_REMOTE_CLOSED, NULL);
-				break;
-			}
-
-			if (read < 0)
-			{
-				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
-					/* No worries */
-					break;
-
-				/* Error! */
-				flap_connection_schedule_destroy(conn,
-						OSCAR_DISCONNECT_LOST_CONNECTION, g_strerror(errno));
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				/* No worries */
 				break;
-			}
 
-			conn->buffer_incoming.data.offset += read;
-			if (conn->buffer_incoming.data.offset < conn->buffer_incoming.data.len)
-				/* Waiting for more data to arrive */
-				break;
+			/* Error! */
+			flap_connection_schedule_destroy(conn,
+					OSCAR_DISCONNECT_LOST_CONNECTION, g_strerror(errno));
+			break;
 		}
+		conn->od->gc->last_received = time(NULL);
+		conn->buffer_incoming_len += read;
 
-		/* We have a complete FLAP!  Handle it and continue reading */
-		byte_stream_rewind(&conn->buffer_incoming.data);
-		parse_flap(conn->od, conn, &conn->buffer_incoming);
-		conn->lastactivity = time(NULL);
+		if (!flap_connection_parse_buffer(conn))
+			break;
 
-		g_free(conn->buffer_incoming.data.data);
-		conn->buffer_incoming.data.data = NULL;
+		/*
+		 * A short read from a plain socket means it's been drained, so
+		 * save the syscall that would only return EAGAIN.  SSL can have
+		 * decrypted data buffered that won't wake us up again, though.
+		 */
+		if (conn->gsc == NULL && (gsize)read < buflen)
+			break;
+	}
 
-		conn->header_received = 0;
+	/* Don't hang on to the room a huge FLAP needed */
+	if (conn->buffer_incoming_len == 0 &&
+			conn->buffer_incoming_size > FLAP_RECV_CHUNK_SIZE)
+	{
+		g_free(conn->buffer_incoming);
+		conn->buffer_incoming = NULL;
+		conn->buffer_incoming_size = 0;
 	}
 }
 
@@ -1031,11 +1141,13 @@ send_cb(gpointer data, gint source, PurpleInputCondition cond)
 		return;
 	}
 
-	if (conn->gsc)
+	if (conn->gsc) {
 		ret = purple_ssl_write(conn->gsc, conn->buffer_outgoing->outptr,
 				writelen);
-	else
-		ret = send(conn->fd, conn->buffer_outgoing->outptr, writelen, 0);
+		if (ret > 0)
+			purple_circ_buffer_mark_read(conn->buffer_outgoing, ret);
+	} else
+		ret = purple_circ_buffer_writev(conn->buffer_outgoing, conn->fd);
 	if (ret <= 0)
 	{
 		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
@@ -1056,8 +1168,6 @@ send_cb(gpointer data, gint source, PurpleInputCondition cond)
 				OSCAR_DISCONNECT_LOST_CONNECTION, g_strerror(errno));
 		return;
 	}
-
-	purple_circ_buffer_mark_read(conn->buffer_outgoing, ret);
 }
 
 static void
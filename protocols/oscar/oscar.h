@@ -274,9 +274,9 @@ struct _FlapConnection
 
 	int fd;
 	PurpleSslConnection *gsc;
-	guint8 header[6];
-	gssize header_received;
-	FlapFrame buffer_incoming;
+	guint8 *buffer_incoming; /**< Received data not yet parsed into FLAPs */
+	gsize buffer_incoming_len; /**< Number of bytes in buffer_incoming */
+	gsize buffer_incoming_size; /**< Allocated size of buffer_incoming */
 	PurpleCircBuffer *buffer_outgoing;
 	guint watcher_incoming;
 	guint watcher_outgoing;
@@ -290,9 +290,7 @@ struct _FlapConnection
 	struct rateclass *default_rateclass;
 	GHashTable *rateclass_members; /* Key is family and subtype, value is pointer to the rateclass struct to use. */
 
-	GQueue *queued_snacs; /**< Contains QueuedSnacs. */
-	GQueue *queued_lowpriority_snacs; /**< Contains QueuedSnacs to send only once queued_snacs is empty */
-	guint queued_timeout;
+	guint queued_timeout; /**< Fires when the next queued SNAC may be sent */
 
 	void *internal; /* internal conn-specific libfaim data */
 };
@@ -353,6 +351,7 @@ struct _OscarData
 	PurpleConnection *gc;
 
 	void *modlistv;
+	GHashTable *snac_dispatch; /**< See aim__findsnacmodules() */
 
 	/*
 	 * Outstanding snac handling
@@ -887,6 +886,19 @@ int aim_bart_request(OscarData *od, const char *bn, guint8 iconcsumtype, const g
 #define AIM_SSI_PRESENCE_FLAG_SHOWIDLE        0x00000400
 #define AIM_SSI_PRESENCE_FLAG_NORECENTBUDDIES 0x00020000
 
+/*
+ * Lookup tables shared by every item of one list (official or local).
+ * They are kept up to date by aim_ssi_itemlist_add() and
+ * aim_ssi_itemlist_del(), so never change an item's name or IDs
+ * behind their backs.
+ */
+struct aim_ssi_itemindex
+{
+	GHashTable *ids;   /* (gid << 16 | bid) -> first item with those IDs */
+	GHashTable *names; /* normalized name -> GSList of items, in list order */
+	GSList *unnamed;   /* items without a name, in list order */
+};
+
 struct aim_ssi_item
 {
 	char *name;
@@ -894,6 +906,7 @@ struct aim_ssi_item
 	guint16 bid;
 	guint16 type;
 	GSList *data;
+	struct aim_ssi_itemindex *index;
 	struct aim_ssi_item *next;
 };
 
@@ -915,6 +928,11 @@ struct aim_ssi_tmp
 /* 0x0018 */ int aim_ssi_sendauthrequest(OscarData *od, const char *bn, const char *msg);
 /* 0x001a */ int aim_ssi_sendauthreply(OscarData *od, const char *bn, guint8 reply, const char *msg);
 
+/* These only change the given list; they don't send anything */
+struct aim_ssi_item *aim_ssi_itemlist_add(struct aim_ssi_item **list, const char *name, guint16 gid, guint16 bid, guint16 type, GSList *data);
+int aim_ssi_itemlist_del(struct aim_ssi_item **list, struct aim_ssi_item *del);
+struct aim_ssi_tmp *aim_ssi_itemlist_diff(struct aim_ssi_item *official, struct aim_ssi_item *local, int max);
+
 /* Client functions for retrieving SSI data */
 struct aim_ssi_item *aim_ssi_itemlist_find(struct aim_ssi_item *list, guint16 gid, guint16 bid);
 struct aim_ssi_item *aim_ssi_itemlist_finditem(struct aim_ssi_item *list, const char *gn, const char *bn, guint16 type);
@@ -1185,6 +1203,7 @@ int aim__registermodule(OscarData *od, int (*modfirst)(OscarData *, aim_module_t
 void aim__shutdownmodules(OscarData *od);
 aim_module_t *aim__findmodulebygroup(OscarData *od, guint16 group);
 aim_module_t *aim__findmodule(OscarData *od, const char *name);
+aim_module_t **aim__findsnacmodules(OscarData *od, guint16 family);
 
 int admin_modfirst(OscarData *od, aim_module_t *mod);
 int buddylist_modfirst(OscarData *od, aim_module_t *mod);
@@ -1289,8 +1308,14 @@ struct rateclass {
 	guint8 dropping_snacs;
 
 	struct timeval last; /**< The time when we last sent a SNAC of this rate class. */
+
+	GQueue *queued_snacs; /**< Contains QueuedSnacs. */
+	GQueue *queued_lowpriority_snacs; /**< Contains QueuedSnacs to send only once queued_snacs is empty */
 };
 
+guint flap_connection_rateclass_get_wait(struct rateclass *rateclass, const struct timeval *now);
+void flap_connection_schedule_queued_snacs(FlapConnection *conn);
+
 int aim_cachecookie(OscarData *od, IcbmCookie *cookie);
 IcbmCookie *aim_uncachecookie(OscarData *od, guint8 *cookie, int type);
 IcbmCookie *aim_mkcookie(guint8 *, int, void *);
@@ -45,6 +45,56 @@ aim_module_t *aim__findmodule(OscarData *od, const char *name)
 	return NULL;
 }
 
+/**
+ * Find the modules that may handle a SNAC of the given family.
+ *
+ * This is a table indexed by family and built from od->modlistv the
+ * first time each family is seen, so that dispatching a SNAC doesn't
+ * mean walking every registered module.  Modules handle their own
+ * subtypes, so the family is the finest useful index.
+ *
+ * @return A NULL-terminated array of modules, in the order their
+ *         snachandlers should be tried.
+ */
+aim_module_t **aim__findsnacmodules(OscarData *od, guint16 family)
+{
+	aim_module_t **mods;
+	aim_module_t *cur;
+	int count = 0;
+
+	if (od->snac_dispatch == NULL)
+		od->snac_dispatch = g_hash_table_new_full(g_direct_hash,
+				g_direct_equal, NULL, g_free);
+	else if ((mods = g_hash_table_lookup(od->snac_dispatch,
+			GUINT_TO_POINTER((guint)family))) != NULL)
+		return mods;
+
+	for (cur = (aim_module_t *)od->modlistv; cur; cur = cur->next) {
+		if ((cur->flags & AIM_MODFLAG_MULTIFAMILY) || (cur->family == family))
+			count++;
+	}
+
+	mods = g_new(aim_module_t *, count + 1);
+	count = 0;
+	for (cur = (aim_module_t *)od->modlistv; cur; cur = cur->next) {
+		if ((cur->flags & AIM_MODFLAG_MULTIFAMILY) || (cur->family == family))
+			mods[count++] = cur;
+	}
+	mods[count] = NULL;
+
+	g_hash_table_insert(od->snac_dispatch, GUINT_TO_POINTER((guint)family), mods);
+
+	return mods;
+}
+
+static void aim__invalidatesnacmodules(OscarData *od)
+{
+	if (od->snac_dispatch != NULL) {
+		g_hash_table_destroy(od->snac_dispatch);
+		od->snac_dispatch = NULL;
+	}
+}
+
 int aim__registermodule(OscarData *od, int (*modfirst)(OscarData *, aim_module_t *))
 {
 	aim_module_t *mod;
@@ -68,6 +118,7 @@ int aim__registermodule(OscarData *od, int (*modfirst)(OscarData *, aim_module_t
 
 	mod->next = (aim_module_t *)od->modlistv;
 	od->modlistv = mod;
+	aim__invalidatesnacmodules(od);
 
 	return 0;
 }
@@ -90,6 +141,7 @@ void aim__shutdownmodules(OscarData *od)
 	}
 
 	od->modlistv = NULL;
+	aim__invalidatesnacmodules(od);
 
 	return;
 }
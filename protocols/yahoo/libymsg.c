@@ -947,45 +947,27 @@ struct _yahoo_im {
 static void yahoo_process_sms_message(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
 	PurpleAccount *account;
-	GSList *l = pkt->hash;
 	struct _yahoo_im *sms = NULL;
 	YahooData *yd;
-	char *server_msg = NULL;
+	const char *from, *carrier, *server_msg;
 	char *m;
 
 	yd = gc->proto_data;
 	account = purple_connection_get_account(gc);
 
-	while (l != NULL) {
-		struct yahoo_pair *pair = l->data;
-		if (pair->key == 4) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				sms = g_new0(struct _yahoo_im, 1);
-				sms->from = g_strdup_printf("+%s", pair->value);
-				sms->time = time(NULL);
-				sms->utf8 = TRUE;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_sms_message "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		}
-		if (pair->key == 14) {
-			if (sms)
-				sms->msg = pair->value;
-		}
-		if (pair->key == 68)
-			if(sms)
-				g_hash_table_insert(yd->sms_carrier, g_strdup(sms->from), g_strdup(pair->value));
-		if (pair->key == 16) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				server_msg = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_sms_message "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		}
-		l = l->next;
+	from = yahoo_packet_get_utf8(pkt, 4);
+	if (from != NULL) {
+		sms = g_new0(struct _yahoo_im, 1);
+		sms->from = g_strdup_printf("+%s", from);
+		sms->time = time(NULL);
+		sms->utf8 = TRUE;
+		sms->msg = (char *)yahoo_packet_get_str(pkt, 14);
+
+		carrier = yahoo_packet_get_str(pkt, 68);
+		if (carrier != NULL)
+			g_hash_table_insert(yd->sms_carrier, g_strdup(sms->from), g_strdup(carrier));
 	}
+	server_msg = yahoo_packet_get_utf8(pkt, 16);
 
 	if(!sms) {
 		purple_debug_info("yahoo", "Received a malformed SMS packet!\n");
@@ -1234,33 +1216,13 @@ static void yahoo_process_message(PurpleConnection *gc, struct yahoo_packet *pkt
 
 static void yahoo_process_sysmessage(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	GSList *l = pkt->hash;
-	char *prim, *me = NULL, *msg = NULL;
+	char *prim;
+	const char *me, *msg;
 
-	while (l) {
-		struct yahoo_pair *pair = l->data;
+	me = yahoo_packet_get_utf8(pkt, 5);
+	msg = yahoo_packet_get_utf8(pkt, 14);
 
-		if (pair->key == 5) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				me = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_sysmessage "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		}
-		if (pair->key == 14) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				msg = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_sysmessage "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		}
-
-		l = l->next;
-	}
-
-	if (!msg || !g_utf8_validate(msg, -1, NULL))
+	if (!msg)
 		return;
 
 	prim = g_strdup_printf(_("Yahoo! system message for %s:"),
@@ -1396,42 +1358,21 @@ static void yahoo_buddy_denied_our_add(PurpleConnection *gc, const char *who, co
 
 static void yahoo_buddy_auth_req_15(PurpleConnection *gc, struct yahoo_packet *pkt) {
 	PurpleAccount *account;
-	GSList *l = pkt->hash;
 	const char *msg = NULL;
 
 	account = purple_connection_get_account(gc);
 
 	/* Buddy authorized/declined our addition */
 	if (pkt->status == 1) {
-		char *temp = NULL;
+		const char *temp;
 		char *who = NULL;
-		int response = 0;
-		YahooFederation fed = YAHOO_FEDERATION_NONE;
+		int response;
+		YahooFederation fed;
 
-		while (l) {
-			struct yahoo_pair *pair = l->data;
-
-			switch (pair->key) {
-			case 4:
-				if (g_utf8_validate(pair->value, -1, NULL)) {
-					temp = pair->value;
-				} else {
-					purple_debug_warning("yahoo", "yahoo_buddy_auth_req_15 "
-							"got non-UTF-8 string for key %d\n", pair->key);
-				}
-				break;
-			case 13:
-				response = strtol(pair->value, NULL, 10);
-				break;
-			case 14:
-				msg = pair->value;
-				break;
-			case 241:
-				fed = strtol(pair->value, NULL, 10);
-				break;
-			}
-			l = l->next;
-		}
+		temp = yahoo_packet_get_utf8(pkt, 4);
+		response = yahoo_packet_get_int(pkt, 13, 0);
+		msg = yahoo_packet_get_str(pkt, 14);
+		fed = yahoo_packet_get_int(pkt, 241, YAHOO_FEDERATION_NONE);
 
 		switch (fed) {
 			case YAHOO_FEDERATION_MSN:
@@ -1461,59 +1402,19 @@ static void yahoo_buddy_auth_req_15(PurpleConnection *gc, struct yahoo_packet *p
 	/* Buddy requested authorization to add us. */
 	else if (pkt->status == 3) {
 		struct yahoo_add_request *add_req;
-		const char *firstname = NULL, *lastname = NULL;
-		char *temp = NULL;
+		const char *firstname, *lastname;
+		const char *temp;
 
 		add_req = g_new0(struct yahoo_add_request, 1);
 		add_req->gc = gc;
-		add_req->fed = YAHOO_FEDERATION_NONE;
-
-		while (l) {
-			struct yahoo_pair *pair = l->data;
 
-			switch (pair->key) {
-			case 4:
-				if (g_utf8_validate(pair->value, -1, NULL)) {
-					temp = pair->value;
-				} else {
-					purple_debug_warning("yahoo", "yahoo_buddy_auth_req_15 "
-							"got non-UTF-8 string for key %d\n", pair->key);
-				}
-				break;
-			case 5:
-				if (g_utf8_validate(pair->value, -1, NULL)) {
-					add_req->id = g_strdup(pair->value);
-				} else {
-					purple_debug_warning("yahoo", "yahoo_buddy_auth_req_15 "
-							"got non-UTF-8 string for key %d\n", pair->key);
-				}
-				break;
-			case 14:
-				msg = pair->value;
-				break;
-			case 216:
-				if (g_utf8_validate(pair->value, -1, NULL)) {
-					firstname = pair->value;
-				} else {
-					purple_debug_warning("yahoo", "yahoo_buddy_auth_req_15 "
-							"got non-UTF-8 string for key %d\n", pair->key);
-				}
-				break;
-			case 241:
-				add_req->fed = strtol(pair->value, NULL, 10);
-				break;
-			case 254:
-				if (g_utf8_validate(pair->value, -1, NULL)) {
-					lastname = pair->value;
-				} else {
-					purple_debug_warning("yahoo", "yahoo_buddy_auth_req_15 "
-							"got non-UTF-8 string for key %d\n", pair->key);
-				}
-				break;
+		temp = yahoo_packet_get_utf8(pkt, 4);
+		add_req->id = g_strdup(yahoo_packet_get_utf8(pkt, 5));
+		msg = yahoo_packet_get_str(pkt, 14);
+		firstname = yahoo_packet_get_utf8(pkt, 216);
+		add_req->fed = yahoo_packet_get_int(pkt, 241, YAHOO_FEDERATION_NONE);
+		lastname = yahoo_packet_get_utf8(pkt, 254);
 
-			}
-			l = l->next;
-		}
 		switch (add_req->fed) {
 			case YAHOO_FEDERATION_MSN:
 				add_req->who = g_strconcat("msn/", temp, NULL);
@@ -1576,42 +1477,16 @@ static void yahoo_buddy_auth_req_15(PurpleConnection *gc, struct yahoo_packet *p
 static void yahoo_buddy_added_us(PurpleConnection *gc, struct yahoo_packet *pkt) {
 	PurpleAccount *account;
 	struct yahoo_add_request *add_req;
-	char *msg = NULL;
-	GSList *l = pkt->hash;
+	const char *msg;
 
 	account = purple_connection_get_account(gc);
 
 	add_req = g_new0(struct yahoo_add_request, 1);
 	add_req->gc = gc;
-
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 1:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				add_req->id = g_strdup(pair->value);
-			} else {
-					purple_debug_warning("yahoo", "yahoo_buddy_added_us "
-							"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 3:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				add_req->who = g_strdup(pair->value);
-			} else {
-					purple_debug_warning("yahoo", "yahoo_buddy_added_us "
-							"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 15: /* time, for when they add us and we're offline */
-			break;
-		case 14:
-			msg = pair->value;
-			break;
-		}
-		l = l->next;
-	}
+	add_req->id = g_strdup(yahoo_packet_get_utf8(pkt, 1));
+	add_req->who = g_strdup(yahoo_packet_get_utf8(pkt, 3));
+	/* Key 15 is the time, for when they add us and we're offline */
+	msg = yahoo_packet_get_str(pkt, 14);
 
 	if (add_req->id && add_req->who) {
 		char *dec_msg = NULL;
@@ -1645,35 +1520,8 @@ static void yahoo_buddy_added_us(PurpleConnection *gc, struct yahoo_packet *pkt)
 /* I have no idea if this every gets called in version 15 */
 static void yahoo_buddy_denied_our_add_old(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	char *who = NULL;
-	char *msg = NULL;
-	GSList *l = pkt->hash;
-
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 3:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_buddy_denied_our_add_old "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 14:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				msg = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_buddy_denied_our_add_old "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		}
-		l = l->next;
-	}
-
-	yahoo_buddy_denied_our_add(gc, who, msg);
+	yahoo_buddy_denied_our_add(gc, yahoo_packet_get_utf8(pkt, 3),
+			yahoo_packet_get_utf8(pkt, 14));
 }
 
 static void yahoo_process_contact(PurpleConnection *gc, struct yahoo_packet *pkt)
@@ -1750,44 +1598,17 @@ static void yahoo_process_mail(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
 	PurpleAccount *account = purple_connection_get_account(gc);
 	YahooData *yd = gc->proto_data;
-	const char *who = NULL;
-	const char *email = NULL;
-	const char *subj = NULL;
+	const char *who, *email, *subj;
 	const char *yahoo_mail_url = (yd->jp? YAHOOJP_MAIL_URL: YAHOO_MAIL_URL);
-	int count = 0;
-	GSList *l = pkt->hash;
+	int count;
 
 	if (!purple_account_get_check_mail(account))
 		return;
 
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-		if (pair->key == 9)
-			count = strtol(pair->value, NULL, 10);
-		else if (pair->key == 43) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_mail "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		} else if (pair->key == 42) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				email = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_mail "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		} else if (pair->key == 18) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				subj = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_mail "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		}
-		l = l->next;
-	}
+	count = yahoo_packet_get_int(pkt, 9, 0);
+	who = yahoo_packet_get_utf8(pkt, 43);
+	email = yahoo_packet_get_utf8(pkt, 42);
+	subj = yahoo_packet_get_utf8(pkt, 18);
 
 	if (who && subj && email && *email) {
 		char *dec_who = yahoo_decode(who);
@@ -2212,34 +2033,13 @@ static void yahoo_auth16_stage1(PurpleConnection *gc, const char *seed)
 
 static void yahoo_process_auth(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	char *seed = NULL;
-	char *sn   = NULL;
-	GSList *l = pkt->hash;
-	int m = 0;
+	const char *seed, *sn;
+	int m;
 	gchar *buf;
 
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-		if (pair->key == 94) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				seed = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_auth "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		}
-		if (pair->key == 1) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				sn = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_auth "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		}
-		if (pair->key == 13)
-			m = atoi(pair->value);
-		l = l->next;
-	}
+	seed = yahoo_packet_get_utf8(pkt, 94);
+	sn = yahoo_packet_get_utf8(pkt, 1);
+	m = yahoo_packet_get_int(pkt, 13, 0);
 
 	if (seed) {
 		switch (m) {
@@ -2296,43 +2096,16 @@ static void keep_buddy(PurpleBuddy *b)
 
 static void yahoo_process_ignore(PurpleConnection *gc, struct yahoo_packet *pkt) {
 	PurpleBuddy *b;
-	GSList *l;
-	gchar *who = NULL;
-	gchar *me = NULL;
+	const gchar *who, *me;
 	gchar buf[BUF_LONG];
-	gboolean ignore = TRUE;
-	gint status = 0;
+	gboolean ignore;
+	gint status;
 
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
-		switch (pair->key) {
-		case 0:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_ignore "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 1:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				me = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_ignore "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 13:
-			/* 1 == ignore, 2 == unignore */
-			ignore = (strtol(pair->value, NULL, 10) == 1);
-			break;
-		case 66:
-			status = strtol(pair->value, NULL, 10);
-			break;
-		default:
-			break;
-		}
-	}
+	who = yahoo_packet_get_utf8(pkt, 0);
+	me = yahoo_packet_get_utf8(pkt, 1);
+	/* 1 == ignore, 2 == unignore */
+	ignore = (yahoo_packet_get_int(pkt, 13, 1) == 1);
+	status = yahoo_packet_get_int(pkt, 66, 0);
 
 	/*
 	 * status
@@ -2376,30 +2149,15 @@ static void yahoo_process_authresp(PurpleConnection *gc, struct yahoo_packet *pk
 #ifdef TRY_WEBMESSENGER_LOGIN
 	YahooData *yd = gc->proto_data;
 #endif /* TRY_WEBMESSENGER_LOGIN */
-	GSList *l = pkt->hash;
-	int err = 0;
+	int err;
 	char *msg;
-	char *url = NULL;
+	const char *url;
 	char *fullmsg;
 	PurpleAccount *account = gc->account;
 	PurpleConnectionError reason = PURPLE_CONNECTION_ERROR_OTHER_ERROR;
 
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		if (pair->key == 66)
-			err = strtol(pair->value, NULL, 10);
-		else if (pair->key == 20) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				url = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_authresp "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		}
-
-		l = l->next;
-	}
+	err = yahoo_packet_get_int(pkt, 66, 0);
+	url = yahoo_packet_get_utf8(pkt, 20);
 
 	switch (err) {
 	case 0:
@@ -2465,42 +2223,20 @@ static void yahoo_process_authresp(PurpleConnection *gc, struct yahoo_packet *pk
 
 static void yahoo_process_addbuddy(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	int err = 0;
+	int err;
 	char *who = NULL;
-	char *temp = NULL;
-	char *group = NULL;
+	const char *temp;
+	const char *group;
 	char *decoded_group;
 	char *buf;
 	YahooFriend *f;
-	GSList *l = pkt->hash;
 	YahooData *yd = gc->proto_data;
-	YahooFederation fed = YAHOO_FEDERATION_NONE;
-
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 66:
-			err = strtol(pair->value, NULL, 10);
-			break;
-		case 7:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				temp = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_addbuddy "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 65:
-			group = pair->value;
-			break;
-		case 241:
-			fed = strtol(pair->value, NULL, 10);
-			break;
-		}
+	YahooFederation fed;
 
-		l = l->next;
-	}
+	err = yahoo_packet_get_int(pkt, 66, 0);
+	temp = yahoo_packet_get_utf8(pkt, 7);
+	group = yahoo_packet_get_str(pkt, 65);
+	fed = yahoo_packet_get_int(pkt, 241, YAHOO_FEDERATION_NONE);
 
 	if (!temp)
 		return;
@@ -2627,8 +2363,7 @@ static void yahoo_p2p_disconnect_destroy_data(gpointer data)
 static void yahoo_p2p_process_p2pfilexfer(gpointer data, gint source, struct yahoo_packet *pkt)
 {
 	struct yahoo_p2p_data *p2p_data;
-	char *who = NULL;
-	GSList *l = pkt->hash;
+	const char *who;
 	struct yahoo_packet *pkt_to_send;
 	PurpleAccount *account;
 	int val_13_to_send = 0;
@@ -2641,30 +2376,15 @@ static void yahoo_p2p_process_p2pfilexfer(gpointer data, gint source, struct yah
 	yd = p2p_data->gc->proto_data;
 
 	/* lets see whats in the packet */
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 4:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-				if(strncmp(who, p2p_data->host_username, strlen(p2p_data->host_username)) != 0) {
-					/* from whom are we receiving the packets ?? */
-					purple_debug_warning("yahoo","p2p: received data from wrong user\n");
-					return;
-				}
-			} else {
-				purple_debug_warning("yahoo", "yahoo_p2p_process_p2pfilexfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 13:
-			p2p_data->val_13 = strtol(pair->value, NULL, 10);	/* Value should be 5-7 */
-			break;
-		/* case 5, 49 look laters, no use right now */
-		}
-		l = l->next;
+	who = yahoo_packet_get_utf8(pkt, 4);
+	if (who && strncmp(who, p2p_data->host_username, strlen(p2p_data->host_username)) != 0) {
+		/* from whom are we receiving the packets ?? */
+		purple_debug_warning("yahoo","p2p: received data from wrong user\n");
+		return;
 	}
+	/* Value should be 5-7 */
+	p2p_data->val_13 = yahoo_packet_get_int(pkt, 13, p2p_data->val_13);
+	/* keys 5, 49 look laters, no use right now */
 
 	account = purple_connection_get_account(p2p_data->gc);
 
@@ -3021,13 +2741,12 @@ static void yahoo_p2p_init_cb(gpointer data, gint source, const gchar *error_mes
 
 static void yahoo_process_p2p(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	GSList *l = pkt->hash;
-	char *who = NULL;
-	char *base64 = NULL;
+	const char *who;
+	const char *base64;
 	guchar *decoded;
 	gsize len;
-	gint val_13 = 0;
-	gint val_11 = 0;
+	gint val_13;
+	gint val_11;
 	PurpleAccount *account;
 	YahooFriend *f;
 
@@ -3036,55 +2755,24 @@ static void yahoo_process_p2p(PurpleConnection *gc, struct yahoo_packet *pkt)
 	if(pkt->status != YAHOO_STATUS_BRB && pkt->status != YAHOO_STATUS_P2P)
 		return ;
 
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 5:
-			/* our identity */
-			break;
-		case 4:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_p2p "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 1:
-			/* who again, the master identity this time? */
-			break;
-		case 12:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				base64 = pair->value;
-				/* so, this is an ip address. in base64. decoded it's in ascii.
-				   after strtol, it's in reversed byte order. Who thought this up?*/
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_p2p "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 13:
-			val_13 = strtol(pair->value, NULL, 10);
-			break;
-		case 11:
-			val_11 = strtol(pair->value, NULL, 10);		/* session id of peer */
-			if( (f = yahoo_friend_find(gc, who)) )
-				f->session_id = val_11;
-			break;
-		/*
-			TODO: figure these out
-			yahoo: Key: 61          Value: 0
-			yahoo: Key: 2   Value:
-			yahoo: Key: 13          Value: 0	packet count ??
-			yahoo: Key: 49          Value: PEERTOPEER
-			yahoo: Key: 140         Value: 1
-		*/
-
-		}
-
-		l = l->next;
-	}
+	/* Key 5 is our identity, and 1 is who again, the master identity this time? */
+	who = yahoo_packet_get_utf8(pkt, 4);
+	/* so, this is an ip address. in base64. decoded it's in ascii.
+	   after strtol, it's in reversed byte order. Who thought this up?*/
+	base64 = yahoo_packet_get_utf8(pkt, 12);
+	val_13 = yahoo_packet_get_int(pkt, 13, 0);
+	/* session id of peer */
+	val_11 = yahoo_packet_get_int(pkt, 11, 0);
+	if (who && yahoo_packet_find_last(pkt, 11) && (f = yahoo_friend_find(gc, who)))
+		f->session_id = val_11;
+	/*
+		TODO: figure these out
+		yahoo: Key: 61          Value: 0
+		yahoo: Key: 2   Value:
+		yahoo: Key: 13          Value: 0	packet count ??
+		yahoo: Key: 49          Value: PEERTOPEER
+		yahoo: Key: 140         Value: 1
+	*/
 
 	if (base64) {
 		guint32 ip;
@@ -3141,61 +2829,22 @@ static void yahoo_process_p2p(PurpleConnection *gc, struct yahoo_packet *pkt)
 static void yahoo_process_audible(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
 	PurpleAccount *account;
-	char *who = NULL, *msg = NULL, *id = NULL;
-	GSList *l = pkt->hash;
+	const char *who, *msg, *id;
 
 	account = purple_connection_get_account(gc);
 
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 4:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_audible "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 5:
-			/* us */
-			break;
-		case 230:
-			/* the audible, in foo.locale.bar.baz format
-			   eg: base.tw.smiley.smiley43 */
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				id = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_audible "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 231:
-			/* the text of the audible */
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				msg = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_audible "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 232:
-			/* SHA-1 hash of audible SWF file (eg: 4e8691499d9c0fb8374478ff9720f4a9ea4a4915) */
-			break;
-		}
-
-		l = l->next;
-	}
+	/* Key 5 is us, and 232 the SHA-1 hash of the audible's SWF file */
+	who = yahoo_packet_get_utf8(pkt, 4);
+	/* the audible, in foo.locale.bar.baz format
+	   eg: base.tw.smiley.smiley43 */
+	id = yahoo_packet_get_utf8(pkt, 230);
+	/* the text of the audible */
+	msg = yahoo_packet_get_utf8(pkt, 231);
 
 	if (!msg)
 		msg = id;
 	if (!who || !msg)
 		return;
-	if (!g_utf8_validate(msg, -1, NULL)) {
-		purple_debug_misc("yahoo", "Warning, nonutf8 audible, ignoring!\n");
-		return;
-	}
 	if (!purple_privacy_check(account, who)) {
 		purple_debug_misc("yahoo", "Audible message from %s for %s dropped!\n",
 				purple_account_get_username(account), who);
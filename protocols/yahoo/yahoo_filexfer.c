@@ -732,82 +732,21 @@ static void yahoo_xfer_end(PurpleXfer *xfer_old)
 
 void yahoo_process_p2pfilexfer(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	GSList *l = pkt->hash;
-
-	char *me      = NULL;
-	char *from    = NULL;
-	char *service = NULL;
-	char *message = NULL;
-	char *command = NULL;
-	char *imv     = NULL;
-	char *unknown = NULL;
+	const char *me;
+	const char *from;
+	const char *service;
+	const char *message;
+	const char *command;
+	const char *imv;
 
 	/* Get all the necessary values from this new packet */
-	while(l != NULL)
-	{
-		struct yahoo_pair *pair = l->data;
-
-		switch(pair->key) {
-		case 5:         /* Get who the packet is for */
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				me = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_p2pfilexfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 4:         /* Get who the packet is from */
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				from = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_p2pfilexfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 49:        /* Get the type of service */
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				service = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_p2pfilexfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 14:        /* Get the 'message' of the packet */
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				message = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_p2pfilexfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 13:        /* Get the command associated with this packet */
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				command = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_p2pfilexfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 63:        /* IMVironment name and version */
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				imv = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_p2pfilexfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 64:        /* Not sure, but it does vary with initialization of Doodle */
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				unknown = pair->value; /* So, I'll keep it (for a little while atleast) */
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_p2pfilexfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		}
-
-		l = l->next;
-	}
+	me = yahoo_packet_get_utf8(pkt, 5);        /* Who the packet is for */
+	from = yahoo_packet_get_utf8(pkt, 4);      /* Who the packet is from */
+	service = yahoo_packet_get_utf8(pkt, 49);  /* The type of service */
+	message = yahoo_packet_get_utf8(pkt, 14);  /* The 'message' of the packet */
+	command = yahoo_packet_get_utf8(pkt, 13);  /* The command associated with this packet */
+	imv = yahoo_packet_get_utf8(pkt, 63);      /* IMVironment name and version */
+	/* Key 64 is not sure, but it does vary with initialization of Doodle */
 
 	/* If this packet is an IMVIRONMENT, handle it accordingly */
 	if(service != NULL && imv != NULL && !strcmp(service, "IMVIRONMENT"))
@@ -827,85 +766,29 @@ void yahoo_process_p2pfilexfer(PurpleConnection *gc, struct yahoo_packet *pkt)
 
 void yahoo_process_filetransfer(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	char *from = NULL;
-	char *to = NULL;
-	char *msg = NULL;
-	char *url = NULL;
-	char *imv = NULL;
-	long expires = 0;
+	const char *from;
+	char *msg;
+	const char *url;
+	const char *imv;
 	PurpleXfer *xfer;
 	YahooData *yd;
 	struct yahoo_xfer_data *xfer_data;
-	char *service = NULL;
-	char *filename = NULL;
-	unsigned long filesize = 0L;
-	GSList *l;
+	const char *service;
+	char *filename;
+	const char *size;
+	unsigned long filesize;
 
 	yd = gc->proto_data;
 
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 4:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				from = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetransfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 5:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				to = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetransfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 14:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				msg = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetransfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 20:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				url = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetransfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 38:
-			expires = strtol(pair->value, NULL, 10);
-			break;
-		case 27:
-			filename = pair->value;
-			break;
-		case 28:
-			filesize = atol(pair->value);
-			break;
-		case 49:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				service = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetransfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 63:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				imv = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetransfer "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		}
-	}
+	/* Key 5 is who it's to, and 38 when it expires */
+	from = yahoo_packet_get_utf8(pkt, 4);
+	msg = (char *)yahoo_packet_get_utf8(pkt, 14);
+	url = yahoo_packet_get_utf8(pkt, 20);
+	filename = (char *)yahoo_packet_get_str(pkt, 27);
+	size = yahoo_packet_get_str(pkt, 28);
+	filesize = size ? atol(size) : 0L;
+	service = yahoo_packet_get_utf8(pkt, 49);
+	imv = yahoo_packet_get_utf8(pkt, 63);
 
 	/*
 	 * The remote user has changed their IMVironment.  We
@@ -1870,69 +1753,26 @@ void yahoo_process_filetrans_15(PurpleConnection *gc, struct yahoo_packet *pkt)
 
 void yahoo_process_filetrans_info_15(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	char *from = NULL;
-	char *to = NULL;
-	char *url = NULL;
-	long val_249 = 0;
-	long val_66 = 0;
+	const char *url;
+	long val_249;
+	long val_66;
 	PurpleXfer *xfer;
 	YahooData *yd;
 	struct yahoo_xfer_data *xfer_data;
-	char *filename = NULL;
-	char *xfer_peer_idstring = NULL;
-	char *xfer_idstring_for_relay = NULL;
-	GSList *l;
+	const char *xfer_peer_idstring;
+	const char *xfer_idstring_for_relay;
 	struct yahoo_packet *pkt_to_send;
 	struct yahoo_p2p_data *p2p_data;
 
 	yd = gc->proto_data;
 
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 4:
-			from = pair->value;
-			break;
-		case 5:
-			to = pair->value;
-			break;
-		case 265:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				xfer_peer_idstring = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetrans_info_15 "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 27:
-			filename = pair->value;
-			break;
-		case 66:
-			val_66 = strtol(pair->value, NULL, 10);
-			break;
-		case 249:
-			val_249 = strtol(pair->value, NULL, 10);
-			/* 249 has value 1 or 2 when doing p2p transfer and value 3 when relaying through yahoo server */
-			break;
-		case 250:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				url = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetrans_info_15 "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 251:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				xfer_idstring_for_relay = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetrans_info_15 "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		}
-	}
+	/* Keys 4 and 5 are who it's from and to, and 27 the filename */
+	xfer_peer_idstring = yahoo_packet_get_utf8(pkt, 265);
+	val_66 = yahoo_packet_get_int(pkt, 66, 0);
+	/* 249 has value 1 or 2 when doing p2p transfer and value 3 when relaying through yahoo server */
+	val_249 = yahoo_packet_get_int(pkt, 249, 0);
+	url = yahoo_packet_get_utf8(pkt, 250);
+	xfer_idstring_for_relay = yahoo_packet_get_utf8(pkt, 251);
 
 	if(!xfer_peer_idstring)
 		return;
@@ -1995,55 +1835,23 @@ void yahoo_process_filetrans_info_15(PurpleConnection *gc, struct yahoo_packet *
 /* TODO: Check filename etc. No probs till some hacker comes in the way */
 void yahoo_process_filetrans_acc_15(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	gchar *xfer_peer_idstring = NULL;
-	gchar *xfer_idstring_for_relay = NULL;
+	const gchar *xfer_peer_idstring;
+	const gchar *xfer_idstring_for_relay;
 	PurpleXfer *xfer;
 	YahooData *yd;
 	struct yahoo_xfer_data *xfer_data;
-	GSList *l;
 	PurpleAccount *account;
-	long val_66 = 0;
-	gchar *url = NULL;
-	int val_249 = 0;
+	long val_66;
+	const gchar *url;
+	int val_249;
 
 	yd = gc->proto_data;
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 251:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				xfer_idstring_for_relay = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetrans_acc_15 "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 265:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				xfer_peer_idstring = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetrans_acc_15 "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 66:
-			val_66 = atol(pair->value);
-			break;
-		case 249:
-			val_249 = atol(pair->value);
-			break;
-		case 250:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				/* we get a p2p url here when sending file, connected as client */
-				url = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_filetrans_acc_15 "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		}
-	}
+	xfer_idstring_for_relay = yahoo_packet_get_utf8(pkt, 251);
+	xfer_peer_idstring = yahoo_packet_get_utf8(pkt, 265);
+	val_66 = yahoo_packet_get_int(pkt, 66, 0);
+	val_249 = yahoo_packet_get_int(pkt, 249, 0);
+	/* we get a p2p url here when sending file, connected as client */
+	url = yahoo_packet_get_utf8(pkt, 250);
 
 	xfer = g_hash_table_lookup(yd->xfer_peer_idstring_map, xfer_peer_idstring);
 	if(!xfer) return;
@@ -146,35 +146,15 @@ void yahoo_friend_free(gpointer p)
 
 void yahoo_process_presence(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	GSList *l = pkt->hash;
 	YahooFriend *f;
-	char *temp = NULL;
+	const char *temp;
 	char *who = NULL;
-	int value = 0;
-	YahooFederation fed = YAHOO_FEDERATION_NONE;
-
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-			case 7:
-				if (g_utf8_validate(pair->value, -1, NULL)) {
-					temp = pair->value;
-				} else {
-					purple_debug_warning("yahoo", "yahoo_process_presence "
-							"got non-UTF-8 string for key %d\n", pair->key);
-				}
-				break;
-			case 31:
-				value = strtol(pair->value, NULL, 10);
-				break;
-			case 241:
-				fed = strtol(pair->value, NULL, 10);
-				break;
-		}
+	int value;
+	YahooFederation fed;
 
-		l = l->next;
-	}
+	temp = yahoo_packet_get_utf8(pkt, 7);
+	value = yahoo_packet_get_int(pkt, 31, 0);
+	fed = yahoo_packet_get_int(pkt, 241, YAHOO_FEDERATION_NONE);
 
 	if (value != 1 && value != 2) {
 		purple_debug_error("yahoo", "Received unknown value for presence key: %d\n", value);
@@ -38,6 +38,19 @@ struct yahoo_packet *yahoo_packet_new(enum yahoo_service service, enum yahoo_sta
 	return pkt;
 }
 
+/* Each pair is encoded as "<key>\xc0\x80<value>\xc0\x80" */
+static size_t yahoo_pair_length(int key, const char *value)
+{
+	size_t len = strlen(value) + 4;
+
+	do {
+		key /= 10;
+		len++;
+	} while (key);
+
+	return len;
+}
+
 void yahoo_packet_hash_str(struct yahoo_packet *pkt, int key, const char *value)
 {
 	struct yahoo_pair *pair;
@@ -48,6 +61,7 @@ void yahoo_packet_hash_str(struct yahoo_packet *pkt, int key, const char *value)
 	pair->key = key;
 	pair->value = g_strdup(value);
 	pkt->hash = g_slist_prepend(pkt->hash, pair);
+	pkt->length += yahoo_pair_length(key, pair->value);
 }
 
 void yahoo_packet_hash_int(struct yahoo_packet *pkt, int key, int value)
@@ -58,6 +72,7 @@ void yahoo_packet_hash_int(struct yahoo_packet *pkt, int key, int value)
 	pair->key = key;
 	pair->value = g_strdup_printf("%d", value);
 	pkt->hash = g_slist_prepend(pkt->hash, pair);
+	pkt->length += yahoo_pair_length(key, pair->value);
 }
 
 void yahoo_packet_hash(struct yahoo_packet *pkt, const char *fmt, ...)
@@ -89,25 +104,8 @@ void yahoo_packet_hash(struct yahoo_packet *pkt, const char *fmt, ...)
 
 size_t yahoo_packet_length(struct yahoo_packet *pkt)
 {
-	GSList *l;
-
-	size_t len = 0;
-
-	l = pkt->hash;
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-		int tmp = pair->key;
-		do {
-			tmp /= 10;
-			len++;
-		} while (tmp);
-		len += 2;
-		len += strlen(pair->value);
-		len += 2;
-		l = l->next;
-	}
-
-	return len;
+	/* Kept up to date as pairs are added */
+	return pkt->length;
 }
 
 /*
@@ -139,16 +137,25 @@ void yahoo_packet_read(struct yahoo_packet *pkt, const guchar *data, int len)
 	char key[64];
 	const guchar *delimiter;
 	gboolean accept;
-	int x;
-	struct yahoo_pair *pair;
+	int x, i;
+	struct yahoo_pair pair;
+	GArray *pairs;
+
+	/*
+	 * Every value is NUL-terminated in place in a single copy of the
+	 * payload, so reading a packet costs a few allocations however many
+	 * pairs it has.
+	 */
+	pkt->data = g_malloc(len + 1);
+	memcpy(pkt->data, data, len);
+	pkt->data[len] = '\0';
+	pairs = g_array_new(FALSE, FALSE, sizeof(struct yahoo_pair));
 
 	while (pos + 1 < len)
 	{
 		if (data[pos] == '\0')
 			break;
 
-		pair = g_new0(struct yahoo_pair, 1);
-
 		x = 0;
 		while (pos + 1 < len) {
 			if (data[pos] == 0xc0 && data[pos + 1] == 0x80)
@@ -165,7 +172,7 @@ void yahoo_packet_read(struct yahoo_packet *pkt, const guchar *data, int len)
 		}
 		key[x] = 0;
 		pos += 2;
-		pair->key = strtol(key, NULL, 10);
+		pair.key = strtol(key, NULL, 10);
 		accept = x; /* if x is 0 there was no key, so don't accept it */
 
 		if (pos + 1 > len) {
@@ -178,23 +185,22 @@ void yahoo_packet_read(struct yahoo_packet *pkt, const guchar *data, int len)
 			if (delimiter == NULL)
 			{
 				/* Malformed packet! (It doesn't end in 0xc0 0x80) */
-				g_free(pair);
 				pos = len;
 				continue;
 			}
 			x = delimiter - data;
-			pair->value = g_strndup((const gchar *)&data[pos], x - pos);
+			pkt->data[x] = '\0';
+			pair.value = &pkt->data[pos];
 			pos = x;
-			pkt->hash = g_slist_prepend(pkt->hash, pair);
+			pkt->length += yahoo_pair_length(pair.key, pair.value);
+			g_array_append_val(pairs, pair);
 
 			if (purple_debug_is_verbose() || g_getenv("PURPLE_YAHOO_DEBUG")) {
 				char *esc;
-				esc = g_strescape(pair->value, NULL);
-				purple_debug_misc("yahoo", "Key: %d  \tValue: %s\n", pair->key, esc);
+				esc = g_strescape(pair.value, NULL);
+				purple_debug_misc("yahoo", "Key: %d  \tValue: %s\n", pair.key, esc);
 				g_free(esc);
 			}
-		} else {
-			g_free(pair);
 		}
 		pos += 2;
 
@@ -205,15 +211,90 @@ void yahoo_packet_read(struct yahoo_packet *pkt, const guchar *data, int len)
 			pos++;
 	}
 
+	pkt->npairs = pairs->len;
+	pkt->pairs = (struct yahoo_pair *)g_array_free(pairs, FALSE);
+
 	/*
-	 * Originally this function used g_slist_append().  I changed
-	 * it to use g_slist_prepend() for improved performance.
-	 * Ideally the Yahoo! PRPL code would be indifferent to the
-	 * order of the key/value pairs, but I don't know if this is
-	 * the case for all incoming messages.  To be on the safe side
-	 * we reverse the list.
+	 * Index the pairs by key.  Handlers still walking pkt->hash see the
+	 * pairs in the order they were received.
 	 */
-	pkt->hash = g_slist_reverse(pkt->hash);
+	pkt->prev = g_new(int, pkt->npairs + 1);
+	pkt->keys = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (i = 0; i < pkt->npairs; i++) {
+		gpointer last = g_hash_table_lookup(pkt->keys, GINT_TO_POINTER(pkt->pairs[i].key));
+		pkt->prev[i] = GPOINTER_TO_INT(last) - 1;
+		g_hash_table_insert(pkt->keys, GINT_TO_POINTER(pkt->pairs[i].key), GINT_TO_POINTER(i + 1));
+	}
+	for (i = pkt->npairs - 1; i >= 0; i--)
+		pkt->hash = g_slist_prepend(pkt->hash, &pkt->pairs[i]);
+}
+
+struct yahoo_pair *yahoo_packet_find_last(struct yahoo_packet *pkt, int key)
+{
+	GSList *l;
+	struct yahoo_pair *last = NULL;
+
+	if (pkt->keys != NULL) {
+		int i = GPOINTER_TO_INT(g_hash_table_lookup(pkt->keys, GINT_TO_POINTER(key))) - 1;
+		return (i >= 0) ? &pkt->pairs[i] : NULL;
+	}
+
+	/* Packets we built ourselves aren't indexed */
+	for (l = pkt->hash; l; l = l->next) {
+		struct yahoo_pair *pair = l->data;
+		if (pair->key == key)
+			last = pair;
+	}
+
+	return last;
+}
+
+struct yahoo_pair *yahoo_packet_find_prev(struct yahoo_packet *pkt, struct yahoo_pair *pair)
+{
+	GSList *l;
+	struct yahoo_pair *prev = NULL;
+
+	if (pkt->keys != NULL) {
+		int i = pkt->prev[pair - pkt->pairs];
+		return (i >= 0) ? &pkt->pairs[i] : NULL;
+	}
+
+	for (l = pkt->hash; l && l->data != pair; l = l->next) {
+		struct yahoo_pair *cur = l->data;
+		if (cur->key == pair->key)
+			prev = cur;
+	}
+
+	return prev;
+}
+
+const char *yahoo_packet_get_str(struct yahoo_packet *pkt, int key)
+{
+	struct yahoo_pair *pair = yahoo_packet_find_last(pkt, key);
+
+	return pair ? pair->value : NULL;
+}
+
+/* Like yahoo_packet_get_str(), but skips (and logs) values that aren't UTF-8 */
+const char *yahoo_packet_get_utf8(struct yahoo_packet *pkt, int key)
+{
+	struct yahoo_pair *pair;
+
+	for (pair = yahoo_packet_find_last(pkt, key); pair; pair = yahoo_packet_find_prev(pkt, pair)) {
+		if (g_utf8_validate(pair->value, -1, NULL))
+			return pair->value;
+		purple_debug_warning("yahoo", "Service 0x%02x got non-UTF-8 "
+				"string for key %d\n", pkt->service, key);
+	}
+
+	return NULL;
+}
+
+int yahoo_packet_get_int(struct yahoo_packet *pkt, int key, int def)
+{
+	struct yahoo_pair *pair = yahoo_packet_find_last(pkt, key);
+
+	return pair ? strtol(pair->value, NULL, 10) : def;
 }
 
 void yahoo_packet_write(struct yahoo_packet *pkt, guchar *data)
@@ -228,16 +309,15 @@ void yahoo_packet_write(struct yahoo_packet *pkt, guchar *data)
 
 	while (l) {
 		struct yahoo_pair *pair = l->data;
-		gchar buf[100];
+		size_t len;
 
-		g_snprintf(buf, sizeof(buf), "%d", pair->key);
-		strcpy((char *)&data[pos], buf);
-		pos += strlen(buf);
+		pos += g_snprintf((char *)&data[pos], 12, "%d", pair->key);
 		data[pos++] = 0xc0;
 		data[pos++] = 0x80;
 
-		strcpy((char *)&data[pos], pair->value);
-		pos += strlen(pair->value);
+		len = strlen(pair->value);
+		memcpy(&data[pos], pair->value, len);
+		pos += len;
 		data[pos++] = 0xc0;
 		data[pos++] = 0x80;
 
@@ -395,9 +475,17 @@ void yahoo_packet_free(struct yahoo_packet *pkt)
 {
 	while (pkt->hash) {
 		struct yahoo_pair *pair = pkt->hash->data;
-		g_free(pair->value);
-		g_free(pair);
+		/* Pairs read off the wire belong to pkt->pairs and pkt->data */
+		if (pkt->pairs == NULL || pair < pkt->pairs || pair >= pkt->pairs + pkt->npairs) {
+			g_free(pair->value);
+			g_free(pair);
+		}
 		pkt->hash = g_slist_delete_link(pkt->hash, pkt->hash);
 	}
+	if (pkt->keys != NULL)
+		g_hash_table_destroy(pkt->keys);
+	g_free(pkt->prev);
+	g_free(pkt->pairs);
+	g_free(pkt->data);
 	g_free(pkt);
 }
@@ -124,6 +124,19 @@ struct yahoo_packet {
 	guint32 status;
 	guint32 id;
 	GSList *hash;
+	size_t length; /* Encoded length of the pairs in hash */
+
+	/*
+	 * Only used by packets filled in by yahoo_packet_read().  All of their
+	 * values point into one copy of the payload, the pairs live in one
+	 * array, and keys maps each key to (1 + the index of) its last pair,
+	 * from which prev chains back through the earlier ones.
+	 */
+	char *data;
+	struct yahoo_pair *pairs;
+	int npairs;
+	int *prev;
+	GHashTable *keys;
 };
 
 #define YAHOO_WEBMESSENGER_PROTO_VER 0x0065
@@ -147,4 +160,16 @@ void yahoo_packet_dump(guchar *data, int len);
 size_t yahoo_packet_length(struct yahoo_packet *pkt);
 void yahoo_packet_free(struct yahoo_packet *pkt);
 
+/*
+ * Typed accessors for received packets.  When a key appears more than
+ * once they return its last value, which is what a handler assigning
+ * each value in a walk over pkt->hash ends up with.  Use
+ * yahoo_packet_find_last() and yahoo_packet_find_prev() to see them all.
+ */
+struct yahoo_pair *yahoo_packet_find_last(struct yahoo_packet *pkt, int key);
+struct yahoo_pair *yahoo_packet_find_prev(struct yahoo_packet *pkt, struct yahoo_pair *pair);
+const char *yahoo_packet_get_str(struct yahoo_packet *pkt, int key);
+const char *yahoo_packet_get_utf8(struct yahoo_packet *pkt, int key);
+int yahoo_packet_get_int(struct yahoo_packet *pkt, int key, int def);
+
 #endif /* _YAHOO_PACKET_H_ */
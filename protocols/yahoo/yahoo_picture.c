@@ -72,58 +72,19 @@ yahoo_fetch_picture_cb(PurpleUtilFetchUrlData *url_data, gpointer user_data,
 void yahoo_process_picture(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
 	YahooData *yd;
-	GSList *l = pkt->hash;
-	char *who = NULL, *us = NULL;
-	gboolean got_icon_info = FALSE, send_icon_info = FALSE;
-	char *url = NULL;
-	int checksum = 0;
-
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 1:
-		case 4:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_picture "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 5:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				us = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_picture "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 13: {
-				int tmp;
-				tmp = strtol(pair->value, NULL, 10);
-				if (tmp == 1) {
-					send_icon_info = TRUE;
-				} else if (tmp == 2) {
-					got_icon_info = TRUE;
-				}
-				break;
-			}
-		case 20:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				url = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_picture "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 192:
-			checksum = strtol(pair->value, NULL, 10);
-			break;
-		}
+	const char *who, *url;
+	gboolean got_icon_info, send_icon_info;
+	int checksum, tmp;
 
-		l = l->next;
-	}
+	/* Key 5 is us */
+	who = yahoo_packet_get_utf8(pkt, 4);
+	if (!who)
+		who = yahoo_packet_get_utf8(pkt, 1);
+	tmp = yahoo_packet_get_int(pkt, 13, 0);
+	send_icon_info = (tmp == 1);
+	got_icon_info = (tmp == 2);
+	url = yahoo_packet_get_utf8(pkt, 20);
+	checksum = yahoo_packet_get_int(pkt, 192, 0);
 
 	if (!who)
 		return;
@@ -160,31 +121,12 @@ void yahoo_process_picture(PurpleConnection *gc, struct yahoo_packet *pkt)
 
 void yahoo_process_picture_checksum(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	GSList *l = pkt->hash;
-	char *who = NULL;
-	int checksum = 0;
-
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 4:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_picture_checksum "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 5:
-			/* us */
-			break;
-		case 192:
-			checksum = strtol(pair->value, NULL, 10);
-			break;
-		}
-		l = l->next;
-	}
+	const char *who;
+	int checksum;
+
+	/* Key 5 is us */
+	who = yahoo_packet_get_utf8(pkt, 4);
+	checksum = yahoo_packet_get_int(pkt, 192, 0);
 
 	if (who) {
 		PurpleBuddy *b = purple_find_buddy(gc->account, who);
@@ -203,31 +145,13 @@ void yahoo_process_picture_upload(PurpleConnection *gc, struct yahoo_packet *pkt
 {
 	PurpleAccount *account = purple_connection_get_account(gc);
 	YahooData *yd = gc->proto_data;
-	GSList *l = pkt->hash;
-	char *url = NULL;
-
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 5:
-			/* us */
-			break;
-		case 27:
-			/* filename on our computer. */
-			break;
-		case 20: /* url at yahoo */
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				url = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_picture_upload "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		case 38: /* timestamp */
-			break;
-		}
-		l = l->next;
-	}
+	const char *url;
+
+	/*
+	 * Key 5 is us, 27 the filename on our computer and 38 a timestamp.
+	 * 20 is the url at yahoo.
+	 */
+	url = yahoo_packet_get_utf8(pkt, 20);
 
 	if (url) {
 		g_free(yd->picture_url);
@@ -241,37 +165,19 @@ void yahoo_process_picture_upload(PurpleConnection *gc, struct yahoo_packet *pkt
 
 void yahoo_process_avatar_update(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	GSList *l = pkt->hash;
-	char *who = NULL;
-	int avatar = 0;
-
-	while (l) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 4:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_avatar_upload "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 5:
-			/* us */
-			break;
-		case 206:   /* Older versions. Still needed? */
-		case 213:   /* Newer versions */
-			/*
-			 * 0 - No icon or avatar
-			 * 1 - Using an avatar
-			 * 2 - Using an icon
-			 */
-			avatar = strtol(pair->value, NULL, 10);
-			break;
-		}
-		l = l->next;
-	}
+	const char *who;
+	int avatar;
+
+	/* Key 5 is us */
+	who = yahoo_packet_get_utf8(pkt, 4);
+	/*
+	 * 0 - No icon or avatar
+	 * 1 - Using an avatar
+	 * 2 - Using an icon
+	 *
+	 * Newer versions send 213; older ones sent 206.  Still needed?
+	 */
+	avatar = yahoo_packet_get_int(pkt, 213, yahoo_packet_get_int(pkt, 206, 0));
 
 	if (who) {
 		if (avatar == 2)
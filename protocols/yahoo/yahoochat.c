@@ -111,6 +111,13 @@ static PurpleConversation *yahoo_find_conference(PurpleConnection *gc, const cha
 	return NULL;
 }
 
+/* The last value of key, decoded from the account's charset, or NULL */
+static char *yahoo_chat_decode_key(PurpleConnection *gc, struct yahoo_packet *pkt, int key, gboolean utf8)
+{
+	const char *value = yahoo_packet_get_str(pkt, key);
+
+	return value ? yahoo_string_decode(gc, value, utf8) : NULL;
+}
 
 void yahoo_process_conference_invite(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
@@ -214,38 +221,17 @@ void yahoo_process_conference_invite(PurpleConnection *gc, struct yahoo_packet *
 
 void yahoo_process_conference_decline(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	GSList *l;
-	char *room = NULL;
-	char *who = NULL;
-	char *msg = NULL;
+	char *room;
+	const char *who;
+	char *msg;
 	PurpleConversation *c = NULL;
-	int utf8 = 0;
+	int utf8;
 
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
+	room = yahoo_chat_decode_key(gc, pkt, 57, FALSE);
+	who = yahoo_packet_get_utf8(pkt, 54);
+	msg = yahoo_chat_decode_key(gc, pkt, 14, FALSE);
+	utf8 = yahoo_packet_get_int(pkt, 97, 0);
 
-		switch (pair->key) {
-		case 57:
-			g_free(room);
-			room = yahoo_string_decode(gc, pair->value, FALSE);
-			break;
-		case 54:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_conference_decline "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 14:
-			g_free(msg);
-			msg = yahoo_string_decode(gc, pair->value, FALSE);
-			break;
-		case 97:
-			utf8 = strtol(pair->value, NULL, 10);
-			break;
-		}
-	}
 	if (!purple_privacy_check(purple_connection_get_account(gc), who))
 	{
 		g_free(room);
@@ -278,29 +264,12 @@ void yahoo_process_conference_decline(PurpleConnection *gc, struct yahoo_packet
 
 void yahoo_process_conference_logon(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	GSList *l;
-	char *room = NULL;
-	char *who = NULL;
+	char *room;
+	const char *who;
 	PurpleConversation *c;
 
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 57:
-			g_free(room);
-			room = yahoo_string_decode(gc, pair->value, FALSE);
-			break;
-		case 53:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_conference_logon "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		}
-	}
+	room = yahoo_chat_decode_key(gc, pkt, 57, FALSE);
+	who = yahoo_packet_get_utf8(pkt, 53);
 
 	if (who && room) {
 		c = yahoo_find_conference(gc, room);
@@ -315,29 +284,12 @@ void yahoo_process_conference_logon(PurpleConnection *gc, struct yahoo_packet *p
 
 void yahoo_process_conference_logoff(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	GSList *l;
-	char *room = NULL;
-	char *who = NULL;
+	char *room;
+	const char *who;
 	PurpleConversation *c;
 
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 57:
-			g_free(room);
-			room = yahoo_string_decode(gc, pair->value, FALSE);
-			break;
-		case 56:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_conference_logoff "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		}
-	}
+	room = yahoo_chat_decode_key(gc, pkt, 57, FALSE);
+	who = yahoo_packet_get_utf8(pkt, 56);
 
 	if (who && room) {
 		c = yahoo_find_conference(gc, room);
@@ -349,37 +301,16 @@ void yahoo_process_conference_logoff(PurpleConnection *gc, struct yahoo_packet *
 
 void yahoo_process_conference_message(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	GSList *l;
-	char *room = NULL;
-	char *who = NULL;
-	char *msg = NULL;
-	int utf8 = 0;
+	char *room;
+	const char *who;
+	char *msg;
+	int utf8;
 	PurpleConversation *c;
 
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 57:
-			g_free(room);
-			room = yahoo_string_decode(gc, pair->value, FALSE);
-			break;
-		case 3:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_conference_message "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 14:
-			msg = pair->value;
-			break;
-		case 97:
-			utf8 = strtol(pair->value, NULL, 10);
-			break;
-		}
-	}
+	room = yahoo_chat_decode_key(gc, pkt, 57, FALSE);
+	who = yahoo_packet_get_utf8(pkt, 3);
+	msg = (char *)yahoo_packet_get_str(pkt, 14);
+	utf8 = yahoo_packet_get_int(pkt, 97, 0);
 
 	if (room && who && msg) {
 		char *msg2;
@@ -669,26 +600,11 @@ void yahoo_process_chat_join(PurpleConnection *gc, struct yahoo_packet *pkt)
 
 void yahoo_process_chat_exit(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	char *who = NULL;
-	char *room = NULL;
-	GSList *l;
-
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
+	const char *who;
+	char *room;
 
-		if (pair->key == 104) {
-			g_free(room);
-			room = yahoo_string_decode(gc, pair->value, TRUE);
-		}
-		if (pair->key == 109) {
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_chat_exit "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-		}
-	}
+	room = yahoo_chat_decode_key(gc, pkt, 104, TRUE);
+	who = yahoo_packet_get_utf8(pkt, 109);
 
 	if (who && room) {
 		PurpleConversation *c = purple_find_chat(gc, YAHOO_CHAT_ID);
@@ -701,44 +617,16 @@ void yahoo_process_chat_exit(PurpleConnection *gc, struct yahoo_packet *pkt)
 
 void yahoo_process_chat_message(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
-	char *room = NULL, *who = NULL, *msg = NULL, *msg2;
-	int msgtype = 1, utf8 = 1; /* default to utf8 */
+	char *room, *msg, *msg2;
+	const char *who;
+	int msgtype, utf8;
 	PurpleConversation *c = NULL;
-	GSList *l;
-
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
 
-		switch (pair->key) {
-
-		case 97:
-			utf8 = strtol(pair->value, NULL, 10);
-			break;
-		case 104:
-			g_free(room);
-			room = yahoo_string_decode(gc, pair->value, TRUE);
-			break;
-		case 109:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_chat_message "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 117:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				msg = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_chat_message "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 124:
-			msgtype = strtol(pair->value, NULL, 10);
-			break;
-		}
-	}
+	utf8 = yahoo_packet_get_int(pkt, 97, 1); /* default to utf8 */
+	room = yahoo_chat_decode_key(gc, pkt, 104, TRUE);
+	who = yahoo_packet_get_utf8(pkt, 109);
+	msg = (char *)yahoo_packet_get_utf8(pkt, 117);
+	msgtype = yahoo_packet_get_int(pkt, 124, 1);
 
 	c = purple_find_chat(gc, YAHOO_CHAT_ID);
 	if (!who || !c) {
@@ -771,41 +659,16 @@ void yahoo_process_chat_message(PurpleConnection *gc, struct yahoo_packet *pkt)
 void yahoo_process_chat_addinvite(PurpleConnection *gc, struct yahoo_packet *pkt)
 {
 	PurpleAccount *account;
-	GSList *l;
-	char *room = NULL;
-	char *msg = NULL;
-	char *who = NULL;
+	char *room;
+	char *msg;
+	const char *who;
 
 	account = purple_connection_get_account(gc);
 
-	for (l = pkt->hash; l; l = l->next) {
-		struct yahoo_pair *pair = l->data;
-
-		switch (pair->key) {
-		case 104:
-			g_free(room);
-			room = yahoo_string_decode(gc, pair->value, TRUE);
-			break;
-		case 129: /* room id? */
-			break;
-		case 126: /* ??? */
-			break;
-		case 117:
-			g_free(msg);
-			msg = yahoo_string_decode(gc, pair->value, FALSE);
-			break;
-		case 119:
-			if (g_utf8_validate(pair->value, -1, NULL)) {
-				who = pair->value;
-			} else {
-				purple_debug_warning("yahoo", "yahoo_process_chat_addinvite "
-						"got non-UTF-8 string for key %d\n", pair->key);
-			}
-			break;
-		case 118: /* us */
-			break;
-		}
-	}
+	/* Keys 129 (room id?) and 126 (???) are ignored, and 118 is us */
+	room = yahoo_chat_decode_key(gc, pkt, 104, TRUE);
+	msg = yahoo_chat_decode_key(gc, pkt, 117, FALSE);
+	who = yahoo_packet_get_utf8(pkt, 119);
 
 	if (room && who) {
 		GHashTable *components;
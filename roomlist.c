@@ -29,9 +29,56 @@
 #include "account.h"
 #include "connection.h"
 #include "debug.h"
+#include "eventloop.h"
 #include "roomlist.h"
 #include "server.h"
+#include "util.h"
 
+/* The UI is told about new rooms this many at a time... */
+#define ROOMLIST_BATCH_SIZE 100
+/* ...or after this many milliseconds, whichever comes first. */
+#define ROOMLIST_BATCH_INTERVAL 100
+
+/*
+ * The rest of a room list.  Lists are only ever allocated by
+ * purple_roomlist_new(), so the public struct comes first and a
+ * PurpleRoomlist * can be cast to this.
+ */
+typedef struct
+{
+	PurpleRoomlist list;
+
+	/* The last link of list.rooms, so appending doesn't walk the list */
+	GList *rooms_tail;
+	/* The same rooms in an array, for building the indexes */
+	GPtrArray *room_array;
+
+	guint max_rooms;
+	guint dropped_rooms;
+
+	/* The first of the rooms at the end of list.rooms that the UI
+	 * hasn't been given yet, and how many there are */
+	GList *pending;
+	guint pending_count;
+	guint flush_timer;
+
+	/* The indexes made by purple_roomlist_find_rooms(), keyed by the
+	 * field they sort on, or "" for the room name */
+	GHashTable *indexes;
+} PurpleRoomlistPrivate;
+
+#define PURPLE_ROOMLIST_GET_PRIVATE(list) ((PurpleRoomlistPrivate *)(list))
+
+/*
+ * The rooms of a list sorted one way.  Rooms are only ever added to
+ * the end of a list, so the index covers the first rooms->len rooms of
+ * room_array and the rest are merged in when it is next used.
+ */
+typedef struct
+{
+	int field;             /* Position of the int field, or -1 for the name */
+	GPtrArray *rooms;
+} PurpleRoomlistIndex;
 
 static PurpleRoomlistUiOps *ops = NULL;
 
@@ -52,11 +99,12 @@ PurpleRoomlist *purple_roomlist_new(PurpleAccount *account)
 
 	g_return_val_if_fail(account != NULL, NULL);
 
-	list = g_new0(PurpleRoomlist, 1);
+	list = (PurpleRoomlist *)g_new0(PurpleRoomlistPrivate, 1);
 	list->account = account;
 	list->rooms = NULL;
 	list->fields = NULL;
 	list->ref = 1;
+	PURPLE_ROOMLIST_GET_PRIVATE(list)->room_array = g_ptr_array_new();
 
 	if (ops && ops->create)
 		ops->create(list);
@@ -94,12 +142,22 @@ static void purple_roomlist_field_destroy(PurpleRoomlistField *f)
 	g_free(f);
 }
 
+static void purple_roomlist_index_destroy(PurpleRoomlistIndex *index)
+{
+	g_ptr_array_free(index->rooms, TRUE);
+	g_free(index);
+}
+
 static void purple_roomlist_destroy(PurpleRoomlist *list)
 {
+	PurpleRoomlistPrivate *priv = PURPLE_ROOMLIST_GET_PRIVATE(list);
 	GList *l;
 
 	purple_debug_misc("roomlist", "destroying list %p\n", list);
 
+	if (priv->flush_timer)
+		purple_timeout_remove(priv->flush_timer);
+
 	if (ops && ops->destroy)
 		ops->destroy(list);
 
@@ -108,6 +166,9 @@ static void purple_roomlist_destroy(PurpleRoomlist *list)
 		purple_roomlist_room_destroy(list, r);
 	}
 	g_list_free(list->rooms);
+	g_ptr_array_free(priv->room_array, TRUE);
+	if (priv->indexes)
+		g_hash_table_destroy(priv->indexes);
 
 	g_list_foreach(list->fields, (GFunc)purple_roomlist_field_destroy, NULL);
 	g_list_free(list->fields);
@@ -137,10 +198,49 @@ void purple_roomlist_set_fields(PurpleRoomlist *list, GList *fields)
 		ops->set_fields(list, fields);
 }
 
+/* Gives the UI the rooms it hasn't seen yet */
+static void purple_roomlist_flush(PurpleRoomlist *list)
+{
+	PurpleRoomlistPrivate *priv = PURPLE_ROOMLIST_GET_PRIVATE(list);
+	GList *rooms = priv->pending;
+
+	if (priv->flush_timer) {
+		purple_timeout_remove(priv->flush_timer);
+		priv->flush_timer = 0;
+	}
+
+	priv->pending = NULL;
+	priv->pending_count = 0;
+
+	if (rooms == NULL || ops == NULL)
+		return;
+
+	if (ops->add_rooms) {
+		ops->add_rooms(list, rooms);
+	} else if (ops->add_room) {
+		for (; rooms != NULL; rooms = rooms->next)
+			ops->add_room(list, rooms->data);
+	}
+}
+
+static gboolean purple_roomlist_flush_cb(gpointer data)
+{
+	PurpleRoomlist *list = data;
+
+	PURPLE_ROOMLIST_GET_PRIVATE(list)->flush_timer = 0;
+	purple_roomlist_flush(list);
+
+	return FALSE;
+}
+
 void purple_roomlist_set_in_progress(PurpleRoomlist *list, gboolean in_progress)
 {
 	g_return_if_fail(list != NULL);
 
+	/* Don't leave the UI without rooms it could be showing */
+	if (!in_progress)
+		purple_roomlist_flush(list);
+
 	list->in_progress = in_progress;
 
 	if (ops && ops->in_progress)
@@ -156,13 +256,205 @@ gboolean purple_roomlist_get_in_progress(PurpleRoomlist *list)
 
 void purple_roomlist_room_add(PurpleRoomlist *list, PurpleRoomlistRoom *room)
 {
+	PurpleRoomlistPrivate *priv;
+
 	g_return_if_fail(list != NULL);
 	g_return_if_fail(room != NULL);
 
-	list->rooms = g_list_append(list->rooms, room);
+	priv = PURPLE_ROOMLIST_GET_PRIVATE(list);
+
+	if (priv->max_rooms && priv->room_array->len >= priv->max_rooms) {
+		if (priv->dropped_rooms++ == 0)
+			purple_debug_info("roomlist", "list %p is full at %u rooms, "
+					"dropping the rest\n", list, priv->max_rooms);
+		purple_roomlist_room_destroy(list, room);
+		return;
+	}
+
+	priv->rooms_tail = g_list_append(priv->rooms_tail, room);
+	if (list->rooms == NULL)
+		list->rooms = priv->rooms_tail;
+	else
+		priv->rooms_tail = priv->rooms_tail->next;
+	g_ptr_array_add(priv->room_array, room);
+
+	if (ops == NULL || (ops->add_room == NULL && ops->add_rooms == NULL))
+		return;
+
+	if (priv->pending == NULL)
+		priv->pending = priv->rooms_tail;
+	priv->pending_count++;
+
+	/*
+	 * A big listing comes in faster than the UI can add rows one at a
+	 * time, so it gets the rooms in batches instead.
+	 */
+	if (priv->pending_count >= ROOMLIST_BATCH_SIZE)
+		purple_roomlist_flush(list);
+	else if (priv->flush_timer == 0)
+		priv->flush_timer = purple_timeout_add(ROOMLIST_BATCH_INTERVAL,
+				purple_roomlist_flush_cb, list);
+}
+
+void purple_roomlist_set_max_rooms(PurpleRoomlist *list, guint max_rooms)
+{
+	g_return_if_fail(list != NULL);
+
+	PURPLE_ROOMLIST_GET_PRIVATE(list)->max_rooms = max_rooms;
+}
+
+guint purple_roomlist_get_room_count(PurpleRoomlist *list)
+{
+	g_return_val_if_fail(list != NULL, 0);
+
+	return PURPLE_ROOMLIST_GET_PRIVATE(list)->room_array->len;
+}
+
+guint purple_roomlist_get_dropped_rooms(PurpleRoomlist *list)
+{
+	g_return_val_if_fail(list != NULL, 0);
+
+	return PURPLE_ROOMLIST_GET_PRIVATE(list)->dropped_rooms;
+}
+
+static gint purple_roomlist_compare_names(gconstpointer a, gconstpointer b)
+{
+	const PurpleRoomlistRoom *room1 = *(PurpleRoomlistRoom * const *)a;
+	const PurpleRoomlistRoom *room2 = *(PurpleRoomlistRoom * const *)b;
+	int ret = g_ascii_strcasecmp(room1->name, room2->name);
+
+	return ret ? ret : strcmp(room1->name, room2->name);
+}
+
+/* Largest first, then by name */
+static gint purple_roomlist_compare_field(gconstpointer a, gconstpointer b,
+		gpointer data)
+{
+	const PurpleRoomlistRoom *room1 = *(PurpleRoomlistRoom * const *)a;
+	const PurpleRoomlistRoom *room2 = *(PurpleRoomlistRoom * const *)b;
+	int field = GPOINTER_TO_INT(data);
+	int value1 = GPOINTER_TO_INT(g_list_nth_data(room1->fields, field));
+	int value2 = GPOINTER_TO_INT(g_list_nth_data(room2->fields, field));
+
+	if (value1 != value2)
+		return value1 > value2 ? -1 : 1;
+
+	return purple_roomlist_compare_names(a, b);
+}
+
+static gint purple_roomlist_index_compare(PurpleRoomlistIndex *index,
+		gconstpointer a, gconstpointer b)
+{
+	if (index->field < 0)
+		return purple_roomlist_compare_names(a, b);
+
+	return purple_roomlist_compare_field(a, b, GINT_TO_POINTER(index->field));
+}
+
+/* Brings an index up to date by merging in the rooms added since */
+static void purple_roomlist_index_update(PurpleRoomlist *list,
+		PurpleRoomlistIndex *index)
+{
+	GPtrArray *room_array = PURPLE_ROOMLIST_GET_PRIVATE(list)->room_array;
+	GPtrArray *added, *merged;
+	guint i, j;
+
+	if (index->rooms->len == room_array->len)
+		return;
+
+	added = g_ptr_array_sized_new(room_array->len - index->rooms->len);
+	for (i = index->rooms->len; i < room_array->len; i++)
+		g_ptr_array_add(added, g_ptr_array_index(room_array, i));
+
+	if (index->field < 0)
+		g_ptr_array_sort(added, purple_roomlist_compare_names);
+	else
+		g_ptr_array_sort_with_data(added, purple_roomlist_compare_field,
+				GINT_TO_POINTER(index->field));
+
+	merged = g_ptr_array_sized_new(room_array->len);
+	i = j = 0;
+	while (i < index->rooms->len && j < added->len) {
+		gpointer *old = &g_ptr_array_index(index->rooms, i);
+		gpointer *new = &g_ptr_array_index(added, j);
+
+		if (purple_roomlist_index_compare(index, old, new) <= 0) {
+			g_ptr_array_add(merged, *old);
+			i++;
+		} else {
+			g_ptr_array_add(merged, *new);
+			j++;
+		}
+	}
+	for (; i < index->rooms->len; i++)
+		g_ptr_array_add(merged, g_ptr_array_index(index->rooms, i));
+	for (; j < added->len; j++)
+		g_ptr_array_add(merged, g_ptr_array_index(added, j));
+
+	g_ptr_array_free(added, TRUE);
+	g_ptr_array_free(index->rooms, TRUE);
+	index->rooms = merged;
+}
+
+GList *purple_roomlist_find_rooms(PurpleRoomlist *roomlist, const char *filter,
+                                  const char *sort_field, guint max)
+{
+	PurpleRoomlistPrivate *priv;
+	PurpleRoomlistIndex *index;
+	GList *rooms = NULL;
+	guint i, found = 0;
+
+	g_return_val_if_fail(roomlist != NULL, NULL);
+
+	priv = PURPLE_ROOMLIST_GET_PRIVATE(roomlist);
+
+	if (sort_field == NULL)
+		sort_field = "";
+
+	if (priv->indexes == NULL)
+		priv->indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				(GDestroyNotify)purple_roomlist_index_destroy);
+
+	index = g_hash_table_lookup(priv->indexes, sort_field);
+	if (index == NULL) {
+		int field = -1;
+
+		if (*sort_field) {
+			GList *l;
+			int pos = 0;
+
+			for (l = roomlist->fields; l != NULL; l = l->next, pos++) {
+				PurpleRoomlistField *f = l->data;
+
+				if (purple_strequal(f->name, sort_field) &&
+						f->type == PURPLE_ROOMLIST_FIELD_INT) {
+					field = pos;
+					break;
+				}
+			}
+
+			g_return_val_if_fail(field >= 0, NULL);
+		}
+
+		index = g_new0(PurpleRoomlistIndex, 1);
+		index->field = field;
+		index->rooms = g_ptr_array_new();
+		g_hash_table_insert(priv->indexes, g_strdup(sort_field), index);
+	}
+
+	purple_roomlist_index_update(roomlist, index);
+
+	for (i = 0; i < index->rooms->len && (max == 0 || found < max); i++) {
+		PurpleRoomlistRoom *room = g_ptr_array_index(index->rooms, i);
+
+		if (filter && *filter && !purple_strcasestr(room->name, filter))
+			continue;
+
+		rooms = g_list_prepend(rooms, room);
+		found++;
+	}
 
-	if (ops && ops->add_room)
-		ops->add_room(list, room);
+	return g_list_reverse(rooms);
 }
 
 PurpleRoomlist *purple_roomlist_get_list(PurpleConnection *gc)
@@ -108,7 +108,14 @@ struct _PurpleRoomlistUiOps {
 	void (*in_progress)(PurpleRoomlist *list, gboolean flag); /**< Are we fetching stuff still? */
 	void (*destroy)(PurpleRoomlist *list); /**< We're destroying list. */
 
-	void (*_purple_reserved1)(void);
+	/**
+	 * Add several rooms to the list at once.  @a rooms is the tail of
+	 * list->rooms holding the new rooms; follow only its next links and
+	 * don't free it.  If this is NULL, add_room is called for each room.
+	 * @since 2.10.0
+	 */
+	void (*add_rooms)(PurpleRoomlist *list, GList *rooms);
+
 	void (*_purple_reserved2)(void);
 	void (*_purple_reserved3)(void);
 	void (*_purple_reserved4)(void);
@@ -198,6 +205,11 @@ gboolean purple_roomlist_get_in_progress(PurpleRoomlist *list);
 /**
  * Adds a room to the list of them.
  *
+ * The UI is given new rooms in batches, every so many rooms or after a
+ * short delay, and whatever is left when the list stops being in
+ * progress.  If the list already has as many rooms as set with
+ * purple_roomlist_set_max_rooms(), the room is freed instead.
+ *
  * @param list The room list.
  * @param room The room to add to the list. The GList of fields must be in the same
                order as was given in purple_roomlist_set_fields().
@@ -247,6 +259,54 @@ void purple_roomlist_expand_category(PurpleRoomlist *list, PurpleRoomlistRoom *c
  */
 GList * purple_roomlist_get_fields(PurpleRoomlist *roomlist);
 
+/**
+ * Limits how many rooms a list keeps, for directories too big to hold.
+ * Rooms added after that are freed and only counted.
+ *
+ * @param list      The room list.
+ * @param max_rooms The most rooms to keep, or 0 for no limit (the default).
+ * @since 2.10.0
+ */
+void purple_roomlist_set_max_rooms(PurpleRoomlist *list, guint max_rooms);
+
+/**
+ * Returns how many rooms are in a list.
+ *
+ * @param list The room list.
+ * @return The number of rooms.
+ * @since 2.10.0
+ */
+guint purple_roomlist_get_room_count(PurpleRoomlist *list);
+
+/**
+ * Returns how many rooms were dropped because the list was full.
+ *
+ * @param list The room list.
+ * @return The number of rooms dropped.
+ * @since 2.10.0
+ */
+guint purple_roomlist_get_dropped_rooms(PurpleRoomlist *list);
+
+/**
+ * Searches a room list, like a server-side directory search would.
+ * The sorted order is kept in an index that is updated with the rooms
+ * added since the last search, so repeated searches of a big list
+ * are cheap.
+ *
+ * @param roomlist   The room list.
+ * @param filter     Only return rooms whose names contain this, ignoring
+ *                   case, or @c NULL for all of them.
+ * @param sort_field The name of an int field (such as the number of
+ *                   users) to sort by, largest first, or @c NULL to sort
+ *                   by room name.
+ * @param max        The most rooms to return, or 0 for all of them.
+ * @return A list of rooms, which still belong to the room list.  Free it
+ *         with g_list_free().
+ * @since 2.10.0
+ */
+GList *purple_roomlist_find_rooms(PurpleRoomlist *roomlist, const char *filter,
+                                  const char *sort_field, guint max);
+
 /*@}*/
 
 /**************************************************************************/
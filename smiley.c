@@ -276,6 +276,213 @@ purple_smileys_load(void)
 	xmlnode_free(root_node);
 }
 
+/*********************************************************************
+ * Shortcut matching                                                 *
+ *********************************************************************/
+
+/*
+ * Every shortcut is kept in two Aho-Corasick automata, one over the raw
+ * shortcuts and one over their markup-escaped form, so finding the
+ * smileys in a message takes one pass over it however many custom
+ * smileys there are.  Shortcuts go in and out of the tries as they
+ * change; the failure links are worked out again on the next search.
+ */
+typedef struct
+{
+	PurpleSmiley *smiley;  /**< The smiley whose shortcut ends here. */
+	guint child;           /**< First child, or 0.                   */
+	guint sibling;         /**< Next child of the same parent, or 0. */
+	guint fail;            /**< Longest proper suffix in the trie.   */
+	guint output;          /**< Longest proper suffix that ends a
+	                            shortcut, or 0.                      */
+	guint depth;           /**< Length of the prefix.                */
+	guchar byte;
+} SmileyTrieNode;
+
+typedef struct
+{
+	GArray *nodes;         /**< SmileyTrieNode; node 0 is the root.  */
+	guint root[256];       /**< The root's children, by byte.        */
+	guint stale;           /**< Nodes left by removed shortcuts.     */
+	gboolean escaped;
+	gboolean dirty;        /**< The links need working out again.    */
+} SmileyMatcher;
+
+static SmileyMatcher smiley_matchers[2]; /* raw, escaped */
+
+#define TRIE_NODE(matcher, i) (&g_array_index((matcher)->nodes, SmileyTrieNode, (i)))
+
+static guint
+smiley_trie_child(SmileyMatcher *matcher, guint node, guchar byte)
+{
+	guint child;
+
+	for (child = TRIE_NODE(matcher, node)->child; child != 0;
+			child = TRIE_NODE(matcher, child)->sibling) {
+		if (TRIE_NODE(matcher, child)->byte == byte)
+			break;
+	}
+
+	return child;
+}
+
+static void
+smiley_trie_insert(SmileyMatcher *matcher, const char *pattern, PurpleSmiley *smiley)
+{
+	const guchar *p;
+	guint node = 0;
+
+	for (p = (const guchar *)pattern; *p != '\0'; p++) {
+		guint child = smiley_trie_child(matcher, node, *p);
+
+		if (child == 0) {
+			SmileyTrieNode new_node;
+
+			memset(&new_node, 0, sizeof(new_node));
+			new_node.byte = *p;
+			new_node.depth = TRIE_NODE(matcher, node)->depth + 1;
+			new_node.sibling = TRIE_NODE(matcher, node)->child;
+
+			child = matcher->nodes->len;
+			g_array_append_val(matcher->nodes, new_node);
+			TRIE_NODE(matcher, node)->child = child;
+		}
+		node = child;
+	}
+
+	/* An empty shortcut would match everywhere, so the root never does */
+	if (node != 0)
+		TRIE_NODE(matcher, node)->smiley = smiley;
+}
+
+static void
+smiley_matcher_add(SmileyMatcher *matcher, const char *shortcut, PurpleSmiley *smiley)
+{
+	if (matcher->escaped) {
+		char *escaped = g_markup_escape_text(shortcut, -1);
+		smiley_trie_insert(matcher, escaped, smiley);
+		g_free(escaped);
+	} else {
+		smiley_trie_insert(matcher, shortcut, smiley);
+	}
+
+	matcher->dirty = TRUE;
+}
+
+static void
+smiley_matcher_remove(SmileyMatcher *matcher, const char *shortcut)
+{
+	char *escaped = NULL;
+	const guchar *p;
+	guint node = 0;
+
+	if (matcher->escaped)
+		shortcut = escaped = g_markup_escape_text(shortcut, -1);
+
+	for (p = (const guchar *)shortcut; *p != '\0'; p++) {
+		node = smiley_trie_child(matcher, node, *p);
+		if (node == 0)
+			break;
+	}
+
+	/* The nodes stay where they are until there are enough of them to
+	 * be worth building the trie again. */
+	if (node != 0) {
+		TRIE_NODE(matcher, node)->smiley = NULL;
+		matcher->stale += TRIE_NODE(matcher, node)->depth;
+		matcher->dirty = TRUE;
+	}
+
+	g_free(escaped);
+}
+
+static void
+smiley_matcher_reset(SmileyMatcher *matcher)
+{
+	SmileyTrieNode root;
+
+	if (matcher->nodes == NULL)
+		matcher->nodes = g_array_new(FALSE, FALSE, sizeof(SmileyTrieNode));
+
+	memset(&root, 0, sizeof(root));
+	g_array_set_size(matcher->nodes, 0);
+	g_array_append_val(matcher->nodes, root);
+
+	matcher->stale = 0;
+	matcher->dirty = TRUE;
+}
+
+static void
+smiley_matcher_link(SmileyMatcher *matcher)
+{
+	guint *queue;
+	guint head = 0, tail = 0;
+	guint child;
+
+	if (matcher->stale > matcher->nodes->len / 2) {
+		GHashTableIter iter;
+		gpointer shortcut, smiley;
+
+		smiley_matcher_reset(matcher);
+		g_hash_table_iter_init(&iter, smiley_shortcut_index);
+		while (g_hash_table_iter_next(&iter, &shortcut, &smiley))
+			smiley_matcher_add(matcher, shortcut, smiley);
+	}
+
+	/* Breadth first, so every suffix is linked before it is needed */
+	queue = g_new(guint, matcher->nodes->len);
+	memset(matcher->root, 0, sizeof(matcher->root));
+
+	for (child = TRIE_NODE(matcher, 0)->child; child != 0;
+			child = TRIE_NODE(matcher, child)->sibling) {
+		SmileyTrieNode *node = TRIE_NODE(matcher, child);
+
+		node->fail = 0;
+		node->output = 0;
+		matcher->root[node->byte] = child;
+		queue[tail++] = child;
+	}
+
+	while (head < tail) {
+		guint parent = queue[head++];
+
+		for (child = TRIE_NODE(matcher, parent)->child; child != 0;
+				child = TRIE_NODE(matcher, child)->sibling) {
+			SmileyTrieNode *node = TRIE_NODE(matcher, child);
+			guint fail = TRIE_NODE(matcher, parent)->fail;
+			guint next;
+
+			while ((next = smiley_trie_child(matcher, fail, node->byte)) == 0 && fail != 0)
+				fail = TRIE_NODE(matcher, fail)->fail;
+
+			node->fail = next;
+			if (TRIE_NODE(matcher, next)->smiley != NULL)
+				node->output = next;
+			else
+				node->output = TRIE_NODE(matcher, next)->output;
+
+			queue[tail++] = child;
+		}
+	}
+
+	g_free(queue);
+	matcher->dirty = FALSE;
+}
+
+static void
+smiley_matchers_add(const char *shortcut, PurpleSmiley *smiley)
+{
+	smiley_matcher_add(&smiley_matchers[0], shortcut, smiley);
+	smiley_matcher_add(&smiley_matchers[1], shortcut, smiley);
+}
+
+static void
+smiley_matchers_remove(const char *shortcut)
+{
+	smiley_matcher_remove(&smiley_matchers[0], shortcut);
+	smiley_matcher_remove(&smiley_matchers[1], shortcut);
+}
+
 /*********************************************************************
  * GObject Stuff                                                     *
  *********************************************************************/
@@ -369,6 +576,7 @@ purple_smiley_finalize(GObject *obj)
 	if (g_hash_table_lookup(smiley_shortcut_index, smiley->shortcut)) {
 		g_hash_table_remove(smiley_shortcut_index, smiley->shortcut);
 		g_hash_table_remove(smiley_checksum_index, smiley->checksum);
+		smiley_matchers_remove(smiley->shortcut);
 	}
 
 	g_free(smiley->shortcut);
@@ -741,11 +949,14 @@ purple_smiley_set_shortcut(PurpleSmiley *smiley, const char *shortcut)
 		return FALSE;
 
 	/* Remove the old shortcut. */
-	if (smiley->shortcut)
+	if (smiley->shortcut) {
 		g_hash_table_remove(smiley_shortcut_index, smiley->shortcut);
+		smiley_matchers_remove(smiley->shortcut);
+	}
 
 	/* Insert the new shortcut. */
 	g_hash_table_insert(smiley_shortcut_index, g_strdup(shortcut), smiley);
+	smiley_matchers_add(shortcut, smiley);
 
 	g_free(smiley->shortcut);
 	smiley->shortcut = g_strdup(shortcut);
@@ -865,6 +1076,112 @@ purple_smileys_find_by_checksum(const char *checksum)
 	return g_hash_table_lookup(smiley_checksum_index, checksum);
 }
 
+GList *
+purple_smileys_find_all(const char *text, gboolean escaped)
+{
+	return purple_smileys_find_all_filtered(text, escaped, NULL, NULL);
+}
+
+/* Whether the filter accepts a smiley, asking it only the first time */
+static gboolean
+smiley_filter_accepts(PurpleSmiley *smiley, PurpleSmileyFilter filter,
+		gpointer data, GHashTable *verdicts)
+{
+	gpointer verdict;
+
+	if (filter == NULL)
+		return TRUE;
+
+	verdict = g_hash_table_lookup(verdicts, smiley);
+	if (verdict == NULL) {
+		verdict = GINT_TO_POINTER(filter(smiley, data) ? 1 : 2);
+		g_hash_table_insert(verdicts, smiley, verdict);
+	}
+
+	return verdict == GINT_TO_POINTER(1);
+}
+
+GList *
+purple_smileys_find_all_filtered(const char *text, gboolean escaped,
+		PurpleSmileyFilter filter, gpointer data)
+{
+	SmileyMatcher *matcher;
+	GHashTable *verdicts = NULL;
+	guint *longest = NULL; /* longest match starting at each offset */
+	GList *matches = NULL;
+	guint state = 0;
+	gsize len, i;
+
+	g_return_val_if_fail(text != NULL, NULL);
+
+	if (g_hash_table_size(smiley_shortcut_index) == 0)
+		return NULL;
+
+	matcher = &smiley_matchers[escaped ? 1 : 0];
+	if (matcher->dirty)
+		smiley_matcher_link(matcher);
+
+	if (filter != NULL)
+		verdicts = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	len = strlen(text);
+	for (i = 0; i < len; i++) {
+		guchar byte = text[i];
+		guint next = 0;
+		guint node;
+
+		while (state != 0 &&
+				(next = smiley_trie_child(matcher, state, byte)) == 0)
+			state = TRIE_NODE(matcher, state)->fail;
+		state = (state == 0) ? matcher->root[byte] : next;
+
+		node = TRIE_NODE(matcher, state)->smiley ? state :
+				TRIE_NODE(matcher, state)->output;
+		for (; node != 0; node = TRIE_NODE(matcher, node)->output) {
+			guint depth = TRIE_NODE(matcher, node)->depth;
+			gsize start = i + 1 - depth;
+
+			if (!smiley_filter_accepts(TRIE_NODE(matcher, node)->smiley,
+					filter, data, verdicts))
+				continue;
+
+			if (longest == NULL)
+				longest = g_new0(guint, len);
+			if (longest[start] == 0 ||
+					TRIE_NODE(matcher, longest[start])->depth < depth)
+				longest[start] = node;
+		}
+	}
+
+	if (verdicts != NULL)
+		g_hash_table_destroy(verdicts);
+
+	if (longest == NULL)
+		return NULL;
+
+	/* Leftmost first, then longest, never overlapping */
+	for (i = 0; i < len; ) {
+		PurpleSmileyMatch *match;
+
+		if (longest[i] == 0) {
+			i++;
+			continue;
+		}
+
+		match = g_new(PurpleSmileyMatch, 1);
+		match->smiley = TRIE_NODE(matcher, longest[i])->smiley;
+		match->offset = i;
+		match->length = TRIE_NODE(matcher, longest[i])->depth;
+		matches = g_list_prepend(matches, match);
+
+		i += match->length;
+	}
+
+	g_free(longest);
+
+	return g_list_reverse(matches);
+}
+
 const char *
 purple_smileys_get_storing_dir(void)
 {
@@ -877,6 +1194,10 @@ purple_smileys_init(void)
 	smiley_shortcut_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 	smiley_checksum_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
+	smiley_matchers[1].escaped = TRUE;
+	smiley_matcher_reset(&smiley_matchers[0]);
+	smiley_matcher_reset(&smiley_matchers[1]);
+
 	smileys_dir = g_build_filename(purple_user_dir(), SMILEYS_DEFAULT_FOLDER, NULL);
 
 	purple_smileys_load();
@@ -893,6 +1214,9 @@ purple_smileys_uninit(void)
 
 	g_hash_table_destroy(smiley_shortcut_index);
 	g_hash_table_destroy(smiley_checksum_index);
+	g_array_free(smiley_matchers[0].nodes, TRUE);
+	g_array_free(smiley_matchers[1].nodes, TRUE);
+	smiley_matchers[0].nodes = smiley_matchers[1].nodes = NULL;
 	g_free(smileys_dir);
 }
 
@@ -44,6 +44,27 @@
 typedef struct _PurpleSmiley        PurpleSmiley;
 typedef struct _PurpleSmileyClass   PurpleSmileyClass;
 
+/**
+ * Where a custom smiley's shortcut was found in a piece of text.
+ *
+ * @see purple_smileys_find_all()
+ * @since 2.10.0
+ */
+typedef struct _PurpleSmileyMatch
+{
+	PurpleSmiley *smiley;  /**< The smiley whose shortcut was found. */
+	gsize offset;          /**< The byte offset of the shortcut.     */
+	gsize length;          /**< The length of the shortcut, in bytes,
+	                            as it appears in the text.           */
+} PurpleSmileyMatch;
+
+/**
+ * Decides whether a smiley may be used, for purple_smileys_find_all_filtered().
+ *
+ * @since 2.10.0
+ */
+typedef gboolean (*PurpleSmileyFilter)(PurpleSmiley *smiley, gpointer data);
+
 #define PURPLE_TYPE_SMILEY             (purple_smiley_get_type ())
 #define PURPLE_SMILEY(smiley)          (G_TYPE_CHECK_INSTANCE_CAST ((smiley), PURPLE_TYPE_SMILEY, PurpleSmiley))
 #define PURPLE_SMILEY_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST ((klass), PURPLE_TYPE_SMILEY, PurpleSmileyClass))
@@ -233,6 +254,46 @@ purple_smileys_find_by_shortcut(const char *shortcut);
 PurpleSmiley *
 purple_smileys_find_by_checksum(const char *checksum);
 
+/**
+ * Finds every custom smiley shortcut in a piece of text, in one pass
+ * however many custom smileys there are.
+ *
+ * Where shortcuts overlap, the one starting first wins, and of those
+ * starting at the same place the longest one wins.
+ *
+ * @param text    The text to search.
+ * @param escaped Whether @a text is markup, in which case the shortcuts
+ *                are looked for with their markup escaped.
+ *
+ * @return A list of PurpleSmileyMatch, in the order they appear in
+ *         @a text. The caller should g_free each match and then free
+ *         the list.
+ *
+ * @since 2.10.0
+ */
+GList *
+purple_smileys_find_all(const char *text, gboolean escaped);
+
+/**
+ * Like purple_smileys_find_all(), but only finds the custom smileys
+ * @a filter accepts.
+ *
+ * A rejected shortcut never hides a shorter or overlapping one that is
+ * accepted.  @a filter is called at most once for each smiley.
+ *
+ * @param text    The text to search.
+ * @param escaped Whether @a text is markup.
+ * @param filter  Returns whether a smiley may be used.
+ * @param data    User data to pass to @a filter.
+ *
+ * @return A list of PurpleSmileyMatch, as for purple_smileys_find_all().
+ *
+ * @since 2.10.0
+ */
+GList *
+purple_smileys_find_all_filtered(const char *text, gboolean escaped,
+		PurpleSmileyFilter filter, gpointer data);
+
 /**
  * Returns the directory used to store custom smiley cached files.
  *
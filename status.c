@@ -74,11 +74,26 @@ struct _PurplePresence
 	time_t idle_time;
 	time_t login_time;
 
+	/*
+	 * The statuses of an account or buddy presence are made from the
+	 * account's status types, which every presence on the account
+	 * shares.  A PurpleStatus is only created for a type once something
+	 * asks for it, so a buddy that stays offline has only its offline
+	 * status.  Once statuses_complete is set, statuses has one for
+	 * every type, in the same order.
+	 */
 	GList *statuses;
-	GHashTable *status_table;
+	gboolean statuses_complete;
 
 	PurpleStatus *active_status;
 
+	/*
+	 * The score from purple_presence_compute_score(), which is good as
+	 * long as score_generation matches the global one.
+	 */
+	int score;
+	guint score_generation;
+
 	union
 	{
 		PurpleAccount *account;
@@ -115,7 +130,9 @@ struct _PurpleStatus
 	 * The current values of the attributes for this status.  The
 	 * key is a string containing the name of the attribute.  It is
 	 * a borrowed reference from the list of attrs in the
-	 * PurpleStatusType.  The value is a PurpleValue.
+	 * PurpleStatusType.  The value is a PurpleValue.  This is NULL
+	 * until an attribute is set; attributes that were never set have
+	 * the default value from the PurpleStatusType.
 	 */
 	GHashTable *attr_values;
 };
@@ -147,6 +164,13 @@ static int primitive_scores[] =
 #define SCORE_IDLE_TIME 10
 #define SCORE_OFFLINE_MESSAGE 11
 
+/*
+ * Bumped whenever something that goes into every presence's score
+ * changes, so that all the cached scores are thrown out at once.
+ * Never 0, which marks a single presence's score as stale.
+ */
+static guint score_generation = 1;
+
 /**************************************************************************
  * PurpleStatusPrimitive API
  **************************************************************************/
@@ -559,7 +583,6 @@ PurpleStatus *
 purple_status_new(PurpleStatusType *status_type, PurplePresence *presence)
 {
 	PurpleStatus *status;
-	GList *l;
 
 	g_return_val_if_fail(status_type != NULL, NULL);
 	g_return_val_if_fail(presence    != NULL, NULL);
@@ -570,21 +593,6 @@ purple_status_new(PurpleStatusType *status_type, PurplePresence *presence)
 	status->type     = status_type;
 	status->presence = presence;
 
-	status->attr_values =
-		g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
-		(GDestroyNotify)purple_value_destroy);
-
-	for (l = purple_status_type_get_attrs(status_type); l != NULL; l = l->next)
-	{
-		PurpleStatusAttr *attr = (PurpleStatusAttr *)l->data;
-		PurpleValue *value = purple_status_attr_get_value(attr);
-		PurpleValue *new_value = purple_value_dup(value);
-
-		g_hash_table_insert(status->attr_values,
-							(char *)purple_status_attr_get_id(attr),
-							new_value);
-	}
-
 	return status;
 }
 
@@ -597,7 +605,8 @@ purple_status_destroy(PurpleStatus *status)
 {
 	g_return_if_fail(status != NULL);
 
-	g_hash_table_destroy(status->attr_values);
+	if (status->attr_values != NULL)
+		g_hash_table_destroy(status->attr_values);
 
 	PURPLE_DBUS_UNREGISTER_POINTER(status);
 	g_free(status);
@@ -703,6 +712,8 @@ status_has_changed(PurpleStatus *status)
 	else
 		old_status = NULL;
 
+	presence->score_generation = 0;
+
 	notify_status_update(presence, old_status, status);
 }
 
@@ -735,6 +746,26 @@ purple_status_set_active_with_attrs(PurpleStatus *status, gboolean active, va_li
 	g_list_free(attrs);
 }
 
+/*
+ * Returns an attribute's value for reading only.  If the attribute was
+ * never set, this is the default shared by every status of the type.
+ */
+static PurpleValue *
+status_peek_attr_value(const PurpleStatus *status, const char *id)
+{
+	PurpleStatusAttr *attr;
+	PurpleValue *value;
+
+	if (status->attr_values != NULL &&
+			(value = g_hash_table_lookup(status->attr_values, id)) != NULL)
+		return value;
+
+	/* Never set, so it still has the default */
+	attr = purple_status_type_get_attr(status->type, id);
+
+	return attr != NULL ? purple_status_attr_get_value(attr) : NULL;
+}
+
 void
 purple_status_set_active_with_attrs_list(PurpleStatus *status, gboolean active,
 									   GList *attrs)
@@ -770,7 +801,7 @@ purple_status_set_active_with_attrs_list(PurpleStatus *status, gboolean active,
 
 		id = l->data;
 		l = l->next;
-		value = purple_status_get_attr_value(status, id);
+		value = status_peek_attr_value(status, id);
 		if (value == NULL)
 		{
 			purple_debug_warning("status", "The attribute \"%s\" on the status \"%s\" is "
@@ -863,6 +894,35 @@ purple_status_set_active_with_attrs_list(PurpleStatus *status, gboolean active,
 	status_has_changed(status);
 }
 
+/*
+ * Returns the status's own copy of an attribute's value, making one
+ * from the default the first time the attribute is set or handed out.
+ */
+static PurpleValue *
+status_get_attr_value_for_set(PurpleStatus *status, const char *id)
+{
+	PurpleStatusAttr *attr;
+	PurpleValue *value;
+
+	if (status->attr_values != NULL &&
+			(value = g_hash_table_lookup(status->attr_values, id)) != NULL)
+		return value;
+
+	attr = purple_status_type_get_attr(status->type, id);
+	if (attr == NULL)
+		return NULL;
+
+	if (status->attr_values == NULL)
+		status->attr_values = g_hash_table_new_full(g_str_hash, g_str_equal,
+				NULL, (GDestroyNotify)purple_value_destroy);
+
+	value = purple_value_dup(purple_status_attr_get_value(attr));
+	g_hash_table_insert(status->attr_values,
+			(char *)purple_status_attr_get_id(attr), value);
+
+	return value;
+}
+
 void
 purple_status_set_attr_boolean(PurpleStatus *status, const char *id,
 		gboolean value)
@@ -873,11 +933,14 @@ purple_status_set_attr_boolean(PurpleStatus *status, const char *id,
 	g_return_if_fail(id     != NULL);
 
 	/* Make sure this attribute exists and is the correct type. */
-	attr_value = purple_status_get_attr_value(status, id);
+	attr_value = status_peek_attr_value(status, id);
 	g_return_if_fail(attr_value != NULL);
 	g_return_if_fail(purple_value_get_type(attr_value) == PURPLE_TYPE_BOOLEAN);
 
-	purple_value_set_boolean(attr_value, value);
+	if (purple_value_get_boolean(attr_value) == value)
+		return;
+
+	purple_value_set_boolean(status_get_attr_value_for_set(status, id), value);
 }
 
 void
@@ -889,11 +952,14 @@ purple_status_set_attr_int(PurpleStatus *status, const char *id, int value)
 	g_return_if_fail(id     != NULL);
 
 	/* Make sure this attribute exists and is the correct type. */
-	attr_value = purple_status_get_attr_value(status, id);
+	attr_value = status_peek_attr_value(status, id);
 	g_return_if_fail(attr_value != NULL);
 	g_return_if_fail(purple_value_get_type(attr_value) == PURPLE_TYPE_INT);
 
-	purple_value_set_int(attr_value, value);
+	if (purple_value_get_int(attr_value) == value)
+		return;
+
+	purple_value_set_int(status_get_attr_value_for_set(status, id), value);
 }
 
 void
@@ -906,7 +972,7 @@ purple_status_set_attr_string(PurpleStatus *status, const char *id,
 	g_return_if_fail(id     != NULL);
 
 	/* Make sure this attribute exists and is the correct type. */
-	attr_value = purple_status_get_attr_value(status, id);
+	attr_value = status_peek_attr_value(status, id);
 	/* This used to be g_return_if_fail, but it's failing a LOT, so
 	 * let's generate a log error for now. */
 	/* g_return_if_fail(attr_value != NULL); */
@@ -922,7 +988,10 @@ purple_status_set_attr_string(PurpleStatus *status, const char *id,
 
 	/* XXX: Check if the value has actually changed. If it has, and the status
 	 * is active, should this trigger 'status_has_changed'? */
-	purple_value_set_string(attr_value, value);
+	if (purple_strequal(purple_value_get_string(attr_value), value))
+		return;
+
+	purple_value_set_string(status_get_attr_value_for_set(status, id), value);
 }
 
 PurpleStatusType *
@@ -1008,7 +1077,11 @@ purple_status_get_attr_value(const PurpleStatus *status, const char *id)
 	g_return_val_if_fail(status != NULL, NULL);
 	g_return_val_if_fail(id     != NULL, NULL);
 
-	return (PurpleValue *)g_hash_table_lookup(status->attr_values, id);
+	/*
+	 * Callers may change the value they get back, so it has to be the
+	 * status's own and not the default that every status shares.
+	 */
+	return status_get_attr_value_for_set((PurpleStatus *)status, id);
 }
 
 gboolean
@@ -1019,7 +1092,7 @@ purple_status_get_attr_boolean(const PurpleStatus *status, const char *id)
 	g_return_val_if_fail(status != NULL, FALSE);
 	g_return_val_if_fail(id     != NULL, FALSE);
 
-	if ((value = purple_status_get_attr_value(status, id)) == NULL)
+	if ((value = status_peek_attr_value(status, id)) == NULL)
 		return FALSE;
 
 	g_return_val_if_fail(purple_value_get_type(value) == PURPLE_TYPE_BOOLEAN, FALSE);
@@ -1035,7 +1108,7 @@ purple_status_get_attr_int(const PurpleStatus *status, const char *id)
 	g_return_val_if_fail(status != NULL, 0);
 	g_return_val_if_fail(id     != NULL, 0);
 
-	if ((value = purple_status_get_attr_value(status, id)) == NULL)
+	if ((value = status_peek_attr_value(status, id)) == NULL)
 		return 0;
 
 	g_return_val_if_fail(purple_value_get_type(value) == PURPLE_TYPE_INT, 0);
@@ -1051,7 +1124,7 @@ purple_status_get_attr_string(const PurpleStatus *status, const char *id)
 	g_return_val_if_fail(status != NULL, NULL);
 	g_return_val_if_fail(id     != NULL, NULL);
 
-	if ((value = purple_status_get_attr_value(status, id)) == NULL)
+	if ((value = status_peek_attr_value(status, id)) == NULL)
 		return NULL;
 
 	g_return_val_if_fail(purple_value_get_type(value) == PURPLE_TYPE_STRING, NULL);
@@ -1107,10 +1180,7 @@ purple_presence_new(PurplePresenceContext context)
 	PURPLE_DBUS_REGISTER_POINTER(presence, PurplePresence);
 
 	presence->context = context;
-
-	presence->status_table =
-		g_hash_table_new_full(g_str_hash, g_str_equal,
-							  g_free, NULL);
+	presence->statuses_complete = TRUE;
 
 	return presence;
 }
@@ -1123,7 +1193,7 @@ purple_presence_new_for_account(PurpleAccount *account)
 
 	presence = purple_presence_new(PURPLE_PRESENCE_CONTEXT_ACCOUNT);
 	presence->u.account = account;
-	presence->statuses = purple_prpl_get_statuses(account, presence);
+	presence->statuses_complete = FALSE;
 
 	return presence;
 }
@@ -1155,7 +1225,7 @@ purple_presence_new_for_buddy(PurpleBuddy *buddy)
 
 	presence->u.buddy.name    = g_strdup(purple_buddy_get_name(buddy));
 	presence->u.buddy.account = account;
-	presence->statuses = purple_prpl_get_statuses(account, presence);
+	presence->statuses_complete = FALSE;
 
 	presence->u.buddy.buddy = buddy;
 
@@ -1179,8 +1249,6 @@ purple_presence_destroy(PurplePresence *presence)
 	g_list_foreach(presence->statuses, (GFunc)purple_status_destroy, NULL);
 	g_list_free(presence->statuses);
 
-	g_hash_table_destroy(presence->status_table);
-
 	PURPLE_DBUS_UNREGISTER_POINTER(presence);
 	g_free(presence);
 }
@@ -1192,9 +1260,6 @@ purple_presence_add_status(PurplePresence *presence, PurpleStatus *status)
 	g_return_if_fail(status   != NULL);
 
 	presence->statuses = g_list_append(presence->statuses, status);
-
-	g_hash_table_insert(presence->status_table,
-	g_strdup(purple_status_get_id(status)), status);
 }
 
 void
@@ -1298,7 +1363,7 @@ update_buddy_idle(PurpleBuddy *buddy, PurplePresence *presence,
 		purple_signal_emit(purple_blist_get_handle(), "buddy-idle-changed", buddy,
 		                 old_idle, idle);
 
-	purple_contact_invalidate_priority_buddy(purple_buddy_get_contact(buddy));
+	_purple_contact_update_priority_buddy(purple_buddy_get_contact(buddy), buddy);
 
 	/* Should this be done here? It'd perhaps make more sense to
 	 * connect to buddy-[un]idle signals and update from there
@@ -1322,6 +1387,7 @@ purple_presence_set_idle(PurplePresence *presence, gboolean idle, time_t idle_ti
 	old_idle            = presence->idle;
 	presence->idle      = idle;
 	presence->idle_time = (idle ? idle_time : 0);
+	presence->score_generation = 0;
 
 	current_time = time(NULL);
 
@@ -1438,41 +1504,95 @@ purple_presence_get_buddy(const PurplePresence *presence)
 	return presence->u.buddy.buddy;
 }
 
+static PurpleStatus *
+presence_find_status_with_type(const PurplePresence *presence,
+		const PurpleStatusType *status_type)
+{
+	GList *l;
+
+	for (l = presence->statuses; l != NULL; l = l->next)
+	{
+		PurpleStatus *status = l->data;
+
+		if (status->type == status_type)
+			return status;
+	}
+
+	return NULL;
+}
+
+/*
+ * Creates the statuses nobody has asked for yet and puts them all in
+ * the order of the status types.  Any statuses added by hand go last.
+ */
+static void
+presence_complete_statuses(PurplePresence *presence)
+{
+	GList *statuses = NULL;
+	GList *l;
+
+	if (presence->statuses_complete)
+		return;
+
+	for (l = purple_account_get_status_types(purple_presence_get_account(presence));
+			l != NULL; l = l->next)
+	{
+		PurpleStatusType *status_type = l->data;
+		PurpleStatus *status = presence_find_status_with_type(presence, status_type);
+
+		if (status != NULL)
+			presence->statuses = g_list_remove(presence->statuses, status);
+		else
+			status = purple_status_new(status_type, presence);
+
+		statuses = g_list_prepend(statuses, status);
+	}
+
+	presence->statuses = g_list_concat(g_list_reverse(statuses),
+			presence->statuses);
+	presence->statuses_complete = TRUE;
+}
+
 GList *
 purple_presence_get_statuses(const PurplePresence *presence)
 {
 	g_return_val_if_fail(presence != NULL, NULL);
 
+	presence_complete_statuses((PurplePresence *)presence);
+
 	return presence->statuses;
 }
 
 PurpleStatus *
 purple_presence_get_status(const PurplePresence *presence, const char *status_id)
 {
+	PurpleStatusType *status_type;
 	PurpleStatus *status;
-	GList *l = NULL;
+	GList *l;
 
 	g_return_val_if_fail(presence  != NULL, NULL);
 	g_return_val_if_fail(status_id != NULL, NULL);
 
-	/* What's the purpose of this hash table? */
-	status = (PurpleStatus *)g_hash_table_lookup(presence->status_table,
-						   status_id);
+	for (l = presence->statuses; l != NULL; l = l->next)
+	{
+		status = l->data;
 
-	if (status == NULL) {
-		for (l = purple_presence_get_statuses(presence);
-			 l != NULL && status == NULL; l = l->next)
-		{
-			PurpleStatus *temp_status = l->data;
+		if (purple_strequal(status_id, purple_status_get_id(status)))
+			return status;
+	}
 
-			if (purple_strequal(status_id, purple_status_get_id(temp_status)))
-				status = temp_status;
-		}
+	if (presence->statuses_complete)
+		return NULL;
 
-		if (status != NULL)
-			g_hash_table_insert(presence->status_table,
-								g_strdup(purple_status_get_id(status)), status);
-	}
+	status_type = (PurpleStatusType *)purple_status_type_find_with_id(
+			purple_account_get_status_types(purple_presence_get_account(presence)),
+			status_id);
+	if (status_type == NULL)
+		return NULL;
+
+	status = purple_status_new(status_type, (PurplePresence *)presence);
+	((PurplePresence *)presence)->statuses =
+			g_list_prepend(presence->statuses, status);
 
 	return status;
 }
@@ -1534,8 +1654,8 @@ purple_presence_is_status_primitive_active(const PurplePresence *presence,
 	g_return_val_if_fail(presence  != NULL,              FALSE);
 	g_return_val_if_fail(primitive != PURPLE_STATUS_UNSET, FALSE);
 
-	for (l = purple_presence_get_statuses(presence);
-	     l != NULL; l = l->next)
+	/* A status that was never created was never active either */
+	for (l = presence->statuses; l != NULL; l = l->next)
 	{
 		PurpleStatus *temp_status = l->data;
 		PurpleStatusType *type = purple_status_get_type(temp_status);
@@ -1577,7 +1697,10 @@ purple_presence_compute_score(const PurplePresence *presence)
 	GList *l;
 	int score = 0;
 
-	for (l = purple_presence_get_statuses(presence); l != NULL; l = l->next) {
+	if (presence->score_generation == score_generation)
+		return presence->score;
+
+	for (l = presence->statuses; l != NULL; l = l->next) {
 		PurpleStatus *status = (PurpleStatus *)l->data;
 		PurpleStatusType *type = purple_status_get_type(status);
 
@@ -1593,9 +1716,20 @@ purple_presence_compute_score(const PurplePresence *presence)
 	score += purple_account_get_int(purple_presence_get_account(presence), "score", 0);
 	if (purple_presence_is_idle(presence))
 		score += primitive_scores[SCORE_IDLE];
+
+	((PurplePresence *)presence)->score = score;
+	((PurplePresence *)presence)->score_generation = score_generation;
+
 	return score;
 }
 
+void
+_purple_presence_invalidate_scores(void)
+{
+	if (++score_generation == 0)
+		score_generation = 1;
+}
+
 gint
 purple_presence_compare(const PurplePresence *presence1,
 		const PurplePresence *presence2)
@@ -1623,12 +1757,13 @@ purple_presence_compare(const PurplePresence *presence1,
 	/* Compute the score of the second set of statuses. */
 	score2 = purple_presence_compute_score(presence2);
 
-	idle_time_1 = time(NULL) - purple_presence_get_idle_time(presence1);
-	idle_time_2 = time(NULL) - purple_presence_get_idle_time(presence2);
+	/* Whoever went idle earlier has been idle longer */
+	idle_time_1 = purple_presence_get_idle_time(presence1);
+	idle_time_2 = purple_presence_get_idle_time(presence2);
 
-	if (idle_time_1 > idle_time_2)
+	if (idle_time_1 < idle_time_2)
 		score1 += primitive_scores[SCORE_IDLE_TIME];
-	else if (idle_time_1 < idle_time_2)
+	else if (idle_time_1 > idle_time_2)
 		score2 += primitive_scores[SCORE_IDLE_TIME];
 
 	if (score1 < score2)
@@ -1650,6 +1785,7 @@ score_pref_changed_cb(const char *name, PurplePrefType type,
 	int index = GPOINTER_TO_INT(data);
 
 	primitive_scores[index] = GPOINTER_TO_INT(value);
+	_purple_presence_invalidate_scores();
 }
 
 void *
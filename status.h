@@ -728,6 +728,12 @@ gboolean purple_status_is_online(const PurpleStatus *status);
 /**
  * Returns the value of an attribute in a status with the specified ID.
  *
+ * The value belongs to the status, so changing it changes only this
+ * status.  To just read an attribute, use
+ * purple_status_get_attr_boolean(), purple_status_get_attr_int() or
+ * purple_status_get_attr_string(), which don't need to make a copy of
+ * an attribute that still has its default.
+ *
  * @param status The status.
  * @param id     The attribute ID.
  *
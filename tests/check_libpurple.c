@@ -11,12 +11,54 @@
 /******************************************************************************
  * libpurple goodies
  *****************************************************************************/
+#define PURPLE_CHECK_READ_COND  (G_IO_IN | G_IO_HUP | G_IO_ERR)
+#define PURPLE_CHECK_WRITE_COND (G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL)
+
+typedef struct {
+	PurpleInputFunction function;
+	gpointer data;
+} PurpleCheckIOClosure;
+
+static gboolean
+purple_check_io_invoke(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	PurpleCheckIOClosure *closure = data;
+	PurpleInputCondition purple_cond = 0;
+
+	if (condition & PURPLE_CHECK_READ_COND)
+		purple_cond |= PURPLE_INPUT_READ;
+	if (condition & PURPLE_CHECK_WRITE_COND)
+		purple_cond |= PURPLE_INPUT_WRITE;
+
+	closure->function(closure->data, g_io_channel_unix_get_fd(source),
+			purple_cond);
+
+	return TRUE;
+}
+
 static guint
 purple_check_input_add(gint fd, PurpleInputCondition condition,
                      PurpleInputFunction function, gpointer data)
 {
-	/* this is a no-op for now, feel free to implement it */
-	return 0;
+	PurpleCheckIOClosure *closure = g_new0(PurpleCheckIOClosure, 1);
+	GIOChannel *channel;
+	GIOCondition cond = 0;
+	guint result;
+
+	closure->function = function;
+	closure->data = data;
+
+	if (condition & PURPLE_INPUT_READ)
+		cond |= PURPLE_CHECK_READ_COND;
+	if (condition & PURPLE_INPUT_WRITE)
+		cond |= PURPLE_CHECK_WRITE_COND;
+
+	channel = g_io_channel_unix_new(fd);
+	result = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT, cond,
+			purple_check_io_invoke, closure, g_free);
+	g_io_channel_unref(channel);
+
+	return result;
 }
 
 static PurpleEventLoopUiOps eventloop_ui_ops = {
@@ -57,6 +99,20 @@ purple_check_init(void) {
 	purple_core_init("check");
 }
 
+void
+check_report_timing(const char *format, ...)
+{
+	va_list args;
+	char *message;
+
+	va_start(args, format);
+	message = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	purple_debug_info("check", "%s\n", message);
+	g_free(message);
+}
+
 /******************************************************************************
  * Check meat and potatoes
  *****************************************************************************/
@@ -84,13 +140,28 @@ int main(void)
 	sr = srunner_create (master_suite());
 
 	srunner_add_suite(sr, cipher_suite());
+	srunner_add_suite(sr, circbuffer_suite());
+	srunner_add_suite(sr, dbus_suite());
+	srunner_add_suite(sr, eventloop_suite());
 	srunner_add_suite(sr, jabber_caps_suite());
 	srunner_add_suite(sr, jabber_digest_md5_suite());
 	srunner_add_suite(sr, jabber_jutil_suite());
 	srunner_add_suite(sr, jabber_scram_suite());
+	srunner_add_suite(sr, msn_servconn_suite());
+	srunner_add_suite(sr, msn_soap_suite());
+	srunner_add_suite(sr, msn_userlist_suite());
+	srunner_add_suite(sr, oscar_feedbag_suite());
+	srunner_add_suite(sr, oscar_flap_suite());
 	srunner_add_suite(sr, oscar_util_suite());
+	srunner_add_suite(sr, outputbatch_suite());
+	srunner_add_suite(sr, plugin_suite());
+	srunner_add_suite(sr, roomlist_suite());
+	srunner_add_suite(sr, smiley_suite());
+	srunner_add_suite(sr, status_suite());
+	srunner_add_suite(sr, yahoo_packet_suite());
 	srunner_add_suite(sr, yahoo_util_suite());
 	srunner_add_suite(sr, util_suite());
+	srunner_add_suite(sr, util_fetch_url_suite());
 	srunner_add_suite(sr, xmlnode_suite());
 
 	/* make this a libpurple "ui" */
@@ -0,0 +1,182 @@
+#include <string.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#include "tests.h"
+#include "../circbuffer.h"
+
+/* Everything left in the buffer, read the way a writer would */
+static char *
+drain(PurpleCircBuffer *buf)
+{
+	GString *out = g_string_new(NULL);
+	gsize len;
+
+	while ((len = purple_circ_buffer_get_max_read(buf)) > 0) {
+		g_string_append_len(out, (const char *)buf->outptr, len);
+		fail_unless(purple_circ_buffer_mark_read(buf, len));
+	}
+	assert_int_equal(0, buf->bufused);
+
+	return g_string_free(out, FALSE);
+}
+
+START_TEST(test_circbuffer_grow_copying_head)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(8);
+
+	purple_circ_buffer_append(buf, "abcdef", 6);
+	fail_unless(purple_circ_buffer_mark_read(buf, 4));
+
+	/* Wraps, leaving a short head before the read position */
+	purple_circ_buffer_append(buf, "ghij", 4);
+	assert_int_equal(8, buf->buflen);
+	fail_unless(buf->inptr == buf->buffer + 2);
+
+	/* The head is copied after the old end; the tail stays put */
+	purple_circ_buffer_append(buf, "klmnop", 6);
+	assert_int_equal(16, buf->buflen);
+	fail_unless(buf->outptr == buf->buffer + 4);
+	assert_int_equal(12, buf->bufused);
+
+	assert_string_equal_free("efghijklmnop", drain(buf));
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+START_TEST(test_circbuffer_grow_moving_tail)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(8);
+
+	purple_circ_buffer_append(buf, "abcdefg", 7);
+	fail_unless(purple_circ_buffer_mark_read(buf, 6));
+
+	/* Wraps, leaving a head longer than the tail */
+	purple_circ_buffer_append(buf, "hijkl", 5);
+	fail_unless(buf->inptr == buf->buffer + 4);
+	fail_unless(buf->outptr == buf->buffer + 6);
+
+	/* The tail is moved up against the new end instead */
+	purple_circ_buffer_append(buf, "mnopqrs", 7);
+	assert_int_equal(16, buf->buflen);
+	fail_unless(buf->outptr == buf->buffer + 14);
+	assert_int_equal(13, buf->bufused);
+
+	assert_string_equal_free("ghijklmnopqrs", drain(buf));
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+START_TEST(test_circbuffer_full)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(8);
+
+	purple_circ_buffer_append(buf, "abcdef", 6);
+	fail_unless(purple_circ_buffer_mark_read(buf, 2));
+
+	/* Exactly full, so the read and write positions meet */
+	purple_circ_buffer_append(buf, "ghij", 4);
+	assert_int_equal(8, buf->bufused);
+	assert_int_equal(8, buf->buflen);
+	fail_unless(buf->inptr == buf->outptr);
+	assert_int_equal(6, purple_circ_buffer_get_max_read(buf));
+
+	purple_circ_buffer_append(buf, "k", 1);
+	assert_int_equal(16, buf->buflen);
+	assert_string_equal_free("cdefghijk", drain(buf));
+
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+START_TEST(test_circbuffer_shrink)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(4);
+	char big[100];
+
+	memset(big, 'x', sizeof(big));
+	purple_circ_buffer_append(buf, big, sizeof(big));
+	assert_int_equal(128, buf->buflen);
+
+	/* Once a big burst has been read, the memory is given back... */
+	g_free(drain(buf));
+	fail_unless(buf->buffer == NULL);
+	assert_int_equal(0, buf->buflen);
+	assert_int_equal(0, purple_circ_buffer_get_max_read(buf));
+
+	/* ...and the buffer starts small again */
+	purple_circ_buffer_append(buf, "xyz", 3);
+	assert_int_equal(4, buf->buflen);
+	assert_string_equal_free("xyz", drain(buf));
+
+	/* A small buffer is kept when it's drained */
+	purple_circ_buffer_append(buf, "ab", 2);
+	g_free(drain(buf));
+	fail_unless(buf->buffer != NULL);
+	fail_unless(buf->inptr == buf->buffer);
+
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+#ifndef _WIN32
+START_TEST(test_circbuffer_writev)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(8);
+	struct iovec iov[2];
+	char received[16];
+	int fds[2];
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+	assert_int_equal(0, purple_circ_buffer_get_read_iov(buf, iov));
+	assert_int_equal(0, purple_circ_buffer_writev(buf, fds[0]));
+
+	/* Contiguous data is one segment */
+	purple_circ_buffer_append(buf, "abcdefg", 7);
+	assert_int_equal(1, purple_circ_buffer_get_read_iov(buf, iov));
+	assert_int_equal(7, iov[0].iov_len);
+	fail_unless(purple_circ_buffer_mark_read(buf, 6));
+
+	/* Wrapped data is two, written with one call and in order */
+	purple_circ_buffer_append(buf, "hijkl", 5);
+	assert_int_equal(2, purple_circ_buffer_get_read_iov(buf, iov));
+	assert_int_equal(2, iov[0].iov_len);
+	assert_int_equal(4, iov[1].iov_len);
+	fail_unless(iov[0].iov_base == buf->outptr);
+	fail_unless(iov[1].iov_base == buf->buffer);
+
+	assert_int_equal(6, purple_circ_buffer_writev(buf, fds[0]));
+	assert_int_equal(0, buf->bufused);
+	assert_int_equal(6, read(fds[1], received, sizeof(received)));
+	fail_unless(memcmp("ghijkl", received, 6) == 0);
+
+	close(fds[0]);
+	close(fds[1]);
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+#endif
+
+Suite *
+circbuffer_suite(void)
+{
+	Suite *s = suite_create("Circular Buffer");
+
+	TCase *tc = tcase_create("Growing");
+	tcase_add_test(tc, test_circbuffer_grow_copying_head);
+	tcase_add_test(tc, test_circbuffer_grow_moving_tail);
+	tcase_add_test(tc, test_circbuffer_full);
+	tcase_add_test(tc, test_circbuffer_shrink);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Writing");
+#ifndef _WIN32
+	tcase_add_test(tc, test_circbuffer_writev);
+#endif
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,387 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../internal.h"
+
+#ifdef HAVE_DBUS
+
+#include "../dbus-purple.h"
+#include "../dbus-server.h"
+
+/*
+ * These need a session bus.  Without one, libpurple has no D-Bus
+ * connection and there is nothing to test; run them with something
+ * like "dbus-run-session make check".
+ */
+
+static int check_signal_handle;
+
+/* Counts the libpurple signals a client gets, by name */
+static DBusHandlerResult
+count_signals(DBusConnection *connection, DBusMessage *message, void *data)
+{
+	GHashTable *received = data;
+
+	if (dbus_message_get_type(message) == DBUS_MESSAGE_TYPE_SIGNAL &&
+			dbus_message_has_interface(message, DBUS_INTERFACE_PURPLE)) {
+		const char *name = dbus_message_get_member(message);
+		int count = GPOINTER_TO_INT(g_hash_table_lookup(received, name));
+
+		g_hash_table_insert(received, g_strdup(name), GINT_TO_POINTER(count + 1));
+	}
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static int
+received_count(GHashTable *received, const char *name)
+{
+	return GPOINTER_TO_INT(g_hash_table_lookup(received, name));
+}
+
+/* A client on the same bus as libpurple, or NULL if there's no bus */
+static DBusConnection *
+client_new(GHashTable *received)
+{
+	DBusConnection *client;
+
+	if (purple_dbus_get_connection() == NULL)
+		return NULL;
+
+	client = dbus_bus_get_private(DBUS_BUS_SESSION, NULL);
+	fail_unless(client != NULL);
+	dbus_connection_set_exit_on_disconnect(client, FALSE);
+	dbus_connection_setup_with_g_main(client, NULL);
+
+	if (received != NULL) {
+		dbus_bus_add_match(client,
+				"type='signal',interface='" DBUS_INTERFACE_PURPLE "'", NULL);
+		dbus_connection_add_filter(client, count_signals, received, NULL);
+	}
+
+	return client;
+}
+
+static void
+client_free(DBusConnection *client)
+{
+	dbus_connection_close(client);
+	dbus_connection_unref(client);
+}
+
+static DBusMessage *
+method_call_new(const char *method)
+{
+	return dbus_message_new_method_call(
+			dbus_bus_get_unique_name(purple_dbus_get_connection()),
+			DBUS_PATH_PURPLE, DBUS_INTERFACE_PURPLE, method);
+}
+
+/*
+ * Sends a method call and keeps libpurple going until the reply is in.
+ * Anything libpurple sent before the reply has been seen by then.
+ */
+static DBusMessage *
+call_message(DBusConnection *client, DBusMessage *message)
+{
+	DBusMessage *reply;
+	DBusPendingCall *pending;
+
+	fail_unless(dbus_connection_send_with_reply(client, message, &pending, -1));
+	dbus_message_unref(message);
+
+	while (!dbus_pending_call_get_completed(pending))
+		g_main_context_iteration(NULL, TRUE);
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+
+	reply = dbus_pending_call_steal_reply(pending);
+	dbus_pending_call_unref(pending);
+
+	return reply;
+}
+
+static DBusMessage *
+call(DBusConnection *client, const char *method, const char *arg)
+{
+	DBusMessage *message = method_call_new(method);
+
+	if (arg != NULL)
+		dbus_message_append_args(message, DBUS_TYPE_STRING, &arg,
+				DBUS_TYPE_INVALID);
+
+	return call_message(client, message);
+}
+
+static void
+call_and_forget(DBusConnection *client, const char *method, const char *arg)
+{
+	DBusMessage *reply = call(client, method, arg);
+
+	fail_unless(dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN);
+	dbus_message_unref(reply);
+}
+
+/* Sends both test signals, then makes sure the client has seen them */
+static void
+emit_and_wait(DBusConnection *client)
+{
+	purple_signal_emit(&check_signal_handle, "check-ping");
+	purple_signal_emit(&check_signal_handle, "check-pong");
+	call_and_forget(client, "PurpleCoreGetVersion", NULL);
+}
+
+START_TEST(test_dbus_methods)
+{
+	DBusConnection *client = client_new(NULL);
+	DBusMessage *reply;
+	const char *version;
+
+	if (client == NULL)
+		return;
+
+	reply = call(client, "PurpleCoreGetVersion", NULL);
+	fail_unless(dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &version,
+			DBUS_TYPE_INVALID));
+	assert_string_equal(purple_core_get_version(), version);
+	dbus_message_unref(reply);
+
+	reply = call(client, "PurpleNoSuchMethod", NULL);
+	fail_unless(dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR);
+	dbus_message_unref(reply);
+
+	client_free(client);
+}
+END_TEST
+
+START_TEST(test_dbus_signal_subscriptions)
+{
+	GHashTable *received = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+	GHashTable *other_received = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+	DBusConnection *client = client_new(received);
+	DBusConnection *other;
+	int i;
+
+	if (client == NULL)
+		return;
+
+	purple_signal_register(&check_signal_handle, "check-ping",
+			purple_marshal_VOID, NULL, 0);
+	purple_signal_register(&check_signal_handle, "check-pong",
+			purple_marshal_VOID, NULL, 0);
+
+	/* With no subscriptions, every signal is sent */
+	emit_and_wait(client);
+	assert_int_equal(1, received_count(received, "CheckPing"));
+	assert_int_equal(1, received_count(received, "CheckPong"));
+
+	/* Subscribing changes nothing unless filtering is turned on... */
+	fail_if(purple_dbus_get_signal_filtering());
+	call_and_forget(client, "SubscribeSignal", "CheckPong");
+	emit_and_wait(client);
+	assert_int_equal(2, received_count(received, "CheckPing"));
+	assert_int_equal(2, received_count(received, "CheckPong"));
+
+	/* ...and then only what somebody wants is sent */
+	purple_dbus_set_signal_filtering(TRUE);
+	fail_unless(purple_dbus_get_signal_filtering());
+	emit_and_wait(client);
+	assert_int_equal(2, received_count(received, "CheckPing"));
+	assert_int_equal(3, received_count(received, "CheckPong"));
+
+	other = client_new(other_received);
+	call_and_forget(other, "SubscribeSignal", "CheckPing");
+	emit_and_wait(client);
+	assert_int_equal(3, received_count(received, "CheckPing"));
+	assert_int_equal(4, received_count(received, "CheckPong"));
+
+	/* The other client's subscriptions go when it does */
+	client_free(other);
+	for (i = 0; i < 100; i++) {
+		int pings = received_count(received, "CheckPing");
+
+		emit_and_wait(client);
+		if (received_count(received, "CheckPing") == pings)
+			break;
+	}
+	fail_unless(i < 100);
+
+	/* With the last subscription gone, everything is sent again */
+	call_and_forget(client, "UnsubscribeSignal", "CheckPong");
+	i = received_count(received, "CheckPing");
+	emit_and_wait(client);
+	assert_int_equal(i + 1, received_count(received, "CheckPing"));
+
+	purple_dbus_set_signal_filtering(FALSE);
+	purple_signal_unregister(&check_signal_handle, "check-ping");
+	purple_signal_unregister(&check_signal_handle, "check-pong");
+	client_free(client);
+	g_hash_table_destroy(received);
+	g_hash_table_destroy(other_received);
+}
+END_TEST
+
+/* How many elements the array at iter has, moving iter past it */
+static int
+array_length(DBusMessageIter *iter)
+{
+	DBusMessageIter array;
+	int length = 0;
+
+	fail_unless(dbus_message_iter_get_arg_type(iter) == DBUS_TYPE_ARRAY);
+	dbus_message_iter_recurse(iter, &array);
+	while (dbus_message_iter_get_arg_type(&array) != DBUS_TYPE_INVALID) {
+		length++;
+		dbus_message_iter_next(&array);
+	}
+	dbus_message_iter_next(iter);
+
+	return length;
+}
+
+/* Asks for the changes since *seq and moves it on */
+static void
+get_buddy_changes(DBusConnection *client, dbus_uint32_t *seq,
+		gboolean *complete, int *changed, int *removed)
+{
+	DBusMessage *message, *reply;
+	DBusMessageIter iter;
+	dbus_bool_t dbus_complete;
+
+	message = method_call_new("PurpleBlistGetBuddyChanges");
+	dbus_message_append_args(message, DBUS_TYPE_UINT32, seq, DBUS_TYPE_INVALID);
+	reply = call_message(client, message);
+
+	fail_unless(dbus_message_iter_init(reply, &iter));
+	dbus_message_iter_get_basic(&iter, seq);
+	dbus_message_iter_next(&iter);
+	dbus_message_iter_get_basic(&iter, &dbus_complete);
+	dbus_message_iter_next(&iter);
+	*complete = dbus_complete;
+	*changed = array_length(&iter);
+	*removed = array_length(&iter);
+
+	dbus_message_unref(reply);
+}
+
+START_TEST(test_dbus_bulk_queries)
+{
+	DBusConnection *client = client_new(NULL);
+	PurpleAccount *account;
+	PurpleBuddy *buddy = NULL;
+	PurpleConversation *conv;
+	DBusMessageIter iter;
+	DBusMessage *message, *reply;
+	dbus_int32_t account_id;
+	dbus_uint32_t seq = 0;
+	gboolean complete;
+	int changed, removed, i;
+	GList *types = NULL;
+	GSList *buddies;
+
+	if (client == NULL)
+		return;
+
+	account = purple_account_new("bulk@example.com", "prpl-check");
+	types = g_list_append(types, purple_status_type_new(PURPLE_STATUS_AVAILABLE,
+			"available", NULL, TRUE));
+	types = g_list_append(types, purple_status_type_new(PURPLE_STATUS_OFFLINE,
+			"offline", NULL, TRUE));
+	purple_account_set_status_types(account, types);
+
+	for (i = 0; i < 100; i++) {
+		char *name = g_strdup_printf("buddy%d@example.com", i);
+		buddy = purple_buddy_new(account, name, NULL);
+		purple_blist_add_buddy(buddy, NULL, NULL, NULL);
+		g_free(name);
+	}
+
+	/* One call gets the state of all of an account's buddies */
+	account_id = purple_dbus_pointer_to_id(account);
+	message = method_call_new("PurpleBlistGetBuddyStates");
+	dbus_message_append_args(message, DBUS_TYPE_INT32, &account_id,
+			DBUS_TYPE_INVALID);
+	reply = call_message(client, message);
+	assert_string_equal("a(issibiss)", dbus_message_get_signature(reply));
+	fail_unless(dbus_message_iter_init(reply, &iter));
+	assert_int_equal(100, array_length(&iter));
+	dbus_message_unref(reply);
+
+	get_buddy_changes(client, &seq, &complete, &changed, &removed);
+	fail_unless(complete);
+	fail_unless(changed >= 100);
+	assert_int_equal(0, removed);
+
+	/* After that, only what changed comes back */
+	purple_presence_switch_status(purple_buddy_get_presence(buddy), "available");
+	purple_blist_alias_buddy(buddy, "Alias");
+	get_buddy_changes(client, &seq, &complete, &changed, &removed);
+	fail_if(complete);
+	assert_int_equal(1, changed);
+	assert_int_equal(0, removed);
+
+	purple_blist_remove_buddy(buddy);
+	get_buddy_changes(client, &seq, &complete, &changed, &removed);
+	fail_if(complete);
+	assert_int_equal(0, changed);
+	assert_int_equal(1, removed);
+
+	get_buddy_changes(client, &seq, &complete, &changed, &removed);
+	fail_if(complete);
+	assert_int_equal(0, changed);
+	assert_int_equal(0, removed);
+
+	/* Nothing is tracked while D-Bus is down, so a number from before it
+	 * was restarted gets the whole list */
+	purple_dbus_uninit();
+	purple_dbus_init();
+	fail_unless(purple_dbus_get_connection() != NULL);
+	purple_blist_alias_buddy(purple_find_buddy(account, "buddy1@example.com"),
+			"Restarted");
+	get_buddy_changes(client, &seq, &complete, &changed, &removed);
+	fail_unless(complete);
+	fail_unless(changed >= 99);
+
+	get_buddy_changes(client, &seq, &complete, &changed, &removed);
+	fail_if(complete);
+	assert_int_equal(0, changed);
+	assert_int_equal(0, removed);
+
+	/* Conversations come all at once too */
+	conv = purple_conversation_new(PURPLE_CONV_TYPE_IM, account,
+			"buddy1@example.com");
+	reply = call(client, "PurpleGetConversationStates", NULL);
+	fail_unless(dbus_message_iter_init(reply, &iter));
+	fail_unless(array_length(&iter) >= 1);
+	dbus_message_unref(reply);
+	purple_conversation_destroy(conv);
+
+	buddies = purple_find_buddies(account, NULL);
+	while (buddies != NULL) {
+		purple_blist_remove_buddy(buddies->data);
+		buddies = g_slist_delete_link(buddies, buddies);
+	}
+	purple_account_destroy(account);
+	client_free(client);
+}
+END_TEST
+
+#endif /* HAVE_DBUS */
+
+Suite *
+dbus_suite(void)
+{
+	Suite *s = suite_create("D-Bus Server");
+
+	TCase *tc = tcase_create("Session Bus");
+#ifdef HAVE_DBUS
+	tcase_add_test(tc, test_dbus_methods);
+	tcase_add_test(tc, test_dbus_signal_subscriptions);
+	tcase_add_test(tc, test_dbus_bulk_queries);
+#endif
+	suite_add_tcase(s, tc);
+
+	return s;
+}
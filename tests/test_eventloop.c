@@ -0,0 +1,350 @@
+#include <string.h>
+#include <unistd.h>
+
+#include "tests.h"
+#include "../eventloop.h"
+
+#define ACTIVE_TIMERS 100000
+
+/*
+ * Timers that write their name down when they go off, and go again until
+ * they've done so "repeats" times.
+ */
+typedef struct
+{
+	const char *name;
+	int repeats;
+	guint handle;
+} CheckTimer;
+
+static GString *fired;
+static int pending;
+
+static gboolean
+check_timer_cb(gpointer data)
+{
+	CheckTimer *timer = data;
+
+	g_string_append_printf(fired, "%s%s", fired->len ? " " : "", timer->name);
+
+	if (--timer->repeats > 0)
+		return TRUE;
+
+	timer->handle = 0;
+	pending--;
+	return FALSE;
+}
+
+static void
+add_check_timer(CheckTimer *timer, const char *name, guint interval, int repeats)
+{
+	timer->name = name;
+	timer->repeats = repeats;
+	timer->handle = purple_timeout_wheel_add(interval, check_timer_cb, timer);
+	fail_unless(timer->handle != 0);
+	pending++;
+}
+
+static void
+wait_for_timers(void)
+{
+	while (pending > 0)
+		g_main_context_iteration(NULL, TRUE);
+}
+
+START_TEST(test_eventloop_timer_wheel)
+{
+	CheckTimer a, b, c, d, e;
+
+	fired = g_string_new(NULL);
+	pending = 0;
+
+	/* Timers go off in order, however they were added */
+	add_check_timer(&c, "c", 120, 1);
+	add_check_timer(&a, "a", 10, 1);
+	add_check_timer(&b, "b", 45, 1);
+	add_check_timer(&d, "d", 30, 3);
+	wait_for_timers();
+	assert_string_equal("a d b d d c", fired->str);
+
+	/* A restarted timer goes off a whole interval later */
+	g_string_truncate(fired, 0);
+	add_check_timer(&a, "a", 150, 1);
+	add_check_timer(&b, "b", 250, 1);
+	g_usleep(100 * 1000);
+	fail_unless(purple_timeout_restart(a.handle));
+	wait_for_timers();
+	assert_string_equal("b a", fired->str);
+
+	/* A removed one never goes off, and can't be removed again */
+	g_string_truncate(fired, 0);
+	add_check_timer(&a, "a", 20, 1);
+	add_check_timer(&e, "e", 1, 1);
+	fail_unless(purple_timeout_remove(e.handle));
+	fail_if(purple_timeout_remove(e.handle));
+	fail_if(purple_timeout_restart(e.handle));
+	pending--;
+	wait_for_timers();
+	assert_string_equal("a", fired->str);
+
+	/* Timers a long way off don't go off early */
+	add_check_timer(&a, "a", 5000, 1);
+	add_check_timer(&c, "c", 10 * 60 * 1000, 1);
+	add_check_timer(&b, "b", 30, 1);
+	g_string_truncate(fired, 0);
+	while (pending > 2)
+		g_main_context_iteration(NULL, TRUE);
+	assert_string_equal("b", fired->str);
+	fail_unless(purple_timeout_remove(a.handle));
+	fail_unless(purple_timeout_remove(c.handle));
+	pending = 0;
+
+	g_string_free(fired, TRUE);
+}
+END_TEST
+
+START_TEST(test_eventloop_timer_wheel_routing)
+{
+	CheckTimer a, b;
+
+	fired = g_string_new(NULL);
+	pending = 0;
+
+	/* Timers of the UI's can't be restarted */
+	a.name = "a";
+	a.repeats = 1;
+	a.handle = purple_timeout_add(10, check_timer_cb, &a);
+	fail_if(purple_timeout_restart(a.handle));
+	pending++;
+
+	/* ...but once purple_timeout_add() uses the wheel, they can */
+	purple_eventloop_set_timer_wheel(TRUE);
+	fail_unless(purple_eventloop_get_timer_wheel());
+	b.name = "b";
+	b.repeats = 2;
+	b.handle = purple_timeout_add(30, check_timer_cb, &b);
+	fail_unless(purple_timeout_restart(b.handle));
+	pending++;
+	purple_eventloop_set_timer_wheel(FALSE);
+
+	wait_for_timers();
+	assert_string_equal("a b b", fired->str);
+
+	b.handle = purple_timeout_add_seconds(1, check_timer_cb, &b);
+	fail_if(purple_timeout_restart(b.handle));
+	fail_unless(purple_timeout_remove(b.handle));
+
+	g_string_free(fired, TRUE);
+}
+END_TEST
+
+static int expired;
+
+static gboolean
+count_expired_cb(gpointer data)
+{
+	expired++;
+	return FALSE;
+}
+
+static gboolean
+never_cb(gpointer data)
+{
+	return FALSE;
+}
+
+START_TEST(test_eventloop_timer_wheel_load)
+{
+	guint *handles = g_new(guint, ACTIVE_TIMERS);
+	GTimer *timer = g_timer_new();
+	double wheel_time, ui_time;
+	int i, j;
+
+	/* Idle timeouts like a connection each would have, pushed back ten times */
+	for (i = 0; i < ACTIVE_TIMERS; i++)
+		handles[i] = purple_timeout_wheel_add_seconds(60 + i % 600, never_cb, NULL);
+	for (j = 0; j < 10; j++)
+		for (i = 0; i < ACTIVE_TIMERS; i++)
+			fail_unless(purple_timeout_restart(handles[i]));
+	for (i = 0; i < ACTIVE_TIMERS; i++)
+		fail_unless(purple_timeout_remove(handles[i]));
+	wheel_time = g_timer_elapsed(timer, NULL);
+
+	/* The same, with a timeout of the UI's for each */
+	g_timer_start(timer);
+	for (i = 0; i < ACTIVE_TIMERS; i++)
+		handles[i] = purple_timeout_add_seconds(60 + i % 600, never_cb, NULL);
+	for (j = 0; j < 10; j++)
+		for (i = 0; i < ACTIVE_TIMERS; i++) {
+			fail_unless(purple_timeout_remove(handles[i]));
+			handles[i] = purple_timeout_add_seconds(60 + i % 600, never_cb, NULL);
+		}
+	for (i = 0; i < ACTIVE_TIMERS; i++)
+		fail_unless(purple_timeout_remove(handles[i]));
+	ui_time = g_timer_elapsed(timer, NULL);
+
+	check_report_timing("%d timers restarted 10 times took %.3f seconds "
+			"in the wheel and %.3f seconds as UI timeouts",
+			ACTIVE_TIMERS, wheel_time, ui_time);
+
+	/* They all go off, spread over a fifth of a second */
+	expired = 0;
+	g_timer_start(timer);
+	for (i = 0; i < ACTIVE_TIMERS; i++)
+		purple_timeout_wheel_add((i * 7919) % 200, count_expired_cb, NULL);
+	while (expired < ACTIVE_TIMERS)
+		g_main_context_iteration(NULL, TRUE);
+	assert_int_equal(ACTIVE_TIMERS, expired);
+
+	check_report_timing("%d timers going off took %.3f seconds",
+			ACTIVE_TIMERS, g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+	g_free(handles);
+}
+END_TEST
+
+static int inputs;
+
+static void
+read_input_cb(gpointer data, gint fd, PurpleInputCondition condition)
+{
+	char c;
+
+	fail_unless(read(fd, &c, 1) == 1);
+	inputs++;
+}
+
+static gboolean
+slow_timeout_cb(gpointer data)
+{
+	g_usleep(30 * 1000);
+	pending--;
+	return FALSE;
+}
+
+static gboolean
+quick_timeout_cb(gpointer data)
+{
+	int *repeats = data;
+
+	if (--*repeats > 0)
+		return TRUE;
+
+	pending--;
+	return FALSE;
+}
+
+static gboolean
+self_removing_cb(gpointer data)
+{
+	fail_unless(purple_timeout_remove(*(guint *)data));
+	pending--;
+	return TRUE;
+}
+
+static PurpleEventLoopCallbackStats *
+find_stats(gpointer function)
+{
+	GList *stats = purple_eventloop_get_callback_stats();
+	GList *l;
+
+	for (l = stats; l != NULL; l = l->next) {
+		PurpleEventLoopCallbackStats *found = l->data;
+
+		if (found->function == function) {
+			g_list_free(stats);
+			return found;
+		}
+	}
+
+	g_list_free(stats);
+	return NULL;
+}
+
+START_TEST(test_eventloop_instrumentation)
+{
+	PurpleEventLoopCallbackStats *stats;
+	GList *busiest;
+	int fds[2], repeats = 3;
+	guint input, handle;
+
+	purple_eventloop_set_instrumented(TRUE);
+	purple_eventloop_set_slow_threshold(20);
+	fail_unless(purple_eventloop_get_instrumented());
+	assert_int_equal(20, purple_eventloop_get_slow_threshold());
+
+	fail_unless(pipe(fds) == 0);
+	input = purple_input_add(fds[0], PURPLE_INPUT_READ, read_input_cb, NULL);
+	fail_unless(write(fds[1], "xy", 2) == 2);
+
+	pending = 3;
+	inputs = 0;
+	purple_timeout_add(10, slow_timeout_cb, NULL);
+	purple_timeout_wheel_add(5, quick_timeout_cb, &repeats);
+	handle = purple_timeout_add(1, self_removing_cb, &handle);
+	while (pending > 0 || inputs < 2)
+		g_main_context_iteration(NULL, TRUE);
+	fail_unless(purple_input_remove(input));
+
+	/* Every call is counted, and the slow one is picked out */
+	stats = find_stats(slow_timeout_cb);
+	fail_unless(stats != NULL);
+	fail_if(stats->input);
+	assert_int_equal(1, stats->calls);
+	assert_int_equal(1, stats->slow_calls);
+	fail_unless(stats->max_time >= 30000);
+	fail_unless(stats->total_time == stats->max_time);
+	assert_int_equal(1, stats->histogram[3]);
+
+	stats = find_stats(quick_timeout_cb);
+	fail_unless(stats != NULL);
+	assert_int_equal(3, stats->calls);
+	assert_int_equal(0, stats->slow_calls);
+
+	stats = find_stats(read_input_cb);
+	fail_unless(stats != NULL);
+	fail_unless(stats->input);
+	assert_int_equal(2, stats->calls);
+
+	assert_int_equal(1, find_stats(self_removing_cb)->calls);
+
+	busiest = purple_eventloop_get_callback_stats();
+	fail_unless(((PurpleEventLoopCallbackStats *)busiest->data)->function ==
+			(gpointer)slow_timeout_cb);
+	g_list_free(busiest);
+
+	/* Nothing is counted once it's off, and the counts can be reset */
+	purple_eventloop_set_instrumented(FALSE);
+	purple_eventloop_reset_callback_stats();
+	pending = 1;
+	purple_timeout_add(1, slow_timeout_cb, NULL);
+	while (pending > 0)
+		g_main_context_iteration(NULL, TRUE);
+	stats = find_stats(slow_timeout_cb);
+	assert_int_equal(0, stats->calls);
+	fail_unless(stats->max_time == 0);
+
+	purple_eventloop_set_slow_threshold(100);
+	close(fds[0]);
+	close(fds[1]);
+}
+END_TEST
+
+Suite *
+eventloop_suite(void)
+{
+	Suite *s = suite_create("Event Loop");
+
+	TCase *tc = tcase_create("Timer Wheel");
+	tcase_add_test(tc, test_eventloop_timer_wheel);
+	tcase_add_test(tc, test_eventloop_timer_wheel_routing);
+	tcase_add_test(tc, test_eventloop_timer_wheel_load);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Instrumentation");
+	tcase_add_test(tc, test_eventloop_instrumentation);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -181,6 +181,36 @@ START_TEST(test_jabber_normalize)
 }
 END_TEST
 
+START_TEST(test_jabber_id_intern)
+{
+	const JabberID *jid1, *jid2;
+	const char *normalized;
+
+	jid1 = jabber_id_intern("PaUL@DaRkRain42.org/Home");
+	fail_if(jid1 == NULL);
+	assert_string_equal("paul", jid1->node);
+	assert_string_equal("darkrain42.org", jid1->domain);
+	assert_string_equal("Home", jid1->resource);
+	assert_string_equal("paul@darkrain42.org", jabber_id_interned_get_bare_jid(jid1));
+	assert_string_equal("paul@darkrain42.org/Home", jabber_id_interned_get_full_jid(jid1));
+
+	/* The same string maps to the same interned JID */
+	jid2 = jabber_id_intern("PaUL@DaRkRain42.org/Home");
+	fail_unless(jid1 == jid2);
+	jabber_id_unref(jid2);
+	jabber_id_unref(jid1);
+
+	/* jabber_id_new() doesn't allow a trailing slash, normalize does */
+	fail_unless(NULL == jabber_id_intern("paul@darkrain42.org/"));
+	assert_string_equal("paul@darkrain42.org", jabber_normalize(NULL, "paul@darkrain42.org/"));
+
+	/* Results don't get overwritten by the next call */
+	normalized = jabber_normalize(NULL, "Foo@Example.com");
+	jabber_normalize(NULL, "Bar@Example.com");
+	assert_string_equal("foo@example.com", normalized);
+}
+END_TEST
+
 Suite *
 jabber_jutil_suite(void)
 {
@@ -203,5 +233,9 @@ jabber_jutil_suite(void)
 	tcase_add_test(tc, test_jabber_normalize);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("JID cache");
+	tcase_add_test(tc, test_jabber_id_intern);
+	suite_add_tcase(s, tc);
+
 	return s;
 }
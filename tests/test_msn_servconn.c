@@ -0,0 +1,245 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../account.h"
+#include "../protocols/msn/msn.h"
+#include "../protocols/msn/cmdproc.h"
+#include "../protocols/msn/servconn.h"
+#include "../protocols/msn/session.h"
+#include "../protocols/msn/table.h"
+
+#define CONTACTS 500
+#define REPLAYS 20
+
+/*
+ * What replaying NS traffic saw, kept in the cmdproc's data.
+ */
+typedef struct {
+	int presences;
+	int payloads;
+	int pings;
+	gsize payload_bytes;
+} ReplayCounts;
+
+/*
+ * The presence part of signing in to the NS, the way it comes off the
+ * wire: an ILN and a UBX with a payload for every contact online, and
+ * the odd QNG in between.
+ */
+static GString *
+captured_ns_traffic(int contacts)
+{
+	GString *traffic = g_string_new(NULL);
+	int i;
+
+	for (i = 0; i < contacts; i++) {
+		char *ubx = g_strdup_printf("<Data><PSM>Status message %d</PSM>"
+				"<CurrentMedia></CurrentMedia>"
+				"<MachineGuid>{F26D1F07-95E2-403C-BC18-D4BFED493428}</MachineGuid>"
+				"</Data>", i);
+
+		g_string_append_printf(traffic, "ILN 12 NLN contact%d@example.com 1 "
+				"Contact%%20%d 2789003324:48 %%3Cmsnobj%%2F%%3E\r\n", i, i);
+		g_string_append_printf(traffic, "UBX contact%d@example.com 1 %d\r\n%s",
+				i, (int)strlen(ubx), ubx);
+		if (i % 100 == 0)
+			g_string_append(traffic, "QNG 50\r\n");
+
+		g_free(ubx);
+	}
+
+	return traffic;
+}
+
+static void
+iln_cmd(MsnCmdProc *cmdproc, MsnCommand *cmd)
+{
+	ReplayCounts *counts = cmdproc->data;
+	char *passport = g_strdup_printf("contact%d@example.com", counts->presences);
+
+	assert_int_equal(12, cmd->trId);
+	assert_int_equal(7, cmd->param_count);
+	assert_string_equal("NLN", cmd->params[1]);
+	assert_string_equal(passport, cmd->params[2]);
+	g_free(passport);
+
+	counts->presences++;
+}
+
+static void
+ubx_cmd_post(MsnCmdProc *cmdproc, MsnCommand *cmd, char *payload, size_t len)
+{
+	ReplayCounts *counts = cmdproc->data;
+
+	fail_unless(len > 12);
+	fail_unless(strncmp(payload, "<Data>", 6) == 0);
+	fail_unless(strncmp(payload + len - 7, "</Data>", 7) == 0);
+
+	counts->payloads++;
+	counts->payload_bytes += len;
+}
+
+static void
+ubx_cmd(MsnCmdProc *cmdproc, MsnCommand *cmd)
+{
+	cmd->payload_cb = ubx_cmd_post;
+	cmd->payload_len = atoi(cmd->params[2]);
+}
+
+static void
+qng_cmd(MsnCmdProc *cmdproc, MsnCommand *cmd)
+{
+	ReplayCounts *counts = cmdproc->data;
+
+	assert_string_equal("50", cmd->params[0]);
+	counts->pings++;
+}
+
+/* Feeds traffic to servconn piece bytes at a time */
+static void
+replay(MsnServConn *servconn, GString *traffic, gsize piece)
+{
+	gsize i;
+
+	for (i = 0; i < traffic->len; i += piece)
+		fail_unless(msn_servconn_feed_data(servconn, traffic->str + i,
+				MIN(piece, traffic->len - i)) == servconn);
+
+	/* Nothing is left over once the last payload is in */
+	assert_int_equal(0, servconn->rx_len);
+	assert_int_equal(0, servconn->payload_len);
+}
+
+START_TEST(test_msn_servconn_replay)
+{
+	PurpleAccount *account = purple_account_new("replay@example.com", "prpl-msn");
+	MsnSession *session = msn_session_new(account);
+	MsnServConn *servconn = msn_servconn_new(session, MSN_SERVCONN_NS);
+	MsnTable *table = msn_table_new();
+	GString *traffic = captured_ns_traffic(CONTACTS);
+	ReplayCounts counts;
+	GTimer *timer;
+	gsize pieces[] = { 1, 2, 7, 64, 1460, 8192 };
+	int i;
+
+	msn_table_add_cmd(table, NULL, "ILN", iln_cmd);
+	msn_table_add_cmd(table, NULL, "UBX", ubx_cmd);
+	msn_table_add_cmd(table, NULL, "QNG", qng_cmd);
+	servconn->cmdproc->cbs_table = table;
+	servconn->cmdproc->data = &counts;
+	servconn->connected = TRUE;
+
+	/* However the traffic is split up, the same commands come out */
+	for (i = 0; i < G_N_ELEMENTS(pieces); i++) {
+		memset(&counts, 0, sizeof(counts));
+		replay(servconn, traffic, pieces[i]);
+		assert_int_equal(CONTACTS, counts.presences);
+		assert_int_equal(CONTACTS, counts.payloads);
+		assert_int_equal((CONTACTS + 99) / 100, counts.pings);
+	}
+
+	/* Then how long getting through it a packet at a time takes */
+	timer = g_timer_new();
+	for (i = 0; i < REPLAYS; i++) {
+		memset(&counts, 0, sizeof(counts));
+		replay(servconn, traffic, 1460);
+	}
+	g_timer_stop(timer);
+
+	check_report_timing("Replayed %" G_GSIZE_FORMAT " bytes of NS traffic "
+			"%d times in %.3f seconds", traffic->len, REPLAYS,
+			g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+	g_string_free(traffic, TRUE);
+
+	servconn->connected = FALSE;
+	msn_servconn_destroy(servconn);
+	msn_table_destroy(table);
+	msn_session_destroy(session);
+	purple_account_destroy(account);
+}
+END_TEST
+
+START_TEST(test_msn_servconn_binary_payload)
+{
+	PurpleAccount *account = purple_account_new("replay@example.com", "prpl-msn");
+	MsnSession *session = msn_session_new(account);
+	MsnServConn *servconn = msn_servconn_new(session, MSN_SERVCONN_NS);
+	MsnTable *table = msn_table_new();
+	ReplayCounts counts;
+	/* A payload with a NUL and a bare \n in it, then a command */
+	const char data[] = "UBX a@example.com 1 15\r\n<Data>\0\n</Data>QNG 50\r\n";
+
+	msn_table_add_cmd(table, NULL, "UBX", ubx_cmd);
+	msn_table_add_cmd(table, NULL, "QNG", qng_cmd);
+	servconn->cmdproc->cbs_table = table;
+	servconn->cmdproc->data = &counts;
+	servconn->connected = TRUE;
+
+	memset(&counts, 0, sizeof(counts));
+	msn_servconn_feed_data(servconn, data, sizeof(data) - 1);
+	assert_int_equal(1, counts.payloads);
+	assert_int_equal(15, counts.payload_bytes);
+	assert_int_equal(1, counts.pings);
+	assert_int_equal(0, servconn->rx_len);
+
+	/* A line only ends at \r\n */
+	msn_servconn_feed_data(servconn, "CHG 5\n", 6);
+	assert_int_equal(6, servconn->rx_len);
+	msn_servconn_feed_data(servconn, "\r\n", 2);
+	assert_string_equal("CHG", servconn->cmdproc->last_cmd->command);
+	assert_string_equal("5\n", servconn->cmdproc->last_cmd->params[0]);
+	assert_int_equal(0, servconn->rx_len);
+
+	servconn->connected = FALSE;
+	msn_servconn_destroy(servconn);
+	msn_table_destroy(table);
+	msn_session_destroy(session);
+	purple_account_destroy(account);
+}
+END_TEST
+
+START_TEST(test_msn_command_params)
+{
+	MsnCommand *cmd;
+
+	cmd = msn_command_from_string("ILN 12 NLN a@example.com 1");
+	assert_string_equal("ILN", cmd->command);
+	assert_int_equal(12, cmd->trId);
+	assert_int_equal(4, cmd->param_count);
+	assert_string_equal("12", cmd->params[0]);
+	assert_string_equal("1", cmd->params[3]);
+	fail_unless(cmd->params[4] == NULL);
+	msn_command_unref(cmd);
+
+	/* Like g_strsplit_set, but the count stops at the first empty one */
+	cmd = msn_command_from_string("CHL 0  abc ");
+	assert_int_equal(1, cmd->param_count);
+	assert_string_equal("", cmd->params[1]);
+	assert_string_equal("abc", cmd->params[2]);
+	assert_string_equal("", cmd->params[3]);
+	fail_unless(cmd->params[4] == NULL);
+	msn_command_unref(cmd);
+
+	cmd = msn_command_from_string("OUT");
+	assert_string_equal("OUT", cmd->command);
+	fail_unless(cmd->params == NULL);
+	assert_int_equal(0, cmd->param_count);
+	msn_command_unref(cmd);
+}
+END_TEST
+
+Suite *
+msn_servconn_suite(void)
+{
+	Suite *s = suite_create("MSN Server Connection");
+
+	TCase *tc = tcase_create("Receiving");
+	tcase_add_test(tc, test_msn_command_params);
+	tcase_add_test(tc, test_msn_servconn_replay);
+	tcase_add_test(tc, test_msn_servconn_binary_payload);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,548 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tests.h"
+#include "../account.h"
+#include "../eventloop.h"
+#include "../sslconn.h"
+#include "../protocols/msn/msn.h"
+#include "../protocols/msn/session.h"
+#include "../protocols/msn/soap.h"
+
+#define REQUESTS 8
+#define CONTACTS 2000
+
+/*
+ * "SSL" that is really just the plain socket, so the SOAP code can talk
+ * to the fake endpoint below.  It remembers the last connection that sent
+ * drop_action, so the endpoint can make that connection fail.
+ */
+static const char *drop_action;
+static PurpleSslConnection *drop_gsc;
+
+static gboolean
+fake_ssl_init(void)
+{
+	return TRUE;
+}
+
+static void
+fake_ssl_uninit(void)
+{
+}
+
+static void
+fake_ssl_connect(PurpleSslConnection *gsc)
+{
+	fcntl(gsc->fd, F_SETFL, fcntl(gsc->fd, F_GETFL) | O_NONBLOCK);
+	gsc->connect_cb(gsc->connect_cb_data, gsc, PURPLE_INPUT_READ);
+}
+
+static void
+fake_ssl_close(PurpleSslConnection *gsc)
+{
+}
+
+static size_t
+fake_ssl_read(PurpleSslConnection *gsc, void *data, size_t len)
+{
+	return read(gsc->fd, data, len);
+}
+
+static size_t
+fake_ssl_write(PurpleSslConnection *gsc, const void *data, size_t len)
+{
+	if (drop_action != NULL) {
+		char *header = g_strdup_printf("\nSOAPAction: %s\r", drop_action);
+
+		if (g_strstr_len(data, len, header) != NULL)
+			drop_gsc = gsc;
+		g_free(header);
+	}
+
+	return write(gsc->fd, data, len);
+}
+
+/* Fails the connection the way sslconn does when the SSL layer gives up */
+static gboolean
+fake_ssl_drop(gpointer data)
+{
+	PurpleSslConnection *gsc = drop_gsc;
+
+	drop_gsc = NULL;
+	fail_unless(gsc != NULL);
+	gsc->error_cb(gsc, PURPLE_SSL_CONNECT_FAILED, gsc->connect_cb_data);
+	purple_ssl_close(gsc);
+
+	return FALSE;
+}
+
+static PurpleSslOps fake_ssl_ops = {
+	fake_ssl_init,
+	fake_ssl_uninit,
+	fake_ssl_connect,
+	fake_ssl_close,
+	fake_ssl_read,
+	fake_ssl_write,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+/*
+ * A fake SOAP endpoint on 127.0.0.1.  It answers every request with the
+ * SOAPAction it was sent, so each response can be checked against the
+ * request it belongs to.  The answer to slow_action is held back for a
+ * while, the first "drops" requests for drop_action fail the connection
+ * they came on instead, and every answer can be padded with contacts.
+ */
+typedef struct {
+	int listener;
+	guint inpa;
+	char *host;
+	GSList *clients;
+	int connections;
+	const char *slow_action;
+	int drops;
+	int contacts;
+} FakeSoapServer;
+
+typedef struct {
+	FakeSoapServer *server;
+	int fd;
+	guint read_inpa;
+	guint write_inpa;
+	guint timeout;
+	GString *in;
+	GString *out;
+} FakeSoapClient;
+
+static void client_write_cb(gpointer data, gint source, PurpleInputCondition cond);
+
+static gboolean
+client_send(gpointer data)
+{
+	FakeSoapClient *client = data;
+
+	client->timeout = 0;
+	if (client->write_inpa == 0 && client->out->len > 0)
+		client->write_inpa = purple_input_add(client->fd, PURPLE_INPUT_WRITE,
+				client_write_cb, client);
+
+	return FALSE;
+}
+
+static void
+client_write_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	FakeSoapClient *client = data;
+	int len;
+
+	/* A bit at a time, so that big responses arrive in many reads */
+	len = write(client->fd, client->out->str, MIN(client->out->len, 16 * 1024));
+	if (len > 0)
+		g_string_erase(client->out, 0, len);
+
+	if (client->out->len == 0 || (len < 0 && errno != EAGAIN)) {
+		purple_input_remove(client->write_inpa);
+		client->write_inpa = 0;
+	}
+}
+
+static void
+client_answer(FakeSoapClient *client, const char *action)
+{
+	GString *body = g_string_new("<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+			"<soap:Envelope xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\">"
+			"<soap:Body><EchoResponse><Action>");
+	int i;
+
+	if (client->server->drops > 0 && g_str_equal(action, drop_action)) {
+		client->server->drops--;
+		purple_timeout_add(0, fake_ssl_drop, NULL);
+		g_string_free(body, TRUE);
+		return;
+	}
+
+	g_string_append(body, action);
+	g_string_append(body, "</Action>");
+	for (i = 0; i < client->server->contacts; i++)
+		g_string_append_printf(body, "<Contact><Id>%d</Id></Contact>", i);
+	g_string_append(body, "</EchoResponse></soap:Body></soap:Envelope>");
+
+	g_string_append_printf(client->out, "HTTP/1.1 200 OK\r\n"
+			"Content-Type: text/xml; charset=utf-8\r\n"
+			"Content-Length: %" G_GSIZE_FORMAT "\r\n"
+			"\r\n", body->len);
+	g_string_append_len(client->out, body->str, body->len);
+	g_string_free(body, TRUE);
+
+	if (client->server->slow_action &&
+			g_str_equal(action, client->server->slow_action))
+		client->timeout = purple_timeout_add(100, client_send, client);
+	else if (client->timeout == 0)
+		client_send(client);
+}
+
+static void
+client_read_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	FakeSoapClient *client = data;
+	char buf[4096];
+	int len;
+
+	while ((len = read(client->fd, buf, sizeof(buf))) > 0)
+		g_string_append_len(client->in, buf, len);
+
+	if (len == 0) {
+		purple_input_remove(client->read_inpa);
+		client->read_inpa = 0;
+	}
+
+	/* Answer every complete request */
+	while (TRUE) {
+		char *end = strstr(client->in->str, "\r\n\r\n");
+		char *header, *action;
+		gsize body_len = 0, request_len;
+
+		if (end == NULL)
+			break;
+
+		header = strstr(client->in->str, "\nContent-Length: ");
+		if (header != NULL && header < end)
+			sscanf(header + 17, "%" G_GSIZE_FORMAT, &body_len);
+		request_len = end + 4 - client->in->str + body_len;
+		if (client->in->len < request_len)
+			break;
+
+		header = strstr(client->in->str, "\nSOAPAction: ");
+		fail_unless(header != NULL && header < end);
+		action = g_strndup(header + 13, strcspn(header + 13, "\r"));
+		client_answer(client, action);
+		g_free(action);
+
+		g_string_erase(client->in, 0, request_len);
+	}
+}
+
+static void
+server_accept_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	FakeSoapServer *server = data;
+	FakeSoapClient *client;
+	int fd;
+
+	fd = accept(server->listener, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	client = g_new0(FakeSoapClient, 1);
+	client->server = server;
+	client->fd = fd;
+	client->in = g_string_new(NULL);
+	client->out = g_string_new(NULL);
+	client->read_inpa = purple_input_add(fd, PURPLE_INPUT_READ,
+			client_read_cb, client);
+
+	server->clients = g_slist_prepend(server->clients, client);
+	server->connections++;
+}
+
+static FakeSoapServer *
+fake_soap_server_new(void)
+{
+	FakeSoapServer *server = g_new0(FakeSoapServer, 1);
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+
+	/* Don't die if a connection goes away while we're writing to it */
+	signal(SIGPIPE, SIG_IGN);
+
+	server->listener = socket(AF_INET, SOCK_STREAM, 0);
+	fail_unless(server->listener >= 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	fail_unless(bind(server->listener, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	fail_unless(listen(server->listener, REQUESTS) == 0);
+	fail_unless(getsockname(server->listener, (struct sockaddr *)&addr, &addrlen) == 0);
+
+	server->host = g_strdup_printf("127.0.0.1:%d", ntohs(addr.sin_port));
+	server->inpa = purple_input_add(server->listener, PURPLE_INPUT_READ,
+			server_accept_cb, server);
+
+	return server;
+}
+
+static void
+fake_soap_server_free(FakeSoapServer *server)
+{
+	while (server->clients) {
+		FakeSoapClient *client = server->clients->data;
+
+		if (client->read_inpa)
+			purple_input_remove(client->read_inpa);
+		if (client->write_inpa)
+			purple_input_remove(client->write_inpa);
+		if (client->timeout)
+			purple_timeout_remove(client->timeout);
+		close(client->fd);
+		g_string_free(client->in, TRUE);
+		g_string_free(client->out, TRUE);
+		g_free(client);
+
+		server->clients = g_slist_delete_link(server->clients, server->clients);
+	}
+
+	purple_input_remove(server->inpa);
+	close(server->listener);
+	g_free(server->host);
+	g_free(server);
+}
+
+/*
+ * What the requests sent during a test got back.
+ */
+typedef struct {
+	GMainLoop *loop;
+	guint timeout;
+	int outstanding;
+	int mismatched;
+	int contacts;
+	GString *answered;
+} SoapTest;
+
+static gboolean
+soap_test_timeout(gpointer data)
+{
+	SoapTest *test = data;
+
+	test->timeout = 0;
+	g_main_loop_quit(test->loop);
+
+	return FALSE;
+}
+
+static void
+soap_test_cb(MsnSoapMessage *request, MsnSoapMessage *response, gpointer data)
+{
+	SoapTest *test = data;
+	xmlnode *echo = NULL;
+	xmlnode *node;
+	char *action = NULL;
+
+	if (response != NULL)
+		echo = xmlnode_get_child(response->xml, "Body/EchoResponse");
+	if (echo != NULL)
+		action = xmlnode_get_data(xmlnode_get_child(echo, "Action"));
+
+	if (action == NULL || !g_str_equal(action, request->action))
+		test->mismatched++;
+	else
+		g_string_append_printf(test->answered, "%s ", action);
+	g_free(action);
+
+	if (echo != NULL) {
+		for (node = xmlnode_get_child(echo, "Contact"); node;
+				node = xmlnode_get_next_twin(node))
+			test->contacts++;
+	}
+
+	if (--test->outstanding == 0)
+		g_main_loop_quit(test->loop);
+}
+
+static void
+soap_test_send(SoapTest *test, MsnSession *session, FakeSoapServer *server,
+               const char *action)
+{
+	xmlnode *xml = xmlnode_new("Envelope");
+
+	xmlnode_new_child(xml, "Body");
+	test->outstanding++;
+	msn_soap_message_send(session, msn_soap_message_new(action, xml),
+			server->host, "/abservice/abservice.asmx", FALSE,
+			soap_test_cb, test);
+}
+
+static void
+soap_test_run(SoapTest *test)
+{
+	test->timeout = purple_timeout_add(3000, soap_test_timeout, test);
+	g_main_loop_run(test->loop);
+	if (test->timeout)
+		purple_timeout_remove(test->timeout);
+}
+
+static MsnSession *
+soap_test_session_new(void)
+{
+	purple_ssl_set_ops(&fake_ssl_ops);
+	if (!purple_ssl_is_supported())
+		return NULL;
+
+	return msn_session_new(purple_account_new("soap@example.com", "prpl-msn"));
+}
+
+static void
+soap_test_session_free(MsnSession *session)
+{
+	PurpleAccount *account = session->account;
+
+	msn_session_destroy(session);
+	purple_account_destroy(account);
+}
+
+START_TEST(test_msn_soap_requests)
+{
+	FakeSoapServer *server;
+	MsnSession *session = soap_test_session_new();
+	SoapTest test;
+	int i;
+
+	/* Nothing to test against without SSL support built in */
+	if (session == NULL)
+		return;
+
+	server = fake_soap_server_new();
+	memset(&test, 0, sizeof(test));
+	test.loop = g_main_loop_new(NULL, FALSE);
+	test.answered = g_string_new(NULL);
+
+	/* Action0 is answered last even though it was sent first */
+	server->slow_action = "Action0";
+	for (i = 0; i < REQUESTS; i++) {
+		char *action = g_strdup_printf("Action%d", i);
+		soap_test_send(&test, session, server, action);
+		g_free(action);
+	}
+	soap_test_run(&test);
+
+	assert_int_equal(0, test.outstanding);
+	assert_int_equal(0, test.mismatched);
+	fail_unless(g_str_has_suffix(test.answered->str, "Action0 "),
+			"answered %s", test.answered->str);
+	fail_unless(server->connections > 1);
+	fail_unless(server->connections <= REQUESTS);
+
+	/* The connections are kept open for the next requests */
+	i = server->connections;
+	soap_test_send(&test, session, server, "Again");
+	soap_test_run(&test);
+	assert_int_equal(0, test.mismatched);
+	assert_int_equal(i, server->connections);
+
+	soap_test_session_free(session);
+	fake_soap_server_free(server);
+	g_string_free(test.answered, TRUE);
+	g_main_loop_unref(test.loop);
+}
+END_TEST
+
+START_TEST(test_msn_soap_connection_error)
+{
+	FakeSoapServer *server;
+	MsnSession *session = soap_test_session_new();
+	SoapTest test;
+	int i;
+
+	if (session == NULL)
+		return;
+
+	server = fake_soap_server_new();
+	memset(&test, 0, sizeof(test));
+	test.loop = g_main_loop_new(NULL, FALSE);
+	test.answered = g_string_new(NULL);
+
+	/* Open a few connections to the host */
+	server->slow_action = "Action0";
+	for (i = 0; i < REQUESTS; i++) {
+		char *action = g_strdup_printf("Action%d", i);
+		soap_test_send(&test, session, server, action);
+		g_free(action);
+	}
+	soap_test_run(&test);
+	fail_unless(server->connections > 1);
+
+	/* A request whose connection fails once it was sent isn't sent again,
+	 * since the server may have acted on it */
+	g_string_truncate(test.answered, 0);
+	drop_action = "Drop";
+	server->drops = 1;
+	soap_test_send(&test, session, server, "Drop");
+	soap_test_run(&test);
+	assert_int_equal(0, server->drops);
+	assert_int_equal(0, test.outstanding);
+	assert_int_equal(1, test.mismatched);
+	assert_string_equal("", test.answered->str);
+	drop_action = NULL;
+
+	/* The other connections carry on */
+	soap_test_send(&test, session, server, "After");
+	soap_test_run(&test);
+	assert_int_equal(0, test.outstanding);
+	assert_int_equal(1, test.mismatched);
+	assert_string_equal("After ", test.answered->str);
+
+	soap_test_session_free(session);
+	fake_soap_server_free(server);
+	g_string_free(test.answered, TRUE);
+	g_main_loop_unref(test.loop);
+}
+END_TEST
+
+/* A response that arrives over many reads is put back together */
+START_TEST(test_msn_soap_large_response)
+{
+	FakeSoapServer *server;
+	MsnSession *session = soap_test_session_new();
+	SoapTest test;
+
+	if (session == NULL)
+		return;
+
+	server = fake_soap_server_new();
+	memset(&test, 0, sizeof(test));
+	test.loop = g_main_loop_new(NULL, FALSE);
+	test.answered = g_string_new(NULL);
+
+	server->contacts = CONTACTS;
+	soap_test_send(&test, session, server, "ABFindAll");
+	soap_test_run(&test);
+
+	assert_int_equal(0, test.outstanding);
+	assert_int_equal(0, test.mismatched);
+	assert_int_equal(CONTACTS, test.contacts);
+
+	soap_test_session_free(session);
+	fake_soap_server_free(server);
+	g_string_free(test.answered, TRUE);
+	g_main_loop_unref(test.loop);
+}
+END_TEST
+
+Suite *
+msn_soap_suite(void)
+{
+	Suite *s = suite_create("MSN SOAP");
+
+	TCase *tc = tcase_create("Fake endpoint");
+	tcase_add_test(tc, test_msn_soap_requests);
+	tcase_add_test(tc, test_msn_soap_connection_error);
+	tcase_add_test(tc, test_msn_soap_large_response);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
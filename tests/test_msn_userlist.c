@@ -0,0 +1,126 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../protocols/msn/msn.h"
+#include "../protocols/msn/user.h"
+#include "../protocols/msn/userlist.h"
+
+#define CONTACTS 200
+
+/*
+ * Merge a synthetic address book the way the contact code does: look each
+ * contact up by passport, add the ones we don't know, then fill in their
+ * uid and mobile phone.
+ */
+static void
+load_address_book(MsnUserList *userlist, int contacts)
+{
+	int i;
+
+	for (i = 0; i < contacts; i++) {
+		char *passport = g_strdup_printf("Contact%04d@Example.com", i);
+		char *uid = g_strdup_printf("%08X-0000-0000-0000-%012X", i, i);
+		char *phone = g_strdup_printf("+1555%07d", i);
+		MsnUser *user;
+
+		user = msn_userlist_find_user(userlist, passport);
+		if (user == NULL) {
+			user = msn_user_new(userlist, passport, NULL);
+			msn_userlist_add_user(userlist, user);
+			msn_user_unref(user);
+		}
+		msn_user_set_uid(user, uid);
+		msn_user_set_mobile_phone(user, phone);
+
+		g_free(passport);
+		g_free(uid);
+		g_free(phone);
+	}
+}
+
+START_TEST(test_msn_userlist_find)
+{
+	MsnUserList *userlist = msn_userlist_new(NULL);
+	MsnUser *user, *other;
+
+	load_address_book(userlist, 10);
+
+	user = msn_userlist_find_user(userlist, "contact0003@example.COM");
+	fail_unless(user != NULL);
+	assert_string_equal("Contact0003@Example.com", msn_user_get_passport(user));
+	fail_unless(user == msn_userlist_find_user_with_id(userlist, "00000003-0000-0000-0000-000000000003"));
+	fail_unless(user == msn_userlist_find_user_with_mobile_phone(userlist, "+15550000003"));
+	fail_unless(NULL == msn_userlist_find_user(userlist, "contact0010@example.com"));
+
+	/* Changing a key moves the user in the index */
+	msn_user_set_passport(user, "renamed@example.com");
+	msn_user_set_uid(user, "NEW-UID");
+	msn_user_set_mobile_phone(user, NULL);
+	fail_unless(NULL == msn_userlist_find_user(userlist, "contact0003@example.com"));
+	fail_unless(user == msn_userlist_find_user(userlist, "RENAMED@example.com"));
+	fail_unless(NULL == msn_userlist_find_user_with_id(userlist, "00000003-0000-0000-0000-000000000003"));
+	fail_unless(user == msn_userlist_find_user_with_id(userlist, "new-uid"));
+	fail_unless(NULL == msn_userlist_find_user_with_mobile_phone(userlist, "+15550000003"));
+
+	/* Users not on the list are never found */
+	other = msn_user_new(userlist, "contact0004@example.com", NULL);
+	msn_user_set_uid(other, "NEW-UID");
+	fail_unless(msn_userlist_find_user(userlist, "contact0004@example.com") != other);
+	fail_unless(user == msn_userlist_find_user_with_id(userlist, "new-uid"));
+
+	/* With a duplicate the newest wins, and the older one takes over again */
+	msn_userlist_add_user(userlist, other);
+	fail_unless(other == msn_userlist_find_user_with_id(userlist, "new-uid"));
+	msn_userlist_remove_user(userlist, other);
+	fail_unless(user == msn_userlist_find_user_with_id(userlist, "new-uid"));
+	fail_unless(msn_userlist_find_user(userlist, "contact0004@example.com") != NULL);
+	msn_user_unref(other);
+
+	msn_userlist_remove_user(userlist, user);
+	fail_unless(NULL == msn_userlist_find_user(userlist, "renamed@example.com"));
+	fail_unless(NULL == msn_userlist_find_user_with_id(userlist, "new-uid"));
+
+	msn_userlist_destroy(userlist);
+}
+END_TEST
+
+/* Every contact of an address book can be found by passport and uid */
+START_TEST(test_msn_userlist_address_book)
+{
+	MsnUserList *userlist = msn_userlist_new(NULL);
+	int i;
+
+	load_address_book(userlist, CONTACTS);
+	/* Signing in again merges the same address book */
+	load_address_book(userlist, CONTACTS);
+	assert_int_equal(CONTACTS, g_list_length(userlist->users));
+
+	for (i = 0; i < CONTACTS; i++) {
+		char *passport = g_strdup_printf("CONTACT%04d@EXAMPLE.COM", i);
+		char *uid = g_strdup_printf("%08x-0000-0000-0000-%012x", i, i);
+		MsnUser *user = msn_userlist_find_user(userlist, passport);
+
+		fail_unless(user != NULL);
+		fail_unless(user == msn_userlist_find_user_with_id(userlist, uid));
+		g_free(passport);
+		g_free(uid);
+	}
+
+	msn_userlist_destroy(userlist);
+}
+END_TEST
+
+Suite *msn_userlist_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("MSN User List");
+
+	tc = tcase_create("Lookups");
+	tcase_add_test(tc, test_msn_userlist_find);
+	tcase_add_test(tc, test_msn_userlist_address_book);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,233 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../protocols/oscar/oscar.h"
+
+static void
+free_list(struct aim_ssi_item **list)
+{
+	while (*list != NULL)
+		aim_ssi_itemlist_del(list, *list);
+}
+
+/* Returns the differences as "<action>:<gid>.<bid>," and frees them */
+static gchar *
+diff_to_string(struct aim_ssi_tmp *diff)
+{
+	GString *str = g_string_new(NULL);
+
+	while (diff != NULL) {
+		struct aim_ssi_tmp *next = diff->next;
+		const char *action;
+
+		if (diff->action == SNAC_SUBTYPE_FEEDBAG_DEL)
+			action = "del";
+		else if (diff->action == SNAC_SUBTYPE_FEEDBAG_ADD)
+			action = "add";
+		else
+			action = "mod";
+		g_string_append_printf(str, "%s:%hu.%hu,", action,
+				diff->item->gid, diff->item->bid);
+
+		g_free(diff);
+		diff = next;
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+/*
+ * A master group, then "Group <n>" with gid n, each holding buddies
+ * named "Buddy <gid>-<bid>" with an alias.
+ */
+static void
+build_list(struct aim_ssi_item **list, int groups, int buddies)
+{
+	int gid, bid;
+
+	aim_ssi_itemlist_add(list, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+	for (gid = 1; gid <= groups; gid++) {
+		char *name = g_strdup_printf("Group %d", gid);
+		aim_ssi_itemlist_add(list, name, gid, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+		g_free(name);
+
+		for (bid = 1; bid <= buddies; bid++) {
+			GSList *data = NULL;
+
+			name = g_strdup_printf("Alias %d-%d", gid, bid);
+			aim_tlvlist_add_str(&data, 0x0131, name);
+			g_free(name);
+
+			name = g_strdup_printf("Buddy %d-%d", gid, bid);
+			aim_ssi_itemlist_add(list, name, gid, bid, AIM_SSI_TYPE_BUDDY, data);
+			g_free(name);
+			aim_tlvlist_free(data);
+		}
+	}
+}
+
+static void
+copy_list(struct aim_ssi_item **dst, struct aim_ssi_item *src)
+{
+	for (; src != NULL; src = src->next)
+		aim_ssi_itemlist_add(dst, src->name, src->gid, src->bid, src->type, src->data);
+}
+
+START_TEST(test_oscar_feedbag_finditem)
+{
+	OscarData od;
+	struct aim_ssi_item *list = NULL, *buddy1, *buddy2, *permit, *pdinfo;
+
+	aim_ssi_itemlist_add(&list, NULL, 0x0000, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+	aim_ssi_itemlist_add(&list, "Buddies", 0x0001, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+	aim_ssi_itemlist_add(&list, "Work", 0x0002, 0x0000, AIM_SSI_TYPE_GROUP, NULL);
+	buddy2 = aim_ssi_itemlist_add(&list, "somebody", 0x0002, 0xFFFF, AIM_SSI_TYPE_BUDDY, NULL);
+	buddy1 = aim_ssi_itemlist_add(&list, "Some Body", 0x0001, 0xFFFF, AIM_SSI_TYPE_BUDDY, NULL);
+	permit = aim_ssi_itemlist_add(&list, "SomeBody", 0x0000, 0xFFFF, AIM_SSI_TYPE_PERMIT, NULL);
+	pdinfo = aim_ssi_itemlist_add(&list, NULL, 0x0000, 0xFFFF, AIM_SSI_TYPE_PDINFO, NULL);
+
+	/* Picked IDs must not collide with anything already there */
+	assert_int_equal(0x0001, buddy2->bid);
+	assert_int_equal(0x0001, buddy1->bid);
+	fail_unless(permit->bid > 0x0002);
+	fail_unless(pdinfo->bid > permit->bid);
+
+	fail_unless(buddy1 == aim_ssi_itemlist_find(list, 0x0001, 0x0001));
+	fail_unless(buddy2 == aim_ssi_itemlist_find(list, 0x0002, 0x0001));
+	fail_unless(NULL == aim_ssi_itemlist_find(list, 0x0003, 0x0001));
+
+	fail_unless(buddy1 == aim_ssi_itemlist_finditem(list, "buddies", "SOMEBODY", AIM_SSI_TYPE_BUDDY));
+	fail_unless(buddy2 == aim_ssi_itemlist_finditem(list, " W o r k", "some body", AIM_SSI_TYPE_BUDDY));
+	fail_unless(NULL == aim_ssi_itemlist_finditem(list, "Friends", "somebody", AIM_SSI_TYPE_BUDDY));
+	fail_unless(aim_ssi_itemlist_find(list, 0x0002, 0x0000) == aim_ssi_itemlist_finditem(list, "work", NULL, AIM_SSI_TYPE_GROUP));
+	fail_unless(permit == aim_ssi_itemlist_finditem(list, NULL, "some body", AIM_SSI_TYPE_PERMIT));
+	fail_unless(NULL == aim_ssi_itemlist_finditem(list, NULL, "some body", AIM_SSI_TYPE_DENY));
+	fail_unless(pdinfo == aim_ssi_itemlist_finditem(list, NULL, NULL, AIM_SSI_TYPE_PDINFO));
+
+	/* The buddy in the group with the lower ID wins, like the list order */
+	fail_unless(buddy1 == aim_ssi_itemlist_exists(list, "SOME BODY"));
+	assert_string_equal("Buddies", aim_ssi_itemlist_findparentname(list, "somebody"));
+
+	aim_ssi_itemlist_del(&list, buddy1);
+	fail_unless(buddy2 == aim_ssi_itemlist_exists(list, "SOME BODY"));
+	assert_string_equal("Work", aim_ssi_itemlist_findparentname(list, "somebody"));
+	fail_unless(NULL == aim_ssi_itemlist_find(list, 0x0001, 0x0001));
+
+	/* Renaming has to move the group in the name index */
+	memset(&od, 0, sizeof(od));
+	od.ssi.local = list;
+	od.ssi.waiting_for_ack = TRUE;
+	assert_int_equal(0, aim_ssi_rename_group(&od, "WORK", "Office"));
+	fail_unless(NULL == aim_ssi_itemlist_finditem(list, "Work", NULL, AIM_SSI_TYPE_GROUP));
+	fail_unless(buddy2 == aim_ssi_itemlist_finditem(list, "office", "somebody", AIM_SSI_TYPE_BUDDY));
+
+	free_list(&list);
+}
+END_TEST
+
+START_TEST(test_oscar_feedbag_diff)
+{
+	struct aim_ssi_item *official = NULL, *local = NULL, *item;
+	int i;
+
+	build_list(&official, 10, 100);
+	copy_list(&local, official);
+	fail_unless(NULL == aim_ssi_itemlist_diff(official, local, 15));
+
+	aim_ssi_itemlist_del(&local, aim_ssi_itemlist_find(local, 3, 50));
+	aim_ssi_itemlist_del(&local, aim_ssi_itemlist_find(local, 1, 1));
+	aim_ssi_itemlist_del(&local, aim_ssi_itemlist_find(local, 10, 100));
+	aim_ssi_itemlist_add(&local, "New Buddy", 4, 0xFFFF, AIM_SSI_TYPE_BUDDY, NULL);
+	aim_ssi_itemlist_add(&local, "New Permit", 0, 0xFFFF, AIM_SSI_TYPE_PERMIT, NULL);
+	item = aim_ssi_itemlist_find(local, 7, 7);
+	aim_tlvlist_replace_str(&item->data, 0x0131, "Changed");
+	item = aim_ssi_itemlist_find(local, 2, 0);
+	aim_ssi_itemlist_del(&local, item);
+	aim_ssi_itemlist_add(&local, "Group Two", 2, 0, AIM_SSI_TYPE_GROUP, NULL);
+
+	/* Deletions go first, then additions, then modifications */
+	assert_string_equal_free("del:1.1,del:3.50,del:10.100,",
+			diff_to_string(aim_ssi_itemlist_diff(official, local, 15)));
+	aim_ssi_itemlist_del(&official, aim_ssi_itemlist_find(official, 1, 1));
+	aim_ssi_itemlist_del(&official, aim_ssi_itemlist_find(official, 3, 50));
+	aim_ssi_itemlist_del(&official, aim_ssi_itemlist_find(official, 10, 100));
+
+	assert_string_equal_free("add:0.102,add:4.101,",
+			diff_to_string(aim_ssi_itemlist_diff(official, local, 15)));
+	aim_ssi_itemlist_add(&official, "New Permit", 0, 102, AIM_SSI_TYPE_PERMIT, NULL);
+	aim_ssi_itemlist_add(&official, "New Buddy", 4, 101, AIM_SSI_TYPE_BUDDY, NULL);
+
+	assert_string_equal_free("mod:2.0,mod:7.7,",
+			diff_to_string(aim_ssi_itemlist_diff(official, local, 15)));
+	aim_ssi_itemlist_del(&official, aim_ssi_itemlist_find(official, 2, 0));
+	aim_ssi_itemlist_add(&official, "Group Two", 2, 0, AIM_SSI_TYPE_GROUP, NULL);
+	item = aim_ssi_itemlist_find(official, 7, 7);
+	aim_tlvlist_replace_str(&item->data, 0x0131, "Changed");
+
+	fail_unless(NULL == aim_ssi_itemlist_diff(official, local, 15));
+
+	/* No more than max differences at a time */
+	for (i = 1; i <= 20; i++)
+		aim_ssi_itemlist_del(&local, aim_ssi_itemlist_find(local, 5, i));
+	assert_string_equal_free("del:5.1,del:5.2,del:5.3,del:5.4,del:5.5,"
+			"del:5.6,del:5.7,del:5.8,del:5.9,del:5.10,del:5.11,"
+			"del:5.12,del:5.13,del:5.14,del:5.15,",
+			diff_to_string(aim_ssi_itemlist_diff(official, local, 15)));
+
+	free_list(&official);
+	free_list(&local);
+}
+END_TEST
+
+/* Looking up every buddy of a large list, then diffing it */
+START_TEST(test_oscar_feedbag_benchmark)
+{
+	struct aim_ssi_item *official = NULL, *local = NULL, *cur;
+	GTimer *timer;
+	int lookups = 0;
+
+	build_list(&official, 50, 40);
+	copy_list(&local, official);
+	aim_ssi_itemlist_del(&local, aim_ssi_itemlist_find(local, 50, 40));
+
+	timer = g_timer_new();
+	for (cur = local; cur != NULL; cur = cur->next) {
+		if (cur->type == AIM_SSI_TYPE_BUDDY) {
+			char *gn = g_strdup_printf("group %hu", cur->gid);
+			fail_unless(cur == aim_ssi_itemlist_finditem(local, gn, cur->name, AIM_SSI_TYPE_BUDDY));
+			fail_unless(cur == aim_ssi_itemlist_exists(local, cur->name));
+			g_free(gn);
+			lookups++;
+		}
+	}
+	assert_string_equal_free("del:50.40,",
+			diff_to_string(aim_ssi_itemlist_diff(official, local, 15)));
+	g_timer_stop(timer);
+
+	check_report_timing("Looked up %d buddies and diffed the list in %.3f "
+			"seconds", lookups, g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+	free_list(&official);
+	free_list(&local);
+}
+END_TEST
+
+Suite *oscar_feedbag_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("OSCAR Feedbag");
+
+	tc = tcase_create("Item lookups");
+	tcase_add_test(tc, test_oscar_feedbag_finditem);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Sync diff");
+	tcase_add_test(tc, test_oscar_feedbag_diff);
+	tcase_add_test(tc, test_oscar_feedbag_benchmark);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,435 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tests.h"
+#include "../protocols/oscar/oscar.h"
+
+#define TEST_FAMILY_A     0x0ffa
+#define TEST_FAMILY_B     0x0ffb
+#define TEST_FAMILY_OTHER 0x0ffc
+
+/*
+ * Every SNAC handled by the test modules is logged here as
+ * "<module>:<family>:<subtype>:<payload length>" so the order and
+ * routing can be compared against what was sent.
+ */
+static GString *dispatched;
+
+static int
+test_snachandler(OscarData *od, FlapConnection *conn, aim_module_t *mod,
+		FlapFrame *frame, aim_modsnac_t *snac, ByteStream *bs)
+{
+	size_t len = byte_stream_bytes_left(bs);
+	size_t i;
+
+	/* Module B declines odd subtypes so they fall through to the catch-all */
+	if (mod->family == TEST_FAMILY_B && (snac->subtype & 1))
+		return 0;
+
+	/* Payload bytes are (subtype + index) & 0xff */
+	for (i = 0; i < len; i++)
+		fail_unless(byte_stream_get8(bs) == ((snac->subtype + i) & 0xff));
+
+	g_string_append_printf(dispatched, "%s:%04x:%04x:%u,", mod->name,
+			snac->family, snac->subtype, (guint)len);
+	return 1;
+}
+
+static int
+test_a_modfirst(OscarData *od, aim_module_t *mod)
+{
+	mod->family = TEST_FAMILY_A;
+	strncpy(mod->name, "a", sizeof(mod->name));
+	mod->snachandler = test_snachandler;
+	return 0;
+}
+
+static int
+test_b_modfirst(OscarData *od, aim_module_t *mod)
+{
+	mod->family = TEST_FAMILY_B;
+	strncpy(mod->name, "b", sizeof(mod->name));
+	mod->snachandler = test_snachandler;
+	return 0;
+}
+
+static int
+test_any_modfirst(OscarData *od, aim_module_t *mod)
+{
+	mod->family = 0xffff;
+	mod->flags = AIM_MODFLAG_MULTIFAMILY;
+	strncpy(mod->name, "any", sizeof(mod->name));
+	mod->snachandler = test_snachandler;
+	return 0;
+}
+
+static void
+append_snac(GByteArray *capture, GString *expected, guint16 seqnum,
+		guint16 family, guint16 subtype, guint16 payloadlen)
+{
+	guint8 header[16];
+	guint16 i;
+	const char *name;
+
+	aimutil_put8(header, 0x2a);
+	aimutil_put8(header + 1, 0x02);
+	aimutil_put16(header + 2, seqnum);
+	aimutil_put16(header + 4, 10 + payloadlen);
+	aimutil_put16(header + 6, family);
+	aimutil_put16(header + 8, subtype);
+	aimutil_put16(header + 10, 0);
+	aimutil_put32(header + 12, seqnum);
+	g_byte_array_append(capture, header, sizeof(header));
+
+	for (i = 0; i < payloadlen; i++) {
+		guint8 byte = (subtype + i) & 0xff;
+		g_byte_array_append(capture, &byte, 1);
+	}
+
+	if (family == TEST_FAMILY_A)
+		name = "a";
+	else if (family == TEST_FAMILY_B && !(subtype & 1))
+		name = "b";
+	else
+		name = "any";
+	g_string_append_printf(expected, "%s:%04x:%04x:%u,", name,
+			family, subtype, payloadlen);
+}
+
+static void
+append_keepalive(GByteArray *capture, guint16 seqnum)
+{
+	guint8 header[6];
+
+	aimutil_put8(header, 0x2a);
+	aimutil_put8(header + 1, 0x05);
+	aimutil_put16(header + 2, seqnum);
+	aimutil_put16(header + 4, 0);
+	g_byte_array_append(capture, header, sizeof(header));
+}
+
+/*
+ * Builds something shaped like a buddy list dump: mostly small SNACs,
+ * the odd large one, keepalives sprinkled in.
+ */
+static GByteArray *
+build_capture(int frames, GString *expected)
+{
+	GByteArray *capture = g_byte_array_new();
+	static const guint16 families[] = {
+		TEST_FAMILY_A, TEST_FAMILY_B, TEST_FAMILY_OTHER
+	};
+	int i;
+
+	for (i = 0; i < frames; i++) {
+		guint16 payloadlen = (i % 97 == 0) ? 20000 : (i * 31) % 300;
+
+		if (i % 50 == 0)
+			append_keepalive(capture, i);
+		append_snac(capture, expected, i, families[i % 3], i % 16, payloadlen);
+	}
+
+	return capture;
+}
+
+static OscarData *
+test_oscar_data_new(void)
+{
+	OscarData *od = g_new0(OscarData, 1);
+
+	od->gc = g_new0(PurpleConnection, 1);
+	aim__registermodule(od, test_any_modfirst);
+	aim__registermodule(od, test_a_modfirst);
+	aim__registermodule(od, test_b_modfirst);
+
+	return od;
+}
+
+static void
+test_oscar_data_free(OscarData *od)
+{
+	aim__shutdownmodules(od);
+	fail_unless(od->snac_dispatch == NULL);
+	g_free(od->gc);
+	g_free(od);
+}
+
+/*
+ * Push a capture through a socketpair into the real reader, writing it
+ * in pieces of chunksize bytes and letting the reader run after each.
+ *
+ * @return The number of read callbacks it took.
+ */
+static int
+replay_capture(GByteArray *capture, gsize chunksize)
+{
+	OscarData *od;
+	FlapConnection conn;
+	int fds[2];
+	gsize sent = 0;
+	int callbacks = 0;
+
+	od = test_oscar_data_new();
+	memset(&conn, 0, sizeof(conn));
+	conn.od = od;
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	conn.fd = fds[0];
+
+	while (sent < capture->len) {
+		gssize ret = write(fds[1], capture->data + sent,
+				MIN(chunksize, capture->len - sent));
+		if (ret > 0)
+			sent += ret;
+		flap_connection_recv_cb(&conn, conn.fd, PURPLE_INPUT_READ);
+		callbacks++;
+	}
+
+	fail_unless(conn.buffer_incoming_len == 0);
+	fail_unless(conn.destroy_timeout == 0);
+
+	close(fds[0]);
+	close(fds[1]);
+	g_free(conn.buffer_incoming);
+	test_oscar_data_free(od);
+
+	return callbacks;
+}
+
+START_TEST(test_oscar_flap_dispatch)
+{
+	OscarData *od = test_oscar_data_new();
+	aim_module_t **mods;
+
+	mods = aim__findsnacmodules(od, TEST_FAMILY_A);
+	assert_string_equal("a", mods[0]->name);
+	assert_string_equal("any", mods[1]->name);
+	fail_unless(mods[2] == NULL);
+	fail_unless(mods == aim__findsnacmodules(od, TEST_FAMILY_A));
+
+	mods = aim__findsnacmodules(od, TEST_FAMILY_OTHER);
+	assert_string_equal("any", mods[0]->name);
+	fail_unless(mods[1] == NULL);
+
+	test_oscar_data_free(od);
+}
+END_TEST
+
+START_TEST(test_oscar_flap_replay)
+{
+	static const gsize chunksizes[] = { 1, 5, 6, 7, 1500, 65536 };
+	GString *expected = g_string_new(NULL);
+	GByteArray *capture = build_capture(300, expected);
+	int i;
+
+	dispatched = g_string_new(NULL);
+	for (i = 0; i < G_N_ELEMENTS(chunksizes); i++) {
+		g_string_truncate(dispatched, 0);
+		replay_capture(capture, chunksizes[i]);
+		fail_unless(g_str_equal(expected->str, dispatched->str),
+				"Dispatch mismatch with %u byte chunks", (guint)chunksizes[i]);
+	}
+
+	g_string_free(dispatched, TRUE);
+	g_string_free(expected, TRUE);
+	g_byte_array_free(capture, TRUE);
+}
+END_TEST
+
+/* Replaying a large capture in big reads */
+START_TEST(test_oscar_flap_replay_benchmark)
+{
+	GString *expected = g_string_new(NULL);
+	GByteArray *capture = build_capture(20000, expected);
+	GTimer *timer = g_timer_new();
+	int callbacks;
+
+	dispatched = g_string_new(NULL);
+	callbacks = replay_capture(capture, 65536);
+	g_timer_stop(timer);
+
+	fail_unless(g_str_equal(expected->str, dispatched->str));
+	check_report_timing("Replayed %u bytes of FLAPs in %d read callbacks, "
+			"%.3f seconds", capture->len, callbacks,
+			g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+	g_string_free(dispatched, TRUE);
+	g_string_free(expected, TRUE);
+	g_byte_array_free(capture, TRUE);
+}
+END_TEST
+
+/*
+ * Simulate sending SNACs in one rateclass as fast as the scheduler
+ * allows, and check each deadline against the server's view of the
+ * average: above alert when we send, but not a millisecond earlier.
+ */
+START_TEST(test_oscar_flap_rateclass_deadline)
+{
+	static const struct {
+		guint32 windowsize, alert, current, max;
+	} params[] = {
+		/* windowsize, alert, current, max */
+		{ 10, 40, 40, 5000 },
+		{ 20, 3000, 2900, 6000 },
+		{ 35, 1500, 6000, 6000 },
+		{ 80, 4000, 1, 6500 },
+		{ 1, 100, 0, 200 },
+	};
+	int i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(params); i++) {
+		struct rateclass rateclass;
+		struct timeval now;
+		guint64 elapsed = 0;
+
+		memset(&rateclass, 0, sizeof(rateclass));
+		rateclass.windowsize = params[i].windowsize;
+		rateclass.alert = params[i].alert;
+		rateclass.current = params[i].current;
+		rateclass.max = params[i].max;
+		now.tv_sec = 1000000;
+		now.tv_usec = 0;
+		rateclass.last = now;
+
+		for (j = 0; j < 200; j++) {
+			guint wait = flap_connection_rateclass_get_wait(&rateclass, &now);
+			guint64 base = (guint64)rateclass.current * (rateclass.windowsize - 1);
+			guint32 average;
+
+			elapsed += wait;
+			now.tv_sec = 1000000 + elapsed / 1000;
+			now.tv_usec = (elapsed % 1000) * 1000;
+
+			average = MIN((base + (now.tv_sec - rateclass.last.tv_sec) * 1000 +
+					(now.tv_usec - rateclass.last.tv_usec) / 1000) / rateclass.windowsize,
+					rateclass.max);
+			fail_unless(average > rateclass.alert,
+					"Params %d, SNAC %d: sent at average %u, alert is %u",
+					i, j, average, rateclass.alert);
+			if (wait > 0) {
+				guint32 earlier = MIN((base + (now.tv_sec - rateclass.last.tv_sec) * 1000 +
+						(now.tv_usec - rateclass.last.tv_usec) / 1000 - 1) / rateclass.windowsize,
+						rateclass.max);
+				fail_unless(earlier <= rateclass.alert,
+						"Params %d, SNAC %d: waited longer than needed", i, j);
+			}
+
+			rateclass.current = average;
+			rateclass.last = now;
+		}
+	}
+}
+END_TEST
+
+static struct rateclass *
+test_rateclass_new(FlapConnection *conn, guint16 classid, guint16 family,
+		guint16 subtype, guint32 alert, guint32 current)
+{
+	struct rateclass *rateclass = g_new0(struct rateclass, 1);
+
+	rateclass->classid = classid;
+	rateclass->windowsize = 10;
+	rateclass->alert = alert;
+	rateclass->current = current;
+	rateclass->max = 6000;
+	gettimeofday(&rateclass->last, NULL);
+
+	conn->rateclasses = g_slist_append(conn->rateclasses, rateclass);
+	g_hash_table_insert(conn->rateclass_members,
+			GUINT_TO_POINTER((family << 16) + subtype), rateclass);
+
+	return rateclass;
+}
+
+/*
+ * A rateclass that is over its limit must not hold up SNACs in other
+ * rateclasses, and its own queue must drain in order once the
+ * deadline passes.
+ */
+START_TEST(test_oscar_flap_rateclass_queues)
+{
+	OscarData od;
+	FlapConnection conn;
+	GTimer *timer;
+	GString *sent = g_string_new(NULL);
+	guint8 *cursor, *end;
+
+	memset(&od, 0, sizeof(od));
+	memset(&conn, 0, sizeof(conn));
+	conn.od = &od;
+	conn.fd = -1;
+	conn.buffer_outgoing = purple_circ_buffer_new(0);
+	conn.rateclass_members = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	/* Needs 50ms before the next SNAC */
+	test_rateclass_new(&conn, 1, 0x0004, 0x0006, 40, 40);
+	/* Plenty of room */
+	test_rateclass_new(&conn, 2, 0x0013, 0x0008, 1000, 5000);
+
+	flap_connection_send_snac_with_priority(&od, &conn, 0x0004, 0x0006, 1, NULL, TRUE);
+	flap_connection_send_snac_with_priority(&od, &conn, 0x0013, 0x0008, 2, NULL, TRUE);
+	flap_connection_send_snac_with_priority(&od, &conn, 0x0004, 0x0006, 3, NULL, FALSE);
+	flap_connection_send_snac_with_priority(&od, &conn, 0x0004, 0x0006, 4, NULL, TRUE);
+	flap_connection_send_snac_with_priority(&od, &conn, 0x0013, 0x0008, 5, NULL, FALSE);
+
+	/* Rateclass 2 went straight out */
+	fail_unless(conn.buffer_outgoing->bufused == 2 * 16);
+	fail_unless(conn.queued_timeout != 0);
+
+	timer = g_timer_new();
+	while (conn.queued_timeout != 0 && g_timer_elapsed(timer, NULL) < 5)
+		g_main_context_iteration(NULL, TRUE);
+	g_timer_destroy(timer);
+	fail_unless(conn.queued_timeout == 0);
+
+	/* Collect the SNAC ids in the order they were sent */
+	cursor = conn.buffer_outgoing->outptr;
+	end = cursor + purple_circ_buffer_get_max_read(conn.buffer_outgoing);
+	for (; cursor + 16 <= end; cursor += 16)
+		g_string_append_printf(sent, "%u,", (guint)aimutil_get32(cursor + 12));
+	assert_string_equal("2,5,1,4,3,", sent->str);
+
+	g_string_free(sent, TRUE);
+	while (conn.rateclasses != NULL) {
+		struct rateclass *rateclass = conn.rateclasses->data;
+		g_queue_free(rateclass->queued_snacs);
+		g_queue_free(rateclass->queued_lowpriority_snacs);
+		g_free(rateclass);
+		conn.rateclasses = g_slist_delete_link(conn.rateclasses, conn.rateclasses);
+	}
+	g_hash_table_destroy(conn.rateclass_members);
+	purple_circ_buffer_destroy(conn.buffer_outgoing);
+}
+END_TEST
+
+Suite *oscar_flap_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("OSCAR FLAP Reader");
+
+	tc = tcase_create("SNAC dispatch table");
+	tcase_add_test(tc, test_oscar_flap_dispatch);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Replay captured FLAP streams");
+	tcase_add_test(tc, test_oscar_flap_replay);
+	tcase_add_test(tc, test_oscar_flap_replay_benchmark);
+	tcase_set_timeout(tc, 60);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Rate limited SNAC scheduling");
+	tcase_add_test(tc, test_oscar_flap_rateclass_deadline);
+	tcase_add_test(tc, test_oscar_flap_rateclass_queues);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
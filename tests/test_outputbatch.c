@@ -0,0 +1,182 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include "tests.h"
+#include "../outputbatch.h"
+
+#define BIG_WRITE (1024 * 1024)
+
+static int write_error;
+static gsize written;
+
+static void
+check_error_cb(PurpleOutputBatch *batch, int error, gpointer data)
+{
+	write_error = error;
+}
+
+static void
+check_written_cb(PurpleOutputBatch *batch, gsize len, gpointer data)
+{
+	written += len;
+}
+
+static void
+nonblocking_socketpair(int fds[2])
+{
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	fail_unless(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+	fail_unless(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+}
+
+/* Everything that can be read from fd right now */
+static void
+read_available(int fd, GString *received)
+{
+	char buf[4096];
+	ssize_t len;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+		g_string_append_len(received, buf, len);
+}
+
+START_TEST(test_outputbatch_coalesce)
+{
+	PurpleOutputBatch *batch = purple_output_batch_new(check_error_cb, NULL);
+	GString *received = g_string_new(NULL);
+	gulong writes, syscalls, total_writes, total_syscalls;
+	int fds[2];
+
+	nonblocking_socketpair(fds);
+	purple_output_batch_get_stats(NULL, &total_writes, &total_syscalls);
+	purple_output_batch_set_written_cb(batch, check_written_cb);
+	written = 0;
+
+	/* What's written before there is a connection is kept for it */
+	purple_output_batch_write(batch, "<stream>", 8);
+	purple_output_batch_set_transport(batch, fds[0], NULL);
+
+	/* Everything written in one pass of the loop goes out together... */
+	purple_output_batch_write(batch, "<a/>", 4);
+	purple_output_batch_write(batch, "<b/>", 4);
+	purple_output_batch_write(batch, "", 0);
+	purple_output_batch_write(batch, "<c/>", 4);
+	assert_int_equal(20, purple_output_batch_get_pending(batch));
+	read_available(fds[1], received);
+	assert_int_equal(0, received->len);
+
+	/* ...once control gets back to the loop */
+	while (purple_output_batch_get_pending(batch) > 0)
+		g_main_context_iteration(NULL, TRUE);
+	read_available(fds[1], received);
+	assert_string_equal("<stream><a/><b/><c/>", received->str);
+	assert_int_equal(20, written);
+
+	purple_output_batch_get_stats(batch, &writes, &syscalls);
+	assert_int_equal(4, writes);
+	assert_int_equal(1, syscalls);
+	purple_output_batch_get_stats(NULL, &writes, &syscalls);
+	assert_int_equal(4, writes - total_writes);
+	assert_int_equal(1, syscalls - total_syscalls);
+
+	/* Flushing by hand doesn't wait for the loop */
+	purple_output_batch_write(batch, "</stream>", 9);
+	fail_unless(purple_output_batch_flush(batch));
+	assert_int_equal(0, purple_output_batch_get_pending(batch));
+	g_string_truncate(received, 0);
+	read_available(fds[1], received);
+	assert_string_equal("</stream>", received->str);
+	purple_output_batch_get_stats(batch, NULL, &syscalls);
+	assert_int_equal(2, syscalls);
+
+	assert_int_equal(0, write_error);
+
+	purple_output_batch_destroy(batch);
+	g_string_free(received, TRUE);
+	close(fds[0]);
+	close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_outputbatch_partial_writes)
+{
+	PurpleOutputBatch *batch = purple_output_batch_new(check_error_cb, NULL);
+	GString *received = g_string_new(NULL);
+	char *data = g_malloc(BIG_WRITE);
+	gulong writes, syscalls;
+	int fds[2], i;
+
+	nonblocking_socketpair(fds);
+	purple_output_batch_set_transport(batch, fds[0], NULL);
+
+	for (i = 0; i < BIG_WRITE; i++)
+		data[i] = i % 251;
+
+	/* More than the socket takes at once, in pieces */
+	for (i = 0; i < BIG_WRITE; i += BIG_WRITE / 16)
+		purple_output_batch_write(batch, data + i, BIG_WRITE / 16);
+
+	fail_unless(purple_output_batch_flush(batch));
+	fail_unless(purple_output_batch_get_pending(batch) > 0);
+	fail_unless(purple_output_batch_get_pending(batch) < BIG_WRITE);
+
+	/* The rest goes as the other end reads, and nothing is lost */
+	while (received->len < BIG_WRITE) {
+		read_available(fds[1], received);
+		g_main_context_iteration(NULL, FALSE);
+	}
+	assert_int_equal(0, purple_output_batch_get_pending(batch));
+	assert_int_equal(BIG_WRITE, received->len);
+	fail_unless(memcmp(data, received->str, BIG_WRITE) == 0);
+
+	purple_output_batch_get_stats(batch, &writes, &syscalls);
+	assert_int_equal(16, writes);
+	fail_unless(syscalls > 1);
+	assert_int_equal(0, write_error);
+
+	purple_output_batch_destroy(batch);
+	g_string_free(received, TRUE);
+	g_free(data);
+	close(fds[0]);
+	close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_outputbatch_error)
+{
+	PurpleOutputBatch *batch = purple_output_batch_new(check_error_cb, NULL);
+	int fds[2];
+
+	signal(SIGPIPE, SIG_IGN);
+	nonblocking_socketpair(fds);
+	purple_output_batch_set_transport(batch, fds[0], NULL);
+	close(fds[1]);
+
+	/* A failed write drops what was queued and says why */
+	write_error = 0;
+	purple_output_batch_write(batch, "<a/>", 4);
+	fail_if(purple_output_batch_flush(batch));
+	assert_int_equal(EPIPE, write_error);
+	assert_int_equal(0, purple_output_batch_get_pending(batch));
+
+	purple_output_batch_destroy(batch);
+	close(fds[0]);
+}
+END_TEST
+
+Suite *
+outputbatch_suite(void)
+{
+	Suite *s = suite_create("Output Batch");
+
+	TCase *tc = tcase_create("Writing");
+	tcase_add_test(tc, test_outputbatch_coalesce);
+	tcase_add_test(tc, test_outputbatch_partial_writes);
+	tcase_add_test(tc, test_outputbatch_error);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
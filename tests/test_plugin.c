@@ -0,0 +1,290 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../internal.h"
+#include "../plugin.h"
+#include "../util.h"
+
+#define SCRIPTS 200
+
+#ifdef PURPLE_PLUGINS
+/*
+ * A loader for "scripts" that are just an id and a name, which counts how
+ * often it has to look at one.
+ */
+static int probes;
+static int loads;
+
+static gboolean
+check_loader_probe(PurplePlugin *plugin)
+{
+	PurplePluginInfo *info;
+	char *contents;
+	char **lines;
+
+	if (!g_file_get_contents(plugin->path, &contents, NULL, NULL))
+		return FALSE;
+
+	/* Opening a module or compiling a script isn't free either */
+	probes++;
+	g_usleep(1000);
+
+	lines = g_strsplit(contents, "\n", 3);
+	g_free(contents);
+
+	info = g_new0(PurplePluginInfo, 1);
+	info->magic = PURPLE_PLUGIN_MAGIC;
+	info->major_version = PURPLE_MAJOR_VERSION;
+	info->minor_version = PURPLE_MINOR_VERSION;
+	info->type = PURPLE_PLUGIN_STANDARD;
+	info->priority = PURPLE_PRIORITY_DEFAULT;
+	info->id = g_strdup(lines[0]);
+	info->name = g_strdup(lines[1]);
+	info->version = g_strdup("1.0");
+	info->summary = g_strdup("A script for the check loader");
+	g_strfreev(lines);
+
+	if (purple_strequal(info->id, "check-script-1"))
+		info->dependencies = g_list_append(NULL, "check-script-0");
+
+	plugin->info = info;
+
+	return purple_plugin_register(plugin);
+}
+
+static gboolean
+check_loader_load(PurplePlugin *plugin)
+{
+	loads++;
+	return TRUE;
+}
+
+static void
+check_loader_destroy(PurplePlugin *plugin)
+{
+	g_free(plugin->info->id);
+	g_free(plugin->info->name);
+	g_free(plugin->info->version);
+	g_free(plugin->info->summary);
+	g_free(plugin->info);
+}
+
+static PurplePluginLoaderInfo check_loader_info =
+{
+	NULL,
+	check_loader_probe,
+	check_loader_load,
+	NULL,
+	check_loader_destroy,
+
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+static PurplePluginInfo check_loader_plugin_info =
+{
+	PURPLE_PLUGIN_MAGIC,
+	PURPLE_MAJOR_VERSION,
+	PURPLE_MINOR_VERSION,
+	PURPLE_PLUGIN_LOADER,
+	NULL,
+	0,
+	NULL,
+	PURPLE_PRIORITY_DEFAULT,
+	"core-check-loader",
+	"Check Loader",
+	"1.0",
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	&check_loader_info,
+	NULL,
+	NULL,
+
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+static PurplePlugin *
+start_check_loader(void)
+{
+	PurplePlugin *loader = purple_plugin_new(TRUE, NULL);
+
+	check_loader_info.exts = g_list_append(NULL, "chk");
+	loader->info = &check_loader_plugin_info;
+	purple_plugin_register(loader);
+	purple_plugins_probe("chk");
+
+	fail_unless(purple_plugin_is_loaded(loader));
+
+	return loader;
+}
+
+static void
+stop_check_loader(PurplePlugin *loader)
+{
+	/* The scripts can't be unloaded once their loader is gone */
+	purple_plugins_unload(PURPLE_PLUGIN_STANDARD);
+	purple_plugin_destroy(loader);
+}
+
+/* Like quitting and starting again, as far as plugins go */
+static void
+restart_plugins(PurplePlugin *loader, const char *dir)
+{
+	stop_check_loader(loader);
+	purple_plugins_uninit();
+
+	purple_plugins_init();
+	purple_plugins_add_search_path(dir);
+
+	probes = loads = 0;
+}
+
+static void
+write_script(const char *dir, int i, const char *name)
+{
+	char *filename, *path, *contents;
+
+	filename = g_strdup_printf("script%d.chk", i);
+	path = g_build_filename(dir, filename, NULL);
+	contents = g_strdup_printf("check-script-%d\n%s\n", i, name);
+
+	fail_unless(g_file_set_contents(path, contents, -1, NULL));
+
+	g_free(contents);
+	g_free(path);
+	g_free(filename);
+}
+
+static PurplePlugin *
+find_script(int i)
+{
+	char *id = g_strdup_printf("check-script-%d", i);
+	PurplePlugin *plugin = purple_plugins_find_with_id(id);
+
+	fail_unless(plugin != NULL, "%s wasn't listed", id);
+	g_free(id);
+
+	return plugin;
+}
+
+START_TEST(test_plugin_probe_cache)
+{
+	char *dir, *path;
+	PurplePlugin *loader, *plugin;
+	GTimer *timer;
+	double cold, warm;
+	int i;
+
+	dir = g_strdup_printf("%s" G_DIR_SEPARATOR_S "purple-check-plugins-%d",
+			g_get_tmp_dir(), getpid());
+	fail_unless(g_mkdir(dir, S_IRUSR | S_IWUSR | S_IXUSR) == 0);
+	purple_util_set_user_dir(dir);
+	purple_plugins_add_search_path(dir);
+
+	for (i = 0; i < SCRIPTS; i++) {
+		char *name = g_strdup_printf("Script %d", i);
+		write_script(dir, i, name);
+		g_free(name);
+	}
+
+	/* The first time around, everything has to be probed */
+	probes = loads = 0;
+	timer = g_timer_new();
+	loader = start_check_loader();
+	cold = g_timer_elapsed(timer, NULL);
+	assert_int_equal(SCRIPTS, probes);
+	fail_unless(find_script(7)->info->name != NULL);
+
+	/* Next time, nothing has changed, so nothing is */
+	restart_plugins(loader, dir);
+	g_timer_start(timer);
+	loader = start_check_loader();
+	warm = g_timer_elapsed(timer, NULL);
+	assert_int_equal(0, probes);
+
+	check_report_timing("Listing %d plugins took %.3f seconds, then %.3f "
+			"seconds from the probe cache", SCRIPTS, cold, warm);
+
+	plugin = find_script(7);
+	assert_string_equal("Script 7", purple_plugin_get_name(plugin));
+	assert_string_equal("1.0", purple_plugin_get_version(plugin));
+	assert_string_equal("A script for the check loader",
+			purple_plugin_get_summary(plugin));
+	fail_if(purple_plugin_is_loaded(plugin));
+	fail_if(purple_plugin_is_unloadable(plugin));
+	plugin = find_script(1);
+	assert_int_equal(1, g_list_length(plugin->info->dependencies));
+	assert_string_equal("check-script-0", plugin->info->dependencies->data);
+
+	/* A script that has changed is probed again */
+	write_script(dir, 3, "Script 3, improved");
+	restart_plugins(loader, dir);
+	loader = start_check_loader();
+	assert_int_equal(1, probes);
+	assert_string_equal("Script 3, improved", purple_plugin_get_name(find_script(3)));
+
+	/* Loading a listed script probes it and what it depends on */
+	plugin = find_script(1);
+	fail_unless(purple_plugin_load(plugin));
+	assert_int_equal(3, probes);
+	assert_int_equal(2, loads);
+	fail_unless(purple_plugin_is_loaded(plugin));
+	fail_unless(purple_plugin_is_loaded(find_script(0)));
+	fail_unless(find_script(1) == plugin);
+	assert_string_equal("Script 1", purple_plugin_get_name(plugin));
+
+	/* One that has gone away since it was listed can't be loaded */
+	path = g_build_filename(dir, "script9.chk", NULL);
+	g_unlink(path);
+	g_free(path);
+	plugin = find_script(9);
+	fail_if(purple_plugin_load(plugin));
+	fail_unless(purple_plugin_is_unloadable(plugin));
+	fail_unless(find_script(9) == plugin);
+
+	stop_check_loader(loader);
+	purple_plugins_uninit();
+	purple_util_set_user_dir("/dev/null");
+
+	for (i = 0; i < SCRIPTS; i++) {
+		char *filename = g_strdup_printf("script%d.chk", i);
+		path = g_build_filename(dir, filename, NULL);
+		g_unlink(path);
+		g_free(path);
+		g_free(filename);
+	}
+	path = g_build_filename(dir, "plugin-cache.xml", NULL);
+	g_unlink(path);
+	g_free(path);
+	g_rmdir(dir);
+
+	g_timer_destroy(timer);
+	g_free(dir);
+}
+END_TEST
+#endif /* PURPLE_PLUGINS */
+
+Suite *
+plugin_suite(void)
+{
+	Suite *s = suite_create("Plugins");
+
+	TCase *tc = tcase_create("Probe Cache");
+#ifdef PURPLE_PLUGINS
+	tcase_add_test(tc, test_plugin_probe_cache);
+#endif
+	suite_add_tcase(s, tc);
+
+	return s;
+}
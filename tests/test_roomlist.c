@@ -0,0 +1,262 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../account.h"
+#include "../roomlist.h"
+#include "../protocols/irc/irc.h"
+
+#define LISTING_SIZE 100000
+
+/*
+ * What a UI would have been told about a room list.
+ */
+static int rooms_added;
+static int batches;
+
+static void
+check_add_room(PurpleRoomlist *list, PurpleRoomlistRoom *room)
+{
+	rooms_added++;
+}
+
+static void
+check_add_rooms(PurpleRoomlist *list, GList *rooms)
+{
+	batches++;
+	rooms_added += g_list_length(rooms);
+}
+
+static PurpleRoomlistUiOps check_roomlist_ops = {
+	NULL, /* show_with_account */
+	NULL, /* create */
+	NULL, /* set_fields */
+	check_add_room,
+	NULL, /* in_progress */
+	NULL, /* destroy */
+	NULL, /* add_rooms */
+	NULL,
+	NULL,
+	NULL
+};
+
+/* A list with the fields the IRC prpl gives it */
+static PurpleRoomlist *
+irc_style_roomlist(PurpleAccount *account)
+{
+	PurpleRoomlist *list = purple_roomlist_new(account);
+	GList *fields = NULL;
+
+	fields = g_list_append(fields, purple_roomlist_field_new(
+			PURPLE_ROOMLIST_FIELD_STRING, "", "channel", TRUE));
+	fields = g_list_append(fields, purple_roomlist_field_new(
+			PURPLE_ROOMLIST_FIELD_INT, "Users", "users", FALSE));
+	fields = g_list_append(fields, purple_roomlist_field_new(
+			PURPLE_ROOMLIST_FIELD_STRING, "Topic", "topic", FALSE));
+	purple_roomlist_set_fields(list, fields);
+
+	return list;
+}
+
+static void
+add_room(PurpleRoomlist *list, const char *name, int users)
+{
+	PurpleRoomlistRoom *room;
+
+	room = purple_roomlist_room_new(PURPLE_ROOMLIST_ROOMTYPE_ROOM, name, NULL);
+	purple_roomlist_room_add_field(list, room, name);
+	purple_roomlist_room_add_field(list, room, GINT_TO_POINTER(users));
+	purple_roomlist_room_add_field(list, room, "topic");
+	purple_roomlist_room_add(list, room);
+}
+
+static void
+assert_room_names(const char *expected, GList *rooms)
+{
+	GString *names = g_string_new(NULL);
+	GList *l;
+
+	for (l = rooms; l != NULL; l = l->next)
+		g_string_append_printf(names, "%s%s", l == rooms ? "" : " ",
+				purple_roomlist_room_get_name(l->data));
+
+	assert_string_equal(expected, names->str);
+	g_string_free(names, TRUE);
+	g_list_free(rooms);
+}
+
+START_TEST(test_roomlist_batches)
+{
+	PurpleAccount *account = purple_account_new("batches@example.com", "prpl-check");
+	PurpleRoomlist *list;
+	int i;
+
+	rooms_added = batches = 0;
+	purple_roomlist_set_ui_ops(&check_roomlist_ops);
+	list = irc_style_roomlist(account);
+	purple_roomlist_set_in_progress(list, TRUE);
+
+	/* The UI hears about the rooms a hundred at a time... */
+	for (i = 0; i < 250; i++) {
+		char *name = g_strdup_printf("#room%d", i);
+		add_room(list, name, i);
+		g_free(name);
+	}
+	assert_int_equal(200, rooms_added);
+	assert_int_equal(250, g_list_length(list->rooms));
+	assert_int_equal(250, purple_roomlist_get_room_count(list));
+
+	/* ...or when the listing goes quiet for a bit... */
+	while (rooms_added < 250)
+		g_main_context_iteration(NULL, TRUE);
+
+	/* ...or when it's over */
+	add_room(list, "#last", 0);
+	purple_roomlist_set_in_progress(list, FALSE);
+	assert_int_equal(251, rooms_added);
+
+	/* A UI that takes the rooms all at once gets them that way */
+	check_roomlist_ops.add_rooms = check_add_rooms;
+	rooms_added = 0;
+	purple_roomlist_set_in_progress(list, TRUE);
+	for (i = 0; i < 150; i++)
+		add_room(list, "#more", i);
+	purple_roomlist_set_in_progress(list, FALSE);
+	assert_int_equal(150, rooms_added);
+	assert_int_equal(2, batches);
+	assert_int_equal(401, purple_roomlist_get_room_count(list));
+
+	purple_roomlist_unref(list);
+	check_roomlist_ops.add_rooms = NULL;
+	purple_roomlist_set_ui_ops(NULL);
+	purple_account_destroy(account);
+}
+END_TEST
+
+START_TEST(test_roomlist_find_rooms)
+{
+	PurpleAccount *account = purple_account_new("find@example.com", "prpl-check");
+	PurpleRoomlist *list = irc_style_roomlist(account);
+
+	add_room(list, "#pidgin", 300);
+	add_room(list, "#Debian", 1200);
+	add_room(list, "#c", 900);
+
+	assert_room_names("#c #Debian #pidgin",
+			purple_roomlist_find_rooms(list, NULL, NULL, 0));
+	assert_room_names("#Debian #c #pidgin",
+			purple_roomlist_find_rooms(list, NULL, "users", 0));
+
+	/* Rooms added later are merged into the order */
+	add_room(list, "#python", 1200);
+	add_room(list, "#a", 5);
+	assert_room_names("#a #c #Debian #pidgin #python",
+			purple_roomlist_find_rooms(list, NULL, NULL, 0));
+	assert_room_names("#Debian #python #c #pidgin #a",
+			purple_roomlist_find_rooms(list, NULL, "users", 0));
+
+	assert_room_names("#pidgin #python",
+			purple_roomlist_find_rooms(list, "P", NULL, 0));
+	assert_room_names("#python",
+			purple_roomlist_find_rooms(list, "p", "users", 1));
+	assert_room_names("#a #c",
+			purple_roomlist_find_rooms(list, "", NULL, 2));
+	assert_room_names("", purple_roomlist_find_rooms(list, "nothing", NULL, 0));
+
+	purple_roomlist_unref(list);
+	purple_account_destroy(account);
+}
+END_TEST
+
+START_TEST(test_roomlist_max_rooms)
+{
+	PurpleAccount *account = purple_account_new("max@example.com", "prpl-check");
+	PurpleRoomlist *list = irc_style_roomlist(account);
+	int i;
+
+	purple_roomlist_set_max_rooms(list, 10);
+	for (i = 0; i < 25; i++)
+		add_room(list, "#room", i);
+
+	assert_int_equal(10, purple_roomlist_get_room_count(list));
+	assert_int_equal(10, g_list_length(list->rooms));
+	assert_int_equal(15, purple_roomlist_get_dropped_rooms(list));
+
+	purple_roomlist_unref(list);
+	purple_account_destroy(account);
+}
+END_TEST
+
+START_TEST(test_roomlist_irc_listing)
+{
+	PurpleAccount *account = purple_account_new("list@irc.example.com", "prpl-irc");
+	struct irc_conn irc;
+	PurpleRoomlist *list;
+	GList *rooms;
+	GTimer *timer;
+	char *args[4];
+	int i;
+
+	memset(&irc, 0, sizeof(irc));
+	irc.account = account;
+	irc.roomlist = list = irc_style_roomlist(account);
+	purple_roomlist_ref(list);
+
+	args[0] = "nick";
+	args[3] = "\002Welcome\002 to the channel";
+
+	timer = g_timer_new();
+	irc_msg_list(&irc, "321", "irc.example.com", args);
+	for (i = 0; i < LISTING_SIZE; i++) {
+		char name[32], users[16];
+
+		g_snprintf(name, sizeof(name), "#channel%d", i);
+		g_snprintf(users, sizeof(users), "%d", (i * 7919) % 5000);
+		args[1] = name;
+		args[2] = users;
+		irc_msg_list(&irc, "322", "irc.example.com", args);
+	}
+	irc_msg_list(&irc, "323", "irc.example.com", args);
+	g_timer_stop(timer);
+
+	fail_if(irc.roomlist);
+	fail_if(purple_roomlist_get_in_progress(list));
+	assert_int_equal(LISTING_SIZE, purple_roomlist_get_room_count(list));
+
+	check_report_timing("%d LIST replies took %.3f seconds",
+			LISTING_SIZE, g_timer_elapsed(timer, NULL));
+
+	g_timer_start(timer);
+	rooms = purple_roomlist_find_rooms(list, NULL, "users", 10);
+	assert_int_equal(10, g_list_length(rooms));
+	fail_unless(GPOINTER_TO_INT(g_list_nth_data(
+			purple_roomlist_room_get_fields(rooms->data), 1)) == 4999);
+	g_list_free(rooms);
+	rooms = purple_roomlist_find_rooms(list, "channel9999", NULL, 0);
+	assert_int_equal(11, g_list_length(rooms));
+	assert_string_equal("#channel9999", purple_roomlist_room_get_name(rooms->data));
+	g_list_free(rooms);
+	g_timer_stop(timer);
+
+	check_report_timing("Searching %d rooms took %.3f seconds",
+			LISTING_SIZE, g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+	purple_roomlist_unref(list);
+	purple_account_destroy(account);
+}
+END_TEST
+
+Suite *
+roomlist_suite(void)
+{
+	Suite *s = suite_create("Room List");
+
+	TCase *tc = tcase_create("Rooms");
+	tcase_add_test(tc, test_roomlist_batches);
+	tcase_add_test(tc, test_roomlist_find_rooms);
+	tcase_add_test(tc, test_roomlist_max_rooms);
+	tcase_add_test(tc, test_roomlist_irc_listing);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
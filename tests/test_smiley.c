@@ -0,0 +1,157 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../smiley.h"
+
+static PurpleSmiley *
+smiley_new(const char *shortcut)
+{
+	static const char gif[] = "GIF89a\x01\x00\x01\x00\x00\x00\x00;";
+	PurpleStoredImage *img;
+
+	img = purple_imgstore_add(g_memdup(gif, sizeof(gif) - 1), sizeof(gif) - 1,
+			"smiley.gif");
+
+	return purple_smiley_new(img, shortcut);
+}
+
+/* Returns the matches as "<shortcut>@<offset>+<length>," and frees them */
+static gchar *
+matches_to_string(GList *matches)
+{
+	GString *str = g_string_new(NULL);
+
+	for (; matches; matches = g_list_delete_link(matches, matches)) {
+		PurpleSmileyMatch *match = matches->data;
+
+		g_string_append_printf(str, "%s@%d+%d,",
+				purple_smiley_get_shortcut(match->smiley),
+				(int)match->offset, (int)match->length);
+		g_free(match);
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+static gchar *
+find_all(const char *text, gboolean escaped)
+{
+	return matches_to_string(purple_smileys_find_all(text, escaped));
+}
+
+START_TEST(test_smileys_find_all)
+{
+	const char *shortcuts[] = { ":-)", ":-))", "-)x", "<3", "&", "abcd", "bc", NULL };
+	PurpleSmiley *smileys[G_N_ELEMENTS(shortcuts)];
+	int i;
+
+	fail_unless(NULL == purple_smileys_find_all("hi :-)", FALSE));
+
+	for (i = 0; shortcuts[i] != NULL; i++)
+		smileys[i] = smiley_new(shortcuts[i]);
+
+	/* Leftmost first, then longest */
+	assert_string_equal_free(":-))@3+4,:-)@12+3,<3@17+2,",
+			find_all("hi :-)) and :-)x <3", FALSE));
+	/* "abc" has to fall back to "bc" when there is no "d" */
+	assert_string_equal_free("bc@1+2,", find_all("abce", FALSE));
+	assert_string_equal_free("", find_all("no smileys here", FALSE));
+
+	/* Markup is matched against the escaped shortcuts */
+	assert_string_equal_free("&@2+5,<3@8+5,", find_all("a &amp; &lt;3", TRUE));
+	assert_string_equal_free("&@2+1,&@8+1,", find_all("a &amp; &lt;3", FALSE));
+
+	/* Removing and renaming shortcuts takes effect straight away */
+	purple_smiley_delete(smileys[1]);
+	assert_string_equal_free(":-)@3+3,", find_all("hi :-)) ", FALSE));
+	fail_unless(purple_smiley_set_shortcut(smileys[0], ":-P"));
+	assert_string_equal_free(":-P@0+3,", find_all(":-P :-)", FALSE));
+
+	for (i = 0; shortcuts[i] != NULL; i++) {
+		if (i != 1)
+			purple_smiley_delete(smileys[i]);
+	}
+	fail_unless(NULL == purple_smileys_find_all(":-P", FALSE));
+}
+END_TEST
+
+static int filter_calls;
+
+/* Accepts every smiley but the ones whose shortcuts are 4 bytes long */
+static gboolean
+reject_long_cb(PurpleSmiley *smiley, gpointer data)
+{
+	filter_calls++;
+	return strlen(purple_smiley_get_shortcut(smiley)) != 4;
+}
+
+START_TEST(test_smileys_find_all_filtered)
+{
+	const char *shortcuts[] = { ":-))", ":-)", "abcd", "cde", NULL };
+	const char *text = ":-)) :-)) abcde";
+	PurpleSmiley *smileys[G_N_ELEMENTS(shortcuts)];
+	int i;
+
+	for (i = 0; shortcuts[i] != NULL; i++)
+		smileys[i] = smiley_new(shortcuts[i]);
+
+	assert_string_equal_free(":-))@0+4,:-))@5+4,abcd@10+4,",
+			find_all(text, FALSE));
+
+	/*
+	 * A rejected shortcut gives way to a shorter one at the same place,
+	 * and to one that it overlapped
+	 */
+	filter_calls = 0;
+	assert_string_equal_free(":-)@0+3,:-)@5+3,cde@12+3,",
+			matches_to_string(purple_smileys_find_all_filtered(text, FALSE,
+					reject_long_cb, NULL)));
+	assert_int_equal(4, filter_calls);
+
+	for (i = 0; shortcuts[i] != NULL; i++)
+		purple_smiley_delete(smileys[i]);
+}
+END_TEST
+
+/* Only the smileys that appear are found among lots of custom ones */
+START_TEST(test_smileys_find_all_many)
+{
+	GString *message = g_string_new(NULL);
+	GList *smileys = NULL, *matches;
+	int i;
+
+	for (i = 0; i < 50; i++) {
+		char *shortcut = g_strdup_printf("(smiley%d)", i);
+		smileys = g_list_prepend(smileys, smiley_new(shortcut));
+		g_free(shortcut);
+	}
+	for (i = 0; i < 20; i++)
+		g_string_append_printf(message, "Some text (smiley%d) &amp; ", i * 2);
+
+	matches = purple_smileys_find_all(message->str, TRUE);
+	assert_int_equal(20, g_list_length(matches));
+	for (; matches; matches = g_list_delete_link(matches, matches))
+		g_free(matches->data);
+
+	g_string_free(message, TRUE);
+	for (; smileys; smileys = g_list_delete_link(smileys, smileys))
+		purple_smiley_delete(smileys->data);
+}
+END_TEST
+
+Suite *
+smiley_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("Smileys");
+
+	tc = tcase_create("Find shortcuts");
+	tcase_add_test(tc, test_smileys_find_all);
+	tcase_add_test(tc, test_smileys_find_all_filtered);
+	tcase_add_test(tc, test_smileys_find_all_many);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
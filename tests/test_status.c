@@ -0,0 +1,247 @@
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "tests.h"
+#include "../account.h"
+#include "../blist.h"
+#include "../status.h"
+
+#define ROSTER_SIZE 50000
+
+/* Status types like a prpl would have */
+static GList *
+check_status_types(void)
+{
+	GList *types = NULL;
+
+	types = g_list_append(types, purple_status_type_new_with_attrs(
+			PURPLE_STATUS_AVAILABLE, "available", NULL, TRUE, TRUE, FALSE,
+			"message", "Message", purple_value_new(PURPLE_TYPE_STRING),
+			NULL));
+	types = g_list_append(types, purple_status_type_new_with_attrs(
+			PURPLE_STATUS_AWAY, "away", NULL, TRUE, TRUE, FALSE,
+			"message", "Message", purple_value_new(PURPLE_TYPE_STRING),
+			NULL));
+	types = g_list_append(types, purple_status_type_new_with_attrs(
+			PURPLE_STATUS_EXTENDED_AWAY, "xa", NULL, TRUE, TRUE, FALSE,
+			"message", "Message", purple_value_new(PURPLE_TYPE_STRING),
+			NULL));
+	types = g_list_append(types, purple_status_type_new_full(
+			PURPLE_STATUS_UNAVAILABLE, "dnd", NULL, TRUE, TRUE, FALSE));
+	types = g_list_append(types, purple_status_type_new_full(
+			PURPLE_STATUS_OFFLINE, "offline", NULL, TRUE, TRUE, FALSE));
+	types = g_list_append(types, purple_status_type_new_with_attrs(
+			PURPLE_STATUS_TUNE, "tune", NULL, FALSE, TRUE, TRUE,
+			PURPLE_TUNE_ARTIST, "Artist", purple_value_new(PURPLE_TYPE_STRING),
+			PURPLE_TUNE_TITLE, "Title", purple_value_new(PURPLE_TYPE_STRING),
+			PURPLE_TUNE_TIME, "Length", purple_value_new(PURPLE_TYPE_INT),
+			NULL));
+
+	return types;
+}
+
+START_TEST(test_status_buddy_presence)
+{
+	PurpleAccount *account = purple_account_new("status@example.com", "prpl-check");
+	PurpleBuddy *buddy, *other;
+	PurplePresence *presence;
+	PurpleStatus *away, *tune;
+	GList *types, *statuses, *l;
+
+	purple_account_set_status_types(account, check_status_types());
+	types = purple_account_get_status_types(account);
+
+	buddy = purple_buddy_new(account, "buddy@example.com", NULL);
+	other = purple_buddy_new(account, "other@example.com", NULL);
+	presence = purple_buddy_get_presence(buddy);
+
+	/* A new buddy is offline */
+	fail_unless(purple_presence_get_active_status(presence) != NULL);
+	assert_string_equal("offline",
+			purple_status_get_id(purple_presence_get_active_status(presence)));
+	fail_if(purple_presence_is_online(presence));
+
+	/* Asking for a status twice gets the same one */
+	away = purple_presence_get_status(presence, "away");
+	fail_unless(away != NULL);
+	assert_string_equal("away", purple_status_get_id(away));
+	fail_unless(away == purple_presence_get_status(presence, "away"));
+	fail_unless(purple_status_get_presence(away) == presence);
+	fail_if(purple_status_is_active(away));
+	fail_if(purple_presence_get_status(presence, "nonexistent"));
+
+	/* Attributes have their defaults until they are set */
+	fail_if(purple_status_get_attr_string(away, "message"));
+	fail_unless(purple_status_get_attr_value(away, "message") != NULL);
+	fail_if(purple_status_get_attr_value(away, "nonexistent"));
+	purple_status_set_attr_string(away, "message", "brb");
+	assert_string_equal("brb", purple_status_get_attr_string(away, "message"));
+	fail_if(purple_status_get_attr_string(
+			purple_presence_get_status(purple_buddy_get_presence(other), "away"),
+			"message"));
+
+	purple_presence_switch_status(presence, "away");
+	fail_unless(purple_presence_get_active_status(presence) == away);
+	fail_unless(purple_presence_is_online(presence));
+	fail_unless(purple_presence_is_status_primitive_active(presence,
+			PURPLE_STATUS_AWAY));
+	fail_if(purple_presence_is_status_primitive_active(presence,
+			PURPLE_STATUS_TUNE));
+	fail_unless(purple_presence_compare(presence,
+			purple_buddy_get_presence(other)) < 0);
+
+	/* Switching to a status resets the attributes not given */
+	fail_if(purple_status_get_attr_string(away, "message"));
+
+	/* Independent statuses work alongside the exclusive one */
+	tune = purple_presence_get_status(presence, "tune");
+	purple_presence_set_status_active(presence, "tune", TRUE);
+	fail_unless(purple_presence_is_status_primitive_active(presence,
+			PURPLE_STATUS_TUNE));
+	fail_unless(purple_presence_get_active_status(presence) == away);
+
+	/* Changing a value that a status hands out changes only that status */
+	purple_value_set_string(purple_status_get_attr_value(tune, PURPLE_TUNE_ARTIST),
+			"Artist");
+	assert_string_equal("Artist", purple_status_get_attr_string(tune,
+			PURPLE_TUNE_ARTIST));
+	fail_if(purple_status_get_attr_string(
+			purple_presence_get_status(purple_buddy_get_presence(other), "tune"),
+			PURPLE_TUNE_ARTIST));
+
+	/* The whole list follows the order of the types */
+	statuses = purple_presence_get_statuses(presence);
+	assert_int_equal(g_list_length(types), g_list_length(statuses));
+	for (l = types; l != NULL; l = l->next, statuses = statuses->next)
+		fail_unless(purple_status_get_type(statuses->data) == l->data);
+	fail_unless(g_list_find(purple_presence_get_statuses(presence), away) != NULL);
+	fail_unless(g_list_find(purple_presence_get_statuses(presence), tune) != NULL);
+	fail_unless(purple_presence_get_status(presence, "tune") == tune);
+	fail_unless(purple_status_is_active(tune));
+
+	purple_buddy_destroy(buddy);
+	purple_buddy_destroy(other);
+	purple_account_destroy(account);
+}
+END_TEST
+
+START_TEST(test_status_presence_scores)
+{
+	PurpleAccount *account = purple_account_new("scores@example.com", "prpl-check");
+	PurpleBuddy *buddy1, *buddy2;
+	PurplePresence *presence1, *presence2;
+	int available = purple_prefs_get_int("/purple/status/scores/available");
+
+	purple_account_set_status_types(account, check_status_types());
+	buddy1 = purple_buddy_new(account, "buddy1@example.com", NULL);
+	buddy2 = purple_buddy_new(account, "buddy2@example.com", NULL);
+	presence1 = purple_buddy_get_presence(buddy1);
+	presence2 = purple_buddy_get_presence(buddy2);
+
+	purple_presence_switch_status(presence1, "away");
+	purple_presence_switch_status(presence2, "xa");
+	fail_unless(purple_presence_compare(presence1, presence2) < 0);
+	fail_unless(purple_presence_compare(presence2, presence1) > 0);
+
+	/* A cached score goes stale when the status changes... */
+	purple_presence_switch_status(presence2, "available");
+	fail_unless(purple_presence_compare(presence1, presence2) > 0);
+
+	/* ...and when what the statuses are worth changes */
+	purple_prefs_set_int("/purple/status/scores/available", -1000);
+	fail_unless(purple_presence_compare(presence1, presence2) < 0);
+	purple_prefs_set_int("/purple/status/scores/available", available);
+	fail_unless(purple_presence_compare(presence1, presence2) > 0);
+
+	purple_buddy_destroy(buddy1);
+	purple_buddy_destroy(buddy2);
+	purple_account_destroy(account);
+}
+END_TEST
+
+/* How much of the heap is in use, where we can find out */
+static gsize
+heap_in_use(void)
+{
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+	return mallinfo2().uordblks;
+#else
+	return (guint)mallinfo().uordblks;
+#endif
+#else
+	return 0;
+#endif
+}
+
+START_TEST(test_status_large_roster)
+{
+	PurpleAccount *account = purple_account_new("roster@example.com", "prpl-check");
+	PurpleBuddy **buddies = g_new(PurpleBuddy *, ROSTER_SIZE);
+	GTimer *timer;
+	gsize heap_before, heap_after;
+	GList *attrs = NULL;
+	int i, online = 0;
+
+	purple_account_set_status_types(account, check_status_types());
+	attrs = g_list_append(attrs, "message");
+	attrs = g_list_append(attrs, "Out to lunch");
+
+	timer = g_timer_new();
+	heap_before = heap_in_use();
+
+	for (i = 0; i < ROSTER_SIZE; i++) {
+		char *name = g_strdup_printf("buddy%d@example.com", i);
+		buddies[i] = purple_buddy_new(account, name, NULL);
+		g_free(name);
+	}
+
+	/* A tenth of the roster comes online, some with a message */
+	for (i = 0; i < ROSTER_SIZE; i += 10) {
+		PurplePresence *presence = purple_buddy_get_presence(buddies[i]);
+
+		if (i % 20 == 0)
+			purple_status_set_active_with_attrs_list(
+					purple_presence_get_status(presence, "away"), TRUE, attrs);
+		else
+			purple_presence_switch_status(presence, "available");
+	}
+
+	heap_after = heap_in_use();
+	g_timer_stop(timer);
+
+	for (i = 0; i < ROSTER_SIZE; i++)
+		if (purple_presence_is_online(purple_buddy_get_presence(buddies[i])))
+			online++;
+	assert_int_equal(ROSTER_SIZE / 10, online);
+
+	check_report_timing("%d buddies took %.3f seconds and about %"
+			G_GSIZE_FORMAT " bytes of heap each", ROSTER_SIZE,
+			g_timer_elapsed(timer, NULL),
+			heap_after > heap_before ? (heap_after - heap_before) / ROSTER_SIZE : 0);
+
+	for (i = 0; i < ROSTER_SIZE; i++)
+		purple_buddy_destroy(buddies[i]);
+
+	g_timer_destroy(timer);
+	g_list_free(attrs);
+	g_free(buddies);
+	purple_account_destroy(account);
+}
+END_TEST
+
+Suite *
+status_suite(void)
+{
+	Suite *s = suite_create("Status");
+
+	TCase *tc = tcase_create("Presence");
+	tcase_add_test(tc, test_status_buddy_presence);
+	tcase_add_test(tc, test_status_presence_scores);
+	tcase_add_test(tc, test_status_large_roster);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -1,8 +1,12 @@
 #include <string.h>
 
 #include "tests.h"
+#include "../internal.h"
 #include "../util.h"
 
+#define PREFETCH_BUDDIES 20000
+#define SNAPSHOT_BUDDIES 500
+
 START_TEST(test_util_base16_encode)
 {
 	assert_string_equal_free("68656c6c6f2c20776f726c642100", purple_base16_encode((const unsigned char *)"hello, world!", 14));
@@ -184,6 +188,356 @@ START_TEST(test_markup_html_to_xhtml)
 	purple_markup_html_to_xhtml("<FONT>x</FONT>", &xhtml, &plaintext);
 	assert_string_equal_free("x", xhtml);
 	assert_string_equal_free("x", plaintext);
+
+	purple_markup_html_to_xhtml("<FONT FACE=\"Arial\" SIZE=4 COLOR=\"#ff0000\">big <B>red</B></FONT>", &xhtml, &plaintext);
+	assert_string_equal_free("<span style='font-family: Arial; font-size: large; color: #ff0000;'>"
+			"big <span style='font-weight: bold;'>red</span></span>", xhtml);
+	assert_string_equal_free("big red", plaintext);
+
+	purple_markup_html_to_xhtml("<a href=\"http://pidgin.im/\">Pidgin</a> <!-- hidden --> rocks", &xhtml, &plaintext);
+	assert_string_equal_free("<a href=\"http://pidgin.im/\">Pidgin</a> <!-- hidden --> rocks", xhtml);
+	assert_string_equal_free("Pidgin <http://pidgin.im/>  rocks", plaintext);
+
+	purple_markup_html_to_xhtml("I <3 <i>you</i> &amp; me", &xhtml, &plaintext);
+	assert_string_equal_free("I &lt;3 <em>you</em> &amp; me", xhtml);
+	assert_string_equal_free("I <3 you & me", plaintext);
+}
+END_TEST
+
+START_TEST(test_markup_next_token)
+{
+	const char *markup = "a<b class='x>y'>&amp;<!-- c --></B ><3";
+	PurpleMarkupToken token;
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	assert_int_equal(PURPLE_MARKUP_TOKEN_TEXT, token.type);
+	assert_int_equal(1, token.len);
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	assert_int_equal(PURPLE_MARKUP_TOKEN_START_TAG, token.type);
+	assert_int_equal(15, token.len);
+	assert_int_equal(1, token.name_len);
+	fail_unless(strncmp(token.attrs, " class='x>y'", token.attrs_len) == 0);
+	fail_if(token.empty);
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	assert_int_equal(PURPLE_MARKUP_TOKEN_ENTITY, token.type);
+	assert_int_equal(5, token.len);
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	assert_int_equal(PURPLE_MARKUP_TOKEN_COMMENT, token.type);
+	assert_int_equal(10, token.len);
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	assert_int_equal(PURPLE_MARKUP_TOKEN_END_TAG, token.type);
+	fail_unless(strncmp(token.name, "B", token.name_len) == 0);
+
+	/* A '<' that doesn't start a tag is just text */
+	fail_unless(purple_markup_next_token(&markup, &token));
+	assert_int_equal(PURPLE_MARKUP_TOKEN_TEXT, token.type);
+	assert_int_equal(1, token.len);
+	fail_unless(purple_markup_next_token(&markup, &token));
+	assert_int_equal(PURPLE_MARKUP_TOKEN_TEXT, token.type);
+	assert_int_equal(1, token.len);
+
+	fail_if(purple_markup_next_token(&markup, &token));
+}
+END_TEST
+
+START_TEST(test_markup_strip_html)
+{
+	assert_string_equal_free("big red", purple_markup_strip_html(
+			"<FONT FACE=\"Arial\" SIZE=4 COLOR=\"#ff0000\">big <B>red</B></FONT>"));
+	assert_string_equal_free("I <3 you & me", purple_markup_strip_html("I <3 <i>you</i> &amp; me"));
+	assert_string_equal_free("Pidgin (http://pidgin.im/)  rocks", purple_markup_strip_html(
+			"<a href=\"http://pidgin.im/\">Pidgin</a> <!-- hidden --> rocks"));
+	assert_string_equal_free("http://x.org/", purple_markup_strip_html(
+			"<a href=\"http://x.org/\">http://x.org/</a>"));
+	assert_string_equal_free("\nline\ntwo\n", purple_markup_strip_html("<br>line<BR/>two<hr>"));
+	assert_string_equal_free("visible", purple_markup_strip_html(
+			"<script>var x = \"<b>\";</script>visible<style>b {}</style>"));
+	assert_string_equal_free("a\tb\n", purple_markup_strip_html(
+			"<table><tr><td>a</td> <td>b</td></tr></table>"));
+}
+END_TEST
+
+START_TEST(test_markup_linkify)
+{
+	assert_string_equal_free("see <A HREF=\"http://pidgin.im/\">http://pidgin.im/</A> or mail "
+			"<A HREF=\"mailto:me@example.com\">me@example.com</A>",
+			purple_markup_linkify("see http://pidgin.im/ or mail me@example.com"));
+	assert_string_equal_free("(<A HREF=\"http://example.com/foo\">http://example.com/foo</A>)",
+			purple_markup_linkify("(http://example.com/foo)"));
+	/* Existing links and tag attributes are left alone */
+	assert_string_equal_free("<a href=\"http://x.org/\">http://x.org/</a> then "
+			"<A HREF=\"http://www.pidgin.im\">www.pidgin.im</A>.",
+			purple_markup_linkify("<a href=\"http://x.org/\">http://x.org/</a> then www.pidgin.im."));
+	assert_string_equal_free("<A HREF=\"http://pidgin.im/\">http://pidgin.im/</A><img src=\"http://x.org/y.png\">",
+			purple_markup_linkify("http://pidgin.im/<img src=\"http://x.org/y.png\">"));
+}
+END_TEST
+
+START_TEST(test_markup_slice)
+{
+	assert_string_equal_free("<b>ld</b><i>ital</i>", purple_markup_slice("<b>bold</b><i>italic &lt;3</i>", 2, 8));
+	assert_string_equal_free("<FONT FACE=\"Arial\">g <B>red</B></FONT>",
+			purple_markup_slice("<FONT FACE=\"Arial\">big <B>red</B></FONT>", 2, 8));
+	assert_string_equal_free("<3 <i>you</i>", purple_markup_slice("I <3 <i>you</i> &amp; me", 2, 8));
+	assert_string_equal_free("ine<BR/>tw", purple_markup_slice("<br>line<BR/>two<hr>", 2, 8));
+}
+END_TEST
+
+/* Running some typical messages through each of the markup functions */
+START_TEST(test_markup_benchmark)
+{
+	static const char *messages[] = {
+		"<HTML><BODY BGCOLOR=\"#ffffff\"><FONT FACE=\"Arial\" SIZE=2 COLOR=\"#000000\">"
+			"hey, did you see <A HREF=\"http://www.example.com/news/2010/article.html\">"
+			"this article</A>? it's pretty good &amp; worth a read</FONT></BODY></HTML>",
+		"<font color=\"#0000ff\"><b>ok</b> i'll check http://pidgin.im/ later, "
+			"mail me at someone@example.com (or ping me)</font><br>thanks!",
+		"Just some plain text that goes on for a while without any markup at all, "
+			"which is what most messages look like in practice.",
+		"<span style='font-size: small;'>lol <img src=\"smiley.png\" alt=\":)\"/> "
+			"&lt;3 &quot;quoted&quot;</span>"
+	};
+	GTimer *timer = g_timer_new();
+	int i;
+
+	for (i = 0; i < 20000; i++) {
+		const char *msg = messages[i % G_N_ELEMENTS(messages)];
+		char *xhtml, *plain;
+
+		purple_markup_html_to_xhtml(msg, &xhtml, &plain);
+		g_free(xhtml);
+		g_free(plain);
+		g_free(purple_markup_strip_html(msg));
+		g_free(purple_markup_linkify(msg));
+		g_free(purple_markup_slice(msg, 10, 40));
+	}
+	g_timer_stop(timer);
+
+	check_report_timing("Ran %d messages through the markup functions in "
+			"%.3f seconds", i, g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+}
+END_TEST
+
+/*
+ * The escaping and unescaping as they were before they learned to skip
+ * over text that needs no work, to check the fast paths against.
+ */
+static gchar *
+reference_escape_text(const gchar *text, gssize length)
+{
+	GString *str = g_string_new(NULL);
+	const gchar *p, *end;
+
+	if (length < 0)
+		length = strlen(text);
+
+	for (p = text, end = text + length; p != end; p = g_utf8_next_char(p)) {
+		gunichar c;
+
+		switch (*p) {
+			case '&': g_string_append(str, "&amp;"); break;
+			case '<': g_string_append(str, "&lt;"); break;
+			case '>': g_string_append(str, "&gt;"); break;
+			case '"': g_string_append(str, "&quot;"); break;
+			default:
+				c = g_utf8_get_char(p);
+				if ((0x1 <= c && c <= 0x8) || (0xb <= c && c <= 0xc) ||
+						(0xe <= c && c <= 0x1f) || (0x7f <= c && c <= 0x84) ||
+						(0x86 <= c && c <= 0x9f))
+					g_string_append_printf(str, "&#x%x;", c);
+				else
+					g_string_append_len(str, p, g_utf8_next_char(p) - p);
+				break;
+		}
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+static const char *
+reference_unescape_entity(const char *text, int *length)
+{
+	static const struct {
+		const char *entity;
+		const char *text;
+	} entities[] = {
+		{ "&amp;", "&" }, { "&lt;", "<" }, { "&gt;", ">" },
+		{ "&nbsp;", " " }, { "&copy;", "\302\251" }, { "&quot;", "\"" },
+		{ "&reg;", "\302\256" }, { "&apos;", "'" }
+	};
+	static char buf[7];
+	unsigned int pound;
+	char temp[2];
+	int i, len;
+
+	if (*text != '&')
+		return NULL;
+
+	for (i = 0; i < G_N_ELEMENTS(entities); i++) {
+		len = strlen(entities[i].entity);
+		if (!g_ascii_strncasecmp(text, entities[i].entity, len)) {
+			*length = len;
+			return entities[i].text;
+		}
+	}
+
+	if (text[1] == '#' && (sscanf(text, "&#%u%1[;]", &pound, temp) == 2 ||
+				sscanf(text, "&#x%x%1[;]", &pound, temp) == 2) && pound != 0) {
+		buf[g_unichar_to_utf8((gunichar)pound, buf)] = '\0';
+		len = (text[2] == 'x' ? 3 : 2);
+		while (g_ascii_isxdigit(text[len]))
+			len++;
+		if (text[len] == ';')
+			len++;
+		*length = len;
+		return buf;
+	}
+
+	return NULL;
+}
+
+static gchar *
+reference_unescape(const char *text, gboolean html)
+{
+	GString *ret = g_string_new(NULL);
+	const char *ent;
+	int len;
+
+	while (*text) {
+		if ((ent = reference_unescape_entity(text, &len)) != NULL) {
+			g_string_append(ret, ent);
+			text += len;
+		} else if (html && !strncmp(text, "<br>", 4)) {
+			g_string_append_c(ret, '\n');
+			text += 4;
+		} else {
+			g_string_append_c(ret, *text++);
+		}
+	}
+
+	return g_string_free(ret, FALSE);
+}
+
+static void
+check_escape(const gchar *text, gssize length)
+{
+	GString *str = g_string_new("x");
+	gchar *expected;
+
+	expected = reference_escape_text(text, length);
+	assert_string_equal_free(expected, purple_markup_escape_text(text, length));
+	g_free(expected);
+
+	expected = g_markup_escape_text(text, length);
+	purple_markup_append_escaped_text(str, text, length);
+	assert_string_equal(expected, str->str + 1);
+	g_free(expected);
+	g_string_free(str, TRUE);
+}
+
+static void
+check_unescape(const char *text)
+{
+	const char *ent, *expected_ent;
+	gchar *expected;
+	int len = 0, expected_len = 0;
+
+	expected = reference_unescape(text, FALSE);
+	assert_string_equal_free(expected, purple_unescape_text(text));
+	g_free(expected);
+
+	expected = reference_unescape(text, TRUE);
+	assert_string_equal_free(expected, purple_unescape_html(text));
+	g_free(expected);
+
+	/* Both return the same static buffer for numeric entities */
+	ent = purple_markup_unescape_entity(text, &len);
+	expected = ent ? g_strdup(ent) : NULL;
+	expected_ent = reference_unescape_entity(text, &expected_len);
+	fail_unless((expected == NULL) == (expected_ent == NULL), "%s", text);
+	if (expected != NULL) {
+		assert_string_equal(expected_ent, expected);
+		assert_int_equal(expected_len, len);
+	}
+	g_free(expected);
+}
+
+START_TEST(test_markup_escape_text)
+{
+	static const char *pieces[] = {
+		"a", "&", "<", ">", "\"", "'", "\t", "\n", "\x01", "\x7f",
+		"\xc2\x85", "\xc2\x80", "\xc2\x9f", "\xc2\xa0", "\xc3\xa9", "\xe2\x82\xac"
+	};
+	char buf[32];
+	gunichar c;
+	int i, j, offset;
+
+	/* Every character, and the ones that fit in a byte or two at every
+	 * offset into the words the fast path reads */
+	for (c = 1; c <= 0x10ffff; c++) {
+		if (c >= 0xd800 && c <= 0xdfff)
+			continue;
+
+		for (offset = 0; offset < (c < 0x800 ? 17 : 1); offset++) {
+			memset(buf, 'a', sizeof(buf));
+			buf[offset + g_unichar_to_utf8(c, buf + offset) + 6] = '\0';
+			check_escape(buf, -1);
+		}
+	}
+
+	/* Runs of the interesting ones */
+	for (i = 0; i < 16 * 16 * 16; i++) {
+		GString *str = g_string_new("abcdefg");
+		int n = i;
+
+		for (j = 0; j < 3; j++, n /= 16)
+			g_string_append(str, pieces[n % 16]);
+		g_string_append(str, "hijklmn");
+
+		check_escape(str->str, -1);
+		check_escape(str->str, str->len - 3);
+		g_string_free(str, TRUE);
+	}
+
+	check_escape("ab\0&cdefghijklmnop", 18);
+}
+END_TEST
+
+START_TEST(test_markup_unescape)
+{
+	static const char alphabet[] = "&;#xXamplgtbsqucoyreAMPLT09fF< ";
+	static const char *entities[] = {
+		"&amp;", "&lt;", "&gt;", "&nbsp;", "&copy;", "&quot;", "&reg;",
+		"&apos;", "&#65;", "&#x41;", "&#x1F600;", "&#0;", "&AMP;", "&Lt;",
+		"&amp", "&", "<br>", "<BR>", "<br/>"
+	};
+	char buf[32];
+	int i, j, k, n, total;
+
+	/* Every string of up to four characters after an & */
+	for (k = 1, total = 1; k <= 4; k++) {
+		total *= sizeof(alphabet) - 1;
+		for (i = 0; i < total; i++) {
+			buf[0] = '&';
+			for (j = 0, n = i; j < k; j++, n /= sizeof(alphabet) - 1)
+				buf[j + 1] = alphabet[n % (sizeof(alphabet) - 1)];
+			buf[k + 1] = '\0';
+			check_unescape(buf);
+		}
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(entities); i++) {
+		for (j = 0; j < G_N_ELEMENTS(entities); j++) {
+			g_snprintf(buf, sizeof(buf), "x%sy%s z<b>", entities[i], entities[j]);
+			check_unescape(buf);
+		}
+	}
 }
 END_TEST
 
@@ -232,6 +586,273 @@ START_TEST(test_strdup_withhtml)
 }
 END_TEST
 
+/* Writes a file in the user directory, returning its full path */
+static char *
+write_user_file(const char *filename, const char *contents)
+{
+	char *path = g_build_filename(purple_user_dir(), filename, NULL);
+
+	fail_unless(g_file_set_contents(path, contents, -1, NULL));
+
+	return path;
+}
+
+static char *
+big_xml_file(const char *root, const char *element, int count)
+{
+	GString *xml = g_string_new(NULL);
+	int i;
+
+	g_string_append_printf(xml, "<?xml version='1.0' encoding='UTF-8' ?>\n"
+			"<%s version='1.0'>", root);
+	for (i = 0; i < count; i++)
+		g_string_append_printf(xml, "<%s name='item&#%d;%d@example.com' "
+				"account='me@example.com' proto='prpl-check'>"
+				"<alias>Item %d &amp; co</alias>"
+				"<setting name='last_seen' type='int'>%d</setting>"
+				"</%s>", element, 0x100 + i % 0x100, i, i, i, element);
+	g_string_append_printf(xml, "</%s>\n", root);
+
+	return g_string_free(xml, FALSE);
+}
+
+static const char * const prefetch_xml_files[] = {
+	"blist.xml", "accounts.xml", "status.xml", NULL
+};
+
+START_TEST(test_util_prefetch_files)
+{
+	static const char * const files[] = { "pounces.xml", "missing", NULL };
+	static const char * const xml_files[] = {
+		"blist.xml", "accounts.xml", "status.xml", "missing.xml", NULL
+	};
+	char *dir, *paths[4], *contents, *missing, *before[3];
+	xmlnode *nodes[3];
+	gsize length;
+	GTimer *timer;
+	double sequential, prefetched;
+	int i;
+
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	dir = g_strdup_printf("%s" G_DIR_SEPARATOR_S "purple-check-prefetch-%d",
+			g_get_tmp_dir(), getpid());
+	fail_unless(g_mkdir(dir, S_IRUSR | S_IWUSR | S_IXUSR) == 0);
+	purple_util_set_user_dir(dir);
+
+	contents = big_xml_file("purple", "buddy", PREFETCH_BUDDIES);
+	paths[0] = write_user_file("blist.xml", contents);
+	g_free(contents);
+	contents = big_xml_file("account", "account", PREFETCH_BUDDIES / 10);
+	paths[1] = write_user_file("accounts.xml", contents);
+	g_free(contents);
+	contents = big_xml_file("statuses", "status", PREFETCH_BUDDIES / 2);
+	paths[2] = write_user_file("status.xml", contents);
+	g_free(contents);
+	paths[3] = write_user_file("pounces.xml", "<pounces version='1.0'/>");
+
+	/* What reading them one after the other gets, and how long it takes */
+	timer = g_timer_new();
+	for (i = 0; i < 3; i++)
+		nodes[i] = purple_util_read_xml_from_file(prefetch_xml_files[i], "check");
+	sequential = g_timer_elapsed(timer, NULL);
+
+	for (i = 0; i < 3; i++) {
+		fail_unless(nodes[i] != NULL);
+		before[i] = xmlnode_to_str(nodes[i], NULL);
+		xmlnode_free(nodes[i]);
+	}
+
+	/* Prefetching reads and parses them all at once, and gets the same */
+	g_timer_start(timer);
+	_purple_util_prefetch_files(files, xml_files);
+	for (i = 0; i < 3; i++)
+		nodes[i] = purple_util_read_xml_from_file(prefetch_xml_files[i], "check");
+	prefetched = g_timer_elapsed(timer, NULL);
+
+	for (i = 0; i < 3; i++) {
+		fail_unless(nodes[i] != NULL);
+		fail_unless(nodes[i]->child != NULL);
+		assert_string_equal_free(before[i], xmlnode_to_str(nodes[i], NULL));
+		xmlnode_free(nodes[i]);
+		g_free(before[i]);
+	}
+
+	check_report_timing("Reading the files took %.3f seconds, or %.3f "
+			"seconds prefetched", sequential, prefetched);
+
+	/* Files that aren't there are left to be read as usual */
+	fail_if(purple_util_read_xml_from_file("missing.xml", "check"));
+	fail_if(_purple_util_take_prefetched_file(paths[0], &contents, NULL));
+
+	missing = g_build_filename(dir, "missing", NULL);
+	fail_if(_purple_util_take_prefetched_file(missing, &contents, &length));
+	g_free(missing);
+
+	fail_unless(_purple_util_take_prefetched_file(paths[3], &contents, &length));
+	assert_int_equal(strlen("<pounces version='1.0'/>"), length);
+	assert_string_equal_free("<pounces version='1.0'/>", contents);
+	fail_if(_purple_util_take_prefetched_file(paths[3], &contents, &length));
+
+	purple_util_set_user_dir("/dev/null");
+
+	for (i = 0; i < 4; i++) {
+		g_unlink(paths[i]);
+		g_free(paths[i]);
+	}
+	g_rmdir(dir);
+
+	g_timer_destroy(timer);
+	g_free(dir);
+}
+END_TEST
+
+/* A tree like a big buddy list's */
+static xmlnode *
+big_blist_tree(int buddies)
+{
+	xmlnode *root, *blist, *group = NULL, *contact, *buddy, *setting;
+	char name[64];
+	int i;
+
+	root = xmlnode_new("purple");
+	xmlnode_set_attrib(root, "version", "1.0");
+	blist = xmlnode_new_child(root, "blist");
+
+	for (i = 0; i < buddies; i++) {
+		if (i % 100 == 0) {
+			g_snprintf(name, sizeof(name), "Group %d", i / 100);
+			group = xmlnode_new_child(blist, "group");
+			xmlnode_set_attrib(group, "name", name);
+		}
+
+		contact = xmlnode_new_child(group, "contact");
+		buddy = xmlnode_new_child(contact, "buddy");
+		xmlnode_set_attrib(buddy, "account", "me@example.com");
+		xmlnode_set_attrib(buddy, "proto", "prpl-check");
+		g_snprintf(name, sizeof(name), "buddy%d@example.com", i);
+		xmlnode_insert_data(xmlnode_new_child(buddy, "name"), name, -1);
+		g_snprintf(name, sizeof(name), "Buddy <%d> & co", i);
+		xmlnode_insert_data(xmlnode_new_child(buddy, "alias"), name, -1);
+		setting = xmlnode_new_child(buddy, "setting");
+		xmlnode_set_attrib(setting, "name", "last_seen");
+		xmlnode_set_attrib(setting, "type", "int");
+		g_snprintf(name, sizeof(name), "%d", 1300000000 + i);
+		xmlnode_insert_data(setting, name, -1);
+	}
+
+	return root;
+}
+
+START_TEST(test_util_xml_snapshot)
+{
+	char *dir, *path, *snapshot, *expected, *contents, *edited;
+	gsize length;
+	const char *namespaced = "<a xmlns='urn:a' xmlns:b='urn:b'>"
+			"<b:c b:d='e &amp; f'>g<h/>i</b:c></a>";
+	xmlnode *node;
+	FILE *file;
+	gboolean snapshots = purple_prefs_get_bool("/purple/snapshots");
+
+	dir = g_strdup_printf("%s" G_DIR_SEPARATOR_S "purple-check-snapshot-%d",
+			g_get_tmp_dir(), getpid());
+	fail_unless(g_mkdir(dir, S_IRUSR | S_IWUSR | S_IXUSR) == 0);
+	purple_util_set_user_dir(dir);
+	path = g_build_filename(dir, "blist.xml", NULL);
+	snapshot = g_build_filename(dir, "blist.xml.snapshot", NULL);
+
+	/* Without snapshots, there's just the file */
+	purple_prefs_set_bool("/purple/snapshots", FALSE);
+	node = big_blist_tree(SNAPSHOT_BUDDIES);
+	expected = xmlnode_to_str(node, NULL);
+	fail_unless(purple_util_write_xml_to_file("blist.xml", node));
+	xmlnode_free(node);
+	fail_unless(g_file_test(path, G_FILE_TEST_EXISTS));
+	fail_if(g_file_test(snapshot, G_FILE_TEST_EXISTS));
+
+	node = purple_util_read_xml_from_file("blist.xml", "check");
+	fail_unless(node != NULL);
+	xmlnode_free(node);
+
+	/* With them, reading the file gets the same tree from the snapshot */
+	purple_prefs_set_bool("/purple/snapshots", TRUE);
+	node = big_blist_tree(SNAPSHOT_BUDDIES);
+	fail_unless(purple_util_write_xml_to_file("blist.xml", node));
+	xmlnode_free(node);
+	fail_unless(g_file_test(snapshot, G_FILE_TEST_EXISTS));
+
+	node = purple_util_read_xml_from_file("blist.xml", "check");
+	fail_unless(node != NULL);
+	assert_string_equal_free(expected, xmlnode_to_str(node, NULL));
+	xmlnode_free(node);
+
+	/* Namespaces, prefixes and mixed content all come back */
+	g_free(expected);
+	node = xmlnode_from_str(namespaced, -1);
+	expected = xmlnode_to_str(node, NULL);
+	fail_unless(purple_util_write_xml_to_file("blist.xml", node));
+	xmlnode_free(node);
+	node = purple_util_read_xml_from_file("blist.xml", "check");
+	fail_unless(node != NULL);
+	assert_string_equal_free(expected, xmlnode_to_str(node, NULL));
+	assert_string_equal("urn:b", xmlnode_get_namespace(xmlnode_get_child(node, "c")));
+	assert_string_equal("b", xmlnode_get_prefix(xmlnode_get_child(node, "c")));
+	xmlnode_free(node);
+
+	/* A snapshot that doesn't check out is passed over for the file */
+	fail_unless((file = g_fopen(snapshot, "r+b")) != NULL);
+	fseek(file, -1, SEEK_END);
+	fputc('!', file);
+	fclose(file);
+	node = purple_util_read_xml_from_file("blist.xml", "check");
+	fail_unless(node != NULL);
+	assert_string_equal("e & f",
+			xmlnode_get_attrib(xmlnode_get_child(node, "c"), "d"));
+	xmlnode_free(node);
+
+	/* So is one for a file that has changed since, even right away and
+	 * without changing its size */
+	node = xmlnode_from_str(namespaced, -1);
+	fail_unless(purple_util_write_xml_to_file("blist.xml", node));
+	xmlnode_free(node);
+	fail_unless(g_file_get_contents(path, &contents, &length, NULL));
+	fail_unless((edited = strstr(contents, "e &amp; f")) != NULL);
+	edited[0] = 'E';
+	fail_unless(purple_util_write_data_to_file("blist.xml", contents, length));
+	g_free(contents);
+	node = purple_util_read_xml_from_file("blist.xml", "check");
+	fail_unless(node != NULL);
+	assert_string_equal("E & f",
+			xmlnode_get_attrib(xmlnode_get_child(node, "c"), "d"));
+	xmlnode_free(node);
+
+	fail_unless(purple_util_write_data_to_file("blist.xml", "<purple/>", -1));
+	node = purple_util_read_xml_from_file("blist.xml", "check");
+	fail_unless(node != NULL);
+	assert_string_equal_free("<purple/>", xmlnode_to_str(node, NULL));
+	xmlnode_free(node);
+
+	/* And turning snapshots off gets rid of it */
+	purple_prefs_set_bool("/purple/snapshots", FALSE);
+	node = xmlnode_new("purple");
+	fail_unless(purple_util_write_xml_to_file("blist.xml", node));
+	xmlnode_free(node);
+	fail_if(g_file_test(snapshot, G_FILE_TEST_EXISTS));
+
+	purple_prefs_set_bool("/purple/snapshots", snapshots);
+	purple_util_set_user_dir("/dev/null");
+
+	g_unlink(path);
+	g_rmdir(dir);
+
+	g_free(expected);
+	g_free(snapshot);
+	g_free(path);
+	g_free(dir);
+}
+END_TEST
+
 Suite *
 util_suite(void)
 {
@@ -270,6 +891,16 @@ util_suite(void)
 
 	tc = tcase_create("Markup");
 	tcase_add_test(tc, test_markup_html_to_xhtml);
+	tcase_add_test(tc, test_markup_next_token);
+	tcase_add_test(tc, test_markup_strip_html);
+	tcase_add_test(tc, test_markup_linkify);
+	tcase_add_test(tc, test_markup_slice);
+	tcase_add_test(tc, test_markup_benchmark);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Escaping");
+	tcase_add_test(tc, test_markup_escape_text);
+	tcase_add_test(tc, test_markup_unescape);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("Stripping Unparseables");
@@ -284,5 +915,13 @@ util_suite(void)
 	tcase_add_test(tc, test_strdup_withhtml);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("Prefetching");
+	tcase_add_test(tc, test_util_prefetch_files);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Snapshots");
+	tcase_add_test(tc, test_util_xml_snapshot);
+	suite_add_tcase(s, tc);
+
 	return s;
 }
@@ -0,0 +1,440 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tests.h"
+#include "../eventloop.h"
+#include "../util.h"
+
+/*
+ * A tiny HTTP server on 127.0.0.1 for the fetches to talk to.  It answers
+ * one request with a canned response, written a piece at a time so that
+ * the client gets it in bits.
+ */
+typedef struct {
+	int listener;
+	int client;
+	guint inpa;
+	guint timeout;
+	GString *request;
+	GPtrArray *pieces;
+	guint next_piece;
+	gsize written;
+	char *url;
+} TestHttpServer;
+
+static gboolean
+server_write_cb(gpointer data)
+{
+	TestHttpServer *server = data;
+	const char *piece;
+	gsize piece_len;
+	int len;
+
+	if (server->next_piece == server->pieces->len) {
+		close(server->client);
+		server->client = -1;
+		server->timeout = 0;
+		return FALSE;
+	}
+
+	piece = g_ptr_array_index(server->pieces, server->next_piece);
+	piece_len = strlen(piece);
+	len = write(server->client, piece + server->written, piece_len - server->written);
+	if (len < 0 && errno == EAGAIN)
+		return TRUE;
+	if (len < 0) {
+		/* The client hung up */
+		server->timeout = 0;
+		return FALSE;
+	}
+
+	server->written += len;
+	if (server->written == piece_len) {
+		server->next_piece++;
+		server->written = 0;
+	}
+
+	return TRUE;
+}
+
+static void
+server_read_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	TestHttpServer *server = data;
+	char buf[1024];
+	int len;
+
+	len = read(source, buf, sizeof(buf));
+	if (len < 0 && errno == EAGAIN)
+		return;
+
+	if (len > 0) {
+		g_string_append_len(server->request, buf, len);
+		if (strstr(server->request->str, "\r\n\r\n") == NULL)
+			return;
+		server->timeout = purple_timeout_add(1, server_write_cb, server);
+	}
+
+	purple_input_remove(server->inpa);
+	server->inpa = 0;
+}
+
+static void
+server_accept_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	TestHttpServer *server = data;
+
+	server->client = accept(source, NULL, NULL);
+	if (server->client < 0)
+		return;
+
+	fcntl(server->client, F_SETFL, O_NONBLOCK);
+	purple_input_remove(server->inpa);
+	server->inpa = purple_input_add(server->client, PURPLE_INPUT_READ,
+			server_read_cb, server);
+}
+
+static TestHttpServer *
+test_http_server_new(void)
+{
+	TestHttpServer *server = g_new0(TestHttpServer, 1);
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+
+	/* Writing to a fetch that has been cancelled mustn't kill us */
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	server->listener = socket(AF_INET, SOCK_STREAM, 0);
+	fail_unless(server->listener >= 0);
+	fail_unless(bind(server->listener, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	fail_unless(listen(server->listener, 1) == 0);
+	fail_unless(getsockname(server->listener, (struct sockaddr *)&addr, &addrlen) == 0);
+
+	server->client = -1;
+	server->request = g_string_new(NULL);
+	server->pieces = g_ptr_array_new();
+	server->url = g_strdup_printf("http://127.0.0.1:%d/test", ntohs(addr.sin_port));
+	server->inpa = purple_input_add(server->listener, PURPLE_INPUT_READ,
+			server_accept_cb, server);
+
+	return server;
+}
+
+/* Queues the next piece of the response */
+static void
+test_http_server_add(TestHttpServer *server, const char *piece)
+{
+	g_ptr_array_add(server->pieces, g_strdup(piece));
+}
+
+static void
+test_http_server_free(TestHttpServer *server)
+{
+	guint i;
+
+	if (server->inpa)
+		purple_input_remove(server->inpa);
+	if (server->timeout)
+		purple_timeout_remove(server->timeout);
+	if (server->client >= 0)
+		close(server->client);
+	close(server->listener);
+
+	for (i = 0; i < server->pieces->len; i++)
+		g_free(g_ptr_array_index(server->pieces, i));
+	g_ptr_array_free(server->pieces, TRUE);
+	g_string_free(server->request, TRUE);
+	g_free(server->url);
+	g_free(server);
+}
+
+typedef struct {
+	GMainLoop *loop;
+	gboolean done;
+	gboolean timed_out;
+	gchar *data;
+	gsize len;
+	gchar *error;
+	GString *body;      /* What the stream callback got */
+	int pieces;
+	gsize stop_after;   /* Stop streaming after this much, if not 0 */
+} FetchResult;
+
+static void
+fetch_cb(PurpleUtilFetchUrlData *url_data, gpointer user_data,
+		const gchar *url_text, gsize len, const gchar *error_message)
+{
+	FetchResult *result = user_data;
+
+	result->done = TRUE;
+	result->data = url_text ? g_strndup(url_text, len) : NULL;
+	result->len = len;
+	result->error = g_strdup(error_message);
+	g_main_loop_quit(result->loop);
+}
+
+static gboolean
+fetch_stream_cb(PurpleUtilFetchUrlData *url_data, gpointer user_data,
+		const gchar *data, gsize len)
+{
+	FetchResult *result = user_data;
+
+	g_string_append_len(result->body, data, len);
+	result->pieces++;
+
+	if (result->stop_after && result->body->len >= result->stop_after) {
+		g_main_loop_quit(result->loop);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+fetch_timeout_cb(gpointer data)
+{
+	FetchResult *result = data;
+
+	result->timed_out = TRUE;
+	g_main_loop_quit(result->loop);
+
+	return FALSE;
+}
+
+static void
+fetch_result_init(FetchResult *result)
+{
+	memset(result, 0, sizeof(FetchResult));
+	result->loop = g_main_loop_new(NULL, FALSE);
+	result->body = g_string_new(NULL);
+}
+
+static void
+fetch_result_run(FetchResult *result)
+{
+	guint timeout = g_timeout_add(3000, fetch_timeout_cb, result);
+
+	g_main_loop_run(result->loop);
+	fail_if(result->timed_out, "The fetch never finished");
+	g_source_remove(timeout);
+}
+
+static void
+fetch_result_clear(FetchResult *result)
+{
+	g_main_loop_unref(result->loop);
+	g_free(result->data);
+	g_free(result->error);
+	g_string_free(result->body, TRUE);
+}
+
+START_TEST(test_util_fetch_url_content_length)
+{
+	TestHttpServer *server = test_http_server_new();
+	FetchResult result;
+
+	test_http_server_add(server, "HTTP/1.0 200 OK\r\nContent-Len");
+	test_http_server_add(server, "gth: 11\r\n\r\nhello");
+	test_http_server_add(server, " world");
+
+	fetch_result_init(&result);
+	purple_util_fetch_url_request(server->url, FALSE, "check", FALSE, NULL,
+			FALSE, fetch_cb, &result);
+	fetch_result_run(&result);
+
+	fail_unless(g_str_has_prefix(server->request->str, "GET /test HTTP/1.0\r\n"));
+	fail_unless(result.error == NULL);
+	assert_string_equal("hello world", result.data);
+	assert_int_equal(11, (int)result.len);
+
+	fetch_result_clear(&result);
+	test_http_server_free(server);
+}
+END_TEST
+
+static void
+add_chunked_response(TestHttpServer *server)
+{
+	test_http_server_add(server, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r");
+	test_http_server_add(server, "\nhello\r\n");
+	test_http_server_add(server, "6\r\n wor");
+	test_http_server_add(server, "ld\r\n0\r\n\r\n");
+}
+
+START_TEST(test_util_fetch_url_chunked)
+{
+	TestHttpServer *server = test_http_server_new();
+	FetchResult result;
+
+	add_chunked_response(server);
+
+	fetch_result_init(&result);
+	purple_util_fetch_url_request(server->url, FALSE, NULL, TRUE, NULL,
+			FALSE, fetch_cb, &result);
+	fetch_result_run(&result);
+
+	fail_unless(result.error == NULL);
+	assert_string_equal("hello world", result.data);
+	assert_int_equal(11, (int)result.len);
+
+	fetch_result_clear(&result);
+	test_http_server_free(server);
+
+	/* The headers and the chunks come back as they were */
+	server = test_http_server_new();
+	add_chunked_response(server);
+
+	fetch_result_init(&result);
+	purple_util_fetch_url_request(server->url, FALSE, NULL, TRUE, NULL,
+			TRUE, fetch_cb, &result);
+	fetch_result_run(&result);
+
+	assert_string_equal("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+			"5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", result.data);
+
+	fetch_result_clear(&result);
+	test_http_server_free(server);
+}
+END_TEST
+
+START_TEST(test_util_fetch_url_stream)
+{
+	TestHttpServer *server = test_http_server_new();
+	FetchResult result;
+
+	add_chunked_response(server);
+
+	fetch_result_init(&result);
+	purple_util_fetch_url_stream_with_account(NULL, server->url, FALSE, NULL,
+			TRUE, NULL, -1, fetch_stream_cb, fetch_cb, &result);
+	fetch_result_run(&result);
+
+	fail_unless(result.done);
+	fail_unless(result.error == NULL);
+	fail_unless(result.data == NULL);
+	assert_int_equal(11, (int)result.len);
+	assert_string_equal("hello world", result.body->str);
+
+	fetch_result_clear(&result);
+	test_http_server_free(server);
+
+	/* Stopping part way means the completion callback never comes */
+	server = test_http_server_new();
+	add_chunked_response(server);
+
+	fetch_result_init(&result);
+	result.stop_after = 1;
+	purple_util_fetch_url_stream_with_account(NULL, server->url, FALSE, NULL,
+			TRUE, NULL, -1, fetch_stream_cb, fetch_cb, &result);
+	fetch_result_run(&result);
+
+	fail_if(result.done);
+	assert_int_equal(1, result.pieces);
+
+	fetch_result_clear(&result);
+	test_http_server_free(server);
+}
+END_TEST
+
+START_TEST(test_util_fetch_url_too_long)
+{
+	TestHttpServer *server = test_http_server_new();
+	FetchResult result;
+
+	add_chunked_response(server);
+
+	fetch_result_init(&result);
+	purple_util_fetch_url_request_len(server->url, FALSE, NULL, TRUE, NULL,
+			FALSE, 8, fetch_cb, &result);
+	fetch_result_run(&result);
+
+	fail_unless(result.error != NULL);
+	fail_unless(result.data == NULL);
+
+	fetch_result_clear(&result);
+	test_http_server_free(server);
+
+	server = test_http_server_new();
+	add_chunked_response(server);
+
+	fetch_result_init(&result);
+	purple_util_fetch_url_stream_with_account(NULL, server->url, FALSE, NULL,
+			TRUE, NULL, 8, fetch_stream_cb, fetch_cb, &result);
+	fetch_result_run(&result);
+
+	/* Whatever made it through before the limit was the start of the body */
+	fail_unless(result.error != NULL);
+	fail_unless(result.body->len <= 8);
+	fail_unless(strncmp("hello world", result.body->str, result.body->len) == 0);
+
+	fetch_result_clear(&result);
+	test_http_server_free(server);
+}
+END_TEST
+
+/* A body that arrives over many reads is put back together either way */
+START_TEST(test_util_fetch_url_large)
+{
+	TestHttpServer *server;
+	FetchResult result;
+	gchar *piece = g_strnfill(4 * 1024, 'x');
+	int i, round;
+
+	for (round = 0; round < 2; round++) {
+		server = test_http_server_new();
+		test_http_server_add(server, "HTTP/1.0 200 OK\r\nContent-Length: 65536\r\n\r\n");
+		for (i = 0; i < 16; i++)
+			test_http_server_add(server, piece);
+
+		fetch_result_init(&result);
+		if (round == 0)
+			purple_util_fetch_url_request_len(server->url, FALSE, NULL, FALSE,
+					NULL, FALSE, 128 * 1024, fetch_cb, &result);
+		else
+			purple_util_fetch_url_stream_with_account(NULL, server->url, FALSE,
+					NULL, FALSE, NULL, -1, fetch_stream_cb, fetch_cb, &result);
+		fetch_result_run(&result);
+
+		fail_unless(result.error == NULL);
+		assert_int_equal(65536, (int)result.len);
+		if (round == 0) {
+			assert_int_equal(65536, (int)strlen(result.data));
+		} else {
+			assert_int_equal(65536, (int)result.body->len);
+			fail_unless(result.pieces > 1);
+		}
+
+		fetch_result_clear(&result);
+		test_http_server_free(server);
+	}
+
+	g_free(piece);
+}
+END_TEST
+
+Suite *
+util_fetch_url_suite(void)
+{
+	Suite *s = suite_create("URL Fetching");
+
+	TCase *tc = tcase_create("Local server");
+	tcase_add_test(tc, test_util_fetch_url_content_length);
+	tcase_add_test(tc, test_util_fetch_url_chunked);
+	tcase_add_test(tc, test_util_fetch_url_stream);
+	tcase_add_test(tc, test_util_fetch_url_too_long);
+	tcase_add_test(tc, test_util_fetch_url_large);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
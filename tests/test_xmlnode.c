@@ -21,6 +21,74 @@ START_TEST(test_xmlnode_billion_laughs_attack)
 }
 END_TEST
 
+START_TEST(test_xmlnode_to_str)
+{
+	xmlnode *message, *body;
+	int len;
+
+	message = xmlnode_new("message");
+	xmlnode_set_namespace(message, "jabber:client");
+	xmlnode_set_attrib(message, "to", "a&b@example.com");
+	body = xmlnode_new_child(message, "body");
+	xmlnode_insert_data(body, "1 < 2 & \"3\" > 0", -1);
+
+	assert_string_equal_free("<message xmlns='jabber:client' to='a&amp;b@example.com'>"
+			"<body>1 &lt; 2 &amp; &quot;3&quot; &gt; 0</body></message>",
+			xmlnode_to_str(message, &len));
+	assert_int_equal(114, len);
+	assert_string_equal_free("1 < 2 & \"3\" > 0", xmlnode_get_data_unescaped(body));
+
+	xmlnode_free(body);
+	body = xmlnode_new_child(message, "body");
+	xmlnode_insert_data(body, "nothing to escape", -1);
+	assert_string_equal_free("nothing to escape", xmlnode_get_data_unescaped(body));
+	assert_string_equal_free("<message xmlns='jabber:client' to='a&amp;b@example.com'>"
+			"<body>nothing to escape</body></message>", xmlnode_to_str(message, NULL));
+
+	xmlnode_free(message);
+}
+END_TEST
+
+static xmlnode *
+parse_in_pieces(const char *xml, gsize piece)
+{
+	xmlnode_parser *parser = xmlnode_parser_new();
+	gsize len = strlen(xml), i;
+
+	for (i = 0; i < len; i += piece)
+		xmlnode_parser_feed(parser, xml + i, MIN(piece, len - i));
+
+	return xmlnode_parser_finish(parser);
+}
+
+START_TEST(test_xmlnode_parser)
+{
+	const char *xml = "<?xml version='1.0' encoding='UTF-8'?>"
+			"<soap:Envelope xmlns:soap='http://schemas.xmlsoap.org/soap/envelope/'>"
+			"<soap:Body><a x='1'>one &amp; two</a><b/></soap:Body></soap:Envelope>";
+	xmlnode *whole = xmlnode_from_str(xml, -1);
+	char *expected = xmlnode_to_str(whole, NULL);
+	gsize piece;
+
+	/* Wherever the pieces break, the tree comes out the same */
+	for (piece = 1; piece <= strlen(xml); piece++) {
+		xmlnode *node = parse_in_pieces(xml, piece);
+
+		fail_unless(node != NULL, "piece size %d", (int)piece);
+		assert_string_equal_free(expected, xmlnode_to_str(node, NULL));
+		xmlnode_free(node);
+	}
+
+	fail_if(parse_in_pieces("<a><b>unfinished", 4));
+	fail_if(parse_in_pieces("<a>unfinished", 4));
+	fail_if(parse_in_pieces("<a><b></a>", 4));
+	fail_if(parse_in_pieces("", 4));
+
+	g_free(expected);
+	xmlnode_free(whole);
+}
+END_TEST
+
 Suite *
 xmlnode_suite(void)
 {
@@ -28,6 +96,8 @@ xmlnode_suite(void)
 
 	TCase *tc = tcase_create("xmlnode");
 	tcase_add_test(tc, test_xmlnode_billion_laughs_attack);
+	tcase_add_test(tc, test_xmlnode_to_str);
+	tcase_add_test(tc, test_xmlnode_parser);
 	suite_add_tcase(s, tc);
 
 	return s;
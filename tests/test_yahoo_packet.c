@@ -0,0 +1,108 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../protocols/yahoo/libymsg.h"
+#include "../protocols/yahoo/yahoo_packet.h"
+
+static struct yahoo_packet *
+read_payload(const char *data, int len)
+{
+	struct yahoo_packet *pkt = yahoo_packet_new(YAHOO_SERVICE_LIST_15, YAHOO_STATUS_AVAILABLE, 0);
+	yahoo_packet_read(pkt, (const guchar *)data, len);
+	return pkt;
+}
+
+START_TEST(test_yahoo_packet_roundtrip)
+{
+	struct yahoo_packet *pkt, *pkt2;
+	struct yahoo_pair *pair;
+	guchar *buf;
+	size_t len;
+	GSList *l;
+	GString *order;
+
+	pkt = yahoo_packet_new(YAHOO_SERVICE_LIST_15, YAHOO_STATUS_AVAILABLE, 0);
+	yahoo_packet_hash(pkt, "ssi", 1, "me", 7, "buddy1", 13, 2);
+	yahoo_packet_hash_str(pkt, 7, "buddy2");
+	/* "1" "me" + "7" "buddy1" + "13" "2" + "7" "buddy2", plus delimiters */
+	assert_int_equal(36, (int)yahoo_packet_length(pkt));
+
+	len = yahoo_packet_build(pkt, 0, FALSE, FALSE, &buf);
+	assert_int_equal(YAHOO_PACKET_HDRLEN + 36, (int)len);
+
+	pkt2 = read_payload((const char *)buf + YAHOO_PACKET_HDRLEN, 36);
+	assert_int_equal(36, (int)yahoo_packet_length(pkt2));
+
+	/* Handlers walking the list still see the pairs in order */
+	order = g_string_new(NULL);
+	for (l = pkt2->hash; l; l = l->next) {
+		pair = l->data;
+		g_string_append_printf(order, "%d=%s,", pair->key, pair->value);
+	}
+	assert_string_equal("1=me,7=buddy1,13=2,7=buddy2,", order->str);
+	g_string_free(order, TRUE);
+
+	assert_string_equal("me", yahoo_packet_get_str(pkt2, 1));
+	assert_string_equal("buddy2", yahoo_packet_get_str(pkt2, 7));
+	pair = yahoo_packet_find_prev(pkt2, yahoo_packet_find_last(pkt2, 7));
+	assert_string_equal("buddy1", pair->value);
+	fail_unless(NULL == yahoo_packet_find_prev(pkt2, pair));
+	assert_int_equal(2, yahoo_packet_get_int(pkt2, 13, 0));
+	fail_unless(NULL == yahoo_packet_get_str(pkt2, 99));
+	assert_int_equal(-1, yahoo_packet_get_int(pkt2, 99, -1));
+
+	/* Unindexed packets answer the same way */
+	assert_string_equal("buddy2", yahoo_packet_get_str(pkt, 7));
+	assert_int_equal(2, yahoo_packet_get_int(pkt, 13, 0));
+
+	g_free(buf);
+	yahoo_packet_free(pkt);
+	yahoo_packet_free(pkt2);
+}
+END_TEST
+
+START_TEST(test_yahoo_packet_read_malformed)
+{
+	struct yahoo_packet *pkt;
+	static const char bad_utf8[] = "5\xc0\x80ok\xc0\x80" "5\xc0\x80\xff\xfe\xc0\x80";
+	static const char truncated[] = "1\xc0\x80me\xc0\x80" "7\xc0\x80" "buddy";
+	static const char junk[] = "1\xc0\x80me\xc0\x80\0junk\xc0\x80junk\xc0\x80";
+
+	pkt = read_payload(bad_utf8, sizeof(bad_utf8) - 1);
+	assert_string_equal("\xff\xfe", yahoo_packet_get_str(pkt, 5));
+	assert_string_equal("ok", yahoo_packet_get_utf8(pkt, 5));
+	yahoo_packet_free(pkt);
+
+	pkt = read_payload(truncated, sizeof(truncated) - 1);
+	assert_int_equal(1, g_slist_length(pkt->hash));
+	assert_string_equal("me", yahoo_packet_get_str(pkt, 1));
+	fail_unless(NULL == yahoo_packet_get_str(pkt, 7));
+	yahoo_packet_free(pkt);
+
+	/* Stop at a NUL where the next key should be */
+	pkt = read_payload(junk, sizeof(junk) - 1);
+	assert_int_equal(1, g_slist_length(pkt->hash));
+	yahoo_packet_free(pkt);
+
+	pkt = read_payload("", 0);
+	fail_unless(NULL == pkt->hash);
+	fail_unless(NULL == yahoo_packet_get_str(pkt, 1));
+	yahoo_packet_free(pkt);
+}
+END_TEST
+
+Suite *
+yahoo_packet_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("Yahoo Packets");
+
+	tc = tcase_create("Encode and decode key/value pairs");
+	tcase_add_test(tc, test_yahoo_packet_roundtrip);
+	tcase_add_test(tc, test_yahoo_packet_read_malformed);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -9,15 +9,36 @@
 /* remember to add the suite to the runner in check_libpurple.c */
 Suite * master_suite(void);
 Suite * cipher_suite(void);
+Suite * circbuffer_suite(void);
+Suite * dbus_suite(void);
+Suite * eventloop_suite(void);
 Suite * jabber_caps_suite(void);
 Suite * jabber_digest_md5_suite(void);
 Suite * jabber_jutil_suite(void);
 Suite * jabber_scram_suite(void);
+Suite * msn_servconn_suite(void);
+Suite * msn_soap_suite(void);
+Suite * msn_userlist_suite(void);
+Suite * oscar_feedbag_suite(void);
+Suite * oscar_flap_suite(void);
 Suite * oscar_util_suite(void);
+Suite * outputbatch_suite(void);
+Suite * plugin_suite(void);
+Suite * roomlist_suite(void);
+Suite * smiley_suite(void);
+Suite * status_suite(void);
+Suite * yahoo_packet_suite(void);
 Suite * yahoo_util_suite(void);
 Suite * util_suite(void);
+Suite * util_fetch_url_suite(void);
 Suite * xmlnode_suite(void);
 
+/*
+ * Benchmarks report what they timed through this, which only shows up
+ * when the tests are run with PURPLE_CHECK_DEBUG set.
+ */
+void check_report_timing(const char *format, ...) G_GNUC_PRINTF(1, 2);
+
 /* helper macros */
 #define assert_int_equal(expected, actual) { \
 	fail_if(expected != actual, "Expected '%d' but got '%d'", expected, actual); \
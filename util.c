@@ -39,9 +39,24 @@
 
 #define MAX_HTTP_CHUNK_SIZE (10 * 1024 * 1024)
 
+/* The least we try to read from the server at a time */
+#define URL_FETCH_READ_SIZE 4096
+
+/* How long the headers can get when there is no max_len to go by */
+#define URL_FETCH_MAX_HEADERS_LEN (64 * 1024)
+
+typedef enum
+{
+	URL_FETCH_CHUNK_SIZE,   /* Waiting for a chunk size line */
+	URL_FETCH_CHUNK_DATA,   /* In the middle of a chunk */
+	URL_FETCH_CHUNK_END,    /* Waiting for the \r\n after a chunk */
+	URL_FETCH_CHUNK_DONE    /* Got the last chunk, or gave up */
+} UrlFetchChunkState;
+
 struct _PurpleUtilFetchUrlData
 {
 	PurpleUtilFetchUrlCallback callback;
+	PurpleUtilFetchUrlStreamCallback stream_cb;
 	void *user_data;
 
 	struct
@@ -71,17 +86,47 @@ struct _PurpleUtilFetchUrlData
 
 	gboolean got_headers;
 	gboolean has_explicit_data_len;
+	/*
+	 * The response is read straight into webdata.  The first len bytes
+	 * are ready for the callback, and the raw_len bytes after them are
+	 * still to be looked at: headers, or chunked data to decode.
+	 */
 	char *webdata;
 	gsize len;
-	unsigned long data_len;
+	gsize raw_len;
+	gsize size;
+	gsize content_len;
+	gsize body_len;      /* Body bytes received, before decoding */
+	gsize streamed_len;  /* Body bytes passed to stream_cb */
 	gsize max_len;
 	gboolean chunked;
+	UrlFetchChunkState chunk_state;
+	gsize chunk_left;
 	PurpleAccount *account;
 };
 
 static char *custom_user_dir = NULL;
 static char *user_dir = NULL;
 
+/*
+ * A file being read, and maybe parsed, on a thread of its own while the
+ * main thread gets on with starting up.
+ */
+typedef struct
+{
+	char *filename_full;
+	gboolean parse;
+	GThread *thread;
+
+	gchar *contents;
+	gsize length;
+	xmlnode *node;
+} PurplePrefetchedFile;
+
+static GList *prefetched_files = NULL;
+
+static void prefetched_file_free(PurplePrefetchedFile *file);
+
 
 PurpleMenuAction *
 purple_menu_action_new(const char *label, PurpleCallback callback, gpointer data,
@@ -116,6 +161,14 @@ purple_util_uninit(void)
 {
 	/* Free these so we don't have leaks at shutdown. */
 
+	while (prefetched_files != NULL) {
+		PurplePrefetchedFile *file = prefetched_files->data;
+
+		prefetched_files = g_list_delete_link(prefetched_files, prefetched_files);
+		g_thread_join(file->thread);
+		prefetched_file_free(file);
+	}
+
 	g_free(custom_user_dir);
 	custom_user_dir = NULL;
 
@@ -879,25 +932,99 @@ purple_str_to_time(const char *timestamp, gboolean utc,
  **************************************************************************/
 
 /*
- * This function is stolen from glib's gmarkup.c and modified to not
- * replace ' with &apos;
+ * Most text has nothing in it that needs escaping, so look for the bytes
+ * that might a word at a time.  MARKUP_HAS_LESS() is true if any byte in
+ * x is less than n (for n <= 0x80), MARKUP_HAS_BYTE() if any byte is b.
+ */
+#define MARKUP_ONES            G_GUINT64_CONSTANT(0x0101010101010101)
+#define MARKUP_HIGHS           (MARKUP_ONES * 0x80)
+#define MARKUP_HAS_LESS(x, n)  (((x) - MARKUP_ONES * (n)) & ~(x) & MARKUP_HIGHS)
+#define MARKUP_HAS_BYTE(x, b)  MARKUP_HAS_LESS((x) ^ (MARKUP_ONES * (b)), 1)
+
+/*
+ * Returns whether the character at p needs escaping: the XML special
+ * characters, and the control characters other than tab, newline and
+ * carriage return, including U+007F to U+009F but not U+0085.
+ */
+static gboolean
+markup_needs_escape(const guchar *p, const guchar *end, gboolean apos)
+{
+	switch (*p) {
+		case '&':
+		case '<':
+		case '>':
+		case '"':
+		case 0x7f:
+			return TRUE;
+
+		case '\'':
+			return apos;
+
+		case '\0':
+		case '\t':
+		case '\n':
+		case '\r':
+			return FALSE;
+
+		case 0xc2:
+			return (p + 1 < end && p[1] >= 0x80 && p[1] <= 0x9f && p[1] != 0x85);
+
+		default:
+			return (*p < 0x20);
+	}
+}
+
+/* Returns how many bytes at the start of text can be copied as they are */
+static gsize
+markup_escape_span(const gchar *text, gsize length, gboolean apos)
+{
+	const guchar *start = (const guchar *)text;
+	const guchar *p = start, *end = start + length;
+	int i;
+
+	while (end - p >= 8) {
+		guint64 x;
+
+		memcpy(&x, p, sizeof(x));
+		if (MARKUP_HAS_LESS(x, 0x20) | MARKUP_HAS_BYTE(x, '&') |
+				MARKUP_HAS_BYTE(x, '<') | MARKUP_HAS_BYTE(x, '>') |
+				MARKUP_HAS_BYTE(x, '"') | MARKUP_HAS_BYTE(x, '\'') |
+				MARKUP_HAS_BYTE(x, 0x7f) | MARKUP_HAS_BYTE(x, 0xc2)) {
+			for (i = 0; i < 8; i++) {
+				if (markup_needs_escape(p + i, end, apos))
+					return p + i - start;
+			}
+		}
+		p += 8;
+	}
+
+	for (; p < end; p++) {
+		if (markup_needs_escape(p, end, apos))
+			break;
+	}
+
+	return p - start;
+}
+
+/*
+ * This is glib's escaping from gmarkup.c, modified to not replace ' with
+ * &apos; and to copy everything between the characters it does replace
+ * in one go.
  */
 static void append_escaped_text(GString *str,
 		const gchar *text, gssize length)
 {
-	const gchar *p;
-	const gchar *end;
-	gunichar c;
+	const gchar *end = text + length;
 
-	p = text;
-	end = text + length;
+	while (text < end) {
+		gsize span = markup_escape_span(text, end - text, FALSE);
 
-	while (p != end)
-	{
-		const gchar *next;
-		next = g_utf8_next_char (p);
+		g_string_append_len(str, text, span);
+		text += span;
+		if (text == end)
+			break;
 
-		switch (*p)
+		switch (*text)
 		{
 			case '&':
 				g_string_append (str, "&amp;");
@@ -916,19 +1043,14 @@ static void append_escaped_text(GString *str,
 				break;
 
 			default:
-				c = g_utf8_get_char (p);
-				if ((0x1 <= c && c <= 0x8) ||
-						(0xb <= c && c <= 0xc) ||
-						(0xe <= c && c <= 0x1f) ||
-						(0x7f <= c && c <= 0x84) ||
-						(0x86 <= c && c <= 0x9f))
-					g_string_append_printf (str, "&#x%x;", c);
-				else
-					g_string_append_len (str, p, next - p);
+				/* A control character; U+0080 to U+009F are two bytes */
+				if ((guchar)*text == 0xc2)
+					text++;
+				g_string_append_printf (str, "&#x%x;", (guchar)*text);
 				break;
 		}
 
-		p = next;
+		text++;
 	}
 }
 
@@ -949,10 +1071,37 @@ gchar *purple_markup_escape_text(const gchar *text, gssize length)
 	return g_string_free(str, FALSE);
 }
 
-const char *
-purple_markup_unescape_entity(const char *text, int *length)
+void
+purple_markup_append_escaped_text(GString *str, const gchar *text, gssize length)
 {
-	const char *pln;
+	gsize span;
+
+	g_return_if_fail(str != NULL);
+	g_return_if_fail(text != NULL);
+
+	if (length < 0)
+		length = strlen(text);
+
+	span = markup_escape_span(text, length, TRUE);
+	g_string_append_len(str, text, span);
+
+	if (span < (gsize)length) {
+		/* Leave the rest to glib, so the escapes are exactly its own */
+		char *escaped = g_markup_escape_text(text + span, length - span);
+		g_string_append(str, escaped);
+		g_free(escaped);
+	}
+}
+
+/*
+ * Numeric entities are written into buf, which needs room for seven bytes,
+ * so that callers which may run on more than one thread can bring their
+ * own.
+ */
+static const char *
+markup_unescape_entity(const char *text, int *length, char *buf)
+{
+	const char *pln = NULL;
 	int len, pound;
 	char temp[2];
 
@@ -961,36 +1110,56 @@ purple_markup_unescape_entity(const char *text, int *length)
 
 #define IS_ENTITY(s)  (!g_ascii_strncasecmp(text, s, (len = sizeof(s) - 1)))
 
-	if(IS_ENTITY("&amp;"))
-		pln = "&";
-	else if(IS_ENTITY("&lt;"))
-		pln = "<";
-	else if(IS_ENTITY("&gt;"))
-		pln = ">";
-	else if(IS_ENTITY("&nbsp;"))
-		pln = " ";
-	else if(IS_ENTITY("&copy;"))
-		pln = "\302\251";      /* or use g_unichar_to_utf8(0xa9); */
-	else if(IS_ENTITY("&quot;"))
-		pln = "\"";
-	else if(IS_ENTITY("&reg;"))
-		pln = "\302\256";      /* or use g_unichar_to_utf8(0xae); */
-	else if(IS_ENTITY("&apos;"))
-		pln = "\'";
-	else if(*(text+1) == '#' &&
-			(sscanf(text, "&#%u%1[;]", &pound, temp) == 2 ||
+	/* Only try the entities that could match */
+	switch (g_ascii_tolower(text[1])) {
+	case 'a':
+		if(IS_ENTITY("&amp;"))
+			pln = "&";
+		else if(IS_ENTITY("&apos;"))
+			pln = "\'";
+		break;
+	case 'l':
+		if(IS_ENTITY("&lt;"))
+			pln = "<";
+		break;
+	case 'g':
+		if(IS_ENTITY("&gt;"))
+			pln = ">";
+		break;
+	case 'n':
+		if(IS_ENTITY("&nbsp;"))
+			pln = " ";
+		break;
+	case 'c':
+		if(IS_ENTITY("&copy;"))
+			pln = "\302\251";      /* or use g_unichar_to_utf8(0xa9); */
+		break;
+	case 'q':
+		if(IS_ENTITY("&quot;"))
+			pln = "\"";
+		break;
+	case 'r':
+		if(IS_ENTITY("&reg;"))
+			pln = "\302\256";      /* or use g_unichar_to_utf8(0xae); */
+		break;
+	case '#':
+		if ((sscanf(text, "&#%u%1[;]", &pound, temp) == 2 ||
 			 sscanf(text, "&#x%x%1[;]", &pound, temp) == 2) &&
-			pound != 0) {
-		static char buf[7];
-		int buflen = g_unichar_to_utf8((gunichar)pound, buf);
-		buf[buflen] = '\0';
-		pln = buf;
-
-		len = (*(text+2) == 'x' ? 3 : 2);
-		while(isxdigit((gint) text[len])) len++;
-		if(text[len] == ';') len++;
+				pound != 0) {
+			int buflen = g_unichar_to_utf8((gunichar)pound, buf);
+			buf[buflen] = '\0';
+			pln = buf;
+
+			len = (*(text+2) == 'x' ? 3 : 2);
+			while(isxdigit((gint) text[len])) len++;
+			if(text[len] == ';') len++;
+		}
+		break;
 	}
-	else
+
+#undef IS_ENTITY
+
+	if (pln == NULL)
 		return NULL;
 
 	if (length)
@@ -998,6 +1167,14 @@ purple_markup_unescape_entity(const char *text, int *length)
 	return pln;
 }
 
+const char *
+purple_markup_unescape_entity(const char *text, int *length)
+{
+	static char buf[7];
+
+	return markup_unescape_entity(text, length, buf);
+}
+
 char *
 purple_markup_get_css_property(const gchar *style,
 				const gchar *opt)
@@ -1339,765 +1516,995 @@ purple_markup_extract_info_field(const char *str, int len, PurpleNotifyUserInfo
 	return FALSE;
 }
 
-struct purple_parse_tag {
-	char *src_tag;
-	char *dest_tag;
-	gboolean ignore;
-};
+/*
+ * The markup functions below all work off the same tokenizer: it walks
+ * the markup once, without copying anything, and hands each token to a
+ * stage that builds the output as it goes.
+ */
 
-/* NOTE: Do not put `do {} while(0)` around this macro (as this is the method
-         recommended in the GCC docs). It contains 'continue's that should
-         affect the while-loop in purple_markup_html_to_xhtml and doing the
-         above would break that.
-         Also, remember to put braces in constructs that require them for
-         multiple statements when using this macro. */
-#define ALLOW_TAG_ALT(x, y) if(!g_ascii_strncasecmp(c, "<" x " ", strlen("<" x " "))) { \
-						const char *o = c + strlen("<" x); \
-						const char *p = NULL, *q = NULL, *r = NULL; \
-						/* o = iterating over full tag \
-						 * p = > (end of tag) \
-						 * q = start of quoted bit \
-						 * r = < inside tag \
-						 */ \
-						GString *innards = g_string_new(""); \
-						while(o && *o) { \
-							if(!q && (*o == '\"' || *o == '\'') ) { \
-								q = o; \
-							} else if(q) { \
-								if(*o == *q) { /* end of quoted bit */ \
-									char *unescaped = g_strndup(q+1, o-q-1); \
-									char *escaped = g_markup_escape_text(unescaped, -1); \
-									g_string_append_printf(innards, "%c%s%c", *q, escaped, *q); \
-									g_free(unescaped); \
-									g_free(escaped); \
-									q = NULL; \
-								} else if(*c == '\\') { \
-									o++; \
-								} \
-							} else if(*o == '<') { \
-								r = o; \
-							} else if(*o == '>') { \
-								p = o; \
-								break; \
-							} else { \
-								innards = g_string_append_c(innards, *o); \
-							} \
-							o++; \
-						} \
-						if(p && !r) { /* got an end of tag and no other < earlier */\
-							if(*(p-1) != '/') { \
-								struct purple_parse_tag *pt = g_new0(struct purple_parse_tag, 1); \
-								pt->src_tag = x; \
-								pt->dest_tag = y; \
-								tags = g_list_prepend(tags, pt); \
-							} \
-							if(xhtml) { \
-								xhtml = g_string_append(xhtml, "<" y); \
-								xhtml = g_string_append(xhtml, innards->str); \
-								xhtml = g_string_append_c(xhtml, '>'); \
-							} \
-							c = p + 1; \
-						} else { /* got end of tag with earlier < *or* didn't get anything */ \
-							if(xhtml) \
-								xhtml = g_string_append(xhtml, "&lt;"); \
-							if(plain) \
-								plain = g_string_append_c(plain, '<'); \
-							c++; \
-						} \
-						g_string_free(innards, TRUE); \
-						continue; \
-					} \
-					if(!g_ascii_strncasecmp(c, "<" x, strlen("<" x)) && \
-							(*(c+strlen("<" x)) == '>' || \
-							 !g_ascii_strncasecmp(c+strlen("<" x), "/>", 2))) { \
-						if(xhtml) \
-							xhtml = g_string_append(xhtml, "<" y); \
-						c += strlen("<" x); \
-						if(*c != '/') { \
-							struct purple_parse_tag *pt = g_new0(struct purple_parse_tag, 1); \
-							pt->src_tag = x; \
-							pt->dest_tag = y; \
-							tags = g_list_prepend(tags, pt); \
-							if(xhtml) \
-								xhtml = g_string_append_c(xhtml, '>'); \
-						} else { \
-							if(xhtml) \
-								xhtml = g_string_append(xhtml, "/>");\
-						} \
-						c = strchr(c, '>') + 1; \
-						continue; \
-					}
-/* Don't forget to check the note above for ALLOW_TAG_ALT. */
-#define ALLOW_TAG(x) ALLOW_TAG_ALT(x, x)
-void
-purple_markup_html_to_xhtml(const char *html, char **xhtml_out,
-						  char **plain_out)
+static gboolean
+markup_is_name_char(char c)
 {
-	GString *xhtml = NULL;
-	GString *plain = NULL;
-	GString *url = NULL;
-	GString *cdata = NULL;
-	GList *tags = NULL, *tag;
-	const char *c = html;
-	char quote = '\0';
-
-#define CHECK_QUOTE(ptr) if (*(ptr) == '\'' || *(ptr) == '\"') \
-			quote = *(ptr++); \
-		else \
-			quote = '\0';
-
-#define VALID_CHAR(ptr) (*(ptr) && *(ptr) != quote && (quote || (*(ptr) != ' ' && *(ptr) != '>')))
-
-	g_return_if_fail(xhtml_out != NULL || plain_out != NULL);
-
-	if(xhtml_out)
-		xhtml = g_string_new("");
-	if(plain_out)
-		plain = g_string_new("");
-
-	while(c && *c) {
-		if(*c == '<') {
-			if(*(c+1) == '/') { /* closing tag */
-				tag = tags;
-				while(tag) {
-					struct purple_parse_tag *pt = tag->data;
-					if(!g_ascii_strncasecmp((c+2), pt->src_tag, strlen(pt->src_tag)) && *(c+strlen(pt->src_tag)+2) == '>') {
-						c += strlen(pt->src_tag) + 3;
-						break;
-					}
-					tag = tag->next;
-				}
-				if(tag) {
-					while(tags) {
-						struct purple_parse_tag *pt = tags->data;
-						if(xhtml && !pt->ignore)
-							g_string_append_printf(xhtml, "</%s>", pt->dest_tag);
-						if(plain && purple_strequal(pt->src_tag, "a")) {
-							/* if this is a link, we have to add the url to the plaintext, too */
-							if (cdata && url &&
-									(!g_string_equal(cdata, url) && (g_ascii_strncasecmp(url->str, "mailto:", 7) != 0 ||
-									                                 g_utf8_collate(url->str + 7, cdata->str) != 0)))
-								g_string_append_printf(plain, " <%s>", g_strstrip(url->str));
-							if (cdata) {
-								g_string_free(cdata, TRUE);
-								cdata = NULL;
-							}
-
-						}
-						if(tags == tag)
-							break;
-						tags = g_list_remove(tags, pt);
-						g_free(pt);
-					}
-					g_free(tag->data);
-					tags = g_list_remove(tags, tag->data);
-				} else {
-					/* a closing tag we weren't expecting...
-					 * we'll let it slide, if it's really a tag...if it's
-					 * just a </ we'll escape it properly */
-					const char *end = c+2;
-					while(*end && g_ascii_isalpha(*end))
-						end++;
-					if(*end == '>') {
-						c = end+1;
-					} else {
-						if(xhtml)
-							xhtml = g_string_append(xhtml, "&lt;");
-						if(plain)
-							plain = g_string_append_c(plain, '<');
-						c++;
-					}
-				}
-			} else { /* opening tag */
-				ALLOW_TAG("blockquote");
-				ALLOW_TAG("cite");
-				ALLOW_TAG("div");
-				ALLOW_TAG("em");
-				ALLOW_TAG("h1");
-				ALLOW_TAG("h2");
-				ALLOW_TAG("h3");
-				ALLOW_TAG("h4");
-				ALLOW_TAG("h5");
-				ALLOW_TAG("h6");
-				/* we only allow html to start the message */
-				if(c == html) {
-					ALLOW_TAG("html");
-				}
-				ALLOW_TAG_ALT("i", "em");
-				ALLOW_TAG_ALT("italic", "em");
-				ALLOW_TAG("li");
-				ALLOW_TAG("ol");
-				ALLOW_TAG("p");
-				ALLOW_TAG("pre");
-				ALLOW_TAG("q");
-				ALLOW_TAG("span");
-				ALLOW_TAG("ul");
-
-
-				/* we skip <HR> because it's not legal in XHTML-IM.  However,
-				 * we still want to send something sensible, so we put a
-				 * linebreak in its place. <BR> also needs special handling
-				 * because putting a </BR> to close it would just be dumb. */
-				if((!g_ascii_strncasecmp(c, "<br", 3)
-							|| !g_ascii_strncasecmp(c, "<hr", 3))
-						&& (*(c+3) == '>' ||
-							!g_ascii_strncasecmp(c+3, "/>", 2) ||
-							!g_ascii_strncasecmp(c+3, " />", 3))) {
-					c = strchr(c, '>') + 1;
-					if(xhtml)
-						xhtml = g_string_append(xhtml, "<br/>");
-					if(plain && *c != '\n')
-						plain = g_string_append_c(plain, '\n');
-					continue;
-				}
-				if(!g_ascii_strncasecmp(c, "<b>", 3) || !g_ascii_strncasecmp(c, "<bold>", strlen("<bold>")) || !g_ascii_strncasecmp(c, "<strong>", strlen("<strong>"))) {
-					struct purple_parse_tag *pt = g_new0(struct purple_parse_tag, 1);
-					if (*(c+2) == '>')
-						pt->src_tag = "b";
-					else if (*(c+2) == 'o')
-						pt->src_tag = "bold";
-					else
-						pt->src_tag = "strong";
-					pt->dest_tag = "span";
-					tags = g_list_prepend(tags, pt);
-					c = strchr(c, '>') + 1;
-					if(xhtml)
-						xhtml = g_string_append(xhtml, "<span style='font-weight: bold;'>");
-					continue;
-				}
-				if(!g_ascii_strncasecmp(c, "<u>", 3) || !g_ascii_strncasecmp(c, "<underline>", strlen("<underline>"))) {
-					struct purple_parse_tag *pt = g_new0(struct purple_parse_tag, 1);
-					pt->src_tag = *(c+2) == '>' ? "u" : "underline";
-					pt->dest_tag = "span";
-					tags = g_list_prepend(tags, pt);
-					c = strchr(c, '>') + 1;
-					if (xhtml)
-						xhtml = g_string_append(xhtml, "<span style='text-decoration: underline;'>");
-					continue;
-				}
-				if(!g_ascii_strncasecmp(c, "<s>", 3) || !g_ascii_strncasecmp(c, "<strike>", strlen("<strike>"))) {
-					struct purple_parse_tag *pt = g_new0(struct purple_parse_tag, 1);
-					pt->src_tag = *(c+2) == '>' ? "s" : "strike";
-					pt->dest_tag = "span";
-					tags = g_list_prepend(tags, pt);
-					c = strchr(c, '>') + 1;
-					if(xhtml)
-						xhtml = g_string_append(xhtml, "<span style='text-decoration: line-through;'>");
-					continue;
-				}
-				if(!g_ascii_strncasecmp(c, "<sub>", 5)) {
-					struct purple_parse_tag *pt = g_new0(struct purple_parse_tag, 1);
-					pt->src_tag = "sub";
-					pt->dest_tag = "span";
-					tags = g_list_prepend(tags, pt);
-					c = strchr(c, '>') + 1;
-					if(xhtml)
-						xhtml = g_string_append(xhtml, "<span style='vertical-align:sub;'>");
-					continue;
-				}
-				if(!g_ascii_strncasecmp(c, "<sup>", 5)) {
-					struct purple_parse_tag *pt = g_new0(struct purple_parse_tag, 1);
-					pt->src_tag = "sup";
-					pt->dest_tag = "span";
-					tags = g_list_prepend(tags, pt);
-					c = strchr(c, '>') + 1;
-					if(xhtml)
-						xhtml = g_string_append(xhtml, "<span style='vertical-align:super;'>");
-					continue;
-				}
-				if (!g_ascii_strncasecmp(c, "<img", 4) && (*(c+4) == '>' || *(c+4) == ' ')) {
-					const char *p = c + 4;
-					GString *src = NULL, *alt = NULL;
-					while (*p && *p != '>') {
-						if (!g_ascii_strncasecmp(p, "src=", 4)) {
-							const char *q = p + 4;
-							if (src)
-								g_string_free(src, TRUE);
-							src = g_string_new("");
-							CHECK_QUOTE(q);
-							while (VALID_CHAR(q)) {
-								src = g_string_append_c(src, *q);
-								q++;
-							}
-							p = q;
-						} else if (!g_ascii_strncasecmp(p, "alt=", 4)) {
-							const char *q = p + 4;
-							if (alt)
-								g_string_free(alt, TRUE);
-							alt = g_string_new("");
-							CHECK_QUOTE(q);
-							while (VALID_CHAR(q)) {
-								alt = g_string_append_c(alt, *q);
-								q++;
-							}
-							p = q;
-						} else {
-							p++;
-						}
-					}
-					if ((c = strchr(p, '>')) != NULL)
-						c++;
-					else
-						c = p;
-					/* src and alt are required! */
-					if(src && xhtml)
-						g_string_append_printf(xhtml, "<img src='%s' alt='%s' />", g_strstrip(src->str), alt ? alt->str : "");
-					if(alt) {
-						if(plain)
-							plain = g_string_append(plain, alt->str);
-						if(!src && xhtml)
-							xhtml = g_string_append(xhtml, alt->str);
-						g_string_free(alt, TRUE);
-					}
-					g_string_free(src, TRUE);
-					continue;
-				}
-				if (!g_ascii_strncasecmp(c, "<a", 2) && (*(c+2) == '>' || *(c+2) == ' ')) {
-					const char *p = c + 2;
-					struct purple_parse_tag *pt;
-					while (*p && *p != '>') {
-						if (!g_ascii_strncasecmp(p, "href=", 5)) {
-							const char *q = p + 5;
-							if (url)
-								g_string_free(url, TRUE);
-							url = g_string_new("");
-							if (cdata)
-								g_string_free(cdata, TRUE);
-							cdata = g_string_new("");
-							CHECK_QUOTE(q);
-							while (VALID_CHAR(q)) {
-								int len;
-								if ((*q == '&') && (purple_markup_unescape_entity(q, &len) == NULL))
-									url = g_string_append(url, "&amp;");
-								else
-									url = g_string_append_c(url, *q);
-								q++;
-							}
-							p = q;
-						} else {
-							p++;
-						}
-					}
-					if ((c = strchr(p, '>')) != NULL)
-						c++;
-					else
-						c = p;
-					pt = g_new0(struct purple_parse_tag, 1);
-					pt->src_tag = "a";
-					pt->dest_tag = "a";
-					tags = g_list_prepend(tags, pt);
-					if(xhtml)
-						g_string_append_printf(xhtml, "<a href=\"%s\">", url ? g_strstrip(url->str) : "");
-					continue;
-				}
-				if(!g_ascii_strncasecmp(c, "<font", 5) && (*(c+5) == '>' || *(c+5) == ' ')) {
-					const char *p = c + 5;
-					GString *style = g_string_new("");
-					struct purple_parse_tag *pt;
-					while (*p && *p != '>') {
-						if (!g_ascii_strncasecmp(p, "back=", 5)) {
-							const char *q = p + 5;
-							GString *color = g_string_new("");
-							CHECK_QUOTE(q);
-							while (VALID_CHAR(q)) {
-								color = g_string_append_c(color, *q);
-								q++;
-							}
-							g_string_append_printf(style, "background: %s; ", color->str);
-							g_string_free(color, TRUE);
-							p = q;
-						} else if (!g_ascii_strncasecmp(p, "color=", 6)) {
-							const char *q = p + 6;
-							GString *color = g_string_new("");
-							CHECK_QUOTE(q);
-							while (VALID_CHAR(q)) {
-								color = g_string_append_c(color, *q);
-								q++;
-							}
-							g_string_append_printf(style, "color: %s; ", color->str);
-							g_string_free(color, TRUE);
-							p = q;
-						} else if (!g_ascii_strncasecmp(p, "face=", 5)) {
-							const char *q = p + 5;
-							GString *face = g_string_new("");
-							CHECK_QUOTE(q);
-							while (VALID_CHAR(q)) {
-								face = g_string_append_c(face, *q);
-								q++;
-							}
-							g_string_append_printf(style, "font-family: %s; ", g_strstrip(face->str));
-							g_string_free(face, TRUE);
-							p = q;
-						} else if (!g_ascii_strncasecmp(p, "size=", 5)) {
-							const char *q = p + 5;
-							int sz;
-							const char *size = "medium";
-							CHECK_QUOTE(q);
-							sz = atoi(q);
-							switch (sz)
-							{
-							case 1:
-							  size = "xx-small";
-							  break;
-							case 2:
-							  size = "small";
-							  break;
-							case 3:
-							  size = "medium";
-							  break;
-							case 4:
-							  size = "large";
-							  break;
-							case 5:
-							  size = "x-large";
-							  break;
-							case 6:
-							case 7:
-							  size = "xx-large";
-							  break;
-							default:
-							  break;
-							}
-							g_string_append_printf(style, "font-size: %s; ", size);
-							p = q;
-						} else {
-							p++;
-						}
-					}
-					if ((c = strchr(p, '>')) != NULL)
-						c++;
-					else
-						c = p;
-					pt = g_new0(struct purple_parse_tag, 1);
-					pt->src_tag = "font";
-					pt->dest_tag = "span";
-					tags = g_list_prepend(tags, pt);
-					if(style->len && xhtml)
-						g_string_append_printf(xhtml, "<span style='%s'>", g_strstrip(style->str));
-					else
-						pt->ignore = TRUE;
-					g_string_free(style, TRUE);
-					continue;
-				}
-				if (!g_ascii_strncasecmp(c, "<body ", 6)) {
-					const char *p = c + 6;
-					gboolean did_something = FALSE;
-					while (*p && *p != '>') {
-						if (!g_ascii_strncasecmp(p, "bgcolor=", 8)) {
-							const char *q = p + 8;
-							struct purple_parse_tag *pt = g_new0(struct purple_parse_tag, 1);
-							GString *color = g_string_new("");
-							CHECK_QUOTE(q);
-							while (VALID_CHAR(q)) {
-								color = g_string_append_c(color, *q);
-								q++;
-							}
-							if (xhtml)
-								g_string_append_printf(xhtml, "<span style='background: %s;'>", g_strstrip(color->str));
-							g_string_free(color, TRUE);
-							if ((c = strchr(p, '>')) != NULL)
-								c++;
-							else
-								c = p;
-							pt->src_tag = "body";
-							pt->dest_tag = "span";
-							tags = g_list_prepend(tags, pt);
-							did_something = TRUE;
-							break;
-						}
-						p++;
-					}
-					if (did_something) continue;
-				}
-				/* this has to come after the special case for bgcolor */
-				ALLOW_TAG("body");
-				if(!g_ascii_strncasecmp(c, "<!--", strlen("<!--"))) {
-					char *p = strstr(c + strlen("<!--"), "-->");
-					if(p) {
-						if(xhtml)
-							xhtml = g_string_append(xhtml, "<!--");
-						c += strlen("<!--");
-						continue;
-					}
-				}
+	return g_ascii_isalnum(c) || c == '-' || c == ':' || c == '_';
+}
 
-				if(xhtml)
-					xhtml = g_string_append(xhtml, "&lt;");
-				if(plain)
-					plain = g_string_append_c(plain, '<');
-				c++;
-			}
-		} else if(*c == '&') {
-			char buf[7];
-			const char *pln;
-			int len;
-
-			if ((pln = purple_markup_unescape_entity(c, &len)) == NULL) {
-				len = 1;
-				g_snprintf(buf, sizeof(buf), "%c", *c);
-				pln = buf;
-			}
-			if(xhtml)
-				xhtml = g_string_append_len(xhtml, c, len);
-			if(plain)
-				plain = g_string_append(plain, pln);
-			if(cdata)
-				cdata = g_string_append_len(cdata, c, len);
-			c += len;
-		} else {
-			if(xhtml)
-				xhtml = g_string_append_c(xhtml, *c);
-			if(plain)
-				plain = g_string_append_c(plain, *c);
-			if(cdata)
-				cdata = g_string_append_c(cdata, *c);
-			c++;
-		}
-	}
-	if(xhtml) {
-		for (tag = tags; tag ; tag = tag->next) {
-			struct purple_parse_tag *pt = tag->data;
-			if(!pt->ignore)
-				g_string_append_printf(xhtml, "</%s>", pt->dest_tag);
-		}
-	}
-	g_list_free(tags);
-	if(xhtml_out)
-		*xhtml_out = g_string_free(xhtml, FALSE);
-	if(plain_out)
-		*plain_out = g_string_free(plain, FALSE);
-	if(url)
-		g_string_free(url, TRUE);
-	if (cdata)
-		g_string_free(cdata, TRUE);
-#undef CHECK_QUOTE
-#undef VALID_CHAR
+/* Returns whether a tag token has the given (lower case) name */
+static gboolean
+markup_token_is(const PurpleMarkupToken *token, PurpleMarkupTokenType type,
+		const char *name)
+{
+	return token->type == type && token->name_len == strlen(name) &&
+		g_ascii_strncasecmp(token->name, name, token->name_len) == 0;
 }
 
-/* The following are probably reasonable changes:
- * - \n should be converted to a normal space
- * - in addition to <br>, <p> and <div> etc. should also be converted into \n
- * - We want to turn </td>#whitespace<td> sequences into a single tab
- * - We want to turn <td> into a single tab (for msn profile "parsing")
- * - We want to turn </tr>#whitespace<tr> sequences into a single \n
- * - <script>...</script> and <style>...</style> should be completely removed
+/*
+ * Scans the tag starting at c, filling in the tag parts of token.
+ * Returns the end of the tag, or NULL if c does not start a tag.
  */
-
-char *
-purple_markup_strip_html(const char *str)
+static const char *
+markup_scan_tag(const char *c, PurpleMarkupToken *token)
 {
-	int i, j, k, entlen;
-	gboolean visible = TRUE;
-	gboolean closing_td_p = FALSE;
-	gchar *str2;
-	const gchar *cdata_close_tag = NULL, *ent;
-	gchar *href = NULL;
-	int href_st = 0;
+	const char *p = c + 1;
+	gboolean value = FALSE;
+	char quote = '\0';
 
-	if(!str)
-		return NULL;
+	if (!strncmp(p, "!--", 3)) {
+		const char *end = strstr(p + 3, "-->");
 
-	str2 = g_strdup(str);
+		if (end == NULL)
+			return NULL;
 
-	for (i = 0, j = 0; str2[i]; i++)
-	{
-		if (str2[i] == '<')
-		{
-			if (cdata_close_tag)
-			{
-				/* Note: Don't even assume any other tag is a tag in CDATA */
-				if (g_ascii_strncasecmp(str2 + i, cdata_close_tag,
-						strlen(cdata_close_tag)) == 0)
-				{
-					i += strlen(cdata_close_tag) - 1;
-					cdata_close_tag = NULL;
-				}
-				continue;
-			}
-			else if (g_ascii_strncasecmp(str2 + i, "<td", 3) == 0 && closing_td_p)
-			{
-				str2[j++] = '\t';
-				visible = TRUE;
-			}
-			else if (g_ascii_strncasecmp(str2 + i, "</td>", 5) == 0)
-			{
-				closing_td_p = TRUE;
-				visible = FALSE;
-			}
-			else
-			{
-				closing_td_p = FALSE;
-				visible = TRUE;
-			}
+		token->type = PURPLE_MARKUP_TOKEN_COMMENT;
+		return end + 3;
+	}
 
-			k = i + 1;
+	if (*p == '!' || *p == '?') {
+		/* <!DOCTYPE ...> and friends */
+		const char *end = strpbrk(p, "<>");
 
-			if(g_ascii_isspace(str2[k]))
-				visible = TRUE;
-			else if (str2[k])
-			{
-				/* Scan until we end the tag either implicitly (closed start
-				 * tag) or explicitly, using a sloppy method (i.e., < or >
-				 * inside quoted attributes will screw us up)
-				 */
-				while (str2[k] && str2[k] != '<' && str2[k] != '>')
-				{
-					k++;
-				}
+		if (end == NULL || *end == '<')
+			return NULL;
 
-				/* If we've got an <a> tag with an href, save the address
-				 * to print later. */
-				if (g_ascii_strncasecmp(str2 + i, "<a", 2) == 0 &&
-				    g_ascii_isspace(str2[i+2]))
-				{
-					int st; /* start of href, inclusive [ */
-					int end; /* end of href, exclusive ) */
-					char delim = ' ';
-					/* Find start of href */
-					for (st = i + 3; st < k; st++)
-					{
-						if (g_ascii_strncasecmp(str2+st, "href=", 5) == 0)
-						{
-							st += 5;
-							if (str2[st] == '"' || str2[st] == '\'')
-							{
-								delim = str2[st];
-								st++;
-							}
-							break;
-						}
-					}
-					/* find end of address */
-					for (end = st; end < k && str2[end] != delim; end++)
-					{
-						/* All the work is done in the loop construct above. */
-					}
+		token->type = PURPLE_MARKUP_TOKEN_COMMENT;
+		return end + 1;
+	}
 
-					/* If there's an address, save it.  If there was
-					 * already one saved, kill it. */
-					if (st < k)
-					{
-						char *tmp;
-						g_free(href);
-						tmp = g_strndup(str2 + st, end - st);
-						href = purple_unescape_html(tmp);
-						g_free(tmp);
-						href_st = j;
-					}
-				}
+	if (*p == '/') {
+		token->type = PURPLE_MARKUP_TOKEN_END_TAG;
+		p++;
+	} else {
+		token->type = PURPLE_MARKUP_TOKEN_START_TAG;
+	}
 
-				/* Replace </a> with an ascii representation of the
-				 * address the link was pointing to. */
-				else if (href != NULL && g_ascii_strncasecmp(str2 + i, "</a>", 4) == 0)
-				{
+	if (!g_ascii_isalpha(*p))
+		return NULL;
 
-					size_t hrlen = strlen(href);
+	token->name = p;
+	while (markup_is_name_char(*p))
+		p++;
+	token->name_len = p - token->name;
 
-					/* Only insert the href if it's different from the CDATA. */
-					if ((hrlen != j - href_st ||
-					     strncmp(str2 + href_st, href, hrlen)) &&
-					    (hrlen != j - href_st + 7 || /* 7 == strlen("http://") */
-					     strncmp(str2 + href_st, href + 7, hrlen - 7)))
-					{
-						str2[j++] = ' ';
-						str2[j++] = '(';
-						g_memmove(str2 + j, href, hrlen);
-						j += hrlen;
-						str2[j++] = ')';
-						g_free(href);
-						href = NULL;
-					}
-				}
+	if (token->type == PURPLE_MARKUP_TOKEN_END_TAG) {
+		while (g_ascii_isspace(*p))
+			p++;
 
-				/* Check for tags which should be mapped to newline (but ignore some of
-				 * the tags at the beginning of the text) */
-				else if ((j && (g_ascii_strncasecmp(str2 + i, "<p>", 3) == 0
-				              || g_ascii_strncasecmp(str2 + i, "<tr", 3) == 0
-				              || g_ascii_strncasecmp(str2 + i, "<hr", 3) == 0
-				              || g_ascii_strncasecmp(str2 + i, "<li", 3) == 0
-				              || g_ascii_strncasecmp(str2 + i, "<div", 4) == 0))
-				 || g_ascii_strncasecmp(str2 + i, "<br", 3) == 0
-				 || g_ascii_strncasecmp(str2 + i, "</table>", 8) == 0)
-				{
-					str2[j++] = '\n';
-				}
-				/* Check for tags which begin CDATA and need to be closed */
-#if 0 /* FIXME.. option is end tag optional, we can't handle this right now */
-				else if (g_ascii_strncasecmp(str2 + i, "<option", 7) == 0)
-				{
-					/* FIXME: We should not do this if the OPTION is SELECT'd */
-					cdata_close_tag = "</option>";
-				}
-#endif
-				else if (g_ascii_strncasecmp(str2 + i, "<script", 7) == 0)
-				{
-					cdata_close_tag = "</script>";
-				}
-				else if (g_ascii_strncasecmp(str2 + i, "<style", 6) == 0)
-				{
-					cdata_close_tag = "</style>";
-				}
-				/* Update the index and continue checking after the tag */
-				i = (str2[k] == '<' || str2[k] == '\0')? k - 1: k;
-				continue;
-			}
-		}
-		else if (cdata_close_tag)
-		{
-			continue;
-		}
-		else if (!g_ascii_isspace(str2[i]))
-		{
-			visible = TRUE;
-		}
+		return (*p == '>') ? p + 1 : NULL;
+	}
 
-		if (str2[i] == '&' && (ent = purple_markup_unescape_entity(str2 + i, &entlen)) != NULL)
-		{
-			while (*ent)
-				str2[j++] = *ent++;
-			i += entlen - 1;
+	if (*p != '>' && *p != '/' && !g_ascii_isspace(*p))
+		return NULL;
+
+	/* Quotes only count around attribute values, so that an apostrophe
+	 * in something like <3 doesn't swallow the rest of the message. */
+	token->attrs = p;
+	for (; *p != '\0'; p++) {
+		if (quote) {
+			if (*p == quote)
+				quote = '\0';
 			continue;
 		}
 
-		if (visible)
-			str2[j++] = g_ascii_isspace(str2[i])? ' ': str2[i];
+		if (*p == '>')
+			break;
+		if (*p == '<')
+			return NULL;
+
+		if ((*p == '"' || *p == '\'') && value) {
+			quote = *p;
+			value = FALSE;
+		} else if (!g_ascii_isspace(*p)) {
+			value = (*p == '=');
+		}
 	}
 
-	g_free(href);
+	if (*p != '>')
+		return NULL;
 
-	str2[j] = '\0';
+	token->attrs_len = p - token->attrs;
+	token->empty = (token->attrs_len > 0 && *(p - 1) == '/');
 
-	return str2;
+	return p + 1;
 }
 
-static gboolean
-badchar(char c)
+gboolean
+purple_markup_next_token(const char **markup, PurpleMarkupToken *token)
 {
-	switch (c) {
-	case ' ':
-	case ',':
-	case '\0':
-	case '\n':
-	case '\r':
-	case '<':
-	case '>':
-	case '"':
-		return TRUE;
-	default:
+	const char *c, *end;
+	int len;
+
+	g_return_val_if_fail(markup != NULL, FALSE);
+	g_return_val_if_fail(token != NULL, FALSE);
+
+	c = *markup;
+	if (c == NULL || *c == '\0')
 		return FALSE;
+
+	memset(token, 0, sizeof(PurpleMarkupToken));
+	token->start = c;
+
+	if (*c == '<') {
+		end = markup_scan_tag(c, token);
+		if (end == NULL) {
+			/* Just a '<' on its own */
+			memset(token, 0, sizeof(PurpleMarkupToken));
+			token->start = c;
+			token->type = PURPLE_MARKUP_TOKEN_TEXT;
+			end = c + 1;
+		}
+	} else if (*c == '&' && purple_markup_unescape_entity(c, &len) != NULL) {
+		token->type = PURPLE_MARKUP_TOKEN_ENTITY;
+		end = c + len;
+	} else {
+		token->type = PURPLE_MARKUP_TOKEN_TEXT;
+		end = c + 1 + strcspn(c + 1, "<&");
 	}
+
+	token->len = end - c;
+	*markup = end;
+
+	return TRUE;
 }
 
+/*
+ * Walks the attributes of a tag: name="value", name='value', name=value
+ * or just name.  value is NULL for an attribute without one.
+ */
 static gboolean
-badentity(const char *c)
+markup_next_attribute(const char **attrs, const char *end,
+		const char **name, gsize *name_len,
+		const char **value, gsize *value_len)
 {
-	if (!g_ascii_strncasecmp(c, "&lt;", 4) ||
-		!g_ascii_strncasecmp(c, "&gt;", 4) ||
-		!g_ascii_strncasecmp(c, "&quot;", 6)) {
-		return TRUE;
-	}
-	return FALSE;
-}
+	const char *p = *attrs;
+
+	while (p < end && !markup_is_name_char(*p))
+		p++;
+	if (p >= end)
+		return FALSE;
+
+	*name = p;
+	while (p < end && markup_is_name_char(*p))
+		p++;
+	*name_len = p - *name;
+
+	*value = NULL;
+	*value_len = 0;
+
+	while (p < end && g_ascii_isspace(*p))
+		p++;
+	if (p < end && *p == '=') {
+		p++;
+		while (p < end && g_ascii_isspace(*p))
+			p++;
+
+		if (p < end && (*p == '"' || *p == '\'')) {
+			const char *q = memchr(p + 1, *p, end - p - 1);
+
+			if (q == NULL)
+				q = end;
+			*value = p + 1;
+			*value_len = q - *value;
+			p = (q < end) ? q + 1 : end;
+		} else {
+			*value = p;
+			while (p < end && !g_ascii_isspace(*p))
+				p++;
+			*value_len = p - *value;
+		}
+	}
+
+	*attrs = p;
+
+	return TRUE;
+}
+
+/* Returns the value of the attribute called attr, or NULL */
+static char *
+markup_token_get_attribute(const PurpleMarkupToken *token, const char *attr)
+{
+	const char *p = token->attrs, *end = token->attrs + token->attrs_len;
+	const char *name, *value;
+	gsize name_len, value_len;
+
+	while (markup_next_attribute(&p, end, &name, &name_len, &value, &value_len)) {
+		if (g_ascii_strncasecmp(name, attr, name_len) == 0 &&
+				attr[name_len] == '\0')
+			return g_strndup(value ? value : "", value_len);
+	}
+
+	return NULL;
+}
+
+/* Appends text, turning any entities in it into the characters */
+static void
+markup_append_unescaped(GString *str, const char *text, gsize len)
+{
+	const char *end = text + len;
+	char buf[7];
+
+	while (text < end) {
+		const char *amp = memchr(text, '&', end - text);
+		const char *ent;
+		int entlen;
+
+		if (amp == NULL) {
+			g_string_append_len(str, text, end - text);
+			break;
+		}
+
+		g_string_append_len(str, text, amp - text);
+		if ((ent = markup_unescape_entity(amp, &entlen, buf)) != NULL) {
+			g_string_append(str, ent);
+			text = amp + entlen;
+		} else {
+			g_string_append_c(str, '&');
+			text = amp + 1;
+		}
+	}
+}
+
+/*
+ * A stage gets every token in order, then finish() once.  token()
+ * returns FALSE when the stage does not need any more of the markup.
+ */
+typedef struct _MarkupStage MarkupStage;
+
+struct _MarkupStage
+{
+	gboolean (*token)(MarkupStage *stage, const PurpleMarkupToken *token);
+	void (*finish)(MarkupStage *stage);
+};
+
+static void
+markup_run(const char *markup, MarkupStage *stage)
+{
+	PurpleMarkupToken token;
+
+	while (purple_markup_next_token(&markup, &token)) {
+		if (!stage->token(stage, &token))
+			break;
+	}
+
+	if (stage->finish)
+		stage->finish(stage);
+}
+
+/**************************************************************************
+ * HTML to XHTML
+ **************************************************************************/
+
+struct purple_parse_tag {
+	const char *src_tag;
+	const char *dest_tag;
+	gboolean ignore;
+};
+
+typedef enum
+{
+	XHTML_TAG_ALLOW,   /* copied over, with its attributes */
+	XHTML_TAG_HTML,    /* copied over, but only at the very start */
+	XHTML_TAG_BREAK,   /* <br/> */
+	XHTML_TAG_SPAN,    /* a <span> with a style */
+	XHTML_TAG_BODY,
+	XHTML_TAG_FONT,
+	XHTML_TAG_IMG,
+	XHTML_TAG_LINK
+} XhtmlTagType;
+
+typedef struct
+{
+	const char *name;
+	const char *dest; /* the XHTML tag, or the style of a span */
+	XhtmlTagType type;
+} XhtmlTag;
+
+/* Sorted by name, for bsearch() */
+static const XhtmlTag xhtml_tags[] = {
+	{ "a",          "a",                               XHTML_TAG_LINK  },
+	{ "b",          "font-weight: bold;",              XHTML_TAG_SPAN  },
+	{ "blockquote", "blockquote",                      XHTML_TAG_ALLOW },
+	{ "body",       "body",                            XHTML_TAG_BODY  },
+	{ "bold",       "font-weight: bold;",              XHTML_TAG_SPAN  },
+	{ "br",         NULL,                              XHTML_TAG_BREAK },
+	{ "cite",       "cite",                            XHTML_TAG_ALLOW },
+	{ "div",        "div",                             XHTML_TAG_ALLOW },
+	{ "em",         "em",                              XHTML_TAG_ALLOW },
+	{ "font",       "span",                            XHTML_TAG_FONT  },
+	{ "h1",         "h1",                              XHTML_TAG_ALLOW },
+	{ "h2",         "h2",                              XHTML_TAG_ALLOW },
+	{ "h3",         "h3",                              XHTML_TAG_ALLOW },
+	{ "h4",         "h4",                              XHTML_TAG_ALLOW },
+	{ "h5",         "h5",                              XHTML_TAG_ALLOW },
+	{ "h6",         "h6",                              XHTML_TAG_ALLOW },
+	/* we skip <HR> because it's not legal in XHTML-IM.  However,
+	 * we still want to send something sensible, so we put a
+	 * linebreak in its place. */
+	{ "hr",         NULL,                              XHTML_TAG_BREAK },
+	{ "html",       "html",                            XHTML_TAG_HTML  },
+	{ "i",          "em",                              XHTML_TAG_ALLOW },
+	{ "img",        NULL,                              XHTML_TAG_IMG   },
+	{ "italic",     "em",                              XHTML_TAG_ALLOW },
+	{ "li",         "li",                              XHTML_TAG_ALLOW },
+	{ "ol",         "ol",                              XHTML_TAG_ALLOW },
+	{ "p",          "p",                               XHTML_TAG_ALLOW },
+	{ "pre",        "pre",                             XHTML_TAG_ALLOW },
+	{ "q",          "q",                               XHTML_TAG_ALLOW },
+	{ "s",          "text-decoration: line-through;",  XHTML_TAG_SPAN  },
+	{ "span",       "span",                            XHTML_TAG_ALLOW },
+	{ "strike",     "text-decoration: line-through;",  XHTML_TAG_SPAN  },
+	{ "strong",     "font-weight: bold;",              XHTML_TAG_SPAN  },
+	{ "sub",        "vertical-align:sub;",             XHTML_TAG_SPAN  },
+	{ "sup",        "vertical-align:super;",           XHTML_TAG_SPAN  },
+	{ "u",          "text-decoration: underline;",     XHTML_TAG_SPAN  },
+	{ "ul",         "ul",                              XHTML_TAG_ALLOW },
+	{ "underline",  "text-decoration: underline;",     XHTML_TAG_SPAN  }
+};
+
+static int
+xhtml_tag_compare(const void *key, const void *member)
+{
+	const PurpleMarkupToken *token = key;
+	const char *name = ((const XhtmlTag *)member)->name;
+	int ret = g_ascii_strncasecmp(token->name, name, token->name_len);
+
+	if (ret == 0 && name[token->name_len] != '\0')
+		return -1;
+
+	return ret;
+}
+
+typedef struct
+{
+	MarkupStage stage;
+	const char *html;
+	GString *xhtml;
+	GString *plain;
+	GString *url;
+	GString *cdata;
+	GArray *tags; /* struct purple_parse_tag, innermost last */
+} XhtmlStage;
+
+static void
+xhtml_push_tag(XhtmlStage *s, const char *src_tag, const char *dest_tag,
+		gboolean ignore)
+{
+	struct purple_parse_tag pt;
+
+	pt.src_tag = src_tag;
+	pt.dest_tag = dest_tag;
+	pt.ignore = ignore;
+	g_array_append_val(s->tags, pt);
+}
+
+static void
+xhtml_close_tag(XhtmlStage *s, const struct purple_parse_tag *pt)
+{
+	if (s->xhtml && !pt->ignore)
+		g_string_append_printf(s->xhtml, "</%s>", pt->dest_tag);
+
+	if (s->plain && purple_strequal(pt->src_tag, "a")) {
+		/* if this is a link, we have to add the url to the plaintext, too */
+		if (s->cdata && s->url &&
+				(!g_string_equal(s->cdata, s->url) &&
+				 (g_ascii_strncasecmp(s->url->str, "mailto:", 7) != 0 ||
+				  g_utf8_collate(s->url->str + 7, s->cdata->str) != 0)))
+			g_string_append_printf(s->plain, " <%s>", s->url->str);
+		if (s->cdata) {
+			g_string_free(s->cdata, TRUE);
+			s->cdata = NULL;
+		}
+	}
+}
+
+/* Quoted attribute values are escaped on the way through */
+static void
+xhtml_append_attributes(GString *xhtml, const char *attrs, gsize len)
+{
+	const char *p = attrs, *end = attrs + len;
+	gboolean value = FALSE;
+
+	while (p < end) {
+		const char *q;
+
+		if ((*p == '"' || *p == '\'') && value &&
+				(q = memchr(p + 1, *p, end - p - 1)) != NULL) {
+			g_string_append_c(xhtml, *p);
+			purple_markup_append_escaped_text(xhtml, p + 1, q - p - 1);
+			g_string_append_c(xhtml, *p);
+			value = FALSE;
+			p = q + 1;
+			continue;
+		}
+
+		if (!g_ascii_isspace(*p))
+			value = (*p == '=');
+		g_string_append_c(xhtml, *p);
+		p++;
+	}
+}
+
+/* Text that looked like markup but isn't anything we allow */
+static void
+xhtml_append_escaped_tag(XhtmlStage *s, const PurpleMarkupToken *token)
+{
+	if (s->xhtml) {
+		g_string_append(s->xhtml, "&lt;");
+		g_string_append_len(s->xhtml, token->start + 1, token->len - 1);
+	}
+	if (s->plain) {
+		g_string_append_c(s->plain, '<');
+		markup_append_unescaped(s->plain, token->start + 1, token->len - 1);
+	}
+	if (s->cdata)
+		g_string_append_len(s->cdata, token->start + 1, token->len - 1);
+}
+
+static void
+xhtml_font_style(GString *style, const PurpleMarkupToken *token)
+{
+	const char *p = token->attrs, *end = token->attrs + token->attrs_len;
+	const char *name, *value;
+	gsize name_len, value_len;
+
+	while (markup_next_attribute(&p, end, &name, &name_len, &value, &value_len)) {
+		char *val;
+
+		if (value == NULL)
+			continue;
+
+		val = g_strndup(value, value_len);
+		if (name_len == 4 && !g_ascii_strncasecmp(name, "back", 4)) {
+			g_string_append_printf(style, "background: %s; ", val);
+		} else if (name_len == 5 && !g_ascii_strncasecmp(name, "color", 5)) {
+			g_string_append_printf(style, "color: %s; ", val);
+		} else if (name_len == 4 && !g_ascii_strncasecmp(name, "face", 4)) {
+			g_string_append_printf(style, "font-family: %s; ", g_strstrip(val));
+		} else if (name_len == 4 && !g_ascii_strncasecmp(name, "size", 4)) {
+			const char *size = "medium";
+
+			switch (atoi(val))
+			{
+			case 1:
+			  size = "xx-small";
+			  break;
+			case 2:
+			  size = "small";
+			  break;
+			case 3:
+			  size = "medium";
+			  break;
+			case 4:
+			  size = "large";
+			  break;
+			case 5:
+			  size = "x-large";
+			  break;
+			case 6:
+			case 7:
+			  size = "xx-large";
+			  break;
+			default:
+			  break;
+			}
+			g_string_append_printf(style, "font-size: %s; ", size);
+		}
+		g_free(val);
+	}
+}
+
+static void
+xhtml_start_tag(XhtmlStage *s, const PurpleMarkupToken *token)
+{
+	const char *end = token->start + token->len;
+	const XhtmlTag *tag;
+	char *src, *alt, *href, *bgcolor = NULL;
+	GString *style;
+	XhtmlTagType type;
+
+	tag = bsearch(token, xhtml_tags, G_N_ELEMENTS(xhtml_tags),
+			sizeof(XhtmlTag), xhtml_tag_compare);
+	if (tag == NULL) {
+		xhtml_append_escaped_tag(s, token);
+		return;
+	}
+
+	type = tag->type;
+	if (type == XHTML_TAG_BODY) {
+		/* a body without a background color is just allowed */
+		bgcolor = markup_token_get_attribute(token, "bgcolor");
+		if (bgcolor == NULL)
+			type = XHTML_TAG_ALLOW;
+	}
+
+	switch (type) {
+	case XHTML_TAG_HTML:
+		/* we only allow html to start the message */
+		if (token->start != s->html) {
+			xhtml_append_escaped_tag(s, token);
+			return;
+		}
+		/* fall through */
+	case XHTML_TAG_ALLOW:
+		if (s->xhtml) {
+			g_string_append_printf(s->xhtml, "<%s", tag->dest);
+			xhtml_append_attributes(s->xhtml, token->attrs, token->attrs_len);
+			g_string_append_c(s->xhtml, '>');
+		}
+		if (!token->empty)
+			xhtml_push_tag(s, tag->name, tag->dest, FALSE);
+		break;
+
+	case XHTML_TAG_BREAK:
+		if (s->xhtml)
+			g_string_append(s->xhtml, "<br/>");
+		if (s->plain && *end != '\n')
+			g_string_append_c(s->plain, '\n');
+		break;
+
+	case XHTML_TAG_SPAN:
+		if (token->empty)
+			break;
+		if (s->xhtml)
+			g_string_append_printf(s->xhtml, "<span style='%s'>", tag->dest);
+		xhtml_push_tag(s, tag->name, "span", FALSE);
+		break;
+
+	case XHTML_TAG_BODY:
+		if (s->xhtml)
+			g_string_append_printf(s->xhtml, "<span style='background: %s;'>",
+					g_strstrip(bgcolor));
+		g_free(bgcolor);
+		xhtml_push_tag(s, tag->name, "span", FALSE);
+		break;
+
+	case XHTML_TAG_FONT:
+		style = g_string_new("");
+		xhtml_font_style(style, token);
+		if (style->len && s->xhtml) {
+			g_string_append_printf(s->xhtml, "<span style='%s'>",
+					g_strstrip(style->str));
+			xhtml_push_tag(s, tag->name, tag->dest, FALSE);
+		} else {
+			xhtml_push_tag(s, tag->name, tag->dest, TRUE);
+		}
+		g_string_free(style, TRUE);
+		break;
+
+	case XHTML_TAG_IMG:
+		src = markup_token_get_attribute(token, "src");
+		alt = markup_token_get_attribute(token, "alt");
+		/* src and alt are required! */
+		if (src && s->xhtml)
+			g_string_append_printf(s->xhtml, "<img src='%s' alt='%s' />",
+					g_strstrip(src), alt ? alt : "");
+		if (alt) {
+			if (s->plain)
+				g_string_append(s->plain, alt);
+			if (!src && s->xhtml)
+				g_string_append(s->xhtml, alt);
+		}
+		g_free(src);
+		g_free(alt);
+		break;
+
+	case XHTML_TAG_LINK:
+		if (s->url) {
+			g_string_free(s->url, TRUE);
+			s->url = NULL;
+		}
+		if (s->cdata) {
+			g_string_free(s->cdata, TRUE);
+			s->cdata = NULL;
+		}
+		href = markup_token_get_attribute(token, "href");
+		if (href) {
+			const char *q;
+
+			s->url = g_string_sized_new(strlen(href));
+			s->cdata = g_string_new("");
+			for (q = href; *q; q++) {
+				int len;
+				if ((*q == '&') && (purple_markup_unescape_entity(q, &len) == NULL))
+					g_string_append(s->url, "&amp;");
+				else
+					g_string_append_c(s->url, *q);
+			}
+			g_strstrip(s->url->str);
+			g_string_truncate(s->url, strlen(s->url->str));
+			g_free(href);
+		}
+		xhtml_push_tag(s, tag->name, tag->dest, FALSE);
+		if (s->xhtml)
+			g_string_append_printf(s->xhtml, "<a href=\"%s\">",
+					s->url ? s->url->str : "");
+		break;
+	}
+}
+
+static void
+xhtml_end_tag(XhtmlStage *s, const PurpleMarkupToken *token)
+{
+	int i, j;
+
+	for (i = s->tags->len - 1; i >= 0; i--) {
+		struct purple_parse_tag *pt =
+			&g_array_index(s->tags, struct purple_parse_tag, i);
+		if (markup_token_is(token, PURPLE_MARKUP_TOKEN_END_TAG, pt->src_tag))
+			break;
+	}
+
+	/* a closing tag we weren't expecting... we'll let it slide */
+	if (i < 0)
+		return;
+
+	/* close everything opened inside it too */
+	for (j = s->tags->len - 1; j >= i; j--)
+		xhtml_close_tag(s, &g_array_index(s->tags, struct purple_parse_tag, j));
+	g_array_set_size(s->tags, i);
+}
+
+static gboolean
+xhtml_stage_token(MarkupStage *stage, const PurpleMarkupToken *token)
+{
+	XhtmlStage *s = (XhtmlStage *)stage;
+	const char *ent;
+
+	switch (token->type) {
+	case PURPLE_MARKUP_TOKEN_TEXT:
+		if (*token->start == '<') {
+			if (s->xhtml)
+				g_string_append(s->xhtml, "&lt;");
+			if (s->plain)
+				g_string_append_c(s->plain, '<');
+			break;
+		}
+		if (s->xhtml)
+			g_string_append_len(s->xhtml, token->start, token->len);
+		if (s->plain)
+			g_string_append_len(s->plain, token->start, token->len);
+		if (s->cdata)
+			g_string_append_len(s->cdata, token->start, token->len);
+		break;
+
+	case PURPLE_MARKUP_TOKEN_ENTITY:
+		ent = purple_markup_unescape_entity(token->start, NULL);
+		if (s->xhtml)
+			g_string_append_len(s->xhtml, token->start, token->len);
+		if (s->plain)
+			g_string_append(s->plain, ent);
+		if (s->cdata)
+			g_string_append_len(s->cdata, token->start, token->len);
+		break;
+
+	case PURPLE_MARKUP_TOKEN_START_TAG:
+		xhtml_start_tag(s, token);
+		break;
+
+	case PURPLE_MARKUP_TOKEN_END_TAG:
+		xhtml_end_tag(s, token);
+		break;
+
+	case PURPLE_MARKUP_TOKEN_COMMENT:
+		if (strncmp(token->start, "<!--", 4) != 0)
+			xhtml_append_escaped_tag(s, token);
+		else if (s->xhtml)
+			g_string_append_len(s->xhtml, token->start, token->len);
+		break;
+	}
+
+	return TRUE;
+}
+
+static void
+xhtml_stage_finish(MarkupStage *stage)
+{
+	XhtmlStage *s = (XhtmlStage *)stage;
+	int i;
+
+	if (s->xhtml) {
+		for (i = s->tags->len - 1; i >= 0; i--) {
+			struct purple_parse_tag *pt =
+				&g_array_index(s->tags, struct purple_parse_tag, i);
+			if (!pt->ignore)
+				g_string_append_printf(s->xhtml, "</%s>", pt->dest_tag);
+		}
+	}
+}
+
+void
+purple_markup_html_to_xhtml(const char *html, char **xhtml_out,
+						  char **plain_out)
+{
+	XhtmlStage s;
+	gsize len;
+
+	g_return_if_fail(xhtml_out != NULL || plain_out != NULL);
+
+	memset(&s, 0, sizeof(s));
+	s.stage.token = xhtml_stage_token;
+	s.stage.finish = xhtml_stage_finish;
+	s.html = html;
+	s.tags = g_array_new(FALSE, FALSE, sizeof(struct purple_parse_tag));
+
+	len = html ? strlen(html) : 0;
+	if (xhtml_out)
+		s.xhtml = g_string_sized_new(len);
+	if (plain_out)
+		s.plain = g_string_sized_new(len);
+
+	markup_run(html, &s.stage);
+
+	g_array_free(s.tags, TRUE);
+	if (xhtml_out)
+		*xhtml_out = g_string_free(s.xhtml, FALSE);
+	if (plain_out)
+		*plain_out = g_string_free(s.plain, FALSE);
+	if (s.url)
+		g_string_free(s.url, TRUE);
+	if (s.cdata)
+		g_string_free(s.cdata, TRUE);
+}
+
+/**************************************************************************
+ * Stripping HTML
+ **************************************************************************/
+
+/* The following are probably reasonable changes:
+ * - \n should be converted to a normal space
+ * - in addition to <br>, <p> and <div> etc. should also be converted into \n
+ * - We want to turn </td>#whitespace<td> sequences into a single tab
+ * - We want to turn <td> into a single tab (for msn profile "parsing")
+ * - We want to turn </tr>#whitespace<tr> sequences into a single \n
+ * - <script>...</script> and <style>...</style> should be completely removed
+ */
+
+typedef struct
+{
+	MarkupStage stage;
+	GString *ret;
+	gboolean visible;
+	gboolean closing_td_p;
+	const char *cdata_close_tag; /* skip everything up to this end tag */
+	gchar *href;
+	gsize href_st;
+} StripStage;
+
+static void
+strip_text(StripStage *s, const char *text, gsize len)
+{
+	const char *p = text, *end = text + len;
+
+	while (p < end) {
+		const char *q = p;
+
+		while (q < end && !g_ascii_isspace(*q))
+			q++;
+		if (q > p) {
+			s->visible = TRUE;
+			g_string_append_len(s->ret, p, q - p);
+		}
+
+		/* Whitespace only shows up once something visible has */
+		for (p = q; q < end && g_ascii_isspace(*q); q++)
+			;
+		if (q > p && s->visible) {
+			gsize len = s->ret->len;
+
+			g_string_set_size(s->ret, len + (q - p));
+			memset(s->ret->str + len, ' ', q - p);
+		}
+		p = q;
+	}
+}
+
+static void
+strip_tag(StripStage *s, const PurpleMarkupToken *token)
+{
+	GString *ret = s->ret;
+
+	if (markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "td") && s->closing_td_p) {
+		g_string_append_c(ret, '\t');
+		s->visible = TRUE;
+	} else if (markup_token_is(token, PURPLE_MARKUP_TOKEN_END_TAG, "td")) {
+		s->closing_td_p = TRUE;
+		s->visible = FALSE;
+	} else {
+		s->closing_td_p = FALSE;
+		s->visible = TRUE;
+	}
+
+	/* If we've got an <a> tag with an href, save the address
+	 * to print later. */
+	if (markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "a")) {
+		char *href = markup_token_get_attribute(token, "href");
+
+		/* If there's an address, save it.  If there was
+		 * already one saved, kill it. */
+		if (href != NULL) {
+			g_free(s->href);
+			s->href = purple_unescape_html(href);
+			s->href_st = ret->len;
+			g_free(href);
+		}
+	}
+
+	/* Replace </a> with an ascii representation of the
+	 * address the link was pointing to. */
+	else if (s->href != NULL &&
+			markup_token_is(token, PURPLE_MARKUP_TOKEN_END_TAG, "a"))
+	{
+		size_t hrlen = strlen(s->href);
+		const char *cdata = ret->str + s->href_st;
+		gsize cdlen = ret->len - s->href_st;
+
+		/* Only insert the href if it's different from the CDATA. */
+		if ((hrlen != cdlen || strncmp(cdata, s->href, hrlen)) &&
+		    (hrlen != cdlen + 7 || /* 7 == strlen("http://") */
+		     strncmp(cdata, s->href + 7, hrlen - 7)))
+		{
+			g_string_append_printf(ret, " (%s)", s->href);
+			g_free(s->href);
+			s->href = NULL;
+		}
+	}
+
+	/* Check for tags which should be mapped to newline (but ignore some of
+	 * the tags at the beginning of the text) */
+	else if ((ret->len && (markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "p")
+	                    || markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "tr")
+	                    || markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "hr")
+	                    || markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "li")
+	                    || markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "div")))
+	      || markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "br")
+	      || markup_token_is(token, PURPLE_MARKUP_TOKEN_END_TAG, "table"))
+	{
+		g_string_append_c(ret, '\n');
+	}
+
+	/* Check for tags which begin CDATA and need to be closed */
+	else if (markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "script") &&
+			!token->empty)
+	{
+		s->cdata_close_tag = "script";
+	}
+	else if (markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "style") &&
+			!token->empty)
+	{
+		s->cdata_close_tag = "style";
+	}
+}
+
+static gboolean
+strip_stage_token(MarkupStage *stage, const PurpleMarkupToken *token)
+{
+	StripStage *s = (StripStage *)stage;
+
+	if (s->cdata_close_tag) {
+		/* Note: Don't even assume any other tag is a tag in CDATA */
+		if (markup_token_is(token, PURPLE_MARKUP_TOKEN_END_TAG, s->cdata_close_tag))
+			s->cdata_close_tag = NULL;
+		return TRUE;
+	}
+
+	switch (token->type) {
+	case PURPLE_MARKUP_TOKEN_TEXT:
+		if (*token->start == '<') {
+			s->closing_td_p = FALSE;
+			s->visible = TRUE;
+		}
+		strip_text(s, token->start, token->len);
+		break;
+
+	case PURPLE_MARKUP_TOKEN_ENTITY:
+		s->visible = TRUE;
+		g_string_append(s->ret, purple_markup_unescape_entity(token->start, NULL));
+		break;
+
+	default:
+		strip_tag(s, token);
+		break;
+	}
+
+	return TRUE;
+}
+
+char *
+purple_markup_strip_html(const char *str)
+{
+	StripStage s;
+
+	if(!str)
+		return NULL;
+
+	memset(&s, 0, sizeof(s));
+	s.stage.token = strip_stage_token;
+	s.ret = g_string_sized_new(strlen(str));
+	s.visible = TRUE;
+
+	markup_run(str, &s.stage);
+
+	g_free(s.href);
+
+	return g_string_free(s.ret, FALSE);
+}
+
+/**************************************************************************
+ * Linkifying
+ **************************************************************************/
+
+static gboolean
+badchar(char c)
+{
+	switch (c) {
+	case ' ':
+	case ',':
+	case '\0':
+	case '\n':
+	case '\r':
+	case '<':
+	case '>':
+	case '"':
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static gboolean
+badentity(const char *c)
+{
+	if (!g_ascii_strncasecmp(c, "&lt;", 4) ||
+		!g_ascii_strncasecmp(c, "&gt;", 4) ||
+		!g_ascii_strncasecmp(c, "&quot;", 6)) {
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/* Whether anything interesting to linkify can start at c */
+static gboolean
+linkify_trigger(char c)
+{
+	switch (c) {
+	case '(':
+	case ')':
+	case '@':
+	case 'f':
+	case 'F':
+	case 'h':
+	case 'H':
+	case 'm':
+	case 'M':
+	case 's':
+	case 'S':
+	case 'w':
+	case 'W':
+	case 'x':
+	case 'X':
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
 
 static const char *
 process_link(GString *ret,
@@ -2138,69 +2545,52 @@ process_link(GString *ret,
 	return c;
 }
 
-char *
-purple_markup_linkify(const char *text)
+/*
+ * Linkifies the text between c and end.  end is always the '<' of the
+ * next tag or the end of the string, and every scan below stops at
+ * either of those, just as every scan backwards stops at the '>' that
+ * ends the previous tag.
+ */
+static void
+linkify_text(GString *ret, const char *text, const char *c,
+		const char *end, int *inside_paren)
 {
-	const char *c, *t, *q = NULL;
+	const char *t;
 	char *tmpurlbuf, *url_buf;
 	gunichar g;
-	gboolean inside_html = FALSE;
-	int inside_paren = 0;
-	GString *ret;
-
-	if (text == NULL)
-		return NULL;
-
-	ret = g_string_new("");
 
-	c = text;
-	while (*c) {
+	while (c < end) {
+		/* Copy over whatever can't be the start of anything */
+		for (t = c; t < end && !linkify_trigger(*t); t++)
+			;
+		if (t > c) {
+			g_string_append_len(ret, c, t - c);
+			c = t;
+			continue;
+		}
 
-		if(*c == '(' && !inside_html) {
-			inside_paren++;
+		if(*c == '(') {
+			(*inside_paren)++;
 			ret = g_string_append_c(ret, *c);
 			c++;
 		}
 
-		if(inside_html) {
-			if(*c == '>') {
-				inside_html = FALSE;
-			} else if(!q && (*c == '\"' || *c == '\'')) {
-				q = c;
-			} else if(q) {
-				if(*c == *q)
-					q = NULL;
-			}
-		} else if(*c == '<') {
-			inside_html = TRUE;
-			if (!g_ascii_strncasecmp(c, "<A", 2)) {
-				while (1) {
-					if (!g_ascii_strncasecmp(c, "/A>", 3)) {
-						inside_html = FALSE;
-						break;
-					}
-					ret = g_string_append_c(ret, *c);
-					c++;
-					if (!(*c))
-						break;
-				}
-			}
-		} else if (!g_ascii_strncasecmp(c, "http://", 7)) {
-			c = process_link(ret, text, c, 7, "", inside_paren);
+		if (!g_ascii_strncasecmp(c, "http://", 7)) {
+			c = process_link(ret, text, c, 7, "", *inside_paren);
 		} else if (!g_ascii_strncasecmp(c, "https://", 8)) {
-			c = process_link(ret, text, c, 8, "", inside_paren);
+			c = process_link(ret, text, c, 8, "", *inside_paren);
 		} else if (!g_ascii_strncasecmp(c, "ftp://", 6)) {
-			c = process_link(ret, text, c, 6, "", inside_paren);
+			c = process_link(ret, text, c, 6, "", *inside_paren);
 		} else if (!g_ascii_strncasecmp(c, "sftp://", 7)) {
-			c = process_link(ret, text, c, 7, "", inside_paren);
+			c = process_link(ret, text, c, 7, "", *inside_paren);
 		} else if (!g_ascii_strncasecmp(c, "file://", 7)) {
-			c = process_link(ret, text, c, 7, "", inside_paren);
+			c = process_link(ret, text, c, 7, "", *inside_paren);
 		} else if (!g_ascii_strncasecmp(c, "www.", 4) && c[4] != '.' && (c == text || badchar(c[-1]) || badentity(c-1))) {
-			c = process_link(ret, text, c, 4, "http://", inside_paren);
+			c = process_link(ret, text, c, 4, "http://", *inside_paren);
 		} else if (!g_ascii_strncasecmp(c, "ftp.", 4) && c[4] != '.' && (c == text || badchar(c[-1]) || badentity(c-1))) {
-			c = process_link(ret, text, c, 4, "ftp://", inside_paren);
+			c = process_link(ret, text, c, 4, "ftp://", *inside_paren);
 		} else if (!g_ascii_strncasecmp(c, "xmpp:", 5) && (c == text || badchar(c[-1]) || badentity(c-1))) {
-			c = process_link(ret, text, c, 5, "", inside_paren);
+			c = process_link(ret, text, c, 5, "", *inside_paren);
 		} else if (!g_ascii_strncasecmp(c, "mailto:", 7)) {
 			t = c;
 			while (1) {
@@ -2300,45 +2690,205 @@ purple_markup_linkify(const char *text)
 			}
 		}
 
-		if(*c == ')' && !inside_html) {
-			inside_paren--;
+		if(c < end && *c == ')') {
+			(*inside_paren)--;
 			ret = g_string_append_c(ret, *c);
 			c++;
 		}
 
-		if (*c == 0)
+		if (c >= end)
 			break;
 
 		ret = g_string_append_c(ret, *c);
 		c++;
+	}
+}
+
+typedef struct
+{
+	MarkupStage stage;
+	const char *text;
+	GString *ret;
+	const char *run;     /* start of the text not linkified yet */
+	gboolean in_link;    /* inside an <a>, which is left alone */
+	int inside_paren;
+} LinkifyStage;
+
+static gboolean
+linkify_stage_token(MarkupStage *stage, const PurpleMarkupToken *token)
+{
+	LinkifyStage *s = (LinkifyStage *)stage;
+
+	if (!s->in_link && (token->type == PURPLE_MARKUP_TOKEN_TEXT ||
+			token->type == PURPLE_MARKUP_TOKEN_ENTITY)) {
+		if (s->run == NULL)
+			s->run = token->start;
+		return TRUE;
+	}
+
+	if (s->run) {
+		linkify_text(s->ret, s->text, s->run, token->start, &s->inside_paren);
+		s->run = NULL;
+	}
+
+	g_string_append_len(s->ret, token->start, token->len);
+
+	if (markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "a"))
+		s->in_link = !token->empty;
+	else if (markup_token_is(token, PURPLE_MARKUP_TOKEN_END_TAG, "a"))
+		s->in_link = FALSE;
+
+	return TRUE;
+}
+
+static void
+linkify_stage_finish(MarkupStage *stage)
+{
+	LinkifyStage *s = (LinkifyStage *)stage;
+
+	if (s->run)
+		linkify_text(s->ret, s->text, s->run, s->run + strlen(s->run),
+				&s->inside_paren);
+}
+
+char *
+purple_markup_linkify(const char *text)
+{
+	LinkifyStage s;
+
+	if (text == NULL)
+		return NULL;
+
+	memset(&s, 0, sizeof(s));
+	s.stage.token = linkify_stage_token;
+	s.stage.finish = linkify_stage_finish;
+	s.text = text;
+	s.ret = g_string_sized_new(strlen(text));
+
+	markup_run(text, &s.stage);
+
+	return g_string_free(s.ret, FALSE);
+}
+
+/**************************************************************************
+ * Slicing
+ **************************************************************************/
+
+typedef struct
+{
+	MarkupStage stage;
+	GString *ret;
+	GArray *tags;   /* PurpleMarkupToken, innermost last */
+	guint x, y, z;
+	gboolean appended;
+} SliceStage;
+
+static gboolean
+slice_stage_token(MarkupStage *stage, const PurpleMarkupToken *token)
+{
+	SliceStage *s = (SliceStage *)stage;
+	const char *p, *end;
+	guint i;
+
+	switch (token->type) {
+	case PURPLE_MARKUP_TOKEN_TEXT:
+		end = token->start + token->len;
+		for (p = token->start; p < end && s->z < s->y; ) {
+			const char *next = g_utf8_next_char(p);
+
+			if (next > end)
+				next = end;
+
+			if (s->z == s->x && s->z > 0 && !s->appended) {
+				for (i = 0; i < s->tags->len; i++) {
+					PurpleMarkupToken *tag =
+						&g_array_index(s->tags, PurpleMarkupToken, i);
+					g_string_append_len(s->ret, tag->start, tag->len);
+				}
+				s->appended = TRUE;
+			}
+
+			if (s->z >= s->x)
+				g_string_append_len(s->ret, p, next - p);
+			s->z++;
+			p = next;
+		}
+		break;
+
+	case PURPLE_MARKUP_TOKEN_ENTITY:
+		if (s->z >= s->x)
+			g_string_append_len(s->ret, token->start, token->len);
+		s->z++;
+		break;
+
+	default:
+		if (markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "img")) {
+			s->z += strlen("[Image]");
+		} else if (markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "br")) {
+			s->z += 1;
+		} else if (markup_token_is(token, PURPLE_MARKUP_TOKEN_START_TAG, "hr")) {
+			s->z += strlen("\n---\n");
+		} else if (token->type == PURPLE_MARKUP_TOKEN_END_TAG) {
+			/* pop stack */
+			if (s->tags->len > 0)
+				g_array_set_size(s->tags, s->tags->len - 1);
+		} else if (token->type == PURPLE_MARKUP_TOKEN_START_TAG && !token->empty) {
+			/* push it unto the stack */
+			g_array_append_vals(s->tags, token, 1);
+		}
+
+		if (s->z >= s->x)
+			g_string_append_len(s->ret, token->start, token->len);
+		break;
+	}
+
+	return s->z < s->y;
+}
+
+char *
+purple_markup_slice(const char *str, guint x, guint y)
+{
+	SliceStage s;
+	int i;
+
+	g_return_val_if_fail(str != NULL, NULL);
+	g_return_val_if_fail(x <= y, NULL);
+
+	if (x == y)
+		return g_strdup("");
+
+	memset(&s, 0, sizeof(s));
+	s.stage.token = slice_stage_token;
+	s.ret = g_string_new("");
+	s.tags = g_array_new(FALSE, FALSE, sizeof(PurpleMarkupToken));
+	s.x = x;
+	s.y = y;
+
+	markup_run(str, &s.stage);
 
+	for (i = s.tags->len - 1; i >= 0; i--) {
+		PurpleMarkupToken *tag = &g_array_index(s.tags, PurpleMarkupToken, i);
+		g_string_append_printf(s.ret, "</%.*s>", (int)tag->name_len, tag->name);
 	}
-	return g_string_free(ret, FALSE);
+
+	g_array_free(s.tags, TRUE);
+
+	return g_string_free(s.ret, FALSE);
 }
 
 char *purple_unescape_text(const char *in)
 {
-    GString *ret;
-    const char *c = in;
-
-    if (in == NULL)
-        return NULL;
+	GString *ret;
+	gsize len;
 
-    ret = g_string_new("");
-    while (*c) {
-        int len;
-        const char *ent;
+	if (in == NULL)
+		return NULL;
 
-        if ((ent = purple_markup_unescape_entity(c, &len)) != NULL) {
-            g_string_append(ret, ent);
-            c += len;
-        } else {
-            g_string_append_c(ret, *c);
-            c++;
-        }
-    }
+	len = strlen(in);
+	ret = g_string_sized_new(len);
+	markup_append_unescaped(ret, in, len);
 
-    return g_string_free(ret, FALSE);
+	return g_string_free(ret, FALSE);
 }
 
 char *purple_unescape_html(const char *html)
@@ -2349,11 +2899,18 @@ char *purple_unescape_html(const char *html)
 	if (html == NULL)
 		return NULL;
 
-	ret = g_string_new("");
+	ret = g_string_sized_new(strlen(html));
 	while (*c) {
+		gsize span = strcspn(c, "&<");
 		int len;
 		const char *ent;
 
+		/* Copy everything up to the next thing that might need work */
+		g_string_append_len(ret, c, span);
+		c += span;
+		if (*c == '\0')
+			break;
+
 		if ((ent = purple_markup_unescape_entity(c, &len)) != NULL) {
 			g_string_append(ret, ent);
 			c += len;
@@ -2369,115 +2926,6 @@ char *purple_unescape_html(const char *html)
 	return g_string_free(ret, FALSE);
 }
 
-char *
-purple_markup_slice(const char *str, guint x, guint y)
-{
-	GString *ret;
-	GQueue *q;
-	guint z = 0;
-	gboolean appended = FALSE;
-	gunichar c;
-	char *tag;
-
-	g_return_val_if_fail(str != NULL, NULL);
-	g_return_val_if_fail(x <= y, NULL);
-
-	if (x == y)
-		return g_strdup("");
-
-	ret = g_string_new("");
-	q = g_queue_new();
-
-	while (*str && (z < y)) {
-		c = g_utf8_get_char(str);
-
-		if (c == '<') {
-			char *end = strchr(str, '>');
-
-			if (!end) {
-				g_string_free(ret, TRUE);
-				while ((tag = g_queue_pop_head(q)))
-					g_free(tag);
-				g_queue_free(q);
-				return NULL;
-			}
-
-			if (!g_ascii_strncasecmp(str, "<img ", 5)) {
-				z += strlen("[Image]");
-			} else if (!g_ascii_strncasecmp(str, "<br", 3)) {
-				z += 1;
-			} else if (!g_ascii_strncasecmp(str, "<hr>", 4)) {
-				z += strlen("\n---\n");
-			} else if (!g_ascii_strncasecmp(str, "</", 2)) {
-				/* pop stack */
-				char *tmp;
-
-				tmp = g_queue_pop_head(q);
-				g_free(tmp);
-				/* z += 0; */
-			} else {
-				/* push it unto the stack */
-				char *tmp;
-
-				tmp = g_strndup(str, end - str + 1);
-				g_queue_push_head(q, tmp);
-				/* z += 0; */
-			}
-
-			if (z >= x) {
-				g_string_append_len(ret, str, end - str + 1);
-			}
-
-			str = end;
-		} else if (c == '&') {
-			char *end = strchr(str, ';');
-			if (!end) {
-				g_string_free(ret, TRUE);
-				while ((tag = g_queue_pop_head(q)))
-					g_free(tag);
-				g_queue_free(q);
-
-				return NULL;
-			}
-
-			if (z >= x)
-				g_string_append_len(ret, str, end - str + 1);
-
-			z++;
-			str = end;
-		} else {
-			if (z == x && z > 0 && !appended) {
-				GList *l = q->tail;
-
-				while (l) {
-					tag = l->data;
-					g_string_append(ret, tag);
-					l = l->prev;
-				}
-				appended = TRUE;
-			}
-
-			if (z >= x)
-				g_string_append_unichar(ret, c);
-			z++;
-		}
-
-		str = g_utf8_next_char(str);
-	}
-
-	while ((tag = g_queue_pop_head(q))) {
-		char *name;
-
-		name = purple_markup_get_tag_name(tag);
-		g_string_append_printf(ret, "</%s>", name);
-		g_free(name);
-		g_free(tag);
-	}
-
-	g_queue_free(q);
-	return g_string_free(ret, FALSE);
-}
-
 char *
 purple_markup_get_tag_name(const char *tag)
 {
@@ -2608,103 +3056,419 @@ purple_util_write_data_to_file_absolute(const char *filename_full, const char *d
 		return FALSE;
 	}
 
-	/* Write to file */
-	real_size = (size == -1) ? strlen(data) : (size_t) size;
-	byteswritten = fwrite(data, 1, real_size, file);
+	/* Write to file */
+	real_size = (size == -1) ? strlen(data) : (size_t) size;
+	byteswritten = fwrite(data, 1, real_size, file);
+
+#ifdef HAVE_FILENO
+	/* Apparently XFS (and possibly other filesystems) do not
+	 * guarantee that file data is flushed before file metadata,
+	 * so this procedure is insufficient without some flushage. */
+	if (fflush(file) < 0) {
+		purple_debug_error("util", "Error flushing %s: %s\n",
+				   filename_temp, g_strerror(errno));
+		g_free(filename_temp);
+		fclose(file);
+		return FALSE;
+	}
+	if (fsync(fileno(file)) < 0) {
+		purple_debug_error("util", "Error syncing file contents for %s: %s\n",
+				   filename_temp, g_strerror(errno));
+		g_free(filename_temp);
+		fclose(file);
+		return FALSE;
+	}
+#endif
+
+	/* Close file */
+	if (fclose(file) != 0)
+	{
+		purple_debug_error("util", "Error closing file %s: %s\n",
+				   filename_temp, g_strerror(errno));
+		g_free(filename_temp);
+		return FALSE;
+	}
+
+#ifndef HAVE_FILENO
+	/* This is the same effect (we hope) as the HAVE_FILENO block
+	 * above, but for systems without fileno(). */
+	if ((fd = open(filename_temp, O_RDWR)) < 0) {
+		purple_debug_error("util", "Error opening file %s for flush: %s\n",
+				   filename_temp, g_strerror(errno));
+		g_free(filename_temp);
+		return FALSE;
+	}
+	if (fsync(fd) < 0) {
+		purple_debug_error("util", "Error syncing %s: %s\n",
+				   filename_temp, g_strerror(errno));
+		g_free(filename_temp);
+		close(fd);
+		return FALSE;
+	}
+	if (close(fd) < 0) {
+		purple_debug_error("util", "Error closing %s after sync: %s\n",
+				   filename_temp, g_strerror(errno));
+		g_free(filename_temp);
+		return FALSE;
+	}
+#endif
+
+	/* Ensure the file is the correct size */
+	if (byteswritten != real_size)
+	{
+		purple_debug_error("util", "Error writing to file %s: Wrote %"
+				   G_GSIZE_FORMAT " bytes "
+				   "but should have written %" G_GSIZE_FORMAT
+				   "; is your disk full?\n",
+				   filename_temp, byteswritten, real_size);
+		g_free(filename_temp);
+		return FALSE;
+	}
+	/* Use stat to be absolutely sure. */
+	if ((g_stat(filename_temp, &st) == -1) || (st.st_size != real_size))
+	{
+		purple_debug_error("util", "Error writing data to file %s: "
+				   "Incomplete file written; is your disk "
+				   "full?\n",
+				   filename_temp);
+		g_free(filename_temp);
+		return FALSE;
+	}
+
+#ifndef _WIN32
+	/* Set file permissions */
+	if (chmod(filename_temp, S_IRUSR | S_IWUSR) == -1)
+	{
+		purple_debug_error("util", "Error setting permissions of file %s: %s\n",
+						 filename_temp, g_strerror(errno));
+	}
+#endif
+
+	/* Rename to the REAL name */
+	if (g_rename(filename_temp, filename_full) == -1)
+	{
+		purple_debug_error("util", "Error renaming %s to %s: %s\n",
+				   filename_temp, filename_full,
+				   g_strerror(errno));
+	}
+
+	g_free(filename_temp);
+
+	return TRUE;
+}
+
+/*
+ * A snapshot is written next to an XML file, and is only good for as long
+ * as that file holds exactly what was written with it: the size and a
+ * checksum of the file's contents are kept to check that.  The other
+ * checksum is of everything after the header.  The generation only
+ * counts the snapshots written, for the debug log.
+ */
+#define SNAPSHOT_MAGIC      "PRPLSNAP"
+#define SNAPSHOT_VERSION    2
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+typedef struct
+{
+	char magic[8];
+	guint32 version;
+	guint32 byte_order;
+	guint32 generation;
+	guint32 checksum;
+	gint64 xml_size;
+	guint32 xml_checksum;
+	guint32 padding;
+} PurpleSnapshotHeader;
+
+/* FNV-1a, taken eight bytes at a time */
+static guint32
+snapshot_checksum(const char *data, gsize size)
+{
+	guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+	guint64 word;
+
+	for (; size >= sizeof(word); data += sizeof(word), size -= sizeof(word)) {
+		memcpy(&word, data, sizeof(word));
+		hash = (hash ^ word) * G_GUINT64_CONSTANT(1099511628211);
+	}
+
+	for (; size > 0; data++, size--)
+		hash = (hash ^ (guchar)*data) * G_GUINT64_CONSTANT(1099511628211);
+
+	return (guint32)(hash ^ (hash >> 32));
+}
+
+static char *
+snapshot_filename(const char *filename_full)
+{
+	return g_strconcat(filename_full, ".snapshot", NULL);
+}
+
+/*
+ * Fills in the header if filename_full has a snapshot that is still good
+ * for it.  The header is read from the start of snapshot, which has to be
+ * at least as big.
+ */
+static gboolean
+snapshot_is_current(const char *filename_full, const char *snapshot,
+                    gsize size, PurpleSnapshotHeader *header)
+{
+	GMappedFile *xml;
+	struct stat st;
+	gboolean current;
+
+	if (size < sizeof(*header))
+		return FALSE;
+
+	memcpy(header, snapshot, sizeof(*header));
+
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+			header->version != SNAPSHOT_VERSION ||
+			header->byte_order != SNAPSHOT_BYTE_ORDER)
+		return FALSE;
+
+	if (g_stat(filename_full, &st) != 0 ||
+			header->xml_size != (gint64)st.st_size)
+		return FALSE;
+
+	/* Reading the file through is still far quicker than parsing it */
+	if ((xml = g_mapped_file_new(filename_full, FALSE, NULL)) == NULL)
+		return FALSE;
+	current = (gint64)g_mapped_file_get_length(xml) == header->xml_size &&
+			header->xml_checksum == snapshot_checksum(
+				g_mapped_file_get_contents(xml), g_mapped_file_get_length(xml));
+#if GLIB_CHECK_VERSION(2,22,0)
+	g_mapped_file_unref(xml);
+#else
+	g_mapped_file_free(xml);
+#endif
+
+	return current && header->checksum == snapshot_checksum(
+			snapshot + sizeof(*header), size - sizeof(*header));
+}
+
+/*
+ * Loads the snapshot of filename_full, if it has one that's current.
+ * This can be used away from the main thread, in which case nothing is
+ * logged and the tree has to be adopted.
+ */
+static xmlnode *
+read_xml_snapshot(const char *filename_full, gboolean in_thread)
+{
+	PurpleSnapshotHeader header;
+	GMappedFile *mapped;
+	char *snapshot_full;
+	const char *snapshot;
+	gsize size;
+	xmlnode *node = NULL;
+
+	snapshot_full = snapshot_filename(filename_full);
+	mapped = g_mapped_file_new(snapshot_full, FALSE, NULL);
+
+	if (mapped == NULL) {
+		g_free(snapshot_full);
+		return NULL;
+	}
+
+	snapshot = g_mapped_file_get_contents(mapped);
+	size = g_mapped_file_get_length(mapped);
+
+	if (snapshot_is_current(filename_full, snapshot, size, &header))
+		node = _purple_xmlnode_from_snapshot(snapshot + sizeof(header),
+				size - sizeof(header), in_thread);
+
+	if (!in_thread) {
+		if (node != NULL)
+			purple_debug_info("util", "Read snapshot %s, generation %u\n",
+					snapshot_full, header.generation);
+		else
+			purple_debug_info("util", "Snapshot %s is out of date\n",
+					snapshot_full);
+	}
+
+#if GLIB_CHECK_VERSION(2,22,0)
+	g_mapped_file_unref(mapped);
+#else
+	g_mapped_file_free(mapped);
+#endif
+	g_free(snapshot_full);
+
+	return node;
+}
+
+/*
+ * Writes the snapshot of filename_full, which has just been written with
+ * data, the formatted form of node.
+ */
+static void
+write_xml_snapshot(const char *filename_full, xmlnode *node,
+                   const char *data, gsize len)
+{
+	PurpleSnapshotHeader header;
+	GString *snapshot;
+	char *snapshot_full;
+	FILE *file;
+
+	snapshot_full = snapshot_filename(filename_full);
+
+	/* Carry on counting from the last snapshot, whether it's current or not */
+	memset(&header, 0, sizeof(header));
+	if ((file = g_fopen(snapshot_full, "rb")) != NULL) {
+		if (fread(&header, sizeof(header), 1, file) != 1 ||
+				memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+			header.generation = 0;
+		fclose(file);
+	}
+
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.generation++;
+	header.xml_size = len;
+	header.xml_checksum = snapshot_checksum(data, len);
+
+	snapshot = g_string_new_len((const char *)&header, sizeof(header));
+	_purple_xmlnode_to_snapshot(node, snapshot);
+
+	header.checksum = snapshot_checksum(snapshot->str + sizeof(header),
+			snapshot->len - sizeof(header));
+	memcpy(snapshot->str, &header, sizeof(header));
+
+	purple_util_write_data_to_file_absolute(snapshot_full, snapshot->str,
+			snapshot->len);
+
+	g_string_free(snapshot, TRUE);
+	g_free(snapshot_full);
+}
+
+gboolean
+purple_util_write_xml_to_file(const char *filename, xmlnode *node)
+{
+	char *data, *filename_full, *snapshot_full;
+	gboolean ret;
+
+	g_return_val_if_fail(filename != NULL, FALSE);
+	g_return_val_if_fail(node != NULL, FALSE);
+
+	data = xmlnode_to_formatted_str(node, NULL);
+	ret = purple_util_write_data_to_file(filename, data, -1);
+
+	filename_full = g_build_filename(purple_user_dir(), filename, NULL);
+
+	if (ret && purple_prefs_get_bool("/purple/snapshots")) {
+		write_xml_snapshot(filename_full, node, data, strlen(data));
+	} else {
+		/* It's out of date now anyway */
+		snapshot_full = snapshot_filename(filename_full);
+		g_unlink(snapshot_full);
+		g_free(snapshot_full);
+	}
+
+	g_free(filename_full);
+	g_free(data);
+
+	return ret;
+}
+
+static gpointer
+prefetch_file_thread(gpointer data)
+{
+	PurplePrefetchedFile *file = data;
+
+	if (file->parse &&
+			(file->node = read_xml_snapshot(file->filename_full, TRUE)) != NULL)
+		return NULL;
+
+	if (!g_file_get_contents(file->filename_full, &file->contents,
+			&file->length, NULL))
+		return NULL;
+
+	if (file->parse)
+		file->node = _purple_xmlnode_from_str_in_thread(file->contents,
+				file->length);
+
+	return NULL;
+}
+
+static void
+prefetch_file(const char *filename, gboolean parse)
+{
+	PurplePrefetchedFile *file = g_new0(PurplePrefetchedFile, 1);
+
+	file->filename_full = g_build_filename(purple_user_dir(), filename, NULL);
+	file->parse = parse;
+	file->thread = g_thread_create(prefetch_file_thread, file, TRUE, NULL);
+
+	/* Without a thread, the file is read when it's asked for, as usual */
+	if (file->thread == NULL) {
+		g_free(file->filename_full);
+		g_free(file);
+		return;
+	}
+
+	prefetched_files = g_list_prepend(prefetched_files, file);
+}
+
+void
+_purple_util_prefetch_files(const char * const *files,
+                            const char * const *xml_files)
+{
+	g_return_if_fail(g_thread_supported());
+
+	_purple_xmlnode_init_threads();
 
-#ifdef HAVE_FILENO
-	/* Apparently XFS (and possibly other filesystems) do not
-	 * guarantee that file data is flushed before file metadata,
-	 * so this procedure is insufficient without some flushage. */
-	if (fflush(file) < 0) {
-		purple_debug_error("util", "Error flushing %s: %s\n",
-				   filename_temp, g_strerror(errno));
-		g_free(filename_temp);
-		fclose(file);
-		return FALSE;
-	}
-	if (fsync(fileno(file)) < 0) {
-		purple_debug_error("util", "Error syncing file contents for %s: %s\n",
-				   filename_temp, g_strerror(errno));
-		g_free(filename_temp);
-		fclose(file);
-		return FALSE;
-	}
-#endif
+	for (; files != NULL && *files != NULL; files++)
+		prefetch_file(*files, FALSE);
+	for (; xml_files != NULL && *xml_files != NULL; xml_files++)
+		prefetch_file(*xml_files, TRUE);
+}
 
-	/* Close file */
-	if (fclose(file) != 0)
-	{
-		purple_debug_error("util", "Error closing file %s: %s\n",
-				   filename_temp, g_strerror(errno));
-		g_free(filename_temp);
-		return FALSE;
-	}
+/* Waits for a prefetched file and takes it off the list */
+static PurplePrefetchedFile *
+take_prefetched_file(const char *filename_full)
+{
+	GList *l;
 
-#ifndef HAVE_FILENO
-	/* This is the same effect (we hope) as the HAVE_FILENO block
-	 * above, but for systems without fileno(). */
-	if ((fd = open(filename_temp, O_RDWR)) < 0) {
-		purple_debug_error("util", "Error opening file %s for flush: %s\n",
-				   filename_temp, g_strerror(errno));
-		g_free(filename_temp);
-		return FALSE;
-	}
-	if (fsync(fd) < 0) {
-		purple_debug_error("util", "Error syncing %s: %s\n",
-				   filename_temp, g_strerror(errno));
-		g_free(filename_temp);
-		close(fd);
-		return FALSE;
-	}
-	if (close(fd) < 0) {
-		purple_debug_error("util", "Error closing %s after sync: %s\n",
-				   filename_temp, g_strerror(errno));
-		g_free(filename_temp);
-		return FALSE;
-	}
-#endif
+	for (l = prefetched_files; l != NULL; l = l->next) {
+		PurplePrefetchedFile *file = l->data;
 
-	/* Ensure the file is the correct size */
-	if (byteswritten != real_size)
-	{
-		purple_debug_error("util", "Error writing to file %s: Wrote %"
-				   G_GSIZE_FORMAT " bytes "
-				   "but should have written %" G_GSIZE_FORMAT
-				   "; is your disk full?\n",
-				   filename_temp, byteswritten, real_size);
-		g_free(filename_temp);
-		return FALSE;
-	}
-	/* Use stat to be absolutely sure. */
-	if ((g_stat(filename_temp, &st) == -1) || (st.st_size != real_size))
-	{
-		purple_debug_error("util", "Error writing data to file %s: "
-				   "Incomplete file written; is your disk "
-				   "full?\n",
-				   filename_temp);
-		g_free(filename_temp);
-		return FALSE;
+		if (purple_strequal(file->filename_full, filename_full)) {
+			prefetched_files = g_list_delete_link(prefetched_files, l);
+			g_thread_join(file->thread);
+			return file;
+		}
 	}
 
-#ifndef _WIN32
-	/* Set file permissions */
-	if (chmod(filename_temp, S_IRUSR | S_IWUSR) == -1)
-	{
-		purple_debug_error("util", "Error setting permissions of file %s: %s\n",
-						 filename_temp, g_strerror(errno));
-	}
-#endif
+	return NULL;
+}
 
-	/* Rename to the REAL name */
-	if (g_rename(filename_temp, filename_full) == -1)
-	{
-		purple_debug_error("util", "Error renaming %s to %s: %s\n",
-				   filename_temp, filename_full,
-				   g_strerror(errno));
+static void
+prefetched_file_free(PurplePrefetchedFile *file)
+{
+	if (file->node != NULL)
+		_purple_xmlnode_free_unadopted(file->node);
+	g_free(file->contents);
+	g_free(file->filename_full);
+	g_free(file);
+}
+
+gboolean
+_purple_util_take_prefetched_file(const char *filename_full, gchar **contents,
+                                  gsize *length)
+{
+	PurplePrefetchedFile *file = take_prefetched_file(filename_full);
+
+	if (file == NULL || file->contents == NULL) {
+		if (file != NULL)
+			prefetched_file_free(file);
+		return FALSE;
 	}
 
-	g_free(filename_temp);
+	*contents = file->contents;
+	if (length != NULL)
+		*length = file->length;
+	file->contents = NULL;
+	prefetched_file_free(file);
 
 	return TRUE;
 }
@@ -2712,7 +3476,42 @@ purple_util_write_data_to_file_absolute(const char *filename_full, const char *d
 xmlnode *
 purple_util_read_xml_from_file(const char *filename, const char *description)
 {
-	return xmlnode_from_file(purple_user_dir(), filename, description, "util");
+	PurplePrefetchedFile *file;
+	xmlnode *node = NULL;
+	char *filename_full;
+
+	if (prefetched_files != NULL) {
+		filename_full = g_build_filename(purple_user_dir(), filename, NULL);
+		file = take_prefetched_file(filename_full);
+		g_free(filename_full);
+
+		if (file != NULL) {
+			purple_debug_info("util", "Reading file %s from directory %s "
+					"(prefetched)\n", filename, purple_user_dir());
+			node = file->node;
+			file->node = NULL;
+			prefetched_file_free(file);
+		}
+	}
+
+	if (node != NULL) {
+		_purple_xmlnode_adopt(node);
+		return node;
+	}
+
+	filename_full = g_build_filename(purple_user_dir(), filename, NULL);
+	node = read_xml_snapshot(filename_full, FALSE);
+	g_free(filename_full);
+
+	/*
+	 * Anything that wasn't prefetched or snapshotted, or wasn't there or
+	 * didn't parse when it was, is read here, which deals with any errors
+	 * too.
+	 */
+	if (node == NULL)
+		node = xmlnode_from_file(purple_user_dir(), filename, description, "util");
+
+	return node;
 }
 
 /*
@@ -3669,7 +4468,8 @@ parse_redirect(const char *data, gsize data_len,
 	}
 	gfud->request_written = 0;
 	gfud->len = 0;
-	gfud->data_len = 0;
+	gfud->raw_len = 0;
+	gfud->body_len = 0;
 
 	g_free(gfud->website.user);
 	g_free(gfud->website.passwd);
@@ -3753,202 +4553,313 @@ content_is_chunked(const char *data, gsize data_len)
 	return FALSE;
 }
 
-/* Process in-place */
-static void
-process_chunked_data(char *data, gsize *len)
+/*
+ * Makes room for at least want more bytes after what is in the buffer,
+ * plus a NUL, doubling the size of the buffer so that reading a large
+ * response doesn't mean copying it over and over.
+ */
+static gboolean
+url_fetch_reserve(PurpleUtilFetchUrlData *gfud, gsize want)
 {
-	gsize sz;
-	gsize newlen = 0;
-	char *p = data;
-	char *s = data;
+	gsize need = gfud->len + gfud->raw_len + want + 1;
+	gsize size;
+	char *new_data;
 
-	while (*s) {
-		/* Read the size of this chunk */
-		if (sscanf(s, "%" G_GSIZE_MODIFIER "x", &sz) != 1)
-		{
-			purple_debug_error("util", "Error processing chunked data: "
-					"Expected data length, found: %s\n", s);
-			break;
-		}
-		if (sz == 0) {
-			/* We've reached the last chunk */
-			/*
-			 * TODO: The spec allows "footers" to follow the last chunk.
-			 *       If there is more data after this line then we should
-			 *       treat it like a header.
-			 */
+	if (need <= gfud->size)
+		return TRUE;
+
+	size = MAX(gfud->size * 2, need);
+	new_data = g_try_realloc(gfud->webdata, size);
+	if (new_data == NULL) {
+		purple_debug_error("util",
+				"Failed to allocate %" G_GSIZE_FORMAT " bytes: %s\n",
+				size, g_strerror(errno));
+		purple_util_fetch_url_error(gfud,
+				_("Unable to allocate enough memory to hold "
+				  "the contents from %s.  The web server may "
+				  "be trying something malicious."),
+				gfud->website.address);
+
+		return FALSE;
+	}
+
+	gfud->webdata = new_data;
+	gfud->size = size;
+
+	return TRUE;
+}
+
+/*
+ * Decodes as much of the chunked data at the end of the buffer as has
+ * arrived, in place, keeping anything incomplete for next time.
+ */
+static void
+url_fetch_decode_chunked(PurpleUtilFetchUrlData *gfud)
+{
+	char *s = gfud->webdata + gfud->len;
+	char *end = s + gfud->raw_len;
+	gboolean wait = FALSE;
+
+	while (s < end && !wait && gfud->chunk_state != URL_FETCH_CHUNK_DONE) {
+		char *eol, *size_end;
+		guint64 sz;
+		gsize n;
+
+		switch (gfud->chunk_state) {
+		case URL_FETCH_CHUNK_SIZE:
+			/* Read the size of this chunk */
+			eol = memchr(s, '\n', end - s);
+			if (eol == NULL) {
+				wait = TRUE;
+				break;
+			}
+			*eol = '\0';
+
+			sz = g_ascii_strtoull(s, &size_end, 16);
+			if (size_end == s) {
+				purple_debug_error("util", "Error processing chunked data: "
+						"Expected data length, found: %s\n", s);
+				gfud->chunk_state = URL_FETCH_CHUNK_DONE;
+			} else if (sz == 0) {
+				/* We've reached the last chunk */
+				/*
+				 * TODO: The spec allows "footers" to follow the last chunk.
+				 *       If there is more data after this line then we should
+				 *       treat it like a header.
+				 */
+				gfud->chunk_state = URL_FETCH_CHUNK_DONE;
+			} else if (sz > MAX_HTTP_CHUNK_SIZE) {
+				purple_debug_error("util", "Error processing chunked data: "
+						"Chunk size %" G_GUINT64_FORMAT " bytes was longer "
+						"than the maximum of %d bytes\n",
+						sz, MAX_HTTP_CHUNK_SIZE);
+				gfud->chunk_state = URL_FETCH_CHUNK_DONE;
+			} else {
+				gfud->chunk_left = sz;
+				gfud->chunk_state = URL_FETCH_CHUNK_DATA;
+				s = eol + 1;
+			}
 			break;
-		}
 
-		/* Advance to the start of the data */
-		s = strstr(s, "\r\n");
-		if (s == NULL)
+		case URL_FETCH_CHUNK_DATA:
+			/* Move the data overtop of the chunk sizes we read before it */
+			n = MIN(gfud->chunk_left, (gsize)(end - s));
+			g_memmove(gfud->webdata + gfud->len, s, n);
+			gfud->len += n;
+			gfud->chunk_left -= n;
+			s += n;
+			if (gfud->chunk_left == 0)
+				gfud->chunk_state = URL_FETCH_CHUNK_END;
 			break;
-		s += 2;
 
-		if (sz > MAX_HTTP_CHUNK_SIZE || s + sz > data + *len) {
-			purple_debug_error("util", "Error processing chunked data: "
-					"Chunk size %" G_GSIZE_FORMAT " bytes was longer "
-					"than the data remaining in the buffer (%"
-					G_GSIZE_FORMAT " bytes)\n", sz, data + *len - s);
+		case URL_FETCH_CHUNK_END:
+			if (end - s < 2) {
+				wait = TRUE;
+			} else if (*s != '\r' && *(s + 1) != '\n') {
+				purple_debug_error("util", "Error processing chunked data: "
+						"Expected \\r\\n, found: %.*s\n", (int)(end - s), s);
+				gfud->chunk_state = URL_FETCH_CHUNK_DONE;
+			} else {
+				s += 2;
+				gfud->chunk_state = URL_FETCH_CHUNK_SIZE;
+			}
 			break;
-		}
 
-		/* Move all data overtop of the chunk length that we read in earlier */
-		g_memmove(p, s, sz);
-		p += sz;
-		s += sz;
-		newlen += sz;
-		if (*s == '\0' || (*s != '\r' && *(s + 1) != '\n')) {
-			purple_debug_error("util", "Error processing chunked data: "
-					"Expected \\r\\n, found: %s\n", s);
+		case URL_FETCH_CHUNK_DONE:
 			break;
 		}
-		s += 2;
 	}
 
-	/* NULL terminate the data */
-	*p = 0;
+	/* A size line that long isn't one */
+	if (wait && gfud->chunk_state == URL_FETCH_CHUNK_SIZE && end - s > 1024) {
+		purple_debug_error("util", "Error processing chunked data: "
+				"Expected data length, found: %.*s\n", 1024, s);
+		gfud->chunk_state = URL_FETCH_CHUNK_DONE;
+	}
 
-	*len = newlen;
+	if (gfud->chunk_state == URL_FETCH_CHUNK_DONE) {
+		gfud->raw_len = 0;
+	} else {
+		gfud->raw_len = end - s;
+		g_memmove(gfud->webdata + gfud->len, s, gfud->raw_len);
+	}
 }
 
-static void
-url_fetch_recv_cb(gpointer url_data, gint source, PurpleInputCondition cond)
+/*
+ * Looks for the end of the headers in what has been read so far.
+ * Returns FALSE if gfud has been redirected or freed.
+ */
+static gboolean
+url_fetch_parse_headers(PurpleUtilFetchUrlData *gfud)
 {
-	PurpleUtilFetchUrlData *gfud = url_data;
-	int len;
-	char buf[4096];
-	char *data_cursor;
-	gboolean got_eof = FALSE;
+	char *end_of_headers;
+	guint header_len;
+	gsize content_len;
+
+	/* See if we've reached the end of the headers yet */
+	gfud->webdata[gfud->raw_len] = '\0';
+	end_of_headers = strstr(gfud->webdata, "\r\n\r\n");
+	if (end_of_headers == NULL)
+		return TRUE;
 
-	/*
-	 * Read data in a loop until we can't read any more!  This is a
-	 * little confusing because we read using a different function
-	 * depending on whether the socket is ssl or cleartext.
-	 */
-	while ((gfud->is_ssl && ((len = purple_ssl_read(gfud->ssl_connection, buf, sizeof(buf))) > 0)) ||
-			(!gfud->is_ssl && (len = read(source, buf, sizeof(buf))) > 0))
-	{
-		if((gfud->len + len) > gfud->max_len) {
-			purple_util_fetch_url_error(gfud, _("Error reading from %s: response too long (%d bytes limit)"),
-						    gfud->website.address, gfud->max_len);
-			return;
-		}
+	header_len = (end_of_headers + 4 - gfud->webdata);
 
-		/* If we've filled up our buffer, make it bigger */
-		if((gfud->len + len) >= gfud->data_len) {
-			while((gfud->len + len) >= gfud->data_len)
-				gfud->data_len += sizeof(buf);
+	purple_debug_misc("util", "Response headers: '%.*s'\n",
+		header_len, gfud->webdata);
 
-			gfud->webdata = g_realloc(gfud->webdata, gfud->data_len);
-		}
+	/* See if we can find a redirect. */
+	if(parse_redirect(gfud->webdata, header_len, gfud))
+		return FALSE;
+
+	gfud->got_headers = TRUE;
 
-		data_cursor = gfud->webdata + gfud->len;
+	/* No redirect. See if we can find a content length. */
+	content_len = parse_content_len(gfud->webdata, header_len);
+	gfud->chunked = content_is_chunked(gfud->webdata, header_len);
+	gfud->chunk_state = URL_FETCH_CHUNK_SIZE;
 
-		gfud->len += len;
+	if (content_len != 0)
+		gfud->has_explicit_data_len = TRUE;
+	gfud->content_len = content_len;
 
-		memcpy(data_cursor, buf, len);
+	/* If we're returning the headers too, we don't need to clean them out */
+	gfud->raw_len -= header_len;
+	if (gfud->include_headers)
+		gfud->len = header_len;
+	else
+		/* We may have read part of the body when reading the headers, don't lose it */
+		g_memmove(gfud->webdata, end_of_headers + 4, gfud->raw_len);
+	gfud->body_len = gfud->raw_len;
 
-		gfud->webdata[gfud->len] = '\0';
+	/*
+	 * Make room for the whole body at once if we know how big it is.
+	 * A body bigger than max_len is an error, so don't trust the server
+	 * with more than that.
+	 */
+	if (gfud->max_len && content_len > gfud->max_len) {
+		purple_debug_error("util",
+				"Explicit Content-Length of %" G_GSIZE_FORMAT " is over the max of %" G_GSIZE_FORMAT "\n",
+				content_len, gfud->max_len);
+		content_len = gfud->max_len;
+	}
+	if (gfud->stream_cb == NULL && content_len > gfud->body_len)
+		return url_fetch_reserve(gfud, content_len - gfud->body_len);
 
-		if(!gfud->got_headers) {
-			char *end_of_headers;
+	return TRUE;
+}
 
-			/* See if we've reached the end of the headers yet */
-			end_of_headers = strstr(gfud->webdata, "\r\n\r\n");
-			if (end_of_headers) {
-				guint header_len = (end_of_headers + 4 - gfud->webdata);
-				gsize content_len;
+/*
+ * Makes whatever of the body has arrived ready for the callback, and
+ * hands it to the stream callback if there is one.  Returns FALSE if
+ * gfud has been freed.
+ */
+static gboolean
+url_fetch_process_body(PurpleUtilFetchUrlData *gfud)
+{
+	if (gfud->chunked && !gfud->include_headers) {
+		url_fetch_decode_chunked(gfud);
+	} else {
+		gfud->len += gfud->raw_len;
+		gfud->raw_len = 0;
+	}
 
-				purple_debug_misc("util", "Response headers: '%.*s'\n",
-					header_len, gfud->webdata);
+	if (gfud->max_len &&
+			gfud->streamed_len + gfud->len + gfud->raw_len > gfud->max_len) {
+		purple_util_fetch_url_error(gfud, _("Error reading from %s: response too long (%d bytes limit)"),
+					    gfud->website.address, (int)gfud->max_len);
+		return FALSE;
+	}
 
-				/* See if we can find a redirect. */
-				if(parse_redirect(gfud->webdata, header_len, gfud))
-					return;
+	if (gfud->stream_cb != NULL && gfud->len > 0) {
+		if (!gfud->stream_cb(gfud, gfud->user_data, gfud->webdata, gfud->len)) {
+			purple_util_fetch_url_cancel(gfud);
+			return FALSE;
+		}
 
-				gfud->got_headers = TRUE;
+		gfud->streamed_len += gfud->len;
+		g_memmove(gfud->webdata, gfud->webdata + gfud->len, gfud->raw_len);
+		gfud->len = 0;
+	}
 
-				/* No redirect. See if we can find a content length. */
-				content_len = parse_content_len(gfud->webdata, header_len);
-				gfud->chunked = content_is_chunked(gfud->webdata, header_len);
+	return TRUE;
+}
 
-				if (content_len == 0) {
-					/* We'll stick with an initial 8192 */
-					content_len = 8192;
-				} else {
-					gfud->has_explicit_data_len = TRUE;
-					if (content_len > gfud->max_len) {
-						purple_debug_error("util",
-								"Overriding explicit Content-Length of %" G_GSIZE_FORMAT " with max of %" G_GSSIZE_FORMAT "\n",
-								content_len, gfud->max_len);
-						content_len = gfud->max_len;
-					}
-				}
+static void
+url_fetch_recv_cb(gpointer url_data, gint source, PurpleInputCondition cond)
+{
+	PurpleUtilFetchUrlData *gfud = url_data;
+	int len;
+	gboolean got_eof = FALSE;
+
+	/*
+	 * Read data in a loop until we can't read any more!  This is a
+	 * little confusing because we read using a different function
+	 * depending on whether the socket is ssl or cleartext.  Either way
+	 * it goes straight into the end of the buffer.
+	 */
+	while (TRUE) {
+		char *cursor;
+		gsize want = URL_FETCH_READ_SIZE;
+		gsize room;
 
+		/* The buffer was sized for a body of known length, so only
+		 * make room for what is left of it */
+		if (gfud->got_headers && gfud->has_explicit_data_len && !gfud->chunked)
+			want = MIN(want, gfud->content_len - gfud->body_len);
 
-				/* If we're returning the headers too, we don't need to clean them out */
-				if (gfud->include_headers) {
-					char *new_data;
-					gfud->data_len = content_len + header_len;
-					new_data = g_try_realloc(gfud->webdata, gfud->data_len);
-					if (new_data == NULL) {
-						purple_debug_error("util",
-								"Failed to allocate %" G_GSIZE_FORMAT " bytes: %s\n",
-								content_len, g_strerror(errno));
-						purple_util_fetch_url_error(gfud,
-								_("Unable to allocate enough memory to hold "
-								  "the contents from %s.  The web server may "
-								  "be trying something malicious."),
-								gfud->website.address);
-
-						return;
-					}
-					gfud->webdata = new_data;
-				} else {
-					char *new_data;
-					gsize body_len = gfud->len - header_len;
-
-					content_len = MAX(content_len, body_len);
-
-					new_data = g_try_malloc(content_len);
-					if (new_data == NULL) {
-						purple_debug_error("util",
-								"Failed to allocate %" G_GSIZE_FORMAT " bytes: %s\n",
-								content_len, g_strerror(errno));
-						purple_util_fetch_url_error(gfud,
-								_("Unable to allocate enough memory to hold "
-								  "the contents from %s.  The web server may "
-								  "be trying something malicious."),
-								gfud->website.address);
-
-						return;
-					}
+		if (!url_fetch_reserve(gfud, want))
+			return;
 
-					/* We may have read part of the body when reading the headers, don't lose it */
-					if (body_len > 0) {
-						memcpy(new_data, end_of_headers + 4, body_len);
-					}
+		cursor = gfud->webdata + gfud->len + gfud->raw_len;
+		room = MIN(gfud->size - (cursor - gfud->webdata) - 1, G_MAXINT);
+
+		if (gfud->is_ssl)
+			len = purple_ssl_read(gfud->ssl_connection, cursor, room);
+		else
+			len = read(source, cursor, room);
+		if (len <= 0)
+			break;
+
+		gfud->raw_len += len;
+
+		if (!gfud->got_headers) {
+			if (!url_fetch_parse_headers(gfud))
+				return;
 
-					/* Out with the old... */
-					g_free(gfud->webdata);
+			if (!gfud->got_headers) {
+				gsize max_headers_len = gfud->max_len ?
+						gfud->max_len : URL_FETCH_MAX_HEADERS_LEN;
 
-					/* In with the new. */
-					gfud->len = body_len;
-					gfud->data_len = content_len;
-					gfud->webdata = new_data;
+				if (gfud->raw_len > max_headers_len) {
+					purple_util_fetch_url_error(gfud, _("Error reading from %s: response too long (%d bytes limit)"),
+								    gfud->website.address, (int)max_headers_len);
+					return;
 				}
+				continue;
 			}
+		} else {
+			gfud->body_len += len;
+		}
+
+		/* Anything past the declared length isn't part of this response */
+		if (gfud->has_explicit_data_len && !gfud->chunked &&
+				gfud->body_len > gfud->content_len) {
+			gfud->raw_len -= MIN(gfud->body_len - gfud->content_len, gfud->raw_len);
+			gfud->body_len = gfud->content_len;
 		}
 
-		if(gfud->has_explicit_data_len && gfud->len >= gfud->data_len) {
+		if (!url_fetch_process_body(gfud))
+			return;
+
+		if ((gfud->has_explicit_data_len && gfud->body_len >= gfud->content_len) ||
+				(gfud->chunked && !gfud->include_headers &&
+				 gfud->chunk_state == URL_FETCH_CHUNK_DONE)) {
 			got_eof = TRUE;
 			break;
 		}
 	}
 
-	if(len < 0) {
+	if(len < 0 && !got_eof) {
 		if(errno == EAGAIN) {
 			return;
 		} else {
@@ -3959,15 +4870,22 @@ url_fetch_recv_cb(gpointer url_data, gint source, PurpleInputCondition cond)
 	}
 
 	if((len == 0) || got_eof) {
-		gfud->webdata = g_realloc(gfud->webdata, gfud->len + 1);
-		gfud->webdata[gfud->len] = '\0';
-
-		if (!gfud->include_headers && gfud->chunked) {
-			/* Process only if we don't want the headers. */
-			process_chunked_data(gfud->webdata, &gfud->len);
+		if (!gfud->got_headers) {
+			/* Whatever we got is all there is */
+			gfud->len = gfud->raw_len;
+			gfud->raw_len = 0;
+			if (gfud->stream_cb != NULL && !url_fetch_process_body(gfud))
+				return;
 		}
 
-		gfud->callback(gfud, gfud->user_data, gfud->webdata, gfud->len, NULL);
+		if (gfud->stream_cb != NULL) {
+			gfud->callback(gfud, gfud->user_data, NULL, gfud->streamed_len, NULL);
+		} else {
+			gfud->webdata = g_realloc(gfud->webdata, gfud->len + 1);
+			gfud->webdata[gfud->len] = '\0';
+
+			gfud->callback(gfud, gfud->user_data, gfud->webdata, gfud->len, NULL);
+		}
 		purple_util_fetch_url_cancel(gfud);
 	}
 }
@@ -4165,17 +5083,15 @@ purple_util_fetch_url_request_len(const char *url, gboolean full,
 			user_data);
 }
 
-PurpleUtilFetchUrlData *
-purple_util_fetch_url_request_len_with_account(PurpleAccount *account,
+static PurpleUtilFetchUrlData *
+url_fetch_start(PurpleAccount *account,
 		const char *url, gboolean full,	const char *user_agent, gboolean http11,
-		const char *request, gboolean include_headers, gssize max_len,
+		const char *request, gboolean include_headers, gsize max_len,
+		PurpleUtilFetchUrlStreamCallback stream_cb,
 		PurpleUtilFetchUrlCallback callback, void *user_data)
 {
 	PurpleUtilFetchUrlData *gfud;
 
-	g_return_val_if_fail(url      != NULL, NULL);
-	g_return_val_if_fail(callback != NULL, NULL);
-
 	if(purple_debug_is_unsafe())
 		purple_debug_info("util",
 				 "requested to fetch (%s), full=%d, user_agent=(%s), http11=%d\n",
@@ -4186,6 +5102,7 @@ purple_util_fetch_url_request_len_with_account(PurpleAccount *account,
 	gfud = g_new0(PurpleUtilFetchUrlData, 1);
 
 	gfud->callback = callback;
+	gfud->stream_cb = stream_cb;
 	gfud->user_data  = user_data;
 	gfud->url = g_strdup(url);
 	gfud->user_agent = g_strdup(user_agent);
@@ -4194,11 +5111,7 @@ purple_util_fetch_url_request_len_with_account(PurpleAccount *account,
 	gfud->request = g_strdup(request);
 	gfud->include_headers = include_headers;
 	gfud->fd = -1;
-	if (max_len <= 0) {
-		max_len = DEFAULT_MAX_HTTP_DOWNLOAD;
-		purple_debug_error("util", "Defaulting max download from %s to %" G_GSSIZE_FORMAT "\n", url, max_len);
-	}
-	gfud->max_len = (gsize) max_len;
+	gfud->max_len = max_len;
 	gfud->account = account;
 
 	purple_url_parse(url, &gfud->website.address, &gfud->website.port,
@@ -4233,6 +5146,40 @@ purple_util_fetch_url_request_len_with_account(PurpleAccount *account,
 	return gfud;
 }
 
+PurpleUtilFetchUrlData *
+purple_util_fetch_url_request_len_with_account(PurpleAccount *account,
+		const char *url, gboolean full,	const char *user_agent, gboolean http11,
+		const char *request, gboolean include_headers, gssize max_len,
+		PurpleUtilFetchUrlCallback callback, void *user_data)
+{
+	g_return_val_if_fail(url      != NULL, NULL);
+	g_return_val_if_fail(callback != NULL, NULL);
+
+	if (max_len <= 0) {
+		max_len = DEFAULT_MAX_HTTP_DOWNLOAD;
+		purple_debug_error("util", "Defaulting max download from %s to %" G_GSSIZE_FORMAT "\n", url, max_len);
+	}
+
+	return url_fetch_start(account, url, full, user_agent, http11, request,
+			include_headers, max_len, NULL, callback, user_data);
+}
+
+PurpleUtilFetchUrlData *
+purple_util_fetch_url_stream_with_account(PurpleAccount *account,
+		const char *url, gboolean full,	const char *user_agent, gboolean http11,
+		const char *request, gssize max_len,
+		PurpleUtilFetchUrlStreamCallback stream_cb,
+		PurpleUtilFetchUrlCallback callback, void *user_data)
+{
+	g_return_val_if_fail(url       != NULL, NULL);
+	g_return_val_if_fail(stream_cb != NULL, NULL);
+	g_return_val_if_fail(callback  != NULL, NULL);
+
+	/* Nothing piles up in memory, so there's no need for a default limit */
+	return url_fetch_start(account, url, full, user_agent, http11, request,
+			FALSE, MAX(max_len, 0), stream_cb, callback, user_data);
+}
+
 void
 purple_util_fetch_url_cancel(PurpleUtilFetchUrlData *gfud)
 {
@@ -40,6 +40,8 @@ typedef struct _PurpleUtilFetchUrlData PurpleUtilFetchUrlData;
 typedef struct _PurpleMenuAction PurpleMenuAction;
 /** @copydoc _PurpleKeyValuePair */
 typedef struct _PurpleKeyValuePair PurpleKeyValuePair;
+/** @copydoc _PurpleMarkupToken */
+typedef struct _PurpleMarkupToken PurpleMarkupToken;
 
 #include "account.h"
 #include "signals.h"
@@ -74,6 +76,40 @@ struct _PurpleKeyValuePair
 
 };
 
+/**
+ * The kinds of token purple_markup_next_token() splits markup into.
+ *
+ * @since 2.10.0
+ */
+typedef enum
+{
+	PURPLE_MARKUP_TOKEN_TEXT,       /**< Text, or a '<' that starts nothing. */
+	PURPLE_MARKUP_TOKEN_ENTITY,     /**< An entity, such as &amp;amp;       */
+	PURPLE_MARKUP_TOKEN_START_TAG,  /**< An opening or empty tag.           */
+	PURPLE_MARKUP_TOKEN_END_TAG,    /**< A closing tag.                     */
+	PURPLE_MARKUP_TOKEN_COMMENT     /**< A comment or a declaration.        */
+} PurpleMarkupTokenType;
+
+/**
+ * A piece of markup.  Everything in it points into the markup it came
+ * from, so it is only valid for as long as that is.
+ *
+ * @since 2.10.0
+ */
+struct _PurpleMarkupToken
+{
+	PurpleMarkupTokenType type;
+	const char *start;  /**< The start of the token in the markup.  */
+	gsize len;          /**< The length of the token, in bytes.     */
+	const char *name;   /**< The name of a tag.                     */
+	gsize name_len;
+	const char *attrs;  /**< Everything between the name of a start
+	                         tag and its closing '>'.               */
+	gsize attrs_len;
+	gboolean empty;     /**< Whether a start tag closes itself, as
+	                         in <br/>.                              */
+};
+
 /**
  * Creates a new PurpleMenuAction.
  *
@@ -434,6 +470,20 @@ time_t purple_str_to_time(const char *timestamp, gboolean utc,
  */
 gchar *purple_markup_escape_text(const gchar *text, gssize length);
 
+/**
+ * Appends text to a string, escaped exactly as g_markup_escape_text()
+ * would escape it.  Text with nothing in it to escape, which is most
+ * text, is appended as it is without allocating anything.
+ *
+ * @param str    The string to append to.
+ * @param text   The UTF-8 text to escape.
+ * @param length The length of @a text in bytes, or -1 if it is
+ *               NUL-terminated.
+ *
+ * @since 2.10.0
+ */
+void purple_markup_append_escaped_text(GString *str, const gchar *text, gssize length);
+
 /**
  * Finds an HTML tag matching the given name.
  *
@@ -484,6 +534,24 @@ gboolean purple_markup_extract_info_field(const char *str, int len, PurpleNotify
                                         const char *link_prefix,
 					PurpleInfoFieldFormatCallback format_cb);
 
+/**
+ * Splits markup into tokens, without copying any of it.  The markup
+ * functions below are all built on this, so that each of them walks
+ * the markup just once.
+ *
+ * Anything that looks like a tag but is not one, such as the '<' in
+ * "I <3 you", comes back as text.
+ *
+ * @param markup A pointer to the markup, which is moved past the token.
+ * @param token  The token to fill in.
+ *
+ * @return @c TRUE if there was a token, or @c FALSE at the end of
+ *         the markup.
+ *
+ * @since 2.10.0
+ */
+gboolean purple_markup_next_token(const char **markup, PurpleMarkupToken *token);
+
 /**
  * Converts HTML markup to XHTML.
  *
@@ -712,11 +780,33 @@ gboolean purple_util_write_data_to_file(const char *filename, const char *data,
 gboolean
 purple_util_write_data_to_file_absolute(const char *filename_full, const char *data, gssize size);
 
+/**
+ * Write an xmlnode tree to a file in the purple_user_dir, formatted as
+ * xmlnode_to_formatted_str() formats it.
+ *
+ * If the /purple/snapshots preference is set, a binary snapshot of the
+ * tree is written next to the file too.  For as long as the file isn't
+ * changed by anything else, purple_util_read_xml_from_file() loads the
+ * snapshot instead of parsing the file, which is much quicker for big
+ * files like the buddy list.
+ *
+ * @param filename The basename of the file to write in the purple_user_dir.
+ * @param node     The tree to write.
+ *
+ * @return TRUE if the file was written successfully.  FALSE otherwise.
+ *         Failing to write the snapshot doesn't count.
+ * @since 2.10.0
+ */
+gboolean purple_util_write_xml_to_file(const char *filename, xmlnode *node);
+
 /**
  * Read the contents of a given file and parse the results into an
  * xmlnode tree structure.  This is intended to be used to read
  * Purple's configuration xml files (prefs.xml, pounces.xml, etc.)
  *
+ * If the file has an up to date snapshot written by
+ * purple_util_write_xml_to_file(), the tree comes from that instead.
+ *
  * @param filename    The basename of the file to open in the purple_user_dir.
  * @param description A very short description of the contents of this
  *                    file.  This is used in error messages shown to the
@@ -1208,6 +1298,57 @@ PurpleUtilFetchUrlData *purple_util_fetch_url_request_len_with_account(
 		const gchar *request, gboolean include_headers, gssize max_len,
 		PurpleUtilFetchUrlCallback callback, gpointer data);
 
+/**
+ * This is the signature used for functions that get the body of a URL
+ * fetched with purple_util_fetch_url_stream_with_account() as it arrives.
+ *
+ * @param url_data  The same value that was returned when you called
+ *                  purple_util_fetch_url_stream_with_account().
+ * @param user_data The user data that your code passed in.
+ * @param data      The next piece of the body, with any chunked transfer
+ *                  encoding already removed.  It is only valid until the
+ *                  callback returns.
+ * @param len       The length of data.
+ *
+ * @return @c FALSE to stop the transfer, in which case url_data is
+ *         cancelled and the completion callback is never called.
+ *
+ * @since 2.10.0
+ */
+typedef gboolean (*PurpleUtilFetchUrlStreamCallback)(PurpleUtilFetchUrlData *url_data,
+		gpointer user_data, const gchar *data, gsize len);
+
+/**
+ * Fetches the data from a URL, passing the body to a callback a piece at
+ * a time as it arrives instead of holding all of it in memory.
+ *
+ * When the transfer is done, the completion callback is called with
+ * @a url_text set to NULL and @a len set to the length of the whole body,
+ * or with an error message if it failed.
+ *
+ * @param account    The account for which the request is needed, or NULL.
+ * @param url        The URL.
+ * @param full       TRUE if this is the full URL, or FALSE if it's a
+ *                   partial URL.
+ * @param user_agent The user agent field to use, or NULL.
+ * @param http11     TRUE if HTTP/1.1 should be used to download the file.
+ * @param request    A HTTP request to send to the server instead of the
+ *                   standard GET
+ * @param max_len    The maximum number of body bytes to retrieve, or a
+ *                   negative number for no limit.
+ * @param stream_cb  The callback function for each piece of the body.
+ * @param callback   The callback function for when the transfer is done.
+ * @param data       The user data to pass to the callback functions.
+ *
+ * @since 2.10.0
+ */
+PurpleUtilFetchUrlData *purple_util_fetch_url_stream_with_account(
+		PurpleAccount *account, const gchar *url,
+		gboolean full, const gchar *user_agent, gboolean http11,
+		const gchar *request, gssize max_len,
+		PurpleUtilFetchUrlStreamCallback stream_cb,
+		PurpleUtilFetchUrlCallback callback, gpointer data);
+
 /**
  * Cancel a pending URL request started with either
  * purple_util_fetch_url_request() or purple_util_fetch_url().
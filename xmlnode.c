@@ -46,6 +46,15 @@
 # define NEWLINE_S "\n"
 #endif
 
+/*
+ * Set on threads that parse files for the main thread ahead of time.  The
+ * nodes they make aren't registered with D-Bus, and they don't log, until
+ * the main thread adopts them.
+ */
+static GStaticPrivate parsing_in_thread = G_STATIC_PRIVATE_INIT;
+
+#define IN_THREAD() (g_static_private_get(&parsing_in_thread) != NULL)
+
 static xmlnode*
 new_node(const char *name, XMLNodeType type)
 {
@@ -54,7 +63,8 @@ new_node(const char *name, XMLNodeType type)
 	node->name = g_strdup(name);
 	node->type = type;
 
-	PURPLE_DBUS_REGISTER_POINTER(node, xmlnode);
+	if (!IN_THREAD())
+		PURPLE_DBUS_REGISTER_POINTER(node, xmlnode);
 
 	return node;
 }
@@ -337,7 +347,8 @@ xmlnode_free(xmlnode *node)
 	if(node->namespace_map)
 		g_hash_table_destroy(node->namespace_map);
 
-	PURPLE_DBUS_UNREGISTER_POINTER(node);
+	if (!IN_THREAD())
+		PURPLE_DBUS_UNREGISTER_POINTER(node);
 	g_free(node);
 }
 
@@ -408,8 +419,13 @@ char *
 xmlnode_get_data_unescaped(const xmlnode *node)
 {
 	char *escaped = xmlnode_get_data(node);
+	char *unescaped;
 
-	char *unescaped = escaped ? purple_unescape_html(escaped) : NULL;
+	/* Usually there is nothing to unescape */
+	if (escaped == NULL || strpbrk(escaped, "&<") == NULL)
+		return escaped;
+
+	unescaped = purple_unescape_html(escaped);
 
 	g_free(escaped);
 
@@ -433,7 +449,7 @@ xmlnode_to_str_helper(const xmlnode *node, int *len, gboolean formatting, int de
 	GString *text = g_string_new("");
 	const char *prefix;
 	const xmlnode *c;
-	char *node_name, *esc, *esc2, *tab = NULL;
+	char *esc, *tab = NULL;
 	gboolean need_end = FALSE, pretty = formatting;
 
 	g_return_val_if_fail(node != NULL, NULL);
@@ -443,14 +459,14 @@ xmlnode_to_str_helper(const xmlnode *node, int *len, gboolean formatting, int de
 		text = g_string_append(text, tab);
 	}
 
-	node_name = g_markup_escape_text(node->name, -1);
 	prefix = xmlnode_get_prefix(node);
 
 	if (prefix) {
-		g_string_append_printf(text, "<%s:%s", prefix, node_name);
+		g_string_append_printf(text, "<%s:", prefix);
 	} else {
-		g_string_append_printf(text, "<%s", node_name);
+		g_string_append_c(text, '<');
 	}
+	purple_markup_append_escaped_text(text, node->name, -1);
 
 	if (node->namespace_map) {
 		g_hash_table_foreach(node->namespace_map,
@@ -458,24 +474,24 @@ xmlnode_to_str_helper(const xmlnode *node, int *len, gboolean formatting, int de
 	} else if (node->xmlns) {
 		if(!node->parent || !purple_strequal(node->xmlns, node->parent->xmlns))
 		{
-			char *xmlns = g_markup_escape_text(node->xmlns, -1);
-			g_string_append_printf(text, " xmlns='%s'", xmlns);
-			g_free(xmlns);
+			g_string_append(text, " xmlns='");
+			purple_markup_append_escaped_text(text, node->xmlns, -1);
+			g_string_append_c(text, '\'');
 		}
 	}
 	for(c = node->child; c; c = c->next)
 	{
 		if(c->type == XMLNODE_TYPE_ATTRIB) {
 			const char *aprefix = xmlnode_get_prefix(c);
-			esc = g_markup_escape_text(c->name, -1);
-			esc2 = g_markup_escape_text(c->data, -1);
 			if (aprefix) {
-				g_string_append_printf(text, " %s:%s='%s'", aprefix, esc, esc2);
+				g_string_append_printf(text, " %s:", aprefix);
 			} else {
-				g_string_append_printf(text, " %s='%s'", esc, esc2);
+				g_string_append_c(text, ' ');
 			}
-			g_free(esc);
-			g_free(esc2);
+			purple_markup_append_escaped_text(text, c->name, -1);
+			g_string_append(text, "='");
+			purple_markup_append_escaped_text(text, c->data, -1);
+			g_string_append_c(text, '\'');
 		} else if(c->type == XMLNODE_TYPE_TAG || c->type == XMLNODE_TYPE_DATA) {
 			if(c->type == XMLNODE_TYPE_DATA)
 				pretty = FALSE;
@@ -494,25 +510,23 @@ xmlnode_to_str_helper(const xmlnode *node, int *len, gboolean formatting, int de
 				text = g_string_append_len(text, esc, esc_len);
 				g_free(esc);
 			} else if(c->type == XMLNODE_TYPE_DATA && c->data_sz > 0) {
-				esc = g_markup_escape_text(c->data, c->data_sz);
-				text = g_string_append(text, esc);
-				g_free(esc);
+				purple_markup_append_escaped_text(text, c->data, c->data_sz);
 			}
 		}
 
 		if(tab && pretty)
 			text = g_string_append(text, tab);
 		if (prefix) {
-			g_string_append_printf(text, "</%s:%s>%s", prefix, node_name, formatting ? NEWLINE_S : "");
+			g_string_append_printf(text, "</%s:", prefix);
 		} else {
-			g_string_append_printf(text, "</%s>%s", node_name, formatting ? NEWLINE_S : "");
+			g_string_append(text, "</");
 		}
+		purple_markup_append_escaped_text(text, node->name, -1);
+		g_string_append_printf(text, ">%s", formatting ? NEWLINE_S : "");
 	} else {
 		g_string_append_printf(text, "/>%s", formatting ? NEWLINE_S : "");
 	}
 
-	g_free(node_name);
-
 	g_free(tab);
 
 	if(len)
@@ -638,6 +652,9 @@ xmlnode_parser_error_libxml(void *user_data, const char *msg, ...)
 
 	xpd->error = TRUE;
 
+	if (IN_THREAD())
+		return;
+
 	va_start(args, msg);
 	vsnprintf(errmsg, sizeof(errmsg), msg, args);
 	va_end(args);
@@ -650,6 +667,13 @@ xmlnode_parser_structural_error_libxml(void *user_data, xmlErrorPtr error)
 {
 	struct _xmlnode_parser_data *xpd = user_data;
 
+	if (IN_THREAD()) {
+		if (error && (error->level == XML_ERR_ERROR ||
+		              error->level == XML_ERR_FATAL))
+			xpd->error = TRUE;
+		return;
+	}
+
 	if (error && (error->level == XML_ERR_ERROR ||
 	              error->level == XML_ERR_FATAL)) {
 		xpd->error = TRUE;
@@ -732,6 +756,487 @@ xmlnode_from_str(const char *str, gssize size)
 	return ret;
 }
 
+void
+_purple_xmlnode_init_threads(void)
+{
+	xmlInitParser();
+}
+
+static void
+set_in_thread(gboolean in_thread)
+{
+	g_static_private_set(&parsing_in_thread,
+			in_thread ? GINT_TO_POINTER(TRUE) : NULL, NULL);
+}
+
+xmlnode *
+_purple_xmlnode_from_str_in_thread(const char *str, gssize size)
+{
+	xmlnode *node;
+
+	set_in_thread(TRUE);
+	node = xmlnode_from_str(str, size);
+	set_in_thread(FALSE);
+
+	return node;
+}
+
+void
+_purple_xmlnode_adopt(xmlnode *node)
+{
+	xmlnode *child;
+
+	PURPLE_DBUS_REGISTER_POINTER(node, xmlnode);
+
+	for (child = node->child; child != NULL; child = child->next)
+		_purple_xmlnode_adopt(child);
+}
+
+void
+_purple_xmlnode_free_unadopted(xmlnode *node)
+{
+	set_in_thread(TRUE);
+	xmlnode_free(node);
+	set_in_thread(FALSE);
+}
+
+/*
+ * Snapshots
+ *
+ * A snapshot is a table of every distinct string in a tree, each as its
+ * length, the bytes and a NUL, followed by the nodes in document order.
+ * Nodes refer to their strings by index:
+ *
+ *   tag:    flags, name, [xmlns], [prefix], [namespace count, that many
+ *           prefix/namespace pairs], child count, then the children
+ *   attrib: flags, name, [xmlns], [prefix], value
+ *   data:   flags, data
+ *
+ * The flags byte holds the type and which of the bracketed parts are
+ * there.  Every number is written in seven bit groups, low ones first,
+ * with the top bit set on all but the last, so most take a byte.
+ */
+#define SNAPSHOT_TYPE_MASK    0x03
+#define SNAPSHOT_HAS_XMLNS    0x04
+#define SNAPSHOT_HAS_PREFIX   0x08
+#define SNAPSHOT_HAS_NS_MAP   0x10
+#define SNAPSHOT_MAX_DEPTH    256
+
+typedef struct
+{
+	const char *str;
+	gsize len;
+} SnapshotString;
+
+typedef struct
+{
+	GHashTable *index;
+	GPtrArray *strings;
+	GString *nodes;
+} SnapshotWriter;
+
+static guint
+snapshot_string_hash(gconstpointer key)
+{
+	const SnapshotString *string = key;
+	guint hash = 5381;
+	gsize i;
+
+	for (i = 0; i < string->len; i++)
+		hash = (hash << 5) + hash + (guchar)string->str[i];
+
+	return hash;
+}
+
+static gboolean
+snapshot_string_equal(gconstpointer a, gconstpointer b)
+{
+	const SnapshotString *sa = a, *sb = b;
+
+	return sa->len == sb->len && memcmp(sa->str, sb->str, sa->len) == 0;
+}
+
+static void
+snapshot_append_number(GString *str, gsize number)
+{
+	while (number >= 0x80) {
+		g_string_append_c(str, (char)(number | 0x80));
+		number >>= 7;
+	}
+	g_string_append_c(str, (char)number);
+}
+
+static void
+snapshot_append_string(SnapshotWriter *writer, const char *str, gsize len)
+{
+	SnapshotString key, *string;
+	gpointer index;
+
+	key.str = str;
+	key.len = len;
+
+	if (!g_hash_table_lookup_extended(writer->index, &key, NULL, &index)) {
+		string = g_new(SnapshotString, 1);
+		*string = key;
+		index = GUINT_TO_POINTER(writer->strings->len);
+		g_ptr_array_add(writer->strings, string);
+		g_hash_table_insert(writer->index, string, index);
+	}
+
+	snapshot_append_number(writer->nodes, GPOINTER_TO_UINT(index));
+}
+
+#define snapshot_append_str(writer, str) \
+	snapshot_append_string(writer, str, strlen(str))
+
+static void
+snapshot_append_namespace(gpointer key, gpointer value, gpointer user_data)
+{
+	snapshot_append_str(user_data, key);
+	snapshot_append_str(user_data, value);
+}
+
+static void
+snapshot_append_node(SnapshotWriter *writer, xmlnode *node)
+{
+	xmlnode *child;
+	gsize count = 0;
+	guchar flags = node->type;
+
+	if (node->type == XMLNODE_TYPE_DATA) {
+		g_string_append_c(writer->nodes, (char)flags);
+		snapshot_append_string(writer, node->data, node->data_sz);
+		return;
+	}
+
+	if (node->xmlns != NULL)
+		flags |= SNAPSHOT_HAS_XMLNS;
+	if (node->prefix != NULL)
+		flags |= SNAPSHOT_HAS_PREFIX;
+	if (node->namespace_map != NULL)
+		flags |= SNAPSHOT_HAS_NS_MAP;
+
+	g_string_append_c(writer->nodes, (char)flags);
+	snapshot_append_str(writer, node->name);
+	if (node->xmlns != NULL)
+		snapshot_append_str(writer, node->xmlns);
+	if (node->prefix != NULL)
+		snapshot_append_str(writer, node->prefix);
+
+	if (node->type == XMLNODE_TYPE_ATTRIB) {
+		snapshot_append_str(writer, node->data);
+		return;
+	}
+
+	if (node->namespace_map != NULL) {
+		snapshot_append_number(writer->nodes,
+				g_hash_table_size(node->namespace_map));
+		g_hash_table_foreach(node->namespace_map,
+				snapshot_append_namespace, writer);
+	}
+
+	for (child = node->child; child != NULL; child = child->next)
+		count++;
+	snapshot_append_number(writer->nodes, count);
+
+	for (child = node->child; child != NULL; child = child->next)
+		snapshot_append_node(writer, child);
+}
+
+void
+_purple_xmlnode_to_snapshot(xmlnode *node, GString *snapshot)
+{
+	SnapshotWriter writer;
+	guint i;
+
+	g_return_if_fail(node != NULL);
+	g_return_if_fail(snapshot != NULL);
+
+	writer.index = g_hash_table_new_full(snapshot_string_hash,
+			snapshot_string_equal, g_free, NULL);
+	writer.strings = g_ptr_array_new();
+	writer.nodes = g_string_new(NULL);
+
+	snapshot_append_node(&writer, node);
+
+	snapshot_append_number(snapshot, writer.strings->len);
+	for (i = 0; i < writer.strings->len; i++) {
+		SnapshotString *string = g_ptr_array_index(writer.strings, i);
+
+		snapshot_append_number(snapshot, string->len);
+		g_string_append_len(snapshot, string->str, string->len);
+		g_string_append_c(snapshot, '\0');
+	}
+	g_string_append_len(snapshot, writer.nodes->str, writer.nodes->len);
+
+	g_string_free(writer.nodes, TRUE);
+	g_ptr_array_free(writer.strings, TRUE);
+	g_hash_table_destroy(writer.index);
+}
+
+typedef struct
+{
+	const guchar *pos;
+	const guchar *end;
+	SnapshotString *strings;
+	gsize n_strings;
+} SnapshotReader;
+
+static gboolean
+snapshot_read_number(SnapshotReader *reader, gsize *number)
+{
+	int shift = 0;
+
+	*number = 0;
+
+	while (reader->pos < reader->end && shift < 35) {
+		guchar byte = *reader->pos++;
+
+		*number |= (gsize)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return TRUE;
+		shift += 7;
+	}
+
+	return FALSE;
+}
+
+/* Strings point into the snapshot */
+static const SnapshotString *
+snapshot_read_string(SnapshotReader *reader)
+{
+	gsize index;
+
+	if (!snapshot_read_number(reader, &index) || index >= reader->n_strings)
+		return NULL;
+
+	return &reader->strings[index];
+}
+
+/* Reads the name, xmlns and prefix that tags and attributes have */
+static xmlnode *
+snapshot_read_named_node(SnapshotReader *reader, guchar flags)
+{
+	const SnapshotString *name, *xmlns = NULL, *prefix = NULL;
+	xmlnode *node;
+
+	if ((name = snapshot_read_string(reader)) == NULL)
+		return NULL;
+	if ((flags & SNAPSHOT_HAS_XMLNS) &&
+			(xmlns = snapshot_read_string(reader)) == NULL)
+		return NULL;
+	if ((flags & SNAPSHOT_HAS_PREFIX) &&
+			(prefix = snapshot_read_string(reader)) == NULL)
+		return NULL;
+
+	node = new_node(name->str, flags & SNAPSHOT_TYPE_MASK);
+	if (xmlns != NULL)
+		node->xmlns = g_strndup(xmlns->str, xmlns->len);
+	if (prefix != NULL)
+		node->prefix = g_strndup(prefix->str, prefix->len);
+
+	return node;
+}
+
+static xmlnode *
+snapshot_read_node(SnapshotReader *reader, int depth)
+{
+	const SnapshotString *data;
+	xmlnode *node;
+	gsize count;
+	guchar flags;
+
+	if (reader->pos == reader->end || depth > SNAPSHOT_MAX_DEPTH)
+		return NULL;
+
+	flags = *reader->pos++;
+
+	switch (flags & SNAPSHOT_TYPE_MASK) {
+	case XMLNODE_TYPE_DATA:
+		if ((data = snapshot_read_string(reader)) == NULL)
+			return NULL;
+
+		node = new_node(NULL, XMLNODE_TYPE_DATA);
+		node->data = g_memdup(data->str, data->len);
+		node->data_sz = data->len;
+		return node;
+
+	case XMLNODE_TYPE_ATTRIB:
+		if ((node = snapshot_read_named_node(reader, flags)) == NULL)
+			return NULL;
+
+		if ((data = snapshot_read_string(reader)) == NULL) {
+			xmlnode_free(node);
+			return NULL;
+		}
+
+		node->data = g_strndup(data->str, data->len);
+		return node;
+
+	case XMLNODE_TYPE_TAG:
+		if ((node = snapshot_read_named_node(reader, flags)) == NULL)
+			return NULL;
+
+		if (flags & SNAPSHOT_HAS_NS_MAP) {
+			node->namespace_map = g_hash_table_new_full(
+				g_str_hash, g_str_equal, g_free, g_free);
+
+			if (!snapshot_read_number(reader, &count)) {
+				xmlnode_free(node);
+				return NULL;
+			}
+
+			for (; count > 0; count--) {
+				const SnapshotString *key, *value;
+
+				if ((key = snapshot_read_string(reader)) == NULL ||
+						(value = snapshot_read_string(reader)) == NULL) {
+					xmlnode_free(node);
+					return NULL;
+				}
+
+				g_hash_table_insert(node->namespace_map,
+						g_strndup(key->str, key->len),
+						g_strndup(value->str, value->len));
+			}
+		}
+
+		if (!snapshot_read_number(reader, &count)) {
+			xmlnode_free(node);
+			return NULL;
+		}
+
+		for (; count > 0; count--) {
+			xmlnode *child = snapshot_read_node(reader, depth + 1);
+
+			if (child == NULL) {
+				xmlnode_free(node);
+				return NULL;
+			}
+
+			xmlnode_insert_child(node, child);
+		}
+
+		return node;
+	}
+
+	return NULL;
+}
+
+xmlnode *
+_purple_xmlnode_from_snapshot(const char *snapshot, gsize size,
+                              gboolean in_thread)
+{
+	SnapshotReader reader;
+	xmlnode *node = NULL;
+	gsize i;
+
+	g_return_val_if_fail(snapshot != NULL, NULL);
+
+	reader.pos = (const guchar *)snapshot;
+	reader.end = reader.pos + size;
+
+	/* Every string takes at least two bytes */
+	if (!snapshot_read_number(&reader, &reader.n_strings) ||
+			reader.n_strings > size / 2)
+		return NULL;
+
+	/* The strings are used where they are, so this is all it takes */
+	reader.strings = g_new(SnapshotString, reader.n_strings);
+	for (i = 0; i < reader.n_strings; i++) {
+		gsize len;
+
+		if (!snapshot_read_number(&reader, &len) ||
+				(gsize)(reader.end - reader.pos) <= len ||
+				reader.pos[len] != '\0')
+			break;
+
+		reader.strings[i].str = (const char *)reader.pos;
+		reader.strings[i].len = len;
+		reader.pos += len + 1;
+	}
+
+	if (i == reader.n_strings) {
+		if (in_thread)
+			set_in_thread(TRUE);
+
+		node = snapshot_read_node(&reader, 0);
+
+		/* Anything after the root means it isn't what was written */
+		if (node != NULL && reader.pos != reader.end) {
+			xmlnode_free(node);
+			node = NULL;
+		}
+
+		if (in_thread)
+			set_in_thread(FALSE);
+	}
+
+	g_free(reader.strings);
+
+	return node;
+}
+
+struct _xmlnode_parser {
+	struct _xmlnode_parser_data xpd;
+	xmlParserCtxtPtr context;
+};
+
+xmlnode_parser *
+xmlnode_parser_new(void)
+{
+	xmlnode_parser *parser = g_new0(xmlnode_parser, 1);
+
+	parser->context = xmlCreatePushParserCtxt(&xmlnode_parser_libxml,
+			&parser->xpd, NULL, 0, NULL);
+
+	return parser;
+}
+
+gboolean
+xmlnode_parser_feed(xmlnode_parser *parser, const char *data, gsize size)
+{
+	g_return_val_if_fail(parser != NULL, FALSE);
+
+	while (size > 0 && !parser->xpd.error) {
+		int len = MIN(size, G_MAXINT);
+
+		if (xmlParseChunk(parser->context, data, len, 0) != XML_ERR_OK)
+			parser->xpd.error = TRUE;
+		data += len;
+		size -= len;
+	}
+
+	return !parser->xpd.error;
+}
+
+xmlnode *
+xmlnode_parser_finish(xmlnode_parser *parser)
+{
+	xmlnode *ret;
+
+	g_return_val_if_fail(parser != NULL, NULL);
+
+	if (!parser->xpd.error &&
+			xmlParseChunk(parser->context, NULL, 0, 1) != XML_ERR_OK)
+		parser->xpd.error = TRUE;
+
+	/* An unfinished document leaves current somewhere below the root */
+	ret = parser->xpd.current;
+	while (ret && ret->parent)
+		ret = ret->parent;
+	if (ret && (parser->xpd.error || ret != parser->xpd.current ||
+			!parser->context->wellFormed)) {
+		xmlnode_free(ret);
+		ret = NULL;
+	}
+
+	xmlFreeParserCtxt(parser->context);
+	g_free(parser);
+
+	return ret;
+}
+
 xmlnode *
 xmlnode_from_file(const char *dir,const char *filename, const char *description, const char *process)
 {
@@ -314,6 +314,50 @@ char *xmlnode_to_formatted_str(const xmlnode *node, int *len);
  */
 xmlnode *xmlnode_from_str(const char *str, gssize size);
 
+/**
+ * An XML parser that builds a tree of nodes from a document that
+ * arrives a piece at a time.
+ *
+ * @since 2.10.0
+ */
+typedef struct _xmlnode_parser xmlnode_parser;
+
+/**
+ * Creates a parser for building a node from pieces of a document
+ * with xmlnode_parser_feed().
+ *
+ * @return The new parser.  Free it with xmlnode_parser_finish().
+ *
+ * @since 2.10.0
+ */
+xmlnode_parser *xmlnode_parser_new(void);
+
+/**
+ * Parses the next piece of a document.  The pieces do not have to
+ * break at any particular place.
+ *
+ * @param parser The parser.
+ * @param data   The next piece of the document.
+ * @param size   The size of @a data.
+ *
+ * @return @c FALSE if the document is already known to be malformed.
+ *
+ * @since 2.10.0
+ */
+gboolean xmlnode_parser_feed(xmlnode_parser *parser, const char *data, gsize size);
+
+/**
+ * Finishes parsing a document and frees the parser.
+ *
+ * @param parser The parser.
+ *
+ * @return The root node of the document, or @c NULL if the document
+ *         was malformed or incomplete.
+ *
+ * @since 2.10.0
+ */
+xmlnode *xmlnode_parser_finish(xmlnode_parser *parser);
+
 /**
  * Creates a new node from the source node.
  *